@@ -0,0 +1,697 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <couchdb-glib.h>
+#include <utils.h>
+#ifdef HAVE_OAUTH
+#include <oauth.h>
+#endif
+#include "fake-couchdb.h"
+
+#define BULK_BATCH_SIZE 1000
+#define CHANGE_TIMEOUT_SECONDS 10
+
+static CouchdbSession *couchdb;
+static JsonArray *results;
+
+static gint n_documents = 1000;
+static gint n_changes = 100;
+static gint n_field_lookups = 1000000;
+static gint n_signatures = 100000;
+static gchar *all_docs_sizes = NULL;
+static gchar *server_uri = NULL;
+static gchar *output_file = NULL;
+static gboolean count_allocations = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "server", 's', 0, G_OPTION_ARG_STRING, &server_uri,
+	  "Run against the Couchdb server at URI instead of an in-process one", "URI" },
+	{ "documents", 'n', 0, G_OPTION_ARG_INT, &n_documents,
+	  "Number of documents to get and put (default: 1000)", "N" },
+	{ "changes", 'c', 0, G_OPTION_ARG_INT, &n_changes,
+	  "Number of change notifications to wait for (default: 100)", "N" },
+	{ "field-lookups", 'f', 0, G_OPTION_ARG_INT, &n_field_lookups,
+	  "Number of field lookups (default: 1000000)", "N" },
+	{ "signatures", 'S', 0, G_OPTION_ARG_INT, &n_signatures,
+	  "Number of OAuth signatures to compute (default: 100000)", "N" },
+	{ "all-docs-sizes", 'a', 0, G_OPTION_ARG_STRING, &all_docs_sizes,
+	  "Comma separated database sizes to list (default: 10000,100000)", "SIZES" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_file,
+	  "Write the results to FILE instead of the standard output", "FILE" },
+	{ "allocations", 0, 0, G_OPTION_ARG_NONE, &count_allocations,
+	  "Only count memory allocations per document, instead of timing operations", NULL },
+	{ NULL }
+};
+
+/* Allocations are only counted in the main thread, so that the ones done by
+   the in-process server are left out */
+static pthread_t main_thread;
+static gint64 n_allocations = 0;
+
+static gpointer
+counting_malloc (gsize n_bytes)
+{
+	if (pthread_equal (pthread_self (), main_thread))
+		n_allocations++;
+
+	return malloc (n_bytes);
+}
+
+static gpointer
+counting_realloc (gpointer mem, gsize n_bytes)
+{
+	if (mem == NULL && pthread_equal (pthread_self (), main_thread))
+		n_allocations++;
+
+	return realloc (mem, n_bytes);
+}
+
+static gpointer
+counting_calloc (gsize n_blocks, gsize n_block_bytes)
+{
+	if (pthread_equal (pthread_self (), main_thread))
+		n_allocations++;
+
+	return calloc (n_blocks, n_block_bytes);
+}
+
+static GMemVTable counting_vtable = {
+	counting_malloc,
+	counting_realloc,
+	free,
+	counting_calloc,
+	NULL,
+	NULL
+};
+
+static void
+add_result (const char *name, const char *unit, gdouble value, gint64 count)
+{
+	JsonObject *result;
+
+	result = json_object_new ();
+	json_object_set_string_member (result, "name", name);
+	json_object_set_string_member (result, "unit", unit);
+	json_object_set_double_member (result, "value", value);
+	json_object_set_int_member (result, "count", count);
+	json_array_add_object_element (results, result);
+
+	g_printerr ("%-36s %14.3f %s\n", name, value, unit);
+}
+
+static char *
+create_bench_database (const char *prefix)
+{
+	char *dbname;
+	GError *error = NULL;
+
+	dbname = g_strdup_printf ("%s-%08x", prefix, g_random_int ());
+	if (!couchdb_session_create_database (couchdb, dbname, &error)) {
+		g_error ("Could not create database %s: %s", dbname, error->message);
+	}
+
+	return dbname;
+}
+
+static void
+delete_bench_database (const char *dbname)
+{
+	GError *error = NULL;
+
+	if (!couchdb_session_delete_database (couchdb, dbname, &error)) {
+		g_warning ("Could not delete database %s: %s", dbname, error->message);
+		g_error_free (error);
+	}
+}
+
+static CouchdbDocument *
+create_document (CouchdbSession *session, gint i)
+{
+	CouchdbDocument *document;
+
+	document = couchdb_document_new (session);
+	couchdb_document_set_string_field (document, "record_type", "http://example.com/bench");
+	couchdb_document_set_string_field (document, "name", "Benchmark document");
+	couchdb_document_set_int_field (document, "index", i);
+	couchdb_document_set_boolean_field (document, "even", i % 2 == 0);
+
+	return document;
+}
+
+/* Creates a document with string fields adding up to approximately @kbytes */
+static CouchdbDocument *
+create_document_of_size (gint kbytes)
+{
+	CouchdbDocument *document;
+	gint i;
+
+	document = couchdb_document_new (couchdb);
+	for (i = 0; i < kbytes * 16; i++) {
+		char *field = g_strdup_printf ("field%06d", i);
+
+		couchdb_document_set_string_field (document, field,
+						   "0123456789abcdef0123456789abcdef0123456789");
+		g_free (field);
+	}
+
+	return document;
+}
+
+static void
+bench_get_put (void)
+{
+	char *dbname;
+	GPtrArray *docids;
+	GTimer *timer;
+	gint i;
+	GError *error = NULL;
+
+	dbname = create_bench_database ("bench-get-put");
+	docids = g_ptr_array_new ();
+	timer = g_timer_new ();
+
+	for (i = 0; i < n_documents; i++) {
+		CouchdbDocument *document = create_document (couchdb, i);
+
+		if (!couchdb_document_put (document, dbname, &error))
+			g_error ("Could not store document: %s", error->message);
+
+		g_ptr_array_add (docids, g_strdup (couchdb_document_get_id (document)));
+		g_object_unref (G_OBJECT (document));
+	}
+
+	add_result ("document-put", "ops/s", n_documents / g_timer_elapsed (timer, NULL), n_documents);
+
+	g_timer_start (timer);
+	for (i = 0; i < n_documents; i++) {
+		CouchdbDocument *document;
+
+		document = couchdb_document_get (couchdb, dbname, g_ptr_array_index (docids, i), &error);
+		if (!document)
+			g_error ("Could not retrieve document: %s", error->message);
+
+		g_object_unref (G_OBJECT (document));
+	}
+
+	add_result ("document-get", "ops/s", n_documents / g_timer_elapsed (timer, NULL), n_documents);
+
+	g_timer_destroy (timer);
+	for (i = 0; i < (gint) docids->len; i++)
+		g_free (g_ptr_array_index (docids, i));
+	g_ptr_array_free (docids, TRUE);
+
+	delete_bench_database (dbname);
+	g_free (dbname);
+}
+
+static void
+count_document_cb (CouchdbDocument *document, gpointer user_data)
+{
+	(*((gint *) user_data))++;
+}
+
+static void
+bench_all_docs (gint size)
+{
+	char *dbname, *name;
+	GTimer *timer;
+	gint i, count = 0;
+	GError *error = NULL;
+
+	dbname = create_bench_database ("bench-all-docs");
+
+	/* Fill the database in batches */
+	for (i = 0; i < size; i += BULK_BATCH_SIZE) {
+		GPtrArray *documents;
+		GSList *bulk_results;
+		gint j;
+
+		documents = g_ptr_array_new ();
+		for (j = i; j < MIN (i + BULK_BATCH_SIZE, size); j++)
+			g_ptr_array_add (documents, create_document (couchdb, j));
+
+		bulk_results = couchdb_session_put_documents (couchdb, dbname, documents,
+							      COUCHDB_BULK_FLAGS_NONE, &error);
+		if (error != NULL)
+			g_error ("Could not store documents: %s", error->message);
+
+		couchdb_session_free_bulk_results (bulk_results);
+		for (j = 0; j < (gint) documents->len; j++)
+			g_object_unref (g_ptr_array_index (documents, j));
+		g_ptr_array_free (documents, TRUE);
+	}
+
+	timer = g_timer_new ();
+	if (!couchdb_session_foreach_document (couchdb, dbname, count_document_cb, &count, &error))
+		g_error ("Could not list documents: %s", error->message);
+
+	if (count != size)
+		g_warning ("Listed %d documents, expected %d", count, size);
+
+	name = g_strdup_printf ("all-docs-%d", size);
+	add_result (name, "docs/s", count / g_timer_elapsed (timer, NULL), count);
+	g_free (name);
+
+	g_timer_destroy (timer);
+
+	delete_bench_database (dbname);
+	g_free (dbname);
+}
+
+static void
+bench_json (gint kbytes)
+{
+	CouchdbDocument *document;
+	char *str, *name;
+	gsize length;
+	GTimer *timer;
+	gint i, iterations;
+
+	document = create_document_of_size (kbytes);
+	iterations = MAX (1, 10000 / kbytes);
+
+	timer = g_timer_new ();
+	for (i = 0; i < iterations; i++) {
+		str = couchdb_document_to_string (document);
+		g_free (str);
+	}
+
+	str = couchdb_document_to_string (document);
+	length = strlen (str);
+
+	name = g_strdup_printf ("document-to-string-%dk", kbytes);
+	add_result (name, "ns/KB",
+		    g_timer_elapsed (timer, NULL) * 1e9 / iterations / (length / 1024.0),
+		    iterations);
+	g_free (name);
+
+	g_timer_start (timer);
+	for (i = 0; i < iterations; i++) {
+		JsonParser *parser;
+		CouchdbDocument *parsed;
+
+		parser = json_parser_new ();
+		if (!json_parser_load_from_data (parser, str, length, NULL))
+			g_error ("Could not parse document");
+
+		parsed = couchdb_document_new_from_json_object (
+			couchdb, NULL, json_node_get_object (json_parser_get_root (parser)));
+
+		g_object_unref (G_OBJECT (parsed));
+		g_object_unref (G_OBJECT (parser));
+	}
+
+	name = g_strdup_printf ("document-parse-%dk", kbytes);
+	add_result (name, "ns/KB",
+		    g_timer_elapsed (timer, NULL) * 1e9 / iterations / (length / 1024.0),
+		    iterations);
+	g_free (name);
+
+	g_timer_destroy (timer);
+	g_free (str);
+	g_object_unref (G_OBJECT (document));
+}
+
+static void
+bench_field_access (void)
+{
+	CouchdbDocument *document;
+	char *fields[64];
+	GTimer *timer;
+	gint i;
+
+	document = couchdb_document_new (couchdb);
+	for (i = 0; i < G_N_ELEMENTS (fields); i++) {
+		fields[i] = g_strdup_printf ("field%02d", i);
+		couchdb_document_set_string_field (document, fields[i], fields[i]);
+	}
+
+	timer = g_timer_new ();
+	for (i = 0; i < n_field_lookups; i++) {
+		if (couchdb_document_get_string_field (document, fields[i % G_N_ELEMENTS (fields)]) == NULL)
+			g_error ("Field not found");
+	}
+
+	add_result ("get-string-field", "ns/op",
+		    g_timer_elapsed (timer, NULL) * 1e9 / n_field_lookups, n_field_lookups);
+
+	g_timer_destroy (timer);
+	for (i = 0; i < G_N_ELEMENTS (fields); i++)
+		g_free (fields[i]);
+	g_object_unref (G_OBJECT (document));
+}
+
+#ifdef HAVE_OAUTH
+/* Signing the same URL with liboauth's oauth_sign_url2, which the OAuth
+   header used to be built from, and with a precomputed OAuthSigner */
+static void
+bench_oauth_signing (void)
+{
+	const char *url = "http://127.0.0.1:5984/contacts/_all_docs?include_docs=true&startkey=%22a%22";
+	OAuthSigner *signer;
+	GTimer *timer;
+	gint i;
+
+	timer = g_timer_new ();
+	for (i = 0; i < n_signatures; i++) {
+		char *signed_url;
+
+		signed_url = oauth_sign_url2 (url, NULL, OA_HMAC, "GET",
+					      "consumer", "consumer-secret", "token", "token-secret");
+		free (signed_url);
+	}
+
+	add_result ("oauth-sign-url2", "us/op",
+		    g_timer_elapsed (timer, NULL) * 1e6 / n_signatures, n_signatures);
+
+	signer = oauth_signer_new ("consumer", "consumer-secret", "token", "token-secret");
+	g_timer_start (timer);
+	for (i = 0; i < n_signatures; i++) {
+		char *header;
+
+		header = oauth_signer_sign_header (signer, "GET", url);
+		g_free (header);
+	}
+
+	add_result ("oauth-signer-sign-header", "us/op",
+		    g_timer_elapsed (timer, NULL) * 1e6 / n_signatures, n_signatures);
+
+	oauth_signer_free (signer);
+	g_timer_destroy (timer);
+}
+#endif /* HAVE_OAUTH */
+
+static void
+bench_allocations (void)
+{
+	char *dbname, *str;
+	GPtrArray *docids;
+	CouchdbDocument *document;
+	gint64 start;
+	gint i, count = 0;
+	GError *error = NULL;
+
+	dbname = create_bench_database ("bench-allocations");
+	docids = g_ptr_array_new ();
+
+	for (i = 0; i < n_documents; i++) {
+		document = create_document (couchdb, i);
+		if (!couchdb_document_put (document, dbname, &error))
+			g_error ("Could not store document: %s", error->message);
+
+		g_ptr_array_add (docids, g_strdup (couchdb_document_get_id (document)));
+		g_object_unref (G_OBJECT (document));
+	}
+
+	/* Building a document from its JSON representation alone */
+	document = couchdb_document_get (couchdb, dbname, g_ptr_array_index (docids, 0), &error);
+	str = couchdb_document_to_string (document);
+	g_object_unref (G_OBJECT (document));
+
+	start = n_allocations;
+	for (i = 0; i < n_documents; i++) {
+		JsonParser *parser;
+
+		parser = json_parser_new ();
+		if (!json_parser_load_from_data (parser, str, -1, NULL))
+			g_error ("Could not parse document");
+
+		document = couchdb_document_new_from_json_object (
+			couchdb, dbname, json_node_get_object (json_parser_get_root (parser)));
+		g_object_unref (G_OBJECT (parser));
+		g_object_unref (G_OBJECT (document));
+	}
+	add_result ("allocs-per-document-parse", "allocs", (gdouble) (n_allocations - start) / n_documents, n_documents);
+	g_free (str);
+
+	/* Single gets, which include the HTTP request, uncached and cached */
+	start = n_allocations;
+	for (i = 0; i < n_documents; i++) {
+		document = couchdb_document_get (couchdb, dbname, g_ptr_array_index (docids, i), &error);
+		if (!document)
+			g_error ("Could not retrieve document: %s", error->message);
+		g_object_unref (G_OBJECT (document));
+	}
+	add_result ("allocs-per-document-get", "allocs", (gdouble) (n_allocations - start) / n_documents, n_documents);
+
+	couchdb_session_set_document_cache_size (couchdb, 64 * 1024 * 1024);
+	for (i = 0; i < n_documents; i++) {
+		document = couchdb_document_get (couchdb, dbname, g_ptr_array_index (docids, i), &error);
+		g_object_unref (G_OBJECT (document));
+	}
+
+	start = n_allocations;
+	for (i = 0; i < n_documents; i++) {
+		document = couchdb_document_get (couchdb, dbname, g_ptr_array_index (docids, i), &error);
+		if (!document)
+			g_error ("Could not retrieve document: %s", error->message);
+		g_object_unref (G_OBJECT (document));
+	}
+	add_result ("allocs-per-document-get-cached", "allocs", (gdouble) (n_allocations - start) / n_documents, n_documents);
+	couchdb_session_set_document_cache_size (couchdb, 0);
+
+	/* Rows of an include_docs listing */
+	start = n_allocations;
+	if (!couchdb_session_foreach_document (couchdb, dbname, count_document_cb, &count, &error))
+		g_error ("Could not list documents: %s", error->message);
+	add_result ("allocs-per-listed-document", "allocs", (gdouble) (n_allocations - start) / MAX (count, 1), count);
+
+	for (i = 0; i < (gint) docids->len; i++)
+		g_free (g_ptr_array_index (docids, i));
+	g_ptr_array_free (docids, TRUE);
+
+	delete_bench_database (dbname);
+	g_free (dbname);
+}
+
+typedef struct {
+	GMainLoop *loop;
+	GTimer *timer;
+	gboolean received;
+	guint timeout_id;
+} ChangeData;
+
+static void
+change_created_cb (CouchdbSession *session, const char *dbname, CouchdbDocument *document, gpointer user_data)
+{
+	ChangeData *data = (ChangeData *) user_data;
+
+	g_timer_stop (data->timer);
+	data->received = TRUE;
+	g_main_loop_quit (data->loop);
+}
+
+static gboolean
+change_timeout_cb (gpointer user_data)
+{
+	ChangeData *data = (ChangeData *) user_data;
+
+	data->timeout_id = 0;
+	g_main_loop_quit (data->loop);
+
+	return FALSE;
+}
+
+static void
+bench_change_latency (void)
+{
+	CouchdbSession *writer;
+	char *dbname;
+	ChangeData data;
+	gdouble total = 0, min = G_MAXDOUBLE, max = 0;
+	gint i, received = 0;
+	gulong handler_id;
+	GError *error = NULL;
+
+	/* Changes done through the same session are notified without going
+	   through the server, so write from a different one */
+	dbname = create_bench_database ("bench-changes");
+	writer = couchdb_session_new (couchdb_session_get_uri (couchdb));
+
+	data.loop = g_main_loop_new (NULL, FALSE);
+	data.timer = g_timer_new ();
+	handler_id = g_signal_connect (G_OBJECT (couchdb), "document_created",
+				       G_CALLBACK (change_created_cb), &data);
+	couchdb_session_listen_for_changes (couchdb, dbname);
+
+	for (i = 0; i < n_changes; i++) {
+		CouchdbDocument *document = create_document (writer, i);
+
+		data.received = FALSE;
+		g_timer_start (data.timer);
+		if (!couchdb_document_put (document, dbname, &error))
+			g_error ("Could not store document: %s", error->message);
+
+		/* Measured from the start of the write, until the notification
+		   arrives through the changes feed */
+		data.timeout_id = g_timeout_add_seconds (CHANGE_TIMEOUT_SECONDS, change_timeout_cb, &data);
+		if (!data.received)
+			g_main_loop_run (data.loop);
+		if (data.timeout_id != 0)
+			g_source_remove (data.timeout_id);
+
+		if (data.received) {
+			gdouble elapsed = g_timer_elapsed (data.timer, NULL) * 1e6;
+
+			total += elapsed;
+			min = MIN (min, elapsed);
+			max = MAX (max, elapsed);
+			received++;
+		}
+
+		g_object_unref (G_OBJECT (document));
+	}
+
+	if (received < n_changes)
+		g_warning ("%d change notifications were not received", n_changes - received);
+
+	if (received > 0) {
+		add_result ("change-latency-mean", "us", total / received, received);
+		add_result ("change-latency-min", "us", min, received);
+		add_result ("change-latency-max", "us", max, received);
+	}
+
+	g_signal_handler_disconnect (G_OBJECT (couchdb), handler_id);
+	g_timer_destroy (data.timer);
+	g_main_loop_unref (data.loop);
+	g_object_unref (G_OBJECT (writer));
+
+	delete_bench_database (dbname);
+	g_free (dbname);
+}
+
+static void
+write_results (void)
+{
+	JsonGenerator *generator;
+	JsonObject *object;
+	JsonNode *root;
+	char *data;
+	gsize length;
+	GError *error = NULL;
+
+	object = json_object_new ();
+	json_object_set_string_member (object, "benchmark", "couchdb-glib");
+	json_object_set_string_member (object, "server", server_uri ? server_uri : "in-process");
+	json_object_set_array_member (object, "results", results);
+
+	root = json_node_new (JSON_NODE_OBJECT);
+	json_node_take_object (root, object);
+
+	generator = json_generator_new ();
+	g_object_set (G_OBJECT (generator), "pretty", TRUE, NULL);
+	json_generator_set_root (generator, root);
+	data = json_generator_to_data (generator, &length);
+
+	if (output_file != NULL) {
+		if (!g_file_set_contents (output_file, data, length, &error))
+			g_error ("Could not write %s: %s", output_file, error->message);
+	} else
+		g_print ("%s\n", data);
+
+	g_free (data);
+	g_object_unref (G_OBJECT (generator));
+	json_node_free (root);
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *context;
+	FakeCouchdb *fake = NULL;
+	char **sizes;
+	gint i;
+	GError *error = NULL;
+
+	/* The allocator has to be replaced before anything is allocated, so
+	   look for the option before parsing them */
+	for (i = 1; i < argc; i++) {
+		if (strcmp (argv[i], "--allocations") == 0) {
+			/* Count slice allocations too */
+			setenv ("G_SLICE", "always-malloc", 1);
+			main_thread = pthread_self ();
+			g_mem_set_vtable (&counting_vtable);
+			break;
+		}
+	}
+
+	g_type_init ();
+	g_thread_init (NULL);
+
+	context = g_option_context_new ("- benchmark couchdb-glib");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free (context);
+
+	if (server_uri != NULL) {
+		couchdb = couchdb_session_new (server_uri);
+	} else {
+		fake = fake_couchdb_new ();
+		if (!fake) {
+			g_printerr ("Could not start fake Couchdb server\n");
+			return 1;
+		}
+		couchdb = couchdb_session_new (fake_couchdb_get_uri (fake));
+	}
+
+	results = json_array_new ();
+
+	if (count_allocations) {
+		bench_allocations ();
+		goto out;
+	}
+
+	bench_get_put ();
+
+	sizes = g_strsplit (all_docs_sizes ? all_docs_sizes : "10000,100000", ",", -1);
+	for (i = 0; sizes[i] != NULL; i++) {
+		gint size = atoi (sizes[i]);
+
+		if (size > 0)
+			bench_all_docs (size);
+	}
+	g_strfreev (sizes);
+
+	bench_json (1);
+	bench_json (16);
+	bench_json (256);
+
+	bench_field_access ();
+#ifdef HAVE_OAUTH
+	bench_oauth_signing ();
+#endif
+	bench_change_latency ();
+
+ out:
+	write_results ();
+
+	g_object_unref (G_OBJECT (couchdb));
+	if (fake != NULL)
+		fake_couchdb_free (fake);
+
+	return 0;
+}
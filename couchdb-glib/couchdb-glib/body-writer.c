@@ -0,0 +1,259 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "body-writer.h"
+
+/*
+ * The body writer serializes JSON straight into the body of a request, in
+ * fixed size chunks which are handed over to libsoup as they fill up, so that
+ * the request never exists as a single string, nor is copied once written.
+ * Buffers which are already in memory, like the JSON text of documents that
+ * haven't been modified, are added to the body by reference.
+ */
+
+/* Size of the chunks the body is written in */
+#define BODY_CHUNK_SIZE (16 * 1024)
+
+/* Buffers smaller than this are copied, which is cheaper than adding them
+   as a chunk of their own */
+#define BODY_MIN_BUFFER_SIZE 1024
+
+struct _BodyWriter {
+	SoupMessageBody *body;
+
+	char *chunk;
+	gsize used;
+};
+
+BodyWriter *
+body_writer_new (SoupMessageBody *body)
+{
+	BodyWriter *writer;
+
+	g_return_val_if_fail (body != NULL, NULL);
+
+	writer = g_slice_new0 (BodyWriter);
+	writer->body = body;
+
+	return writer;
+}
+
+static void
+flush (BodyWriter *writer)
+{
+	if (writer->used == 0)
+		return;
+
+	/* The body takes ownership of the chunk */
+	soup_message_body_append (writer->body, SOUP_MEMORY_TAKE, writer->chunk, writer->used);
+	writer->chunk = NULL;
+	writer->used = 0;
+}
+
+/* Writes whatever is left to the body */
+void
+body_writer_free (BodyWriter *writer)
+{
+	g_return_if_fail (writer != NULL);
+
+	flush (writer);
+	g_free (writer->chunk);
+
+	g_slice_free (BodyWriter, writer);
+}
+
+void
+body_writer_append (BodyWriter *writer, const char *data, gsize length)
+{
+	while (length > 0) {
+		gsize n;
+
+		if (writer->chunk == NULL)
+			writer->chunk = g_malloc (BODY_CHUNK_SIZE);
+
+		n = MIN (length, BODY_CHUNK_SIZE - writer->used);
+		memcpy (writer->chunk + writer->used, data, n);
+		writer->used += n;
+		data += n;
+		length -= n;
+
+		if (writer->used == BODY_CHUNK_SIZE)
+			flush (writer);
+	}
+}
+
+void
+body_writer_append_buffer (BodyWriter *writer, SoupBuffer *buffer)
+{
+	if (buffer->length < BODY_MIN_BUFFER_SIZE) {
+		body_writer_append (writer, buffer->data, buffer->length);
+		return;
+	}
+
+	flush (writer);
+	soup_message_body_append_buffer (writer->body, buffer);
+}
+
+/* Appends @str as a quoted JSON string */
+void
+body_writer_append_string (BodyWriter *writer, const char *str)
+{
+	const char *run;
+
+	body_writer_append (writer, "\"", 1);
+
+	/* Characters which don't need escaping are written in runs */
+	for (run = str; *str != '\0'; str++) {
+		char escaped[7];
+
+		if (*str != '"' && *str != '\\' && (guchar) *str >= 0x20)
+			continue;
+
+		body_writer_append (writer, run, str - run);
+		run = str + 1;
+
+		switch (*str) {
+		case '"':
+			body_writer_append (writer, "\\\"", 2);
+			break;
+		case '\\':
+			body_writer_append (writer, "\\\\", 2);
+			break;
+		case '\b':
+			body_writer_append (writer, "\\b", 2);
+			break;
+		case '\f':
+			body_writer_append (writer, "\\f", 2);
+			break;
+		case '\n':
+			body_writer_append (writer, "\\n", 2);
+			break;
+		case '\r':
+			body_writer_append (writer, "\\r", 2);
+			break;
+		case '\t':
+			body_writer_append (writer, "\\t", 2);
+			break;
+		default:
+			g_snprintf (escaped, sizeof (escaped), "\\u%04x", (guchar) *str);
+			body_writer_append (writer, escaped, 6);
+			break;
+		}
+	}
+	body_writer_append (writer, run, str - run);
+
+	body_writer_append (writer, "\"", 1);
+}
+
+static void
+append_value (BodyWriter *writer, JsonNode *node)
+{
+	char number[G_ASCII_DTOSTR_BUF_SIZE + 2];
+
+	switch (json_node_get_value_type (node)) {
+	case G_TYPE_INT:
+	case G_TYPE_INT64:
+		g_snprintf (number, sizeof (number), "%" G_GINT64_FORMAT, (gint64) json_node_get_int (node));
+		body_writer_append (writer, number, strlen (number));
+		break;
+	case G_TYPE_DOUBLE:
+		/* JSON has no infinities or NaNs */
+		if (!isfinite (json_node_get_double (node))) {
+			body_writer_append (writer, "null", 4);
+			break;
+		}
+
+		g_ascii_dtostr (number, G_ASCII_DTOSTR_BUF_SIZE, json_node_get_double (node));
+		/* Keep it a decimal number when it is read back */
+		if (strpbrk (number, ".eE") == NULL)
+			strcat (number, ".0");
+		body_writer_append (writer, number, strlen (number));
+		break;
+	case G_TYPE_BOOLEAN:
+		if (json_node_get_boolean (node))
+			body_writer_append (writer, "true", 4);
+		else
+			body_writer_append (writer, "false", 5);
+		break;
+	case G_TYPE_STRING:
+		if (json_node_get_string (node) != NULL)
+			body_writer_append_string (writer, json_node_get_string (node));
+		else
+			body_writer_append (writer, "null", 4);
+		break;
+	default:
+		g_warning ("Unsupported JSON value type %s",
+			   g_type_name (json_node_get_value_type (node)));
+		body_writer_append (writer, "null", 4);
+		break;
+	}
+}
+
+void
+body_writer_append_node (BodyWriter *writer, JsonNode *node)
+{
+	switch (JSON_NODE_TYPE (node)) {
+	case JSON_NODE_OBJECT: {
+		JsonObject *object;
+		GList *members, *l;
+
+		object = json_node_get_object (node);
+		members = json_object_get_members (object);
+
+		body_writer_append (writer, "{", 1);
+		for (l = members; l != NULL; l = l->next) {
+			if (l != members)
+				body_writer_append (writer, ",", 1);
+			body_writer_append_string (writer, (const char *) l->data);
+			body_writer_append (writer, ":", 1);
+			body_writer_append_node (writer, json_object_get_member (object, (const char *) l->data));
+		}
+		body_writer_append (writer, "}", 1);
+
+		g_list_free (members);
+		break;
+	}
+	case JSON_NODE_ARRAY: {
+		JsonArray *array;
+		guint i;
+
+		array = json_node_get_array (node);
+
+		body_writer_append (writer, "[", 1);
+		for (i = 0; i < json_array_get_length (array); i++) {
+			if (i > 0)
+				body_writer_append (writer, ",", 1);
+			body_writer_append_node (writer, json_array_get_element (array, i));
+		}
+		body_writer_append (writer, "]", 1);
+		break;
+	}
+	case JSON_NODE_VALUE:
+		append_value (writer, node);
+		break;
+	case JSON_NODE_NULL:
+		body_writer_append (writer, "null", 4);
+		break;
+	}
+}
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __BODY_WRITER_H__
+#define __BODY_WRITER_H__
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+#include <libsoup/soup-message-body.h>
+
+typedef struct _BodyWriter BodyWriter;
+
+BodyWriter *body_writer_new (SoupMessageBody *body);
+void        body_writer_free (BodyWriter *writer);
+
+void        body_writer_append (BodyWriter *writer, const char *data, gsize length);
+void        body_writer_append_buffer (BodyWriter *writer, SoupBuffer *buffer);
+void        body_writer_append_string (BodyWriter *writer, const char *str);
+void        body_writer_append_node (BodyWriter *writer, JsonNode *node);
+
+#endif /* __BODY_WRITER_H__ */
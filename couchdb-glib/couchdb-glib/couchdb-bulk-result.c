@@ -0,0 +1,204 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "couchdb-bulk-result.h"
+
+struct _CouchdbBulkResult {
+	gint ref_count;
+
+	char *docid;
+	char *revision;
+	char *error;
+	char *reason;
+};
+
+/*
+ * CouchdbBulkResult object
+ */
+
+GType
+couchdb_bulk_result_get_type (void)
+{
+	static GType object_type = 0;
+
+	if (G_UNLIKELY (!object_type))
+		object_type = g_boxed_type_register_static (g_intern_static_string ("CouchdbBulkResult"),
+							    (GBoxedCopyFunc) couchdb_bulk_result_ref,
+							    (GBoxedFreeFunc) couchdb_bulk_result_unref);
+
+	return object_type;
+}
+
+/**
+ * couchdb_bulk_result_new:
+ * @docid: Unique ID of the document
+ * @revision: New revision of the document, or NULL if it was not stored
+ * @error: Error code returned by CouchDB for this document, or NULL
+ * @reason: Description of the error, or NULL
+ *
+ * Create a new #CouchdbBulkResult object, which contains the result of
+ * storing one document as part of a bulk operation (see
+ * #couchdb_session_put_documents).
+ *
+ * Return value: A newly-created #CouchdbBulkResult object.
+ */
+CouchdbBulkResult *
+couchdb_bulk_result_new (const char *docid, const char *revision, const char *error, const char *reason)
+{
+	CouchdbBulkResult *result;
+
+	result = g_slice_new (CouchdbBulkResult);
+	result->ref_count = 1;
+	result->docid = g_strdup (docid);
+	result->revision = g_strdup (revision);
+	result->error = g_strdup (error);
+	result->reason = g_strdup (reason);
+
+	return result;
+}
+
+/**
+ * couchdb_bulk_result_ref:
+ * @result: A #CouchdbBulkResult object
+ *
+ * Increment reference count of a #CouchdbBulkResult object.
+ *
+ * Return value: A pointer to the object being referenced.
+ */
+CouchdbBulkResult *
+couchdb_bulk_result_ref (CouchdbBulkResult *result)
+{
+	g_return_val_if_fail (result != NULL, NULL);
+	g_return_val_if_fail (result->ref_count > 0, NULL);
+
+	g_atomic_int_exchange_and_add (&result->ref_count, 1);
+
+	return result;
+}
+
+/**
+ * couchdb_bulk_result_unref:
+ * @result: A #CouchdbBulkResult object
+ *
+ * Decrement reference count of a #CouchdbBulkResult object. When
+ * the reference count is equal to 0, the object will be destroyed.
+ */
+void
+couchdb_bulk_result_unref (CouchdbBulkResult *result)
+{
+	gint old_ref;
+
+	g_return_if_fail (result != NULL);
+	g_return_if_fail (result->ref_count > 0);
+
+	old_ref = g_atomic_int_get (&result->ref_count);
+	if (old_ref > 1)
+		g_atomic_int_compare_and_exchange (&result->ref_count, old_ref, old_ref - 1);
+	else {
+		g_free (result->docid);
+		g_free (result->revision);
+		g_free (result->error);
+		g_free (result->reason);
+		g_slice_free (CouchdbBulkResult, result);
+	}
+}
+
+/**
+ * couchdb_bulk_result_get_docid:
+ * @result: A #CouchdbBulkResult object
+ *
+ * Retrieve the unique ID of the document this result refers to.
+ *
+ * Return value: The unique ID of the document.
+ */
+const char *
+couchdb_bulk_result_get_docid (CouchdbBulkResult *result)
+{
+	g_return_val_if_fail (result != NULL, NULL);
+
+	return (const char *) result->docid;
+}
+
+/**
+ * couchdb_bulk_result_get_revision:
+ * @result: A #CouchdbBulkResult object
+ *
+ * Retrieve the new revision of the document this result refers to.
+ *
+ * Return value: The new revision of the document, or NULL if it was not stored.
+ */
+const char *
+couchdb_bulk_result_get_revision (CouchdbBulkResult *result)
+{
+	g_return_val_if_fail (result != NULL, NULL);
+
+	return (const char *) result->revision;
+}
+
+/**
+ * couchdb_bulk_result_is_ok:
+ * @result: A #CouchdbBulkResult object
+ *
+ * Check whether the document this result refers to was successfully stored.
+ *
+ * Return value: TRUE if the document was stored, FALSE otherwise.
+ */
+gboolean
+couchdb_bulk_result_is_ok (CouchdbBulkResult *result)
+{
+	g_return_val_if_fail (result != NULL, FALSE);
+
+	return result->error == NULL;
+}
+
+/**
+ * couchdb_bulk_result_get_error:
+ * @result: A #CouchdbBulkResult object
+ *
+ * Retrieve the error returned by CouchDB for the document this result
+ * refers to, like "conflict" or "forbidden".
+ *
+ * Return value: The error code, or NULL if the document was stored.
+ */
+const char *
+couchdb_bulk_result_get_error (CouchdbBulkResult *result)
+{
+	g_return_val_if_fail (result != NULL, NULL);
+
+	return (const char *) result->error;
+}
+
+/**
+ * couchdb_bulk_result_get_reason:
+ * @result: A #CouchdbBulkResult object
+ *
+ * Retrieve the description of the error returned by CouchDB for the
+ * document this result refers to.
+ *
+ * Return value: The error description, or NULL if the document was stored.
+ */
+const char *
+couchdb_bulk_result_get_reason (CouchdbBulkResult *result)
+{
+	g_return_val_if_fail (result != NULL, NULL);
+
+	return (const char *) result->reason;
+}
@@ -0,0 +1,49 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __COUCHDB_BULK_RESULT_H__
+#define __COUCHDB_BULK_RESULT_H__
+
+#include <glib.h>
+#include <glib-object.h>
+#include "couchdb-types.h"
+
+G_BEGIN_DECLS
+
+#define COUCHDB_TYPE_BULK_RESULT (couchdb_bulk_result_get_type ())
+
+GType              couchdb_bulk_result_get_type (void);
+CouchdbBulkResult *couchdb_bulk_result_new (const char *docid,
+					    const char *revision,
+					    const char *error,
+					    const char *reason);
+CouchdbBulkResult *couchdb_bulk_result_ref (CouchdbBulkResult *result);
+void               couchdb_bulk_result_unref (CouchdbBulkResult *result);
+
+const char        *couchdb_bulk_result_get_docid (CouchdbBulkResult *result);
+const char        *couchdb_bulk_result_get_revision (CouchdbBulkResult *result);
+gboolean           couchdb_bulk_result_is_ok (CouchdbBulkResult *result);
+const char        *couchdb_bulk_result_get_error (CouchdbBulkResult *result);
+const char        *couchdb_bulk_result_get_reason (CouchdbBulkResult *result);
+
+G_END_DECLS
+
+#endif /* __COUCHDB_BULK_RESULT_H__ */
@@ -125,6 +125,38 @@ couchdb_credentials_new_with_username_and_password (const gchar *username,
 	return credentials;
 }
 
+/**
+ * couchdb_credentials_new_with_session_cookie:
+ * @username: CouchDB user name
+ * @password: CouchDB password
+ *
+ * Create a new #CouchdbCredentials object to be used for CouchDB's cookie
+ * based authentication. The username and password are only sent to the
+ * _session API to log in, and every other request is authenticated with the
+ * session cookie it returns, so there is no challenge round trip nor
+ * signature to compute per request. The session is renewed automatically when
+ * it expires.
+ *
+ * Return value: A #CouchdbCredentials object.
+ */
+CouchdbCredentials *
+couchdb_credentials_new_with_session_cookie (const gchar *username,
+					     const gchar *password)
+{
+	CouchdbCredentials *credentials;
+
+	credentials = COUCHDB_CREDENTIALS (g_object_new (COUCHDB_TYPE_CREDENTIALS, NULL));
+	credentials->priv->type = COUCHDB_CREDENTIALS_TYPE_SESSION_COOKIE;
+	couchdb_credentials_set_item (credentials,
+				      COUCHDB_CREDENTIALS_ITEM_USERNAME,
+				      username);
+	couchdb_credentials_set_item (credentials,
+				      COUCHDB_CREDENTIALS_ITEM_PASSWORD,
+				      password);
+
+	return credentials;
+}
+
 /**
  * couchdb_credentials_get_auth_type:
  * @credentials: A #CouchdbCredentials object
@@ -47,7 +47,8 @@ typedef struct {
 typedef enum {
 	COUCHDB_CREDENTIALS_TYPE_UNKNOWN = -1,
 	COUCHDB_CREDENTIALS_TYPE_OAUTH,
-	COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD
+	COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD,
+	COUCHDB_CREDENTIALS_TYPE_SESSION_COOKIE
 } CouchdbCredentialsType;
 
 GType                  couchdb_credentials_get_type (void);
@@ -57,6 +58,8 @@ CouchdbCredentials    *couchdb_credentials_new_with_oauth (const gchar *consumer
 							   const gchar *token_secret);
 CouchdbCredentials    *couchdb_credentials_new_with_username_and_password (const gchar *username,
 									   const gchar *password);
+CouchdbCredentials    *couchdb_credentials_new_with_session_cookie (const gchar *username,
+								    const gchar *password);
 
 CouchdbCredentialsType couchdb_credentials_get_auth_type (CouchdbCredentials *credentials);
 
@@ -26,6 +26,8 @@
 #include <libsoup/soup-gnome.h>
 #include <json-glib/json-glib.h>
 #include "couchdb-document.h"
+#include "couchdb-field-key.h"
+#include "raw-object.h"
 #include "utils.h"
 
 struct _CouchdbDocument {
@@ -34,6 +36,22 @@ struct _CouchdbDocument {
 	CouchdbSession  *couchdb;
 	char		*dbname;
 	JsonNode	*root_node;
+
+	/* Documents retrieved from the server keep the JSON text they came
+	   in, and only parse it into root_node when it is really needed */
+	SoupBuffer	*raw;
+	GHashTable	*raw_members;
+
+	/* Values of nested fields looked up by key in the JSON text */
+	GHashTable	*raw_paths;
+
+	/* Set when the JSON text is not a valid object. The document is then
+	   kept as it is, and can be neither modified nor stored */
+	gboolean	 invalid;
+
+	/* The tables above own the strings returned by the getters, so they
+	   are kept here, once the document is parsed, until it is freed */
+	GSList		*stale_indexes;
 };
 
 G_DEFINE_TYPE(CouchdbDocument, couchdb_document, G_TYPE_OBJECT);
@@ -44,7 +62,16 @@ couchdb_document_finalize (GObject *object)
 	CouchdbDocument *document = COUCHDB_DOCUMENT (object);
 
 	g_free (document->dbname);
-	json_node_free (document->root_node);
+	if (document->root_node != NULL)
+		json_node_free (document->root_node);
+	if (document->raw_members != NULL)
+		g_hash_table_destroy (document->raw_members);
+	if (document->raw_paths != NULL)
+		g_hash_table_destroy (document->raw_paths);
+	g_slist_foreach (document->stale_indexes, (GFunc) g_hash_table_destroy, NULL);
+	g_slist_free (document->stale_indexes);
+	if (document->raw != NULL)
+		soup_buffer_free (document->raw);
 
 	G_OBJECT_CLASS (couchdb_document_parent_class)->finalize (object);
 }
@@ -63,6 +90,117 @@ couchdb_document_init (CouchdbDocument *document)
 	document->couchdb = NULL;
 	document->root_node = NULL;
 	document->dbname = NULL;
+	document->raw = NULL;
+	document->raw_members = NULL;
+	document->raw_paths = NULL;
+	document->invalid = FALSE;
+	document->stale_indexes = NULL;
+}
+
+/* Parse the JSON text of a retrieved document, so that it can be modified.
+   If it is not a valid object, the document is left untouched, instead of
+   being replaced by an empty one that could then be stored over it */
+static gboolean
+materialize (CouchdbDocument *document)
+{
+	JsonParser *parser;
+	JsonNode *root;
+	GError *error = NULL;
+
+	if (document->raw == NULL)
+		return TRUE;
+	if (document->invalid)
+		return FALSE;
+
+	parser = json_parser_new ();
+	if (json_parser_load_from_data (parser, document->raw->data, document->raw->length, &error)) {
+		root = json_parser_get_root (parser);
+		if (root != NULL && json_node_get_node_type (root) == JSON_NODE_OBJECT)
+			document->root_node = json_node_copy (root);
+		else
+			g_warning ("Could not parse document: not a JSON object");
+	} else {
+		g_warning ("Could not parse document: %s", error->message);
+		g_error_free (error);
+	}
+	g_object_unref (G_OBJECT (parser));
+
+	if (document->root_node == NULL) {
+		document->invalid = TRUE;
+		return FALSE;
+	}
+
+	if (document->raw_members != NULL) {
+		document->stale_indexes = g_slist_prepend (document->stale_indexes, document->raw_members);
+		document->raw_members = NULL;
+	}
+	if (document->raw_paths != NULL) {
+		document->stale_indexes = g_slist_prepend (document->stale_indexes, document->raw_paths);
+		document->raw_paths = NULL;
+	}
+	soup_buffer_free (document->raw);
+	document->raw = NULL;
+
+	return TRUE;
+}
+
+/* Look up a top level member of a document which has not been parsed yet */
+static RawValue *
+raw_member (CouchdbDocument *document, const char *field)
+{
+	if (document->raw_members == NULL) {
+		document->raw_members = raw_object_index (document->raw->data, document->raw->length);
+		if (document->raw_members == NULL) {
+			g_warning ("Invalid JSON object in document");
+			document->raw_members = g_hash_table_new (g_str_hash, g_str_equal);
+			document->invalid = TRUE;
+		}
+	}
+
+	return g_hash_table_lookup (document->raw_members, field);
+}
+
+/* Look up a field by key in a document which has not been parsed yet */
+static RawValue *
+raw_key_member (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	RawValue *value;
+	RawValue nested, member;
+	guint i;
+
+	value = raw_member (document, key->names[0]);
+	if (value == NULL || key->n_names == 1)
+		return value;
+
+	if (document->raw_paths == NULL) {
+		document->raw_paths = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+							     (GDestroyNotify) raw_value_free);
+	} else if (g_hash_table_lookup_extended (document->raw_paths, key, NULL, (gpointer *) &value))
+		return value;
+
+	/* Go down the nested objects without indexing them */
+	nested = *value;
+	nested.string = NULL;
+	value = NULL;
+	for (i = 1; i < key->n_names; i++) {
+		const char *names[2];
+
+		names[0] = key->names[i];
+		names[1] = NULL;
+		if (nested.type != RAW_VALUE_OBJECT
+		    || !raw_object_lookup (nested.data, nested.length, names, &member)
+		    || member.data == NULL)
+			break;
+		nested = member;
+	}
+
+	if (i == key->n_names)
+		value = g_slice_dup (RawValue, &nested);
+
+	/* Missing fields are remembered too */
+	g_hash_table_insert (document->raw_paths, key, value);
+
+	return value;
 }
 
 /**
@@ -89,6 +227,32 @@ couchdb_document_new (CouchdbSession *couchdb)
 	return document;
 }
 
+static char *
+document_url (CouchdbSession *couchdb, const char *dbname, const char *docid)
+{
+	char *encoded_docid, *url;
+
+	encoded_docid = soup_uri_encode (docid, NULL);
+	url = g_strdup_printf ("%s/%s/%s", couchdb_session_get_uri (couchdb), dbname, encoded_docid);
+	g_free (encoded_docid);
+
+	return url;
+}
+
+static CouchdbDocument *
+document_from_parser (CouchdbSession *couchdb, const char *dbname, JsonParser *parser)
+{
+	JsonNode *root;
+
+	root = json_parser_get_root (parser);
+	if (root == NULL || json_node_get_node_type (root) != JSON_NODE_OBJECT)
+		return NULL;
+
+	/* The document takes a reference on the parsed tree, which outlives
+	   the parser, so there is nothing to copy */
+	return couchdb_document_new_from_json_object (couchdb, dbname, json_node_get_object (root));
+}
+
 /**
  * couchdb_document_get:
  * @couchdb: A #CouchdbSession object
@@ -107,29 +271,194 @@ couchdb_document_get (CouchdbSession *couchdb,
 		      const char *docid,
 		      GError **error)
 {
-	char *url, *encoded_docid;
-	JsonParser *parser;
+	char *url;
+	SoupBuffer *buffer;
 	CouchdbDocument *document = NULL;
 
 	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
 	g_return_val_if_fail (dbname != NULL, NULL);
 	g_return_val_if_fail (docid != NULL, NULL);
 
-	encoded_docid = soup_uri_encode (docid, NULL);
-	url = g_strdup_printf ("%s/%s/%s", couchdb_session_get_uri (couchdb), dbname, encoded_docid);
+	url = document_url (couchdb, dbname, docid);
+	buffer = couchdb_session_fetch_document (couchdb, dbname, docid, url, error);
+	if (buffer != NULL) {
+		document = couchdb_document_new_from_buffer (couchdb, dbname, buffer);
+		soup_buffer_free (buffer);
+	}
+
+	g_free (url);
+
+	return document;
+}
+
+static void
+get_finished_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+	GError *error = NULL;
+
+	if (couchdb_session_send_message_finish (COUCHDB_SESSION (source_object), res, &error)) {
+		CouchdbDocument *document;
+
+		document = document_from_parser (COUCHDB_SESSION (source_object),
+						 g_object_get_data (G_OBJECT (result), "dbname"),
+						 g_object_get_data (G_OBJECT (result), "parser"));
+		if (document != NULL)
+			g_simple_async_result_set_op_res_gpointer (result, document, g_object_unref);
+		else
+			g_simple_async_result_set_error (result, COUCHDB_ERROR, -1, "Invalid document");
+	} else {
+		g_simple_async_result_set_from_error (result, error);
+		g_error_free (error);
+	}
+
+	g_simple_async_result_complete (result);
+	g_object_unref (G_OBJECT (result));
+}
+
+/**
+ * couchdb_document_get_async:
+ * @couchdb: A #CouchdbSession object
+ * @dbname: Name of the database to retrieve the document from
+ * @docid: Unique ID of the document to be retrieved
+ * @cancellable: A #GCancellable object, or NULL
+ * @callback: Function to call when the document has been retrieved
+ * @user_data: Data to pass to @callback
+ *
+ * Asynchronous version of #couchdb_document_get. When the operation finishes,
+ * @callback will be called, and it should then call #couchdb_document_get_finish
+ * to get the retrieved document.
+ */
+void
+couchdb_document_get_async (CouchdbSession *couchdb,
+			    const char *dbname,
+			    const char *docid,
+			    GCancellable *cancellable,
+			    GAsyncReadyCallback callback,
+			    gpointer user_data)
+{
+	char *url;
+	JsonParser *parser;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (dbname != NULL);
+	g_return_if_fail (docid != NULL);
+
+	result = g_simple_async_result_new (G_OBJECT (couchdb), callback, user_data,
+					    couchdb_document_get_async);
+
 	parser = json_parser_new ();
-	if (couchdb_session_send_message (couchdb, SOUP_METHOD_GET, url, NULL, parser, error)) {
-		document = g_object_new (COUCHDB_TYPE_DOCUMENT, NULL);
-		document->couchdb = couchdb;
+	g_object_set_data_full (G_OBJECT (result), "parser", parser, g_object_unref);
+	g_object_set_data_full (G_OBJECT (result), "dbname", g_strdup (dbname), g_free);
+
+	url = document_url (couchdb, dbname, docid);
+	couchdb_session_send_message_async (couchdb, SOUP_METHOD_GET, url, NULL, parser,
+					    cancellable, get_finished_cb, result);
+
+	g_free (url);
+}
+
+/**
+ * couchdb_document_get_finish:
+ * @couchdb: A #CouchdbSession object
+ * @result: A #GAsyncResult, as passed to the callback
+ * @error: Placeholder for error information
+ *
+ * Finish an operation started with #couchdb_document_get_async.
+ *
+ * Return value: A #CouchdbDocument object if successful, NULL otherwise, in
+ * which case, the error argument will contain information about the error.
+ */
+CouchdbDocument *
+couchdb_document_get_finish (CouchdbSession *couchdb, GAsyncResult *result, GError **error)
+{
+	GSimpleAsyncResult *simple;
+	CouchdbDocument *document;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (couchdb),
+							      couchdb_document_get_async), NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	document = g_simple_async_result_get_op_res_gpointer (simple);
+
+	return document != NULL ? g_object_ref (G_OBJECT (document)) : NULL;
+}
+
+static char *
+put_url (CouchdbDocument *document, const char *dbname, const char **method)
+{
+	const char *id;
+
+	id = couchdb_document_get_id (document);
+	if (id) {
+		*method = SOUP_METHOD_PUT;
+		return document_url (document->couchdb, dbname, id);
+	}
+
+	*method = SOUP_METHOD_POST;
+	return g_strdup_printf ("%s/%s/", couchdb_session_get_uri (document->couchdb), dbname);
+}
+
+static void
+document_stored (CouchdbDocument *document, const char *dbname, JsonParser *parser, gboolean is_new)
+{
+	JsonObject *object;
+
+	object = json_node_get_object (json_parser_get_root (parser));
+	couchdb_document_set_id (document, json_object_get_string_member (object, "id"));
+	couchdb_document_set_revision (document, json_object_get_string_member (object, "rev"));
+	couchdb_session_invalidate_document (document->couchdb, dbname, couchdb_document_get_id (document));
+
+	if (document->dbname) {
+		g_free (document->dbname);
 		document->dbname = g_strdup (dbname);
+	}
+
+	if (is_new)
+		couchdb_session_emit_document_created (document->couchdb, dbname, document);
+	else
+		couchdb_session_emit_document_updated (document->couchdb, dbname, document);
+}
 
-		document->root_node = json_node_copy (json_parser_get_root (parser));		
+/* Documents whose JSON text is not valid refuse all changes, so storing them
+   would silently drop whatever the caller tried to change */
+gboolean
+couchdb_document_check_valid (CouchdbDocument *document, GError **error)
+{
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
+
+	if (document->invalid) {
+		g_set_error (error, COUCHDB_ERROR, -1, "Invalid document: not a JSON object");
+		return FALSE;
 	}
-	g_object_unref (G_OBJECT (parser));
-	g_free (encoded_docid);
-	g_free (url);
 
-	return document;
+	return TRUE;
+}
+
+/* Write the document into a request body, as couchdb_document_to_string
+   would return it, but without building the whole string first */
+void
+couchdb_document_write (CouchdbDocument *document, BodyWriter *writer)
+{
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+
+	/* Unmodified documents are sent back as they were received, without
+	   even copying them */
+	if (document->raw)
+		body_writer_append_buffer (writer, document->raw);
+	else if (document->root_node)
+		body_writer_append_node (writer, document->root_node);
+}
+
+static void
+write_document (BodyWriter *writer, gpointer user_data)
+{
+	couchdb_document_write (COUCHDB_DOCUMENT (user_data), writer);
 }
 
 /**
@@ -155,57 +484,151 @@ couchdb_document_put (CouchdbDocument *document,
 		      const char *dbname,
 		      GError **error)
 {
-	char *url, *body;
-	const char *id;
+	char *url;
+	const char *method;
+	gboolean is_new;
 	JsonParser *parser;
 	gboolean result = FALSE;
-	gboolean send_ok;
 
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
 	g_return_val_if_fail (dbname != NULL, FALSE);
 
-	id = couchdb_document_get_id (document);
-	body = couchdb_document_to_string (document);
+	if (!couchdb_document_check_valid (document, error))
+		return FALSE;
+
+	is_new = couchdb_document_get_id (document) == NULL;
+	url = put_url (document, dbname, &method);
 	parser = json_parser_new ();
-	if (id) {
-		char *encoded_docid;
 
-		encoded_docid = soup_uri_encode (id, NULL);
-		url = g_strdup_printf ("%s/%s/%s", couchdb_session_get_uri (document->couchdb), dbname, encoded_docid);		
-		send_ok = couchdb_session_send_message (document->couchdb, SOUP_METHOD_PUT, url, body, parser, error);
+	if (couchdb_session_send_message_with_body (document->couchdb, method, url,
+						    write_document, document, parser, error)) {
+		document_stored (document, dbname, parser, is_new);
+		result = TRUE;
+	}
+
+	/* free memory */
+	g_free (url);
+	g_object_unref (G_OBJECT (parser));
+
+	return result;
+}
 
-		g_free (encoded_docid);
+static void
+put_finished_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+	CouchdbDocument *document;
+	GError *error = NULL;
+
+	document = COUCHDB_DOCUMENT (g_async_result_get_source_object (G_ASYNC_RESULT (result)));
+	if (couchdb_session_send_message_finish (COUCHDB_SESSION (source_object), res, &error)) {
+		document_stored (document,
+				 g_object_get_data (G_OBJECT (result), "dbname"),
+				 g_object_get_data (G_OBJECT (result), "parser"),
+				 GPOINTER_TO_INT (g_object_get_data (G_OBJECT (result), "is_new")));
 	} else {
-		url = g_strdup_printf ("%s/%s/", couchdb_session_get_uri (document->couchdb), dbname);
-		send_ok = couchdb_session_send_message (document->couchdb, SOUP_METHOD_POST, url, body, parser, error);
+		g_simple_async_result_set_from_error (result, error);
+		g_error_free (error);
 	}
 
-	if (send_ok) {
-		JsonObject *object;
+	g_simple_async_result_complete (result);
 
-		object = json_node_get_object (json_parser_get_root (parser));
-		couchdb_document_set_id (document, json_object_get_string_member (object, "id"));
-		couchdb_document_set_revision (document, json_object_get_string_member (object, "rev"));
+	g_object_unref (G_OBJECT (document));
+	g_object_unref (G_OBJECT (result));
+}
 
-		if (document->dbname) {
-			g_free (document->dbname);
-			document->dbname = g_strdup (dbname);
-		}
+/**
+ * couchdb_document_put_async:
+ * @document: A #CouchdbDocument object
+ * @dbname: Name of the database where the document will be stored
+ * @cancellable: A #GCancellable object, or NULL
+ * @callback: Function to call when the document has been stored
+ * @user_data: Data to pass to @callback
+ *
+ * Asynchronous version of #couchdb_document_put. The @document object will
+ * be updated with the new ID and revision before @callback is called. The
+ * callback should then call #couchdb_document_put_finish to get the result
+ * of the operation.
+ */
+void
+couchdb_document_put_async (CouchdbDocument *document,
+			    const char *dbname,
+			    GCancellable *cancellable,
+			    GAsyncReadyCallback callback,
+			    gpointer user_data)
+{
+	char *url;
+	const char *method;
+	JsonParser *parser;
+	GSimpleAsyncResult *result;
+	GError *error = NULL;
 
-		if (id)
-			g_signal_emit_by_name (document->couchdb, "document_updated", dbname, document);
-		else
-			g_signal_emit_by_name (document->couchdb, "document_created", dbname, document);
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	g_return_if_fail (dbname != NULL);
 
-		result = TRUE;
+	result = g_simple_async_result_new (G_OBJECT (document), callback, user_data,
+					    couchdb_document_put_async);
+
+	if (!couchdb_document_check_valid (document, &error)) {
+		g_simple_async_result_set_from_error (result, error);
+		g_simple_async_result_complete_in_idle (result);
+		g_object_unref (G_OBJECT (result));
+		g_error_free (error);
+		return;
 	}
 
-	/* free memory */
+	parser = json_parser_new ();
+	g_object_set_data_full (G_OBJECT (result), "parser", parser, g_object_unref);
+	g_object_set_data_full (G_OBJECT (result), "dbname", g_strdup (dbname), g_free);
+	g_object_set_data (G_OBJECT (result), "is_new",
+			   GINT_TO_POINTER (couchdb_document_get_id (document) == NULL));
+
+	url = put_url (document, dbname, &method);
+	couchdb_session_send_message_with_body_async (document->couchdb, method, url,
+						      write_document, document, parser,
+						      cancellable, put_finished_cb, result);
+
 	g_free (url);
-	g_free (body);
-	g_object_unref (G_OBJECT (parser));
+}
 
-	return result;
+/**
+ * couchdb_document_put_finish:
+ * @document: A #CouchdbDocument object
+ * @result: A #GAsyncResult, as passed to the callback
+ * @error: Placeholder for error information
+ *
+ * Finish an operation started with #couchdb_document_put_async.
+ *
+ * Return value: TRUE if successful, FALSE otherwise, in which case the error
+ * argument will contain information about the error.
+ */
+gboolean
+couchdb_document_put_finish (CouchdbDocument *document, GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (document),
+							      couchdb_document_put_async), FALSE);
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+static char *
+delete_url (CouchdbDocument *document)
+{
+	const char *id, *revision;
+	char *encoded_docid, *url;
+
+	id = couchdb_document_get_id (document);
+	revision = couchdb_document_get_revision (document);
+	if (!id || !revision)
+		return NULL;
+
+	encoded_docid = soup_uri_encode (id, NULL);
+	url = g_strdup_printf ("%s/%s/%s?rev=%s", couchdb_session_get_uri (document->couchdb),
+			       document->dbname, encoded_docid, revision);
+	g_free (encoded_docid);
+
+	return url;
 }
 
 /**
@@ -229,24 +652,22 @@ couchdb_document_put (CouchdbDocument *document,
 gboolean
 couchdb_document_delete (CouchdbDocument *document, GError **error)
 {
-	const char *id, *revision;
 	char *url;
-	JsonParser *parser;
 	gboolean result = FALSE;
 
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
 
-	id = couchdb_document_get_id (document);
-	revision = couchdb_document_get_revision (document);
-	if (!id || !revision) /* we can't remove a document without an ID and/or a REVISION */
+	url = delete_url (document);
+	if (!url) /* we can't remove a document without an ID and/or a REVISION */
 		return FALSE;
 
-	url = g_strdup_printf ("%s/%s/%s?rev=%s", couchdb_session_get_uri (document->couchdb), document->dbname, id, revision);
-	
 	/* We don't parse the http response, therefore the parser arg is NULL */
 	if (couchdb_session_send_message (document->couchdb, SOUP_METHOD_DELETE, url, NULL, NULL, error)) {
-		result = TRUE;		
-		g_signal_emit_by_name (document->couchdb, "document_deleted", document->dbname, id);
+		result = TRUE;
+		couchdb_session_invalidate_document (document->couchdb, document->dbname,
+						     couchdb_document_get_id (document));
+		couchdb_session_emit_document_deleted (document->couchdb, document->dbname,
+						       couchdb_document_get_id (document));
 	}
 
 	g_free (url);
@@ -254,6 +675,116 @@ couchdb_document_delete (CouchdbDocument *document, GError **error)
 	return result;
 }
 
+static void
+delete_finished_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+	CouchdbDocument *document;
+	GError *error = NULL;
+
+	document = COUCHDB_DOCUMENT (g_async_result_get_source_object (G_ASYNC_RESULT (result)));
+	if (couchdb_session_send_message_finish (COUCHDB_SESSION (source_object), res, &error)) {
+		couchdb_session_invalidate_document (document->couchdb, document->dbname,
+						     couchdb_document_get_id (document));
+		couchdb_session_emit_document_deleted (document->couchdb, document->dbname,
+						       couchdb_document_get_id (document));
+	} else {
+		g_simple_async_result_set_from_error (result, error);
+		g_error_free (error);
+	}
+
+	g_simple_async_result_complete (result);
+
+	g_object_unref (G_OBJECT (document));
+	g_object_unref (G_OBJECT (result));
+}
+
+/**
+ * couchdb_document_delete_async:
+ * @document: A #CouchdbDocument object
+ * @cancellable: A #GCancellable object, or NULL
+ * @callback: Function to call when the document has been deleted
+ * @user_data: Data to pass to @callback
+ *
+ * Asynchronous version of #couchdb_document_delete. When the operation
+ * finishes, @callback will be called, and it should then call
+ * #couchdb_document_delete_finish to get the result of the operation.
+ */
+void
+couchdb_document_delete_async (CouchdbDocument *document,
+			       GCancellable *cancellable,
+			       GAsyncReadyCallback callback,
+			       gpointer user_data)
+{
+	char *url;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+
+	result = g_simple_async_result_new (G_OBJECT (document), callback, user_data,
+					    couchdb_document_delete_async);
+
+	url = delete_url (document);
+	if (!url) {
+		g_simple_async_result_set_error (result, COUCHDB_ERROR, -1,
+						 "Document has no ID and/or revision");
+		g_simple_async_result_complete_in_idle (result);
+		g_object_unref (G_OBJECT (result));
+		return;
+	}
+
+	couchdb_session_send_message_async (document->couchdb, SOUP_METHOD_DELETE, url, NULL, NULL,
+					    cancellable, delete_finished_cb, result);
+
+	g_free (url);
+}
+
+/**
+ * couchdb_document_delete_finish:
+ * @document: A #CouchdbDocument object
+ * @result: A #GAsyncResult, as passed to the callback
+ * @error: Placeholder for error information
+ *
+ * Finish an operation started with #couchdb_document_delete_async.
+ *
+ * Return value: TRUE if successful, FALSE otherwise, in which case the error
+ * argument will contain information about the error.
+ */
+gboolean
+couchdb_document_delete_finish (CouchdbDocument *document, GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (document),
+							      couchdb_document_delete_async), FALSE);
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+/* Look up a field in a parsed document with a single hash lookup */
+static JsonNode *
+field_node (CouchdbDocument *document, const char *field)
+{
+	return json_object_get_member (json_node_get_object (document->root_node), field);
+}
+
+static JsonNode *
+key_node (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	JsonObject *object;
+	JsonNode *node;
+	guint i;
+
+	object = json_node_get_object (document->root_node);
+	for (i = 0; i < key->n_names - 1; i++) {
+		node = json_object_get_member (object, key->names[i]);
+		if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_OBJECT)
+			return NULL;
+		object = json_node_get_object (node);
+	}
+
+	return json_object_get_member (object, key->names[key->n_names - 1]);
+}
+
 /**
  * couchdb_document_get_id:
  * @document: A #CouchdbDocument object
@@ -267,6 +798,12 @@ couchdb_document_get_id (CouchdbDocument *document)
 {
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 
+	if (document->raw) {
+		RawValue *value = raw_member (document, "_id");
+
+		return value != NULL ? raw_value_get_string (value) : NULL;
+	}
+
 	if (document->root_node &&
 	    json_node_get_node_type (document->root_node) == JSON_NODE_OBJECT) {
 		if (json_object_has_member (json_node_get_object (document->root_node),
@@ -298,6 +835,9 @@ couchdb_document_set_id (CouchdbDocument *document, const char *id)
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (id != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_set_string_member (json_node_get_object (document->root_node),
 				       "_id",
 				       id);
@@ -322,6 +862,12 @@ couchdb_document_get_revision (CouchdbDocument *document)
 {
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 
+	if (document->raw) {
+		RawValue *value = raw_member (document, "_rev");
+
+		return value != NULL ? raw_value_get_string (value) : NULL;
+	}
+
 	if (document->root_node &&
 	    json_node_get_node_type (document->root_node) == JSON_NODE_OBJECT) {
 		return json_object_get_string_member (
@@ -347,6 +893,9 @@ couchdb_document_set_revision (CouchdbDocument *document, const char *revision)
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (revision != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_set_string_member (json_node_get_object (document->root_node),
 				       "_rev",
 				       revision);
@@ -364,11 +913,12 @@ couchdb_document_set_revision (CouchdbDocument *document, const char *revision)
 gboolean
 couchdb_document_has_field (CouchdbDocument *document, const char *field)
 {
-	JsonNode *node;
-
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
 	g_return_val_if_fail (field != NULL, FALSE);
 
+	if (document->raw)
+		return raw_member (document, field) != NULL;
+
 	return json_object_has_member (json_node_get_object (document->root_node), field);
 }
 
@@ -385,6 +935,9 @@ couchdb_document_remove_field (CouchdbDocument *document, const char *field)
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (field != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_remove_member (json_node_get_object (document->root_node), field);
 }
 
@@ -403,6 +956,11 @@ couchdb_document_get_array_field (CouchdbDocument *document, const char *field)
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (field != NULL, NULL);
 
+	/* The returned field is a live handle into the document, so the
+	   whole document needs to be parsed */
+	if (!materialize (document))
+		return NULL;
+
 	if (!json_object_has_member (json_node_get_object (document->root_node), field))
 		return NULL;
 
@@ -426,6 +984,9 @@ couchdb_document_set_array_field (CouchdbDocument *document, const char *field,
 	g_return_if_fail (field != NULL);
 	g_return_if_fail (value != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_set_array_member (json_node_get_object (document->root_node),
 				      field,
 				      json_array_ref (couchdb_array_field_get_json_array (value)));
@@ -443,14 +1004,22 @@ couchdb_document_set_array_field (CouchdbDocument *document, const char *field,
 gboolean
 couchdb_document_get_boolean_field (CouchdbDocument *document, const char *field)
 {
+	JsonNode *node;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
 	g_return_val_if_fail (field != NULL, FALSE);
 
-	if (!json_object_has_member (json_node_get_object (document->root_node), field))
+	if (document->raw) {
+		RawValue *value = raw_member (document, field);
+
+		return value != NULL ? raw_value_get_boolean (value) : FALSE;
+	}
+
+	node = field_node (document, field);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
 		return FALSE;
 
-	return json_object_get_boolean_member (json_node_get_object (document->root_node),
-					       field);
+	return json_node_get_boolean (node);
 }
 
 /**
@@ -467,6 +1036,9 @@ couchdb_document_set_boolean_field (CouchdbDocument *document, const char *field
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (field != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_set_boolean_member (json_node_get_object (document->root_node),
 					field,
 					value);
@@ -484,14 +1056,22 @@ couchdb_document_set_boolean_field (CouchdbDocument *document, const char *field
 gint
 couchdb_document_get_int_field (CouchdbDocument *document, const char *field)
 {
+	JsonNode *node;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), -1);
 	g_return_val_if_fail (field != NULL, -1);
 
-	if (!json_object_has_member (json_node_get_object (document->root_node), field))
+	if (document->raw) {
+		RawValue *value = raw_member (document, field);
+
+		return value != NULL ? (gint) raw_value_get_int (value) : 0;
+	}
+
+	node = field_node (document, field);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
 		return 0;
 
-	return json_object_get_int_member (json_node_get_object (document->root_node),
-					   field);
+	return json_node_get_int (node);
 }
 
 /**
@@ -508,6 +1088,9 @@ couchdb_document_set_int_field (CouchdbDocument *document, const char *field, gi
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (field != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_set_int_member (json_node_get_object (document->root_node),
 				    field,
 				    value);
@@ -525,13 +1108,22 @@ couchdb_document_set_int_field (CouchdbDocument *document, const char *field, gi
 gdouble
 couchdb_document_get_double_field (CouchdbDocument *document, const char *field)
 {
+	JsonNode *node;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), -1);
 	g_return_val_if_fail (field != NULL, -1);
 
-	if (!json_object_has_member (json_node_get_object (document->root_node), field))
+	if (document->raw) {
+		RawValue *value = raw_member (document, field);
+
+		return value != NULL ? raw_value_get_double (value) : 0.0;
+	}
+
+	node = field_node (document, field);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
 		return 0.0;
-	return json_object_get_double_member (json_node_get_object (document->root_node),
-					      field);
+
+	return json_node_get_double (node);
 }
 
 /**
@@ -548,6 +1140,9 @@ couchdb_document_set_double_field (CouchdbDocument *document, const char *field,
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (field != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_set_double_member (json_node_get_object (document->root_node),
 				       field,
 				       value);
@@ -565,14 +1160,22 @@ couchdb_document_set_double_field (CouchdbDocument *document, const char *field,
 const char *
 couchdb_document_get_string_field (CouchdbDocument *document, const char *field)
 {
+	JsonNode *node;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (field != NULL, NULL);
 
-	if (!json_object_has_member (json_node_get_object (document->root_node), field))
+	if (document->raw) {
+		RawValue *value = raw_member (document, field);
+
+		return value != NULL ? raw_value_get_string (value) : NULL;
+	}
+
+	node = field_node (document, field);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
 		return NULL;
 
-	return json_object_get_string_member (json_node_get_object (document->root_node),
-					      field);
+	return json_node_get_string (node);
 }
 
 /**
@@ -589,6 +1192,9 @@ couchdb_document_set_string_field (CouchdbDocument *document, const char *field,
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (field != NULL);
 
+	if (!materialize (document))
+		return;
+
 	if (value) {
 		json_object_set_string_member (json_node_get_object (document->root_node),
 					       field,
@@ -614,6 +1220,11 @@ couchdb_document_get_struct_field (CouchdbDocument *document, const char *field)
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (field != NULL, NULL);
 
+	/* The returned field is a live handle into the document, so the
+	   whole document needs to be parsed */
+	if (!materialize (document))
+		return NULL;
+
 	if (!json_object_has_member (json_node_get_object (document->root_node), field))
 		return NULL;
 
@@ -637,11 +1248,301 @@ couchdb_document_set_struct_field (CouchdbDocument *document, const char *field,
 	g_return_if_fail (field != NULL);
 	g_return_if_fail (value != NULL);
 
+	if (!materialize (document))
+		return;
+
 	json_object_set_object_member (json_node_get_object (document->root_node),
 				       field,
 				       json_object_ref (couchdb_struct_field_get_json_object (value)));
 }
 
+/* Get the object the field named by @key is in, creating the objects on the
+   path to it that don't exist yet. Returns NULL, rather than overwriting it,
+   if a member on the path exists but is not an object */
+static JsonObject *
+key_parent_object (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	JsonObject *object;
+	JsonNode *node;
+	guint i;
+
+	if (!materialize (document))
+		return NULL;
+
+	object = json_node_get_object (document->root_node);
+	for (i = 0; i < key->n_names - 1; i++) {
+		node = json_object_get_member (object, key->names[i]);
+		if (node == NULL) {
+			JsonObject *child = json_object_new ();
+
+			json_object_set_object_member (object, key->names[i], child);
+			object = child;
+		} else if (JSON_NODE_TYPE (node) == JSON_NODE_OBJECT) {
+			object = json_node_get_object (node);
+		} else {
+			g_warning ("Can't set field %s: %s is not an object", key->path, key->names[i]);
+			return NULL;
+		}
+	}
+
+	return object;
+}
+
+/**
+ * couchdb_document_has_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ *
+ * Check whether the given document has the field named by @key.
+ *
+ * Return value: TRUE if the field exists in the document, FALSE if not.
+ */
+gboolean
+couchdb_document_has_key (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	if (document->raw)
+		return raw_key_member (document, key) != NULL;
+
+	return key_node (document, key) != NULL;
+}
+
+/**
+ * couchdb_document_get_boolean_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ *
+ * Retrieve the value of a boolean field from the given document, like
+ * #couchdb_document_get_boolean_field, but by key, which can also name
+ * fields in nested objects.
+ *
+ * Return value: The value of the given boolean field.
+ */
+gboolean
+couchdb_document_get_boolean_by_key (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	JsonNode *node;
+
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
+	g_return_val_if_fail (key != NULL, FALSE);
+
+	if (document->raw) {
+		RawValue *value = raw_key_member (document, key);
+
+		return value != NULL ? raw_value_get_boolean (value) : FALSE;
+	}
+
+	node = key_node (document, key);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
+		return FALSE;
+
+	return json_node_get_boolean (node);
+}
+
+/**
+ * couchdb_document_set_boolean_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ * @value: Value to set the field to
+ *
+ * Set the value of a boolean field in the given document, by key. Objects on the
+ * path to the field are created if they don't exist. Nothing is changed if a
+ * member on the path exists but is not an object.
+ */
+void
+couchdb_document_set_boolean_by_key (CouchdbDocument *document, CouchdbFieldKey *key, gboolean value)
+{
+	JsonObject *object;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	g_return_if_fail (key != NULL);
+
+	object = key_parent_object (document, key);
+	if (object == NULL)
+		return;
+
+	json_object_set_boolean_member (object, key->names[key->n_names - 1], value);
+}
+
+/**
+ * couchdb_document_get_int_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ *
+ * Retrieve the value of a integer field from the given document, like
+ * #couchdb_document_get_int_field, but by key, which can also name
+ * fields in nested objects.
+ *
+ * Return value: The value of the given integer field.
+ */
+gint
+couchdb_document_get_int_by_key (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	JsonNode *node;
+
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), 0);
+	g_return_val_if_fail (key != NULL, 0);
+
+	if (document->raw) {
+		RawValue *value = raw_key_member (document, key);
+
+		return value != NULL ? (gint) raw_value_get_int (value) : 0;
+	}
+
+	node = key_node (document, key);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
+		return 0;
+
+	return json_node_get_int (node);
+}
+
+/**
+ * couchdb_document_set_int_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ * @value: Value to set the field to
+ *
+ * Set the value of a integer field in the given document, by key. Objects on the
+ * path to the field are created if they don't exist. Nothing is changed if a
+ * member on the path exists but is not an object.
+ */
+void
+couchdb_document_set_int_by_key (CouchdbDocument *document, CouchdbFieldKey *key, gint value)
+{
+	JsonObject *object;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	g_return_if_fail (key != NULL);
+
+	object = key_parent_object (document, key);
+	if (object == NULL)
+		return;
+
+	json_object_set_int_member (object, key->names[key->n_names - 1], value);
+}
+
+/**
+ * couchdb_document_get_double_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ *
+ * Retrieve the value of a decimal number field from the given document, like
+ * #couchdb_document_get_double_field, but by key, which can also name
+ * fields in nested objects.
+ *
+ * Return value: The value of the given decimal number field.
+ */
+gdouble
+couchdb_document_get_double_by_key (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	JsonNode *node;
+
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), 0.0);
+	g_return_val_if_fail (key != NULL, 0.0);
+
+	if (document->raw) {
+		RawValue *value = raw_key_member (document, key);
+
+		return value != NULL ? raw_value_get_double (value) : 0.0;
+	}
+
+	node = key_node (document, key);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
+		return 0.0;
+
+	return json_node_get_double (node);
+}
+
+/**
+ * couchdb_document_set_double_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ * @value: Value to set the field to
+ *
+ * Set the value of a decimal number field in the given document, by key. Objects on the
+ * path to the field are created if they don't exist. Nothing is changed if a
+ * member on the path exists but is not an object.
+ */
+void
+couchdb_document_set_double_by_key (CouchdbDocument *document, CouchdbFieldKey *key, gdouble value)
+{
+	JsonObject *object;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	g_return_if_fail (key != NULL);
+
+	object = key_parent_object (document, key);
+	if (object == NULL)
+		return;
+
+	json_object_set_double_member (object, key->names[key->n_names - 1], value);
+}
+
+/**
+ * couchdb_document_get_string_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ *
+ * Retrieve the value of a string field from the given document, like
+ * #couchdb_document_get_string_field, but by key, which can also name
+ * fields in nested objects.
+ *
+ * Return value: The value of the given string field.
+ */
+const char *
+couchdb_document_get_string_by_key (CouchdbDocument *document, CouchdbFieldKey *key)
+{
+	JsonNode *node;
+
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
+	g_return_val_if_fail (key != NULL, NULL);
+
+	if (document->raw) {
+		RawValue *value = raw_key_member (document, key);
+
+		return value != NULL ? raw_value_get_string (value) : NULL;
+	}
+
+	node = key_node (document, key);
+	if (node == NULL || JSON_NODE_TYPE (node) != JSON_NODE_VALUE)
+		return NULL;
+
+	return json_node_get_string (node);
+}
+
+/**
+ * couchdb_document_set_string_by_key:
+ * @document: A #CouchdbDocument object
+ * @key: A #CouchdbFieldKey, as returned by #couchdb_field_key_intern
+ * @value: Value to set the field to
+ *
+ * Set the value of a string field in the given document, by key. Objects on
+ * the path to the field are created if they don't exist, and a NULL @value
+ * removes the field. Nothing is changed if a member on the path exists but
+ * is not an object.
+ */
+void
+couchdb_document_set_string_by_key (CouchdbDocument *document, CouchdbFieldKey *key, const char *value)
+{
+	JsonObject *object;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	g_return_if_fail (key != NULL);
+
+	object = key_parent_object (document, key);
+	if (object == NULL)
+		return;
+
+	if (value) {
+		json_object_set_string_member (object, key->names[key->n_names - 1], value);
+	} else {
+		/* Remove field if it's a NULL value */
+		json_object_remove_member (object, key->names[key->n_names - 1]);
+	}
+}
+
 /**
  * couchdb_document_to_string:
  * @document: A #CouchdbDocument object
@@ -655,6 +1556,10 @@ couchdb_document_to_string (CouchdbDocument *document)
 {
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 
+	/* Unmodified documents are sent back as they were received */
+	if (document->raw)
+		return g_strndup (document->raw->data, document->raw->length);
+
 	if (document->root_node) {
 		JsonGenerator *generator;
 		char *str;
@@ -672,10 +1577,60 @@ couchdb_document_to_string (CouchdbDocument *document)
 	return NULL;
 }
 
+CouchdbDocument *
+couchdb_document_new_from_json_object (CouchdbSession *couchdb,
+				       const char *dbname,
+				       JsonObject *json_object)
+{
+	CouchdbDocument *document;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (json_object != NULL, NULL);
+
+	document = g_object_new (COUCHDB_TYPE_DOCUMENT, NULL);
+	document->couchdb = couchdb;
+	document->dbname = g_strdup (dbname);
+	document->root_node = json_node_new (JSON_NODE_OBJECT);
+	json_node_set_object (document->root_node, json_object);
+
+	return document;
+}
+
+/* Create a document from its JSON text, which is only parsed when needed */
+CouchdbDocument *
+couchdb_document_new_from_buffer (CouchdbSession *couchdb,
+				  const char *dbname,
+				  SoupBuffer *buffer)
+{
+	CouchdbDocument *document;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (buffer != NULL, NULL);
+
+	document = g_object_new (COUCHDB_TYPE_DOCUMENT, NULL);
+	document->couchdb = couchdb;
+	document->dbname = g_strdup (dbname);
+	document->raw = soup_buffer_copy (buffer);
+
+	return document;
+}
+
+void
+couchdb_document_set_dbname (CouchdbDocument *document, const char *dbname)
+{
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+
+	g_free (document->dbname);
+	document->dbname = g_strdup (dbname);
+}
+
 JsonObject *
 couchdb_document_get_json_object (CouchdbDocument *document)
 {
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
+
+	if (!materialize (document))
+		return NULL;
 	
 	return json_node_get_object (document->root_node);
 }
@@ -26,6 +26,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <json-glib/json-glib.h>
 #include "couchdb-types.h"
 #include "couchdb-array-field.h"
@@ -52,10 +53,34 @@ CouchdbDocument *couchdb_document_get (CouchdbSession  *couchdb,
 				       const char      *dbname,
 				       const char      *docid,
 				       GError          **error);
+void             couchdb_document_get_async (CouchdbSession      *couchdb,
+					     const char          *dbname,
+					     const char          *docid,
+					     GCancellable        *cancellable,
+					     GAsyncReadyCallback  callback,
+					     gpointer             user_data);
+CouchdbDocument *couchdb_document_get_finish (CouchdbSession *couchdb,
+					      GAsyncResult   *result,
+					      GError        **error);
 gboolean         couchdb_document_put (CouchdbDocument *document,
 				       const char      *dbname,
 				       GError **error);
+void             couchdb_document_put_async (CouchdbDocument     *document,
+					     const char          *dbname,
+					     GCancellable        *cancellable,
+					     GAsyncReadyCallback  callback,
+					     gpointer             user_data);
+gboolean         couchdb_document_put_finish (CouchdbDocument *document,
+					      GAsyncResult    *result,
+					      GError         **error);
 gboolean         couchdb_document_delete (CouchdbDocument *document, GError **error);
+void             couchdb_document_delete_async (CouchdbDocument     *document,
+						GCancellable        *cancellable,
+						GAsyncReadyCallback  callback,
+						gpointer             user_data);
+gboolean         couchdb_document_delete_finish (CouchdbDocument *document,
+						 GAsyncResult    *result,
+						 GError         **error);
 
 const char      *couchdb_document_get_id (CouchdbDocument *document);
 void             couchdb_document_set_id (CouchdbDocument *document, const char *id);
@@ -77,6 +102,16 @@ const char         *couchdb_document_get_string_field (CouchdbDocument *document
 void                couchdb_document_set_string_field (CouchdbDocument *document, const char *field, const char *value);
 CouchdbStructField *couchdb_document_get_struct_field (CouchdbDocument *document, const char *field);
 void                couchdb_document_set_struct_field (CouchdbDocument *document, const char *field, CouchdbStructField *value);
+
+gboolean            couchdb_document_has_key (CouchdbDocument *document, CouchdbFieldKey *key);
+gboolean            couchdb_document_get_boolean_by_key (CouchdbDocument *document, CouchdbFieldKey *key);
+void                couchdb_document_set_boolean_by_key (CouchdbDocument *document, CouchdbFieldKey *key, gboolean value);
+gint                couchdb_document_get_int_by_key (CouchdbDocument *document, CouchdbFieldKey *key);
+void                couchdb_document_set_int_by_key (CouchdbDocument *document, CouchdbFieldKey *key, gint value);
+gdouble             couchdb_document_get_double_by_key (CouchdbDocument *document, CouchdbFieldKey *key);
+void                couchdb_document_set_double_by_key (CouchdbDocument *document, CouchdbFieldKey *key, gdouble value);
+const char         *couchdb_document_get_string_by_key (CouchdbDocument *document, CouchdbFieldKey *key);
+void                couchdb_document_set_string_by_key (CouchdbDocument *document, CouchdbFieldKey *key, const char *value);
       
 char             *couchdb_document_to_string (CouchdbDocument *document);
 
@@ -0,0 +1,122 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "couchdb-field-key.h"
+#include "utils.h"
+
+/* Keys are never freed, like quarks */
+G_LOCK_DEFINE_STATIC (field_keys);
+static GHashTable *field_keys = NULL;
+
+/**
+ * couchdb_field_key_intern:
+ * @path: Name of a field, or path of a field in nested objects
+ *
+ * Get a handle for a document field, to be used with the _by_key field
+ * accessors of #CouchdbDocument, like #couchdb_document_get_string_by_key.
+ * Field names are only looked at here, so accessing fields by key is faster
+ * than by name, and keys can name fields in nested objects, by separating the
+ * names of the objects and of the field with '/', as in
+ * "application_annotations/Ubuntu One/private_application_annotations/deleted".
+ *
+ * Keys are interned, so the same key is returned for the same path, and they
+ * are never freed. They should be looked up once, and kept, by applications.
+ *
+ * Return value: The key for the given path, or NULL if @path is not valid.
+ */
+CouchdbFieldKey *
+couchdb_field_key_intern (const char *path)
+{
+	CouchdbFieldKey *key;
+
+	g_return_val_if_fail (path != NULL, NULL);
+
+	G_LOCK (field_keys);
+
+	if (field_keys == NULL)
+		field_keys = g_hash_table_new (g_str_hash, g_str_equal);
+
+	key = g_hash_table_lookup (field_keys, path);
+	if (key == NULL) {
+		char **names;
+		guint i;
+
+		names = g_strsplit (path, "/", -1);
+		for (i = 0; names[i] != NULL; i++) {
+			if (names[i][0] == '\0') {
+				G_UNLOCK (field_keys);
+				g_strfreev (names);
+				g_return_val_if_reached (NULL);
+			}
+		}
+
+		key = g_new0 (CouchdbFieldKey, 1);
+		key->path = g_intern_string (path);
+		key->n_names = i;
+		key->names = g_new (const char *, i);
+		for (i = 0; i < key->n_names; i++)
+			key->names[i] = g_intern_string (names[i]);
+		g_strfreev (names);
+
+		g_hash_table_insert (field_keys, (gpointer) key->path, key);
+	}
+
+	G_UNLOCK (field_keys);
+
+	return key;
+}
+
+/**
+ * couchdb_field_key_intern_static:
+ * @key: Location of a static #CouchdbFieldKey pointer, initialized to NULL
+ * @path: Name of a field, or path of a field in nested objects
+ *
+ * Convenience function to keep the key for @path in a static variable, so
+ * that it is only looked up the first time it is used.
+ *
+ * Return value: The key for the given path.
+ */
+CouchdbFieldKey *
+couchdb_field_key_intern_static (CouchdbFieldKey **key, const char *path)
+{
+	g_return_val_if_fail (key != NULL, NULL);
+
+	if (G_UNLIKELY (g_atomic_pointer_get ((gpointer *) key) == NULL))
+		g_atomic_pointer_set ((gpointer *) key, couchdb_field_key_intern (path));
+
+	return *key;
+}
+
+/**
+ * couchdb_field_key_get_path:
+ * @key: A #CouchdbFieldKey
+ *
+ * Get the path a key was created for.
+ *
+ * Return value: The path of the given key.
+ */
+const char *
+couchdb_field_key_get_path (CouchdbFieldKey *key)
+{
+	g_return_val_if_fail (key != NULL, NULL);
+
+	return key->path;
+}
@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __COUCHDB_FIELD_KEY_H__
+#define __COUCHDB_FIELD_KEY_H__
+
+#include <glib.h>
+#include "couchdb-types.h"
+
+G_BEGIN_DECLS
+
+CouchdbFieldKey *couchdb_field_key_intern (const char *path);
+CouchdbFieldKey *couchdb_field_key_intern_static (CouchdbFieldKey **key, const char *path);
+const char      *couchdb_field_key_get_path (CouchdbFieldKey *key);
+
+G_END_DECLS
+
+#endif /* __COUCHDB_FIELD_KEY_H__ */
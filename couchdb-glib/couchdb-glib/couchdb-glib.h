@@ -26,11 +26,14 @@
 
 #include <couchdb-types.h>
 #include <couchdb-array-field.h>
+#include <couchdb-bulk-result.h>
 #include <couchdb-credentials.h>
 #include <couchdb-database-info.h>
 #include <couchdb-document.h>
 #include <couchdb-document-info.h>
+#include <couchdb-field-key.h>
 #include <couchdb-session.h>
+#include <couchdb-stats.h>
 #include <couchdb-struct-field.h>
 
 #endif /* __COUCHDB_GLIB_H__ */
@@ -21,14 +21,20 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <libsoup/soup-form.h>
 #include <libsoup/soup-logger.h>
 #include <libsoup/soup-gnome.h>
 #include <libsoup/soup-message.h>
+#include <libsoup/soup-session-async.h>
+#include <libsoup/soup-uri.h>
 #include "couchdb-session.h"
 #include "couchdb-document.h"
 #include "couchdb-document-info.h"
 #include "couchdb-marshal.h"
 #include "dbwatch.h"
+#include "document-cache.h"
+#include "raw-object.h"
+#include "row-splitter.h"
 #include "utils.h"
 #include <string.h>
 #ifdef HAVE_OAUTH
@@ -39,11 +45,26 @@
 
 #define COUCHDB_SIGNAL_AUTHENTICATION_FAILED "authentication-failed"
 
+#define ASYNC_MAX_CONNS_PER_HOST 8
+
 struct _CouchdbSessionPrivate {
 	char *uri;
 	SoupSession *http_session;
-	GHashTable *db_watchlist;
+	SoupSession *async_session;
+	ChangesDispatcher *dispatcher;
 	CouchdbCredentials *credentials;
+	GMutex *cookie_lock;
+	char *session_cookie;
+	gboolean cookie_login_failed;
+	SoupSession *login_session;
+	SoupMessage *cookie_login_message;
+	GSList *held_messages;
+#ifdef HAVE_OAUTH
+	OAuthSigner *oauth_signer;
+#endif
+	DocumentCache *document_cache;
+	CouchdbSessionStats stats;
+	char *shared_key;
 };
 
 G_DEFINE_TYPE(CouchdbSession, couchdb_session, G_TYPE_OBJECT)
@@ -55,6 +76,9 @@ enum {
 	DOCUMENT_CREATED,
 	DOCUMENT_UPDATED,
 	DOCUMENT_DELETED,
+	REQUEST_STARTED,
+	REQUEST_FINISHED,
+	CHANGES_FEED_FAILED,
 	LAST_SIGNAL
 };
 static guint couchdb_session_signals[LAST_SIGNAL];
@@ -79,21 +103,66 @@ static gboolean _session_authenticate(SoupSession *session,
 				      SoupAuth *auth,
 				      gboolean retrying,
 				      gpointer couchdb);
+static void cookie_request_queued_cb (SoupSession *session,
+				      SoupMessage *http_message,
+				      gpointer user_data);
+static void cookie_request_started_cb (SoupSession *session,
+				       SoupMessage *http_message,
+				       SoupSocket *socket,
+				       gpointer user_data);
+static void release_held_messages (CouchdbSession *couchdb);
+static void queue_async_message (CouchdbSession *couchdb,
+				 SoupMessage *http_message,
+				 SoupSessionCallback callback,
+				 gpointer user_data);
+static void cancel_async_message (CouchdbSession *couchdb, SoupMessage *http_message);
+static gboolean send_message_stream_raw (CouchdbSession *couchdb,
+					 const char *method,
+					 const char *url,
+					 const char *body,
+					 RowSplitterRawFunc func,
+					 gpointer user_data,
+					 JsonParser *envelope,
+					 GError **error);
+
+
+static gboolean shared_session_unregister (CouchdbSession *couchdb);
+
+static void
+couchdb_session_dispose (GObject *object)
+{
+	/* A shared session looked up while the last reference was being
+	   dropped stays alive, so it must not be disposed */
+	if (!shared_session_unregister (COUCHDB_SESSION (object)))
+		return;
 
+	G_OBJECT_CLASS (couchdb_session_parent_class)->dispose (object);
+}
 
 static void
 couchdb_session_finalize (GObject *object)
 {
 	CouchdbSession *couchdb = COUCHDB_SESSION (object);
 
-	g_hash_table_destroy (couchdb->priv->db_watchlist);
+	changes_dispatcher_free (couchdb->priv->dispatcher);
+
+	if (couchdb->priv->document_cache != NULL)
+		document_cache_free (couchdb->priv->document_cache);
+
+	if (couchdb->priv->credentials)
+		couchdb_session_disable_authentication (couchdb);
 
 	g_free (couchdb->priv->uri);
 	g_object_unref (couchdb->priv->http_session);
 
-	if (couchdb->priv->credentials)
-		g_object_unref (G_OBJECT (couchdb->priv->credentials));
+	soup_session_abort (couchdb->priv->async_session);
+	g_object_unref (couchdb->priv->async_session);
+
+	if (couchdb->priv->login_session != NULL)
+		g_object_unref (couchdb->priv->login_session);
+	g_mutex_free (couchdb->priv->cookie_lock);
 
+	g_free (couchdb->priv->shared_key);
 	g_free (couchdb->priv);
 
 	G_OBJECT_CLASS (couchdb_session_parent_class)->finalize (object);
@@ -142,6 +211,7 @@ couchdb_session_class_init (CouchdbSessionClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+	object_class->dispose = couchdb_session_dispose;
 	object_class->finalize = couchdb_session_finalize;
 	object_class->set_property = couchdb_session_set_property;
 	object_class->get_property = couchdb_session_get_property;
@@ -167,7 +237,7 @@ couchdb_session_class_init (CouchdbSessionClass *klass)
 	couchdb_session_signals[DATABASE_CREATED] =
 		g_signal_new ("database_created",
 			      G_OBJECT_CLASS_TYPE (object_class),
-			      G_SIGNAL_RUN_LAST,
+			      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
 			      G_STRUCT_OFFSET (CouchdbSessionClass, database_created),
 			      NULL, NULL,
 			      g_cclosure_marshal_VOID__STRING,
@@ -176,7 +246,7 @@ couchdb_session_class_init (CouchdbSessionClass *klass)
 	couchdb_session_signals[DATABASE_DELETED] =
 		g_signal_new ("database_deleted",
 			      G_OBJECT_CLASS_TYPE (object_class),
-			      G_SIGNAL_RUN_LAST,
+			      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
 			      G_STRUCT_OFFSET (CouchdbSessionClass, database_deleted),
 			      NULL, NULL,
 			      g_cclosure_marshal_VOID__STRING,
@@ -185,7 +255,7 @@ couchdb_session_class_init (CouchdbSessionClass *klass)
 	couchdb_session_signals[DOCUMENT_CREATED] =
 		g_signal_new ("document_created",
 			      G_OBJECT_CLASS_TYPE (object_class),
-			      G_SIGNAL_RUN_LAST,
+			      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
 			      G_STRUCT_OFFSET (CouchdbSessionClass, document_created),
 			      NULL, NULL,
 			      _couchdb_marshal_VOID__STRING_OBJECT,
@@ -195,7 +265,7 @@ couchdb_session_class_init (CouchdbSessionClass *klass)
 	couchdb_session_signals[DOCUMENT_UPDATED] =
 		g_signal_new ("document_updated",
 			      G_OBJECT_CLASS_TYPE (object_class),
-			      G_SIGNAL_RUN_LAST,
+			      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
 			      G_STRUCT_OFFSET (CouchdbSessionClass, document_updated),
 			      NULL, NULL,
 			      _couchdb_marshal_VOID__STRING_OBJECT,
@@ -205,13 +275,42 @@ couchdb_session_class_init (CouchdbSessionClass *klass)
 	couchdb_session_signals[DOCUMENT_DELETED] =
 		g_signal_new ("document_deleted",
 			      G_OBJECT_CLASS_TYPE (object_class),
-			      G_SIGNAL_RUN_LAST,
+			      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
 			      G_STRUCT_OFFSET (CouchdbSessionClass, document_deleted),
 			      NULL, NULL,
 			      _couchdb_marshal_VOID__STRING_STRING,
 			      G_TYPE_NONE, 2,
 			      G_TYPE_STRING,
 			      G_TYPE_STRING);
+	couchdb_session_signals[REQUEST_STARTED] =
+		g_signal_new ("request-started",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (CouchdbSessionClass, request_started),
+			      NULL, NULL,
+			      _couchdb_marshal_VOID__STRING_STRING,
+			      G_TYPE_NONE, 2,
+			      G_TYPE_STRING,
+			      G_TYPE_STRING);
+	couchdb_session_signals[REQUEST_FINISHED] =
+		g_signal_new ("request-finished",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (CouchdbSessionClass, request_finished),
+			      NULL, NULL,
+			      _couchdb_marshal_VOID__STRING_POINTER,
+			      G_TYPE_NONE, 2,
+			      G_TYPE_STRING,
+			      G_TYPE_POINTER);
+	couchdb_session_signals[CHANGES_FEED_FAILED] =
+		g_signal_new ("changes-feed-failed",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (CouchdbSessionClass, changes_feed_failed),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__UINT,
+			      G_TYPE_NONE, 1,
+			      G_TYPE_UINT);
 }
 
 static void
@@ -219,9 +318,7 @@ couchdb_session_init (CouchdbSession *couchdb)
 {
 	couchdb->priv = g_new0 (CouchdbSessionPrivate, 1);
 
-	couchdb->priv->db_watchlist = g_hash_table_new_full (g_str_hash, g_str_equal,
-							     (GDestroyNotify) g_free,
-							     (GDestroyNotify) dbwatch_free);
+	couchdb->priv->dispatcher = changes_dispatcher_new (couchdb);
 	if (couchdb->priv->uri == NULL)
 		couchdb->priv->uri = g_strdup("http://127.0.0.1:5984");
 
@@ -229,7 +326,15 @@ couchdb_session_init (CouchdbSession *couchdb)
 		SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_GNOME_FEATURES_2_26,
                 NULL);
 
+	/* Asynchronous requests don't block the caller, so many of them can be
+	   in flight at the same time; allow more than the default 2 connections */
+	couchdb->priv->async_session = soup_session_async_new_with_options (
+		SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_GNOME_FEATURES_2_26,
+		SOUP_SESSION_MAX_CONNS_PER_HOST, ASYNC_MAX_CONNS_PER_HOST,
+		NULL);
+
 	couchdb->priv->credentials = NULL;
+	couchdb->priv->cookie_lock = g_mutex_new ();
 
 #ifdef DEBUG_MESSAGES
 	g_log_set_handler (NULL, G_LOG_LEVEL_DEBUG, debug_message, NULL);
@@ -254,6 +359,123 @@ couchdb_session_new (const char *uri)
 	return g_object_new (COUCHDB_TYPE_SESSION, "uri", uri, NULL);
 }
 
+/* Sessions shared by all users in the process, keyed by URI and credentials.
+   Keys are owned by the sessions */
+G_LOCK_DEFINE_STATIC (shared_sessions);
+static GHashTable *shared_sessions = NULL;
+
+/* Secrets are only part of the key as a digest, so that they aren't kept
+   around in memory */
+static char *
+shared_session_key (const char *uri, CouchdbCredentials *credentials)
+{
+	GString *secrets;
+	char *digest, *key;
+
+	if (credentials == NULL)
+		return g_strdup (uri);
+
+	secrets = g_string_new (NULL);
+	if (couchdb_credentials_get_auth_type (credentials) == COUCHDB_CREDENTIALS_TYPE_OAUTH) {
+		g_string_append_printf (secrets, "%s\n%s\n%s\n%s",
+					couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_CONSUMER_KEY),
+					couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_CONSUMER_SECRET),
+					couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_TOKEN_KEY),
+					couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_TOKEN_SECRET));
+	} else {
+		g_string_append_printf (secrets, "%s\n%s",
+					couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_USERNAME),
+					couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_PASSWORD));
+	}
+
+	digest = g_compute_checksum_for_string (G_CHECKSUM_SHA256, secrets->str, secrets->len);
+	key = g_strdup_printf ("%s\n%d\n%s", uri, couchdb_credentials_get_auth_type (credentials), digest);
+
+	memset (secrets->str, 0, secrets->len);
+	g_string_free (secrets, TRUE);
+	g_free (digest);
+
+	return key;
+}
+
+/* Returns FALSE if the session got a new reference from
+   couchdb_session_new_shared meanwhile, and so must stay registered */
+static gboolean
+shared_session_unregister (CouchdbSession *couchdb)
+{
+	if (couchdb->priv->shared_key == NULL)
+		return TRUE;
+
+	G_LOCK (shared_sessions);
+
+	if (g_atomic_int_get ((gint *) &G_OBJECT (couchdb)->ref_count) > 1) {
+		G_UNLOCK (shared_sessions);
+		return FALSE;
+	}
+
+	g_hash_table_remove (shared_sessions, couchdb->priv->shared_key);
+
+	G_UNLOCK (shared_sessions);
+
+	g_free (couchdb->priv->shared_key);
+	couchdb->priv->shared_key = NULL;
+
+	return TRUE;
+}
+
+/**
+ * couchdb_session_new_shared:
+ * @uri: URI of the CouchDB instance to connect to
+ * @credentials: Credentials to authenticate with, or NULL
+ *
+ * Get a #CouchdbSession object for the given CouchDB instance and credentials
+ * that is shared with all other callers in the process asking for the same
+ * ones. Sharing a session means sharing its connections, its document cache
+ * and its change feeds, so this should be preferred over #couchdb_session_new
+ * by components, like plugins, that are loaded many times in the same process.
+ *
+ * Since the session is shared, callers must not change its authentication
+ * settings or disconnect signal handlers they haven't connected themselves.
+ *
+ * Return value: A #CouchdbSession object, which should be unreferenced by
+ * calling g_object_unref once no longer needed.
+ */
+CouchdbSession *
+couchdb_session_new_shared (const char *uri, CouchdbCredentials *credentials)
+{
+	CouchdbSession *couchdb;
+	char *key;
+
+	if (!uri)
+		uri = "http://127.0.0.1:5984";
+
+	key = shared_session_key (uri, credentials);
+
+	G_LOCK (shared_sessions);
+
+	if (shared_sessions == NULL)
+		shared_sessions = g_hash_table_new (g_str_hash, g_str_equal);
+
+	/* Sessions are only removed from the table once their last reference is
+	   dropped, with the lock held, so the one found here is still alive */
+	couchdb = g_hash_table_lookup (shared_sessions, key);
+	if (couchdb != NULL) {
+		g_object_ref (G_OBJECT (couchdb));
+		g_free (key);
+	} else {
+		couchdb = couchdb_session_new (uri);
+		if (credentials != NULL)
+			couchdb_session_enable_authentication (couchdb, credentials);
+
+		couchdb->priv->shared_key = key;
+		g_hash_table_insert (shared_sessions, key, couchdb);
+	}
+
+	G_UNLOCK (shared_sessions);
+
+	return couchdb;
+}
+
 /**
  * couchdb_session_get_uri:
  * @couchdb: A #CouchdbSession object
@@ -394,7 +616,8 @@ couchdb_session_create_database (CouchdbSession *couchdb, const char *dbname, GE
 	g_free (url);
 
 	if (result)
-		g_signal_emit_by_name (couchdb, "database_created", dbname);
+		g_signal_emit (couchdb, couchdb_session_signals[DATABASE_CREATED],
+			       g_quark_from_string (dbname), dbname);
 
 	return result;
 }
@@ -435,10 +658,14 @@ couchdb_session_delete_database (CouchdbSession *couchdb, const char *dbname, GE
 
 	if (result) {
 		/* If we're listening for changes on this database, stop doing so */
-		if (g_hash_table_lookup (couchdb->priv->db_watchlist, dbname))
-			g_hash_table_remove (couchdb->priv->db_watchlist, dbname);
+		if (changes_dispatcher_has_database (couchdb->priv->dispatcher, dbname))
+			changes_dispatcher_remove_database (couchdb->priv->dispatcher, dbname);
 
-		g_signal_emit_by_name (couchdb, "database_deleted", dbname);
+		if (couchdb->priv->document_cache != NULL)
+			document_cache_remove_database (couchdb->priv->document_cache, dbname);
+
+		g_signal_emit (couchdb, couchdb_session_signals[DATABASE_DELETED],
+			       g_quark_from_string (dbname), dbname);
 	}
 
 	return result;
@@ -498,6 +725,39 @@ couchdb_session_free_database_list (GSList *dblist)
 	g_slist_free (dblist);
 }
 
+static GSList *
+document_list_from_parser (JsonParser *parser)
+{
+	JsonNode *root_node;
+	GSList *doclist = NULL;
+
+	root_node = json_parser_get_root (parser);
+	if (root_node && json_node_get_node_type (root_node) == JSON_NODE_OBJECT) {
+		JsonArray *rows;
+		gint i;
+
+		rows = json_object_get_array_member (
+			json_node_get_object (root_node), "rows");
+		for (i = 0; i < json_array_get_length (rows); i++) {
+			JsonObject *doc;
+			CouchdbDocumentInfo *doc_info;
+
+			doc = json_array_get_object_element (rows, i);
+			if (!doc)
+				continue;
+
+			doc_info = couchdb_document_info_new (
+				json_object_get_string_member (doc, "id"),
+				json_object_get_string_member (
+					json_object_get_object_member (doc, "value"),
+					"rev"));
+			doclist = g_slist_prepend (doclist, doc_info);
+		}
+	}
+
+	return g_slist_reverse (doclist);
+}
+
 /**
  * couchdb_session_list_documents:
  * @couchdb: A #CouchdbSession object
@@ -525,36 +785,108 @@ couchdb_session_list_documents (CouchdbSession *couchdb, const char *dbname, GEr
 
 	url = g_strdup_printf ("%s/%s/_all_docs", couchdb->priv->uri, dbname);
 	parser = json_parser_new ();
-	if (couchdb_session_send_message (couchdb, SOUP_METHOD_GET, url, NULL, parser, error)) {
-		JsonNode *root_node;
+	if (couchdb_session_send_message (couchdb, SOUP_METHOD_GET, url, NULL, parser, error))
+		doclist = document_list_from_parser (parser);
 
-		root_node = json_parser_get_root (parser);
-		if (json_node_get_node_type (root_node) == JSON_NODE_OBJECT) {
-			JsonArray *rows;
-			gint i;
+	g_object_unref (G_OBJECT (parser));
+	g_free (url);
 
-			rows = json_object_get_array_member (
-				json_node_get_object (root_node), "rows");
-			for (i = 0; i < json_array_get_length (rows); i++) {
-				JsonObject *doc;
-				CouchdbDocumentInfo *doc_info;
+	return doclist;
+}
 
-				doc = json_array_get_object_element (rows, i);
-				if (!doc)
-					continue;
+static void
+list_documents_finished_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+	JsonParser *parser;
+	GError *error = NULL;
 
-				doc_info = couchdb_document_info_new (
-					json_object_get_string_member (doc, "id"),
-					json_object_get_string_member (
-						json_object_get_object_member (doc, "value"),
-						"rev"));
-				doclist = g_slist_append (doclist, doc_info);
-			}
+	parser = JSON_PARSER (g_object_get_data (G_OBJECT (result), "parser"));
+	if (couchdb_session_send_message_finish (COUCHDB_SESSION (source_object), res, &error)) {
+		GSList *doclist;
+
+		doclist = document_list_from_parser (parser);
+		if (doclist != NULL) {
+			g_simple_async_result_set_op_res_gpointer (
+				result, doclist,
+				(GDestroyNotify) couchdb_session_free_document_list);
 		}
+	} else {
+		g_simple_async_result_set_from_error (result, error);
+		g_error_free (error);
 	}
 
-	g_object_unref (G_OBJECT (parser));
+	g_simple_async_result_complete (result);
+	g_object_unref (G_OBJECT (result));
+}
+
+/**
+ * couchdb_session_list_documents_async:
+ * @couchdb: A #CouchdbSession object
+ * @dbname: Name of the databases to retrieve documents from
+ * @cancellable: A #GCancellable object, or NULL
+ * @callback: Function to call when the list has been retrieved
+ * @user_data: Data to pass to @callback
+ *
+ * Asynchronous version of #couchdb_session_list_documents. When the operation
+ * finishes, @callback will be called, and it should then call
+ * #couchdb_session_list_documents_finish to get the result of the operation.
+ */
+void
+couchdb_session_list_documents_async (CouchdbSession *couchdb,
+				      const char *dbname,
+				      GCancellable *cancellable,
+				      GAsyncReadyCallback callback,
+				      gpointer user_data)
+{
+	char *url;
+	JsonParser *parser;
+	GSimpleAsyncResult *result;
+
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (dbname != NULL);
+
+	result = g_simple_async_result_new (G_OBJECT (couchdb), callback, user_data,
+					    couchdb_session_list_documents_async);
+
+	url = g_strdup_printf ("%s/%s/_all_docs", couchdb->priv->uri, dbname);
+	parser = json_parser_new ();
+	g_object_set_data_full (G_OBJECT (result), "parser", parser, g_object_unref);
+
+	couchdb_session_send_message_async (couchdb, SOUP_METHOD_GET, url, NULL, parser,
+					    cancellable, list_documents_finished_cb, result);
+
 	g_free (url);
+}
+
+/**
+ * couchdb_session_list_documents_finish:
+ * @couchdb: A #CouchdbSession object
+ * @result: A #GAsyncResult, as passed to the callback
+ * @error: Placeholder for error information
+ *
+ * Finish an operation started with #couchdb_session_list_documents_async.
+ *
+ * Return value: a list of #CouchdbDocumentInfo objects, as returned by
+ * #couchdb_session_list_documents, which should be freed by calling
+ * #couchdb_session_free_document_list.
+ */
+GSList *
+couchdb_session_list_documents_finish (CouchdbSession *couchdb, GAsyncResult *result, GError **error)
+{
+	GSimpleAsyncResult *simple;
+	GSList *doclist;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (couchdb),
+							      couchdb_session_list_documents_async), NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	doclist = g_slist_copy (g_simple_async_result_get_op_res_gpointer (simple));
+	g_slist_foreach (doclist, (GFunc) couchdb_document_info_ref, NULL);
 
 	return doclist;
 }
@@ -575,314 +907,2102 @@ couchdb_session_free_document_list (GSList *doclist)
 	g_slist_free (doclist);
 }
 
-/**
- * couchdb_session_listen_for_changes:
- * @couchdb: A #CouchdbSession object
- * @dbname: Name of the database to poll changes for
- *
- * Setup a listener to get information about changes done to a specific database. Please
- * note that changes done in the application using couchdb-glib will be notified
- * without the need of calling this function. But if the application wants to receive
- * notifications of changes done externally (by another application, or by any other
- * means, like replication with a remote database), it needs to call this function.
- *
- * For each change, one of the signals on the #CouchdbSession object will be emitted,
- * so applications just have to connect to those signals before calling this function.
- */
-void
-couchdb_session_listen_for_changes (CouchdbSession *couchdb, const char *dbname)
+/* Number of documents retrieved on each request by #couchdb_session_foreach_document */
+#define ALL_DOCUMENTS_PAGE_SIZE 500
+
+typedef struct {
+	CouchdbSession *couchdb;
+	const char *dbname;
+	CouchdbDocumentForeachFunc func;
+	gpointer user_data;
+	guint n_rows;
+	char *next_startkey;
+} ForeachDocumentData;
+
+/* Create a document from the "doc" member of a row, without parsing it */
+static CouchdbDocument *
+document_from_row (CouchdbSession *couchdb, const char *dbname, SoupBuffer *row, RawValue *doc)
 {
-	DBWatch *watch;
-	CouchdbDatabaseInfo *db_info;
-	GError *error = NULL;
+	SoupBuffer *buffer;
+	CouchdbDocument *document;
 
-	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
-	g_return_if_fail (dbname != NULL);
+	if (doc->data == NULL || doc->type != RAW_VALUE_OBJECT)
+		return NULL;
 
-	watch = g_hash_table_lookup (couchdb->priv->db_watchlist, dbname);
-	if (watch) {
-		g_warning ("Already listening for changes in '%s' database", dbname);
-		return;
-	}
+	/* The document keeps a reference on the block the row was copied to */
+	buffer = soup_buffer_new_subbuffer (row, doc->data - row->data, doc->length);
+	document = couchdb_document_new_from_buffer (couchdb, dbname, buffer);
+	soup_buffer_free (buffer);
 
-	/* Retrieve information for database, to know the last_update_sequence */
-	db_info = couchdb_session_get_database_info (couchdb, dbname, &error);
-	if (!db_info) {
-		g_warning ("Could not retrieve information for '%s' database: %s",
-			   dbname, error->message);
-		g_error_free (error);
+	return document;
+}
+
+static void
+foreach_document_row_cb (SoupBuffer *row, gpointer user_data)
+{
+	static const char * const names[] = { "id", "doc", NULL };
+	RawValue values[2];
+	CouchdbDocument *document;
+	ForeachDocumentData *data = (ForeachDocumentData *) user_data;
 
+	if (!raw_object_lookup (row->data, row->length, names, values))
 		return;
-	}
 
-	watch = dbwatch_new (couchdb,
-			     dbname,
-			     couchdb_database_info_get_update_sequence (db_info));
-	if (watch)
-		g_hash_table_insert (couchdb->priv->db_watchlist, g_strdup (dbname), watch);
+	/* The extra row is the first one of the next page */
+	if (++data->n_rows > ALL_DOCUMENTS_PAGE_SIZE) {
+		g_free (data->next_startkey);
+		data->next_startkey = g_strdup (raw_value_get_string (&values[0]));
+	} else {
+		document = document_from_row (data->couchdb, data->dbname, row, &values[1]);
+		if (document != NULL) {
+			data->func (document, data->user_data);
+			g_object_unref (G_OBJECT (document));
+		}
+	}
 
-	/* Free memory */
-	couchdb_database_info_unref (db_info);
+	raw_value_clear (&values[0]);
 }
 
 /**
- * couchdb_session_enable_authentication:
+ * couchdb_session_foreach_document:
  * @couchdb: A #CouchdbSession object
- * @credentials: A #CouchdbCredentials object
+ * @dbname: Name of the database to retrieve documents from
+ * @func: Function to call for each document
+ * @user_data: Data to pass to @func
+ * @error: Placeholder for error information
  *
- * Enables authentication for the given #CouchdbSession object. The authentication
- * mechanism should be specificied when creating the #CouchdbCredentials object.
+ * Retrieve all documents from a database, calling @func for each of them.
+ * Documents are retrieved, with their contents, in pages of a fixed size
+ * from the database's _all_docs view, and each page is parsed as it arrives,
+ * so that memory usage does not depend on the number of documents in the
+ * database. The #CouchdbDocument object passed to @func is only valid during
+ * the call, so it should be referenced if it is to be kept.
+ *
+ * Return value: TRUE if successful, FALSE otherwise, in which case the error
+ * argument will contain information about the error. Note that @func might
+ * have already been called for some documents when an error happens.
  */
-void
-couchdb_session_enable_authentication (CouchdbSession *couchdb,
-				       CouchdbCredentials *credentials)
+gboolean
+couchdb_session_foreach_document (CouchdbSession *couchdb,
+				  const char *dbname,
+				  CouchdbDocumentForeachFunc func,
+				  gpointer user_data,
+				  GError **error)
 {
-	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	ForeachDocumentData data = { 0, };
+	gboolean result = TRUE;
 
-	if (couchdb->priv->credentials)
-		g_object_unref (G_OBJECT (couchdb->priv->credentials));
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
+	g_return_val_if_fail (dbname != NULL, FALSE);
+	g_return_val_if_fail (func != NULL, FALSE);
+
+	data.couchdb = couchdb;
+	data.dbname = dbname;
+	data.func = func;
+	data.user_data = user_data;
+
+	do {
+		char *url;
+
+		/* Ask for one more row than we need, to know where the next page starts */
+		if (data.next_startkey != NULL) {
+			char *encoded_key = soup_uri_encode (data.next_startkey, "&+=");
+
+			url = g_strdup_printf ("%s/%s/_all_docs?include_docs=true&limit=%d&startkey_docid=%s",
+					       couchdb->priv->uri, dbname,
+					       ALL_DOCUMENTS_PAGE_SIZE + 1, encoded_key);
+			g_free (encoded_key);
+			g_free (data.next_startkey);
+			data.next_startkey = NULL;
+		} else {
+			url = g_strdup_printf ("%s/%s/_all_docs?include_docs=true&limit=%d",
+					       couchdb->priv->uri, dbname,
+					       ALL_DOCUMENTS_PAGE_SIZE + 1);
+		}
 
-	couchdb->priv->credentials = COUCHDB_CREDENTIALS (g_object_ref (G_OBJECT (credentials)));
-	if (couchdb_credentials_get_auth_type (couchdb->priv->credentials) == COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD) {
-		g_signal_connect (couchdb->priv->http_session,
-				  "authenticate",
-				  G_CALLBACK (_session_authenticate),
-				  couchdb);
-	}
+		data.n_rows = 0;
+		result = send_message_stream_raw (couchdb, SOUP_METHOD_GET, url, NULL,
+						  foreach_document_row_cb, &data,
+						  NULL, error);
+		g_free (url);
+	} while (result && data.next_startkey != NULL);
+
+	g_free (data.next_startkey);
+
+	return result;
+}
+
+static void
+add_document_to_list (CouchdbDocument *document, gpointer user_data)
+{
+	GSList **documents = (GSList **) user_data;
+
+	*documents = g_slist_prepend (*documents, g_object_ref (G_OBJECT (document)));
 }
 
 /**
- * couchdb_session_disable_authentication:
+ * couchdb_session_get_all_documents:
  * @couchdb: A #CouchdbSession object
+ * @dbname: Name of the database to retrieve documents from
+ * @error: Placeholder for error information
  *
- * Disables authentication for the given #CouchdbSession object.
+ * Retrieve all documents, with their contents, from a database. This is
+ * much faster than calling #couchdb_document_get for each of the documents
+ * returned by #couchdb_session_list_documents, since documents are retrieved
+ * in big batches. If the database is big, #couchdb_session_foreach_document
+ * should be used instead, to avoid keeping all documents in memory.
+ *
+ * Return value: A list of #CouchdbDocument objects, or NULL if there are no
+ * documents or if there was an error, in which case the error argument will
+ * contain information about the error. Once no longer needed, the list should
+ * be freed by calling #couchdb_session_free_documents.
  */
-void
-couchdb_session_disable_authentication (CouchdbSession *couchdb)
+GSList *
+couchdb_session_get_all_documents (CouchdbSession *couchdb, const char *dbname, GError **error)
 {
-	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	GSList *documents = NULL;
 
-	if (couchdb_credentials_get_auth_type (couchdb->priv->credentials) == COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD) {
-		g_signal_handlers_disconnect_by_func (couchdb->priv->http_session,
-						      G_CALLBACK (_session_authenticate),
-						      couchdb);
-	}
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (dbname != NULL, NULL);
+
+	if (!couchdb_session_foreach_document (couchdb, dbname, add_document_to_list, &documents, error)) {
+		if (documents != NULL)
+			couchdb_session_free_documents (documents);
 
-	if (couchdb->priv->credentials) {
-		g_object_unref (G_OBJECT (couchdb->priv->credentials));
-		couchdb->priv->credentials = NULL;
+		return NULL;
 	}
+
+	return g_slist_reverse (documents);
 }
 
 /**
- * couchdb_session_is_authentication_enabled:
- * @couchdb: A #CouchdbSession object
- *
- * Gets whether the given #CouchdbSession object has authentication enabled.
+ * couchdb_session_free_documents:
+ * @documents: A list of #CouchdbDocument objects, as returned by
+ * #couchdb_session_get_all_documents
  *
- * Return value: TRUE if authentication is enabled, FALSE otherwise.
+ * Free the list of documents returned by #couchdb_session_get_all_documents
+ * or #couchdb_session_get_documents_by_id.
  */
-gboolean
-couchdb_session_is_authentication_enabled (CouchdbSession *couchdb)
+void
+couchdb_session_free_documents (GSList *documents)
 {
-	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
-	
-	return couchdb->priv->credentials != NULL;
+	g_return_if_fail (documents != NULL);
+
+	g_slist_foreach (documents, (GFunc) g_object_unref, NULL);
+	g_slist_free (documents);
 }
 
-static gboolean
-_session_authenticate(SoupSession *session, SoupMessage *msg,
-		      SoupAuth *auth, gboolean retrying,
-		      gpointer callback_data)
+static char *
+document_keys_to_string (GSList *docids)
 {
-	CouchdbSession *couchdb;
+	JsonObject *object;
+	JsonArray *keys;
+	JsonNode *root_node;
+	JsonGenerator *generator;
+	GSList *sl;
+	char *str;
 
-	g_return_val_if_fail (COUCHDB_IS_SESSION (callback_data), FALSE);
+	keys = json_array_sized_new (g_slist_length (docids));
+	for (sl = docids; sl != NULL; sl = sl->next)
+		json_array_add_string_element (keys, (const char *) sl->data);
 
-	couchdb = COUCHDB_SESSION (callback_data);
+	object = json_object_new ();
+	json_object_set_array_member (object, "keys", keys);
 
-	if (retrying) {
-		g_signal_emit_by_name (couchdb, COUCHDB_SIGNAL_AUTHENTICATION_FAILED, NULL);
+	root_node = json_node_new (JSON_NODE_OBJECT);
+	json_node_take_object (root_node, object);
+
+	generator = json_generator_new ();
+	json_generator_set_root (generator, root_node);
+	str = json_generator_to_data (generator, NULL);
+
+	g_object_unref (G_OBJECT (generator));
+	json_node_free (root_node);
+
+	return str;
+}
+
+typedef struct {
+	CouchdbSession *couchdb;
+	const char *dbname;
+	GSList *documents;
+} GetDocumentsData;
+
+static void
+get_documents_row_cb (SoupBuffer *row, gpointer user_data)
+{
+	static const char * const names[] = { "error", "doc", NULL };
+	RawValue values[2];
+	CouchdbDocument *document;
+	GetDocumentsData *data = (GetDocumentsData *) user_data;
+
+	if (!raw_object_lookup (row->data, row->length, names, values))
+		return;
+
+	/* Missing and deleted documents come back with an error or a null doc */
+	if (values[0].data == NULL) {
+		document = document_from_row (data->couchdb, data->dbname, row, &values[1]);
+		if (document != NULL)
+			data->documents = g_slist_prepend (data->documents, document);
+	}
+}
+
+/**
+ * couchdb_session_get_documents_by_id:
+ * @couchdb: A #CouchdbSession object
+ * @dbname: Name of the database to retrieve documents from
+ * @docids: List of the IDs of the documents to retrieve
+ * @error: Placeholder for error information
+ *
+ * Retrieve a set of documents, with their contents, from a database with a
+ * single request, by posting their IDs to the database's _all_docs view.
+ * This is much faster than calling #couchdb_document_get for each of them,
+ * and, together with #couchdb_session_put_documents, allows modifying or
+ * deleting many documents in just two round trips.
+ *
+ * Return value: A list of #CouchdbDocument objects, in the same order as in
+ * @docids, or NULL if none of them was found or if there was an error, in
+ * which case the error argument will contain information about the error.
+ * Documents that don't exist, or have been deleted, are not included in the
+ * list. Once no longer needed, the list should be freed by calling
+ * #couchdb_session_free_documents.
+ */
+GSList *
+couchdb_session_get_documents_by_id (CouchdbSession *couchdb,
+				     const char *dbname,
+				     GSList *docids,
+				     GError **error)
+{
+	GetDocumentsData data;
+	char *url, *body;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (dbname != NULL, NULL);
+
+	if (docids == NULL)
+		return NULL;
+
+	data.couchdb = couchdb;
+	data.dbname = dbname;
+	data.documents = NULL;
+
+	url = g_strdup_printf ("%s/%s/_all_docs?include_docs=true", couchdb->priv->uri, dbname);
+	body = document_keys_to_string (docids);
+
+	if (!send_message_stream_raw (couchdb, SOUP_METHOD_POST, url, body,
+				      get_documents_row_cb, &data,
+				      NULL, error)) {
+		if (data.documents != NULL)
+			couchdb_session_free_documents (data.documents);
+		data.documents = NULL;
+	}
+
+	/* Free memory */
+	g_free (body);
+	g_free (url);
+
+	return g_slist_reverse (data.documents);
+}
+
+typedef struct {
+	CouchdbSession *couchdb;
+	const char *dbname;
+	CouchdbChangeFunc func;
+	gpointer user_data;
+} ForeachChangeData;
+
+static void
+foreach_change_row_cb (SoupBuffer *row, gpointer user_data)
+{
+	static const char * const names[] = { "id", "deleted", "doc", NULL };
+	RawValue values[3];
+	CouchdbDocument *document = NULL;
+	ForeachChangeData *data = (ForeachChangeData *) user_data;
+
+	if (!raw_object_lookup (row->data, row->length, names, values))
+		return;
+
+	if (raw_value_get_string (&values[0]) != NULL) {
+		if (!raw_value_get_boolean (&values[1]))
+			document = document_from_row (data->couchdb, data->dbname, row, &values[2]);
+
+		data->func (raw_value_get_string (&values[0]), document, data->user_data);
+
+		if (document != NULL)
+			g_object_unref (G_OBJECT (document));
+	}
+
+	raw_value_clear (&values[0]);
+}
+
+/**
+ * couchdb_session_foreach_change:
+ * @couchdb: A #CouchdbSession object
+ * @dbname: Name of the database to retrieve changes from
+ * @since: Update sequence to retrieve changes after
+ * @func: Function to call for each changed document
+ * @user_data: Data to pass to @func
+ * @last_sequence: Placeholder for the update sequence of the last change, or NULL
+ * @error: Placeholder for error information
+ *
+ * Retrieve the documents changed in a database after the @since update
+ * sequence, calling @func for each of them, with the document's contents,
+ * or with a NULL #CouchdbDocument if the document has been deleted. This
+ * allows applications keeping a copy of a database to bring it up to date
+ * by applying only what changed since they last saw it.
+ *
+ * Return value: TRUE if successful, FALSE otherwise, in which case the error
+ * argument will contain information about the error.
+ */
+gboolean
+couchdb_session_foreach_change (CouchdbSession *couchdb,
+				const char *dbname,
+				gint since,
+				CouchdbChangeFunc func,
+				gpointer user_data,
+				gint *last_sequence,
+				GError **error)
+{
+	ForeachChangeData data;
+	JsonParser *envelope;
+	char *url;
+	gboolean result;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
+	g_return_val_if_fail (dbname != NULL, FALSE);
+	g_return_val_if_fail (func != NULL, FALSE);
+
+	data.couchdb = couchdb;
+	data.dbname = dbname;
+	data.func = func;
+	data.user_data = user_data;
+
+	url = g_strdup_printf ("%s/%s/_changes?include_docs=true&since=%d",
+			       couchdb->priv->uri, dbname, since);
+	envelope = json_parser_new ();
+	result = send_message_stream_raw (couchdb, SOUP_METHOD_GET, url, NULL,
+					  foreach_change_row_cb, &data,
+					  envelope, error);
+	if (result && last_sequence != NULL) {
+		JsonNode *root = json_parser_get_root (envelope);
+
+		if (root != NULL && json_node_get_node_type (root) == JSON_NODE_OBJECT
+		    && json_object_has_member (json_node_get_object (root), "last_seq"))
+			*last_sequence = json_object_get_int_member (json_node_get_object (root), "last_seq");
+		else
+			*last_sequence = since;
+	}
+
+	g_object_unref (G_OBJECT (envelope));
+	g_free (url);
+
+	return result;
+}
+
+typedef struct {
+	GPtrArray *documents;
+	CouchdbBulkFlags flags;
+} BulkBody;
+
+/* Documents are written one after the other, so the whole request is never
+   built in memory first, and unmodified documents are not even copied */
+static void
+write_bulk_documents (BodyWriter *writer, gpointer user_data)
+{
+	BulkBody *bulk = (BulkBody *) user_data;
+	guint i;
+
+	body_writer_append (writer, "{", 1);
+	if (bulk->flags & COUCHDB_BULK_FLAGS_ALL_OR_NOTHING)
+		body_writer_append (writer, "\"all_or_nothing\":true,", 22);
+	body_writer_append (writer, "\"docs\":[", 8);
+
+	for (i = 0; i < bulk->documents->len; i++) {
+		if (i > 0)
+			body_writer_append (writer, ",", 1);
+		couchdb_document_write (g_ptr_array_index (bulk->documents, i), writer);
+	}
+
+	body_writer_append (writer, "]}", 2);
+}
+
+/**
+ * couchdb_session_put_documents:
+ * @couchdb: A #CouchdbSession object
+ * @dbname: Name of the database where the documents will be stored
+ * @documents: Array of #CouchdbDocument objects to store
+ * @flags: Flags for the bulk operation
+ * @error: Placeholder for error information
+ *
+ * Store a set of documents on a CouchDB database with a single request, by
+ * using CouchDB's _bulk_docs API. This is much faster than calling
+ * #couchdb_document_put for each document when many documents need to be stored.
+ *
+ * As with #couchdb_document_put, every successfully stored #CouchdbDocument
+ * object is updated with its unique ID and new revision. Documents with the
+ * "_deleted" field set to TRUE are removed from the database.
+ *
+ * If @flags contains %COUCHDB_BULK_FLAGS_ALL_OR_NOTHING, either all the
+ * documents are stored or none of them is.
+ *
+ * Return value: A list of #CouchdbBulkResult objects, one for each document,
+ * in the same order as in @documents, or NULL if the request failed, in which
+ * case the error argument will contain information about the error. Once no
+ * longer needed, the list should be freed by calling #couchdb_session_free_bulk_results.
+ */
+GSList *
+couchdb_session_put_documents (CouchdbSession *couchdb,
+			       const char *dbname,
+			       GPtrArray *documents,
+			       CouchdbBulkFlags flags,
+			       GError **error)
+{
+	char *url;
+	JsonParser *parser;
+	BulkBody bulk;
+	GSList *results = NULL;
+	guint i;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (dbname != NULL, NULL);
+	g_return_val_if_fail (documents != NULL, NULL);
+
+	if (documents->len == 0)
+		return NULL;
+
+	for (i = 0; i < documents->len; i++) {
+		if (!couchdb_document_check_valid (g_ptr_array_index (documents, i), error))
+			return NULL;
+	}
+
+	url = g_strdup_printf ("%s/%s/_bulk_docs", couchdb->priv->uri, dbname);
+	bulk.documents = documents;
+	bulk.flags = flags;
+	parser = json_parser_new ();
+
+	if (couchdb_session_send_message_with_body (couchdb, SOUP_METHOD_POST, url,
+						    write_bulk_documents, &bulk, parser, error)) {
+		JsonNode *root_node;
+
+		root_node = json_parser_get_root (parser);
+		if (root_node && json_node_get_node_type (root_node) == JSON_NODE_ARRAY) {
+			JsonArray *rows;
+			GSList *sl;
+			gboolean *is_new = g_new0 (gboolean, documents->len);
+
+			rows = json_node_get_array (root_node);
+			for (i = 0; i < documents->len; i++) {
+				JsonNode *row_node = NULL;
+				JsonObject *row;
+				CouchdbDocument *document = g_ptr_array_index (documents, i);
+
+				if (i < json_array_get_length (rows))
+					row_node = json_array_get_element (rows, i);
+
+				/* Results are paired with the documents by position, so
+				   there must be one for every document */
+				if (row_node == NULL || JSON_NODE_TYPE (row_node) != JSON_NODE_OBJECT) {
+					results = g_slist_prepend (results, couchdb_bulk_result_new (
+						couchdb_document_get_id (document),
+						NULL,
+						"invalid_response",
+						"Missing or malformed row in the _bulk_docs response"));
+					continue;
+				}
+				row = json_node_get_object (row_node);
+
+				if (json_object_has_member (row, "error")) {
+					results = g_slist_prepend (results, couchdb_bulk_result_new (
+						json_object_get_string_member (row, "id"),
+						NULL,
+						json_object_get_string_member (row, "error"),
+						json_object_has_member (row, "reason") ?
+						json_object_get_string_member (row, "reason") : NULL));
+					continue;
+				}
+
+				is_new[i] = couchdb_document_get_revision (document) == NULL;
+
+				couchdb_document_set_id (document, json_object_get_string_member (row, "id"));
+				couchdb_document_set_revision (document, json_object_get_string_member (row, "rev"));
+				couchdb_document_set_dbname (document, dbname);
+				couchdb_session_invalidate_document (couchdb, dbname, couchdb_document_get_id (document));
+
+				results = g_slist_prepend (results, couchdb_bulk_result_new (
+					json_object_get_string_member (row, "id"),
+					json_object_get_string_member (row, "rev"),
+					NULL, NULL));
+			}
+
+			results = g_slist_reverse (results);
+
+			/* Notify listeners, now that the whole batch has been stored */
+			for (sl = results, i = 0; sl != NULL; sl = sl->next, i++) {
+				CouchdbDocument *document = g_ptr_array_index (documents, i);
+
+				if (!couchdb_bulk_result_is_ok ((CouchdbBulkResult *) sl->data))
+					continue;
+
+				if (couchdb_document_get_boolean_field (document, "_deleted"))
+					couchdb_session_emit_document_deleted (couchdb, dbname,
+									       couchdb_document_get_id (document));
+				else if (is_new[i])
+					couchdb_session_emit_document_created (couchdb, dbname, document);
+				else
+					couchdb_session_emit_document_updated (couchdb, dbname, document);
+			}
+
+			g_free (is_new);
+		}
+	}
+
+	/* Free memory */
+	g_object_unref (G_OBJECT (parser));
+	g_free (url);
+
+	return results;
+}
+
+/**
+ * couchdb_session_free_bulk_results:
+ * @results: A list of #CouchdbBulkResult objects, as returned by
+ * #couchdb_session_put_documents
+ *
+ * Free the list of results returned by #couchdb_session_put_documents.
+ */
+void
+couchdb_session_free_bulk_results (GSList *results)
+{
+	g_return_if_fail (results != NULL);
+
+	g_slist_foreach (results, (GFunc) couchdb_bulk_result_unref, NULL);
+	g_slist_free (results);
+}
+
+/**
+ * couchdb_session_listen_for_changes:
+ * @couchdb: A #CouchdbSession object
+ * @dbname: Name of the database to poll changes for
+ *
+ * Setup a listener to get information about changes done to a specific database. Please
+ * note that changes done in the application using couchdb-glib will be notified
+ * without the need of calling this function. But if the application wants to receive
+ * notifications of changes done externally (by another application, or by any other
+ * means, like replication with a remote database), it needs to call this function.
+ *
+ * For each change, one of the signals on the #CouchdbSession object will be emitted,
+ * so applications just have to connect to those signals before calling this function.
+ * Signals are emitted with the database name as detail, so connecting to, for
+ * instance, "document_updated::contacts" only notifies changes to the contacts
+ * database.
+ *
+ * All databases listened to on a session share a single change dispatcher. When
+ * the server provides it, a single _db_updates feed is used to know which
+ * databases changed, and only those are asked for their changes. Otherwise, a
+ * continuous _changes feed is kept open for each database.
+ */
+void
+couchdb_session_listen_for_changes (CouchdbSession *couchdb, const char *dbname)
+{
+	CouchdbDatabaseInfo *db_info;
+	GError *error = NULL;
+
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (dbname != NULL);
+
+	/* Shared sessions are likely to be asked more than once */
+	if (changes_dispatcher_has_database (couchdb->priv->dispatcher, dbname)) {
+		g_debug ("Already listening for changes in '%s' database", dbname);
+		return;
+	}
+
+	/* Retrieve information for database, to know the last_update_sequence */
+	db_info = couchdb_session_get_database_info (couchdb, dbname, &error);
+	if (!db_info) {
+		g_warning ("Could not retrieve information for '%s' database: %s",
+			   dbname, error->message);
+		g_error_free (error);
+
+		return;
+	}
+
+	changes_dispatcher_add_database (couchdb->priv->dispatcher,
+					 dbname,
+					 couchdb_database_info_get_update_sequence (db_info));
+
+	/* Free memory */
+	couchdb_database_info_unref (db_info);
+}
+
+/* Session used to log in while the synchronous one is busy, going through
+   the same proxy, and trusting the same certificates, as it */
+static SoupSession *
+new_login_session (CouchdbSession *couchdb)
+{
+	SoupSession *login_session;
+	SoupURI *proxy_uri = NULL;
+	char *ssl_ca_file = NULL;
+	guint timeout = 0;
+
+	g_object_get (G_OBJECT (couchdb->priv->http_session),
+		      SOUP_SESSION_PROXY_URI, &proxy_uri,
+		      SOUP_SESSION_SSL_CA_FILE, &ssl_ca_file,
+		      SOUP_SESSION_TIMEOUT, &timeout,
+		      NULL);
+
+	login_session = soup_session_sync_new_with_options (
+		SOUP_SESSION_ADD_FEATURE_BY_TYPE, SOUP_TYPE_GNOME_FEATURES_2_26,
+		SOUP_SESSION_PROXY_URI, proxy_uri,
+		SOUP_SESSION_SSL_CA_FILE, ssl_ca_file,
+		SOUP_SESSION_TIMEOUT, timeout,
+		NULL);
+
+	if (proxy_uri != NULL)
+		soup_uri_free (proxy_uri);
+	g_free (ssl_ca_file);
+
+	return login_session;
+}
+
+/**
+ * couchdb_session_enable_authentication:
+ * @couchdb: A #CouchdbSession object
+ * @credentials: A #CouchdbCredentials object
+ *
+ * Enables authentication for the given #CouchdbSession object. The authentication
+ * mechanism should be specificied when creating the #CouchdbCredentials object.
+ *
+ * With session cookie credentials, if the server refuses them, logging in is
+ * not tried again until authentication is enabled with new credentials.
+ */
+void
+couchdb_session_enable_authentication (CouchdbSession *couchdb,
+				       CouchdbCredentials *credentials)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+
+	if (couchdb->priv->credentials)
+		couchdb_session_disable_authentication (couchdb);
+
+	couchdb->priv->credentials = COUCHDB_CREDENTIALS (g_object_ref (G_OBJECT (credentials)));
+	switch (couchdb_credentials_get_auth_type (couchdb->priv->credentials)) {
+	case COUCHDB_CREDENTIALS_TYPE_OAUTH:
+#ifdef HAVE_OAUTH
+		/* Keys are escaped and hashed once, not for every request */
+		couchdb->priv->oauth_signer = oauth_signer_new (
+			couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_CONSUMER_KEY),
+			couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_CONSUMER_SECRET),
+			couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_TOKEN_KEY),
+			couchdb_credentials_get_item (credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_TOKEN_SECRET));
+#endif
+		break;
+	case COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD:
+		g_signal_connect (couchdb->priv->http_session,
+				  "authenticate",
+				  G_CALLBACK (_session_authenticate),
+				  couchdb);
+		g_signal_connect (couchdb->priv->async_session,
+				  "authenticate",
+				  G_CALLBACK (_session_authenticate),
+				  couchdb);
+		break;
+	case COUCHDB_CREDENTIALS_TYPE_SESSION_COOKIE:
+		if (couchdb->priv->login_session == NULL)
+			couchdb->priv->login_session = new_login_session (couchdb);
+
+		/* We log in when the first request is sent */
+		g_signal_connect (couchdb->priv->http_session, "request-queued",
+				  G_CALLBACK (cookie_request_queued_cb), couchdb);
+		g_signal_connect (couchdb->priv->http_session, "request-started",
+				  G_CALLBACK (cookie_request_started_cb), couchdb);
+		g_signal_connect (couchdb->priv->async_session, "request-queued",
+				  G_CALLBACK (cookie_request_queued_cb), couchdb);
+		g_signal_connect (couchdb->priv->async_session, "request-started",
+				  G_CALLBACK (cookie_request_started_cb), couchdb);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * couchdb_session_disable_authentication:
+ * @couchdb: A #CouchdbSession object
+ *
+ * Disables authentication for the given #CouchdbSession object.
+ */
+void
+couchdb_session_disable_authentication (CouchdbSession *couchdb)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+
+	if (couchdb->priv->credentials == NULL)
+		return;
+
+	switch (couchdb_credentials_get_auth_type (couchdb->priv->credentials)) {
+	case COUCHDB_CREDENTIALS_TYPE_OAUTH:
+#ifdef HAVE_OAUTH
+		oauth_signer_free (couchdb->priv->oauth_signer);
+		couchdb->priv->oauth_signer = NULL;
+#endif
+		break;
+	case COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD:
+		g_signal_handlers_disconnect_by_func (couchdb->priv->http_session,
+						      G_CALLBACK (_session_authenticate),
+						      couchdb);
+		g_signal_handlers_disconnect_by_func (couchdb->priv->async_session,
+						      G_CALLBACK (_session_authenticate),
+						      couchdb);
+		break;
+	case COUCHDB_CREDENTIALS_TYPE_SESSION_COOKIE:
+		g_signal_handlers_disconnect_matched (couchdb->priv->http_session, G_SIGNAL_MATCH_DATA,
+						      0, 0, NULL, NULL, couchdb);
+		g_signal_handlers_disconnect_matched (couchdb->priv->async_session, G_SIGNAL_MATCH_DATA,
+						      0, 0, NULL, NULL, couchdb);
+
+		/* Requests waiting for a login are sent as they are */
+		if (couchdb->priv->cookie_login_message != NULL) {
+			SoupMessage *http_message = couchdb->priv->cookie_login_message;
+
+			couchdb->priv->cookie_login_message = NULL;
+			soup_session_cancel_message (couchdb->priv->async_session, http_message,
+						     SOUP_STATUS_CANCELLED);
+		}
+		release_held_messages (couchdb);
+
+		g_mutex_lock (couchdb->priv->cookie_lock);
+		g_free (couchdb->priv->session_cookie);
+		couchdb->priv->session_cookie = NULL;
+		couchdb->priv->cookie_login_failed = FALSE;
+		g_mutex_unlock (couchdb->priv->cookie_lock);
+		break;
+	default:
+		break;
+	}
+
+	g_object_unref (G_OBJECT (couchdb->priv->credentials));
+	couchdb->priv->credentials = NULL;
+}
+
+/**
+ * couchdb_session_is_authentication_enabled:
+ * @couchdb: A #CouchdbSession object
+ *
+ * Gets whether the given #CouchdbSession object has authentication enabled.
+ *
+ * Return value: TRUE if authentication is enabled, FALSE otherwise.
+ */
+gboolean
+couchdb_session_is_authentication_enabled (CouchdbSession *couchdb)
+{
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
+	
+	return couchdb->priv->credentials != NULL;
+}
+
+static gboolean
+_session_authenticate(SoupSession *session, SoupMessage *msg,
+		      SoupAuth *auth, gboolean retrying,
+		      gpointer callback_data)
+{
+	CouchdbSession *couchdb;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (callback_data), FALSE);
+
+	couchdb = COUCHDB_SESSION (callback_data);
+
+	if (retrying) {
+		/* Only admins can read _db_updates, and not being one is not an
+		   authentication failure, the changes dispatcher just falls back
+		   to per-database feeds */
+		if (g_str_has_suffix (soup_message_get_uri (msg)->path, "/_db_updates"))
+			return FALSE;
+
+		g_signal_emit_by_name (couchdb, COUCHDB_SIGNAL_AUTHENTICATION_FAILED, NULL);
 		g_debug ("Authentication failed!");
 		return FALSE;
-	}
+	}
+
+	if (couchdb_credentials_get_auth_type (couchdb->priv->credentials) == COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD) {
+		const char *username = couchdb_credentials_get_item (couchdb->priv->credentials,
+								     COUCHDB_CREDENTIALS_ITEM_USERNAME);
+		const char *password = couchdb_credentials_get_item (couchdb->priv->credentials,
+								     COUCHDB_CREDENTIALS_ITEM_PASSWORD);
+
+		soup_auth_authenticate (auth, username, password);
+	}
+
+	return TRUE;
+}
+
+#define AUTH_SESSION_COOKIE_NAME "AuthSession="
+#define COOKIE_RETRIED_KEY "couchdb-cookie-retried"
+#define COOKIE_LOGIN_KEY "couchdb-cookie-login"
+
+/* Get the "AuthSession=value" part of the session cookie, if any, set by
+   the response */
+static char *
+auth_session_cookie_from_headers (SoupMessageHeaders *headers)
+{
+	SoupMessageHeadersIter iter;
+	const char *name, *value;
+
+	soup_message_headers_iter_init (&iter, headers);
+	while (soup_message_headers_iter_next (&iter, &name, &value)) {
+		if (g_ascii_strcasecmp (name, "Set-Cookie") == 0
+		    && g_str_has_prefix (value, AUTH_SESSION_COOKIE_NAME)) {
+			const char *end = strchr (value, ';');
+
+			return end != NULL ? g_strndup (value, end - value) : g_strdup (value);
+		}
+	}
+
+	return NULL;
+}
+
+static SoupMessage *
+new_cookie_login_message (CouchdbSession *couchdb)
+{
+	SoupMessage *http_message;
+	char *url, *body;
+
+	url = g_strdup_printf ("%s/_session", couchdb->priv->uri);
+	http_message = soup_message_new (SOUP_METHOD_POST, url);
+	g_free (url);
+	if (http_message == NULL)
+		return NULL;
+
+	body = soup_form_encode ("name", couchdb_credentials_get_item (couchdb->priv->credentials,
+								       COUCHDB_CREDENTIALS_ITEM_USERNAME),
+				 "password", couchdb_credentials_get_item (couchdb->priv->credentials,
+									   COUCHDB_CREDENTIALS_ITEM_PASSWORD),
+				 NULL);
+	soup_message_set_request (http_message, SOUP_FORM_MIME_TYPE_URLENCODED,
+				  SOUP_MEMORY_TAKE, body, strlen (body));
+	g_object_set_data (G_OBJECT (http_message), COOKIE_LOGIN_KEY, GINT_TO_POINTER (TRUE));
+
+	return http_message;
+}
+
+/* Stores the cookie from a login response. If the server refused the
+   credentials, that is remembered, so that we don't try again, and fail
+   again, for every request, until the credentials are changed */
+static gboolean
+finish_cookie_login (CouchdbSession *couchdb, SoupMessage *http_message, GError **error)
+{
+	char *cookie = NULL;
+
+	if (SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code))
+		cookie = auth_session_cookie_from_headers (http_message->response_headers);
+
+	if (cookie != NULL) {
+		g_mutex_lock (couchdb->priv->cookie_lock);
+		g_free (couchdb->priv->session_cookie);
+		couchdb->priv->session_cookie = cookie;
+		g_mutex_unlock (couchdb->priv->cookie_lock);
+
+		return TRUE;
+	}
+
+	g_set_error (error, COUCHDB_ERROR, http_message->status_code,
+		     "Could not log in: %s", http_message->reason_phrase);
+
+	/* Not being able to reach the server says nothing about the credentials */
+	if (!SOUP_STATUS_IS_TRANSPORT_ERROR (http_message->status_code)) {
+		g_mutex_lock (couchdb->priv->cookie_lock);
+		couchdb->priv->cookie_login_failed = TRUE;
+		g_mutex_unlock (couchdb->priv->cookie_lock);
+
+		g_signal_emit_by_name (couchdb, COUCHDB_SIGNAL_AUTHENTICATION_FAILED, NULL);
+	}
+
+	return FALSE;
+}
+
+/* Logs in from the synchronous session, which is busy sending the request
+   that needs it, so the login session, set up like it, is used */
+static gboolean
+cookie_login_sync (CouchdbSession *couchdb, GError **error)
+{
+	SoupMessage *http_message;
+	gboolean result;
+
+	http_message = new_cookie_login_message (couchdb);
+	if (http_message == NULL) {
+		g_set_error (error, COUCHDB_ERROR, SOUP_STATUS_MALFORMED, "Invalid URL: %s", couchdb->priv->uri);
+		return FALSE;
+	}
+
+	soup_session_send_message (couchdb->priv->login_session, http_message);
+	result = finish_cookie_login (couchdb, http_message, error);
+
+	g_object_unref (G_OBJECT (http_message));
+
+	return result;
+}
+
+/* Messages for the asynchronous session, waiting for a login to finish.
+   Messages not queued yet are queued then, and the ones whose cookie
+   expired, which are requeued and paused, are unpaused */
+typedef struct {
+	SoupMessage *http_message;
+	SoupSessionCallback callback;
+	gpointer user_data;
+	gboolean paused;
+	SoupSession *session; /* Only set when finishing a cancelled message */
+} HeldMessage;
+
+static void
+hold_message (CouchdbSession *couchdb,
+	      SoupMessage *http_message,
+	      SoupSessionCallback callback,
+	      gpointer user_data,
+	      gboolean paused)
+{
+	HeldMessage *held;
+
+	held = g_slice_new (HeldMessage);
+	held->http_message = http_message;
+	held->callback = callback;
+	held->user_data = user_data;
+	held->paused = paused;
+	held->session = NULL;
+
+	couchdb->priv->held_messages = g_slist_append (couchdb->priv->held_messages, held);
+}
+
+static void
+release_held_messages (CouchdbSession *couchdb)
+{
+	GSList *held_messages;
+
+	held_messages = couchdb->priv->held_messages;
+	couchdb->priv->held_messages = NULL;
+
+	while (held_messages != NULL) {
+		HeldMessage *held = (HeldMessage *) held_messages->data;
+
+		if (held->paused)
+			soup_session_unpause_message (couchdb->priv->async_session, held->http_message);
+		else
+			soup_session_queue_message (couchdb->priv->async_session, held->http_message,
+						    held->callback, held->user_data);
+
+		g_slice_free (HeldMessage, held);
+		held_messages = g_slist_delete_link (held_messages, held_messages);
+	}
+}
+
+static void
+cookie_login_finished_cb (SoupSession *session, SoupMessage *http_message, gpointer user_data)
+{
+	CouchdbSession *couchdb = COUCHDB_SESSION (user_data);
+	GError *error = NULL;
+
+	/* Only cancelled when authentication is disabled, which already
+	   released the held messages */
+	if (couchdb->priv->cookie_login_message != http_message)
+		return;
+
+	couchdb->priv->cookie_login_message = NULL;
+	if (!finish_cookie_login (couchdb, http_message, &error)) {
+		g_debug ("%s", error->message);
+		g_error_free (error);
+	}
+
+	/* Requests are sent even if logging in failed, so that they finish
+	   with the server's error */
+	release_held_messages (couchdb);
+}
+
+/* Logs in from the asynchronous session, unless it is already being done */
+static void
+start_cookie_login (CouchdbSession *couchdb)
+{
+	SoupMessage *http_message;
+
+	if (couchdb->priv->cookie_login_message != NULL)
+		return;
+
+	http_message = new_cookie_login_message (couchdb);
+	if (http_message == NULL) {
+		g_warning ("Could not log in: Invalid URL: %s", couchdb->priv->uri);
+		release_held_messages (couchdb);
+		return;
+	}
+
+	couchdb->priv->cookie_login_message = http_message;
+	soup_session_queue_message (couchdb->priv->async_session, http_message,
+				    cookie_login_finished_cb, couchdb);
+}
+
+static gboolean
+cookie_login_needed (CouchdbSession *couchdb)
+{
+	gboolean needed;
+
+	if (couchdb->priv->credentials == NULL
+	    || couchdb_credentials_get_auth_type (couchdb->priv->credentials) != COUCHDB_CREDENTIALS_TYPE_SESSION_COOKIE)
+		return FALSE;
+
+	g_mutex_lock (couchdb->priv->cookie_lock);
+	needed = couchdb->priv->session_cookie == NULL && !couchdb->priv->cookie_login_failed;
+	g_mutex_unlock (couchdb->priv->cookie_lock);
+
+	return needed;
+}
+
+/* Queues a message in the asynchronous session. If we need to log in
+   first, the message waits for it, rather than blocking the main loop */
+static void
+queue_async_message (CouchdbSession *couchdb,
+		     SoupMessage *http_message,
+		     SoupSessionCallback callback,
+		     gpointer user_data)
+{
+	if (!cookie_login_needed (couchdb)) {
+		soup_session_queue_message (couchdb->priv->async_session, http_message,
+					    callback, user_data);
+		return;
+	}
+
+	hold_message (couchdb, http_message, callback, user_data, FALSE);
+	start_cookie_login (couchdb);
+}
+
+static gboolean
+finish_cancelled_message_cb (gpointer user_data)
+{
+	HeldMessage *held = (HeldMessage *) user_data;
+
+	if (held->callback != NULL)
+		held->callback (held->session, held->http_message, held->user_data);
+
+	g_object_unref (G_OBJECT (held->http_message));
+	g_object_unref (G_OBJECT (held->session));
+	g_slice_free (HeldMessage, held);
+
+	return FALSE;
+}
+
+static void
+cancel_async_message (CouchdbSession *couchdb, SoupMessage *http_message)
+{
+	GSList *l;
+
+	for (l = couchdb->priv->held_messages; l != NULL; l = l->next) {
+		HeldMessage *held = (HeldMessage *) l->data;
+
+		if (held->http_message != http_message)
+			continue;
+
+		couchdb->priv->held_messages = g_slist_delete_link (couchdb->priv->held_messages, l);
+
+		/* Messages not queued yet are finished here, as the session would,
+		   but from the main loop, since we might be called from a
+		   GCancellable's "cancelled" signal */
+		if (!held->paused) {
+			soup_message_set_status (http_message, SOUP_STATUS_CANCELLED);
+			held->session = g_object_ref (G_OBJECT (couchdb->priv->async_session));
+			g_idle_add (finish_cancelled_message_cb, held);
+
+			return;
+		}
+
+		g_slice_free (HeldMessage, held);
+		break;
+	}
+
+	soup_session_cancel_message (couchdb->priv->async_session, http_message,
+				     SOUP_STATUS_CANCELLED);
+}
+
+static void
+cookie_got_headers_cb (SoupMessage *http_message, gpointer user_data)
+{
+	SoupSession *session = SOUP_SESSION (user_data);
+	CouchdbSession *couchdb;
+	const char *sent_cookie;
+	char *cookie;
+	gboolean login, failed;
+
+	couchdb = COUCHDB_SESSION (g_object_get_data (G_OBJECT (http_message), "couchdb-session"));
+	if (couchdb->priv->credentials == NULL
+	    || couchdb_credentials_get_auth_type (couchdb->priv->credentials) != COUCHDB_CREDENTIALS_TYPE_SESSION_COOKIE)
+		return;
+
+	/* CouchDB sends a fresh cookie when the current one is about to expire */
+	cookie = auth_session_cookie_from_headers (http_message->response_headers);
+	if (cookie != NULL) {
+		g_mutex_lock (couchdb->priv->cookie_lock);
+		g_free (couchdb->priv->session_cookie);
+		couchdb->priv->session_cookie = cookie;
+		g_mutex_unlock (couchdb->priv->cookie_lock);
+		return;
+	}
+
+	/* If it already expired, log in again and resend the request, once */
+	if (http_message->status_code != SOUP_STATUS_UNAUTHORIZED
+	    || g_object_get_data (G_OBJECT (http_message), COOKIE_RETRIED_KEY)
+	    || g_str_has_suffix (soup_message_get_uri (http_message)->path, "/_db_updates"))
+		return;
+
+	g_object_set_data (G_OBJECT (http_message), COOKIE_RETRIED_KEY, GINT_TO_POINTER (TRUE));
+
+	/* Unless another request already got a new cookie */
+	sent_cookie = soup_message_headers_get_one (http_message->request_headers, "Cookie");
+	g_mutex_lock (couchdb->priv->cookie_lock);
+	if (couchdb->priv->session_cookie != NULL && g_strcmp0 (sent_cookie, couchdb->priv->session_cookie) == 0) {
+		g_free (couchdb->priv->session_cookie);
+		couchdb->priv->session_cookie = NULL;
+	}
+	failed = couchdb->priv->cookie_login_failed;
+	login = couchdb->priv->session_cookie == NULL && !failed;
+	g_mutex_unlock (couchdb->priv->cookie_lock);
+
+	/* Sending it again without a cookie would just fail again */
+	if (failed)
+		return;
+
+	soup_session_requeue_message (session, http_message);
+
+	/* The synchronous session logs in when the request is sent again */
+	if (login && session == couchdb->priv->async_session) {
+		soup_session_pause_message (session, http_message);
+		hold_message (couchdb, http_message, NULL, NULL, TRUE);
+		start_cookie_login (couchdb);
+	}
+}
+
+static void
+cookie_request_queued_cb (SoupSession *session, SoupMessage *http_message, gpointer user_data)
+{
+	if (g_object_get_data (G_OBJECT (http_message), COOKIE_LOGIN_KEY))
+		return;
+
+	g_object_set_data (G_OBJECT (http_message), "couchdb-session", user_data);
+	g_signal_connect (G_OBJECT (http_message), "got-headers",
+			  G_CALLBACK (cookie_got_headers_cb), session);
+}
+
+static void
+cookie_request_started_cb (SoupSession *session, SoupMessage *http_message, SoupSocket *socket, gpointer user_data)
+{
+	CouchdbSession *couchdb = COUCHDB_SESSION (user_data);
+
+	if (g_object_get_data (G_OBJECT (http_message), COOKIE_LOGIN_KEY))
+		return;
+
+	/* Messages for the asynchronous session were held until logged in */
+	if (session == couchdb->priv->http_session && cookie_login_needed (couchdb)) {
+		GError *error = NULL;
+
+		if (!cookie_login_sync (couchdb, &error)) {
+			g_warning ("%s", error->message);
+			g_error_free (error);
+		}
+	}
+
+	g_mutex_lock (couchdb->priv->cookie_lock);
+	if (couchdb->priv->session_cookie != NULL)
+		soup_message_headers_replace (http_message->request_headers, "Cookie", couchdb->priv->session_cookie);
+	else
+		soup_message_headers_remove (http_message->request_headers, "Cookie");
+	g_mutex_unlock (couchdb->priv->cookie_lock);
+}
+
+static void
+add_oauth_signature (CouchdbSession *couchdb, SoupMessage *http_message, const char *method, const char *url)
+{
+#ifdef HAVE_OAUTH
+	/* This method is a no-op if we are configured without OAUTH */
+	char *header;
+
+	header = oauth_signer_sign_header (couchdb->priv->oauth_signer, method, url);
+	if (header != NULL) {
+		soup_message_headers_append (http_message->request_headers, "Authorization", header);
+		g_free (header);
+	}
+#endif /* HAVE_OAUTH */
+}
+
+#define REQUEST_TIMING_KEY "couchdb-request-timing"
+
+typedef struct {
+	GTimer *timer;
+	gboolean got_first_byte;
+	CouchdbRequestInfo info;
+} RequestTiming;
+
+static void
+request_timing_free (RequestTiming *timing)
+{
+	g_timer_destroy (timing->timer);
+	g_slice_free (RequestTiming, timing);
+}
+
+static void
+timing_got_headers_cb (SoupMessage *http_message, gpointer user_data)
+{
+	RequestTiming *timing = (RequestTiming *) user_data;
+
+	/* With authentication, the message might be sent more than once */
+	if (!timing->got_first_byte) {
+		timing->info.time_to_first_byte = g_timer_elapsed (timing->timer, NULL) * 1000;
+		timing->got_first_byte = TRUE;
+	}
+}
+
+static void
+timing_got_chunk_cb (SoupMessage *http_message, SoupBuffer *chunk, gpointer user_data)
+{
+	RequestTiming *timing = (RequestTiming *) user_data;
+
+	timing->info.bytes_received += chunk->length;
+}
+
+static void
+start_request_timing (CouchdbSession *couchdb, SoupMessage *http_message, const char *method, const char *url)
+{
+	RequestTiming *timing;
+	SoupURI *base_uri;
+	const char *path;
+
+	timing = g_slice_new0 (RequestTiming);
+	timing->info.method = couchdb_request_method_from_string (method);
+	timing->info.bytes_sent = http_message->request_body->length;
+
+	/* Classify the request by its path, relative to the CouchDB instance */
+	path = soup_message_get_uri (http_message)->path;
+	base_uri = soup_uri_new (couchdb->priv->uri);
+	if (base_uri != NULL) {
+		if (base_uri->path != NULL && strcmp (base_uri->path, "/") != 0 &&
+		    g_str_has_prefix (path, base_uri->path))
+			path += strlen (base_uri->path);
+		soup_uri_free (base_uri);
+	}
+	timing->info.endpoint = couchdb_endpoint_class_from_path (path);
+
+	g_signal_connect (G_OBJECT (http_message), "got-headers",
+			  G_CALLBACK (timing_got_headers_cb), timing);
+	g_signal_connect (G_OBJECT (http_message), "got-chunk",
+			  G_CALLBACK (timing_got_chunk_cb), timing);
+	g_object_set_data_full (G_OBJECT (http_message), REQUEST_TIMING_KEY, timing,
+				(GDestroyNotify) request_timing_free);
+
+	g_signal_emit_by_name (couchdb, "request-started", method, url);
+
+	timing->timer = g_timer_new ();
+}
+
+static void
+add_parse_time (SoupMessage *http_message, GTimer *timer)
+{
+	RequestTiming *timing;
+
+	timing = g_object_get_data (G_OBJECT (http_message), REQUEST_TIMING_KEY);
+	if (timing != NULL)
+		timing->info.parse_time += g_timer_elapsed (timer, NULL) * 1000;
+}
+
+static void
+finish_request_timing (CouchdbSession *couchdb, SoupMessage *http_message)
+{
+	RequestTiming *timing;
+	char *url;
+
+	timing = g_object_get_data (G_OBJECT (http_message), REQUEST_TIMING_KEY);
+	if (timing == NULL)
+		return;
+
+	timing->info.status_code = http_message->status_code;
+	timing->info.total_time = g_timer_elapsed (timing->timer, NULL) * 1000;
+	if (!timing->got_first_byte)
+		timing->info.time_to_first_byte = timing->info.total_time;
+
+	couchdb_session_stats_add (&couchdb->priv->stats, &timing->info);
+
+	if (g_signal_has_handler_pending (couchdb, couchdb_session_signals[REQUEST_FINISHED], 0, FALSE)) {
+		url = soup_uri_to_string (soup_message_get_uri (http_message), FALSE);
+		g_signal_emit_by_name (couchdb, "request-finished", url, &timing->info);
+		g_free (url);
+	}
+
+	g_signal_handlers_disconnect_matched (G_OBJECT (http_message), G_SIGNAL_MATCH_DATA,
+					      0, 0, NULL, NULL, timing);
+	g_object_set_data (G_OBJECT (http_message), REQUEST_TIMING_KEY, NULL);
+}
+
+static gboolean
+parse_json_response (CouchdbSession *couchdb, JsonParser *json_parser, SoupMessage *http_message, GError **error)
+{
+	GError *parse_error = NULL;
+	GTimer *timer;
+	gboolean success = TRUE;
+
+	/* libsoup has already flattened the accumulated body, so parse it in place
+	   instead of copying it chunk by chunk into a new string */
+	if (http_message->response_body->length == 0)
+		return TRUE;
+
+	g_debug ("Response body: %.*s",
+		 (int) http_message->response_body->length,
+		 http_message->response_body->data);
+	timer = g_timer_new ();
+	if (!json_parser_load_from_data (json_parser,
+					 http_message->response_body->data,
+					 http_message->response_body->length,
+					 &parse_error)) {
+		g_set_error (error, COUCHDB_ERROR, -1, "Invalid JSON response: %s",
+			     parse_error->message);
+		g_error_free (parse_error);
+		success = FALSE;
+	}
+
+	add_parse_time (http_message, timer);
+	g_timer_destroy (timer);
+
+	return success;
+}
+
+static SoupMessage *
+prepare_message (CouchdbSession *couchdb, const char *method, const char *url, const char *body, GError **error)
+{
+	SoupMessage *http_message;
+
+	http_message = soup_message_new (method, url);
+	if (http_message == NULL) {
+		g_set_error (error, COUCHDB_ERROR, SOUP_STATUS_MALFORMED, "Invalid URL: %s", url);
+		return NULL;
+	}
+
+	if (body != NULL) {
+		soup_message_set_request (http_message, "application/json", SOUP_MEMORY_COPY,
+					  body, strlen (body));
+	}
+
+	if (couchdb_session_is_authentication_enabled (couchdb)) {
+		switch (couchdb_credentials_get_auth_type (couchdb->priv->credentials)) {
+		case COUCHDB_CREDENTIALS_TYPE_OAUTH:
+			add_oauth_signature (couchdb, http_message, method, url);
+			break;
+		case COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD:
+			/* Done in the "authenticate" signal handler */
+			break;
+		case COUCHDB_CREDENTIALS_TYPE_SESSION_COOKIE:
+			/* Done in the "request-started" signal handler */
+			break;
+		default:
+			g_warning ("Got unknown credentials object, not authenticating message");
+		}
+	}
+
+	g_debug ("Sending %s to %s... with headers\n: ", method, url);
+#ifdef DEBUG_MESSAGES
+	soup_message_headers_foreach (http_message->request_headers,
+				      (SoupMessageHeadersForeachFunc) debug_print_headers,
+				      NULL);
+#endif
+
+	return http_message;
+}
+
+/* Like prepare_message, but with the request body written by @body_func
+   straight into the message, in chunks, instead of copied from a string */
+static SoupMessage *
+prepare_message_with_body (CouchdbSession *couchdb,
+			   const char *method,
+			   const char *url,
+			   CouchdbBodyFunc body_func,
+			   gpointer body_data,
+			   GError **error)
+{
+	SoupMessage *http_message;
+	BodyWriter *writer;
+
+	http_message = prepare_message (couchdb, method, url, NULL, error);
+	if (http_message == NULL)
+		return NULL;
+
+	soup_message_headers_set_content_type (http_message->request_headers, "application/json", NULL);
+
+	writer = body_writer_new (http_message->request_body);
+	body_func (writer, body_data);
+	body_writer_free (writer);
+
+	return http_message;
+}
+
+static gboolean
+process_response (CouchdbSession *couchdb, SoupMessage *http_message, JsonParser *output, GError **error)
+{
+	if (SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code)) {
+		if (output != NULL)
+			return parse_json_response (couchdb, output, http_message, error);
+
+		return TRUE;
+	}
+
+	g_set_error (error, COUCHDB_ERROR, http_message->status_code, "%s", http_message->reason_phrase);
+
+	return FALSE;
+}
+
+/**
+ * couchdb_session_get_stats:
+ * @couchdb: A #CouchdbSession object
+ * @stats: Placeholder for the statistics
+ *
+ * Get statistics about the requests sent to CouchDB by the given #CouchdbSession
+ * since it was created or since the last call to #couchdb_session_reset_stats.
+ * Requests are accounted in total, by HTTP method and by type of endpoint, and for
+ * each of them, the number of requests and failures, the bytes transferred, and
+ * histograms of the time to first byte, total time and JSON parsing time are kept.
+ *
+ * The long-lived connections used to listen for changes (see
+ * #couchdb_session_listen_for_changes) are not accounted.
+ *
+ * For more detailed information, applications can connect to the
+ * "request-started" and "request-finished" signals.
+ */
+void
+couchdb_session_get_stats (CouchdbSession *couchdb, CouchdbSessionStats *stats)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (stats != NULL);
+
+	*stats = couchdb->priv->stats;
+}
+
+/**
+ * couchdb_session_reset_stats:
+ * @couchdb: A #CouchdbSession object
+ *
+ * Reset all the request statistics of the given #CouchdbSession.
+ */
+void
+couchdb_session_reset_stats (CouchdbSession *couchdb)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+
+	memset (&couchdb->priv->stats, 0, sizeof (CouchdbSessionStats));
+}
+
+/**
+ * couchdb_session_set_document_cache_size:
+ * @couchdb: A #CouchdbSession object
+ * @max_size: Maximum size, in bytes, of the cache, or 0 to disable it
+ *
+ * Enable or disable the document cache of the given #CouchdbSession. When enabled,
+ * documents retrieved with #couchdb_document_get are kept in memory, and further
+ * calls to #couchdb_document_get for the same document only ask CouchDB whether
+ * the document changed, instead of transferring it again. The least recently
+ * used documents are dropped from the cache when it grows over @max_size bytes.
+ *
+ * The cache is disabled by default.
+ */
+void
+couchdb_session_set_document_cache_size (CouchdbSession *couchdb, gsize max_size)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+
+	if (max_size == 0) {
+		if (couchdb->priv->document_cache != NULL) {
+			document_cache_free (couchdb->priv->document_cache);
+			couchdb->priv->document_cache = NULL;
+		}
+	} else if (couchdb->priv->document_cache != NULL)
+		document_cache_set_max_size (couchdb->priv->document_cache, max_size);
+	else
+		couchdb->priv->document_cache = document_cache_new (max_size);
+}
+
+/**
+ * couchdb_session_get_document_cache_size:
+ * @couchdb: A #CouchdbSession object
+ *
+ * Get the maximum size of the document cache of the given #CouchdbSession.
+ *
+ * Return value: Maximum size, in bytes, of the cache, or 0 if it is disabled.
+ */
+gsize
+couchdb_session_get_document_cache_size (CouchdbSession *couchdb)
+{
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), 0);
+
+	if (couchdb->priv->document_cache == NULL)
+		return 0;
+
+	return couchdb->priv->document_cache->max_size;
+}
+
+/**
+ * couchdb_session_get_document_cache_stats:
+ * @couchdb: A #CouchdbSession object
+ * @hits: Placeholder for the number of documents served from the cache, or NULL
+ * @misses: Placeholder for the number of documents transferred from CouchDB, or NULL
+ *
+ * Get statistics about the usage of the document cache since it was enabled.
+ */
+void
+couchdb_session_get_document_cache_stats (CouchdbSession *couchdb, guint *hits, guint *misses)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+
+	if (hits != NULL)
+		*hits = couchdb->priv->document_cache ? couchdb->priv->document_cache->hits : 0;
+	if (misses != NULL)
+		*misses = couchdb->priv->document_cache ? couchdb->priv->document_cache->misses : 0;
+}
+
+/* Sends a message built by prepare_message, which may have failed */
+static gboolean
+send_message (CouchdbSession *couchdb, const char *method, const char *url,
+	      SoupMessage *http_message, JsonParser *output, GError **error)
+{
+	gboolean result;
+
+	if (http_message == NULL)
+		return FALSE;
 
-	if (couchdb_credentials_get_auth_type (couchdb->priv->credentials) == COUCHDB_CREDENTIALS_TYPE_USERNAME_AND_PASSWORD) {
-		const char *username = couchdb_credentials_get_item (couchdb->priv->credentials,
-								     COUCHDB_CREDENTIALS_ITEM_USERNAME);
-		const char *password = couchdb_credentials_get_item (couchdb->priv->credentials,
-								     COUCHDB_CREDENTIALS_ITEM_PASSWORD);
+	start_request_timing (couchdb, http_message, method, url);
+	soup_session_send_message (couchdb->priv->http_session, http_message);
+	result = process_response (couchdb, http_message, output, error);
+	finish_request_timing (couchdb, http_message);
 
-		soup_auth_authenticate (auth, username, password);
-	}
+	g_object_unref (G_OBJECT (http_message));
 
-	return TRUE;
+	return result;
 }
 
-static void
-add_oauth_signature (CouchdbSession *couchdb, SoupMessage *http_message, const char *method, const char *url)
+/**
+ * couchdb_session_send_message:
+ * @couchdb: A #CouchdbSession object
+ * @method: HTTP method to use
+ * @url: URL to send the message to
+ * @body: Body of the HTTP request
+ * @output: Placeholder for output information
+ * @error: Placeholder for error information
+ *
+ * This function is used to communicate with CouchDB over HTTP, and should not be used
+ * by applications unless they really have a need (like missing API in couchdb-glib which
+ * the application needs).
+ *
+ * Return value: TRUE if successful, FALSE otherwise.
+ */
+gboolean
+couchdb_session_send_message (CouchdbSession *couchdb, const char *method, const char *url, const char *body, JsonParser *output, GError **error)
 {
-#ifdef HAVE_OAUTH
-	/* This method is a no-op if we are configured without OAUTH */
-	char *signed_url;
-
-	signed_url = oauth_sign_url2 (
-		url, NULL, OA_HMAC, method,
-		couchdb_credentials_get_item (couchdb->priv->credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_CONSUMER_KEY),
-		couchdb_credentials_get_item (couchdb->priv->credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_CONSUMER_SECRET),
-		couchdb_credentials_get_item (couchdb->priv->credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_TOKEN_KEY),
-		couchdb_credentials_get_item (couchdb->priv->credentials, COUCHDB_CREDENTIALS_ITEM_OAUTH_TOKEN_SECRET));
-	if (signed_url != NULL) {
-		char **parsed_url;
-		GString *header = NULL;
-
-		/* Get the OAuth signature from the signed URL */
-		parsed_url = g_strsplit (signed_url, "?", 2);
-		if (parsed_url != NULL) {
-			gchar **params;
-			int i;
-
-			params = g_strsplit (parsed_url[1], "&", 0);
-#ifdef DEBUG_MESSAGES
-			g_debug ("Parsing %s", parsed_url[1]);
-#endif
-			for (i = 0; params[i] != NULL; i++) {
-				gchar **url_param;
-				
-				/* Don't include non-OAuth URL parameters in OAuth header */
-				if (!g_str_has_prefix (params[i], "oauth_"))
-					continue;
-				
-				url_param = g_strsplit (params[i], "=", 2);
-				if (url_param == NULL)
-					continue;
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
+	g_return_val_if_fail (method != NULL, FALSE);
 
-				if (header != NULL)
-					header = g_string_append (header, ", ");
-				else
-					header = g_string_new ("OAuth ");
+	return send_message (couchdb, method, url,
+			     prepare_message (couchdb, method, url, body, error),
+			     output, error);
+}
 
-				header = g_string_append (header, url_param[0]);
-				header = g_string_append (header, "=\"");
-				header = g_string_append (header, url_param[1]);
-				header = g_string_append (header, "\"");
+/* Same as couchdb_session_send_message, for bodies too big to be built as a
+   single string first */
+gboolean
+couchdb_session_send_message_with_body (CouchdbSession *couchdb,
+					const char *method,
+					const char *url,
+					CouchdbBodyFunc body_func,
+					gpointer body_data,
+					JsonParser *output,
+					GError **error)
+{
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
+	g_return_val_if_fail (method != NULL, FALSE);
+	g_return_val_if_fail (body_func != NULL, FALSE);
 
-				g_strfreev (url_param);
-			}
+	return send_message (couchdb, method, url,
+			     prepare_message_with_body (couchdb, method, url, body_func, body_data, error),
+			     output, error);
+}
+
+SoupBuffer *
+couchdb_session_fetch_document (CouchdbSession *couchdb,
+				const char *dbname,
+				const char *docid,
+				const char *url,
+				GError **error)
+{
+	SoupMessage *http_message;
+	DocumentCache *cache;
+	SoupBuffer *buffer = NULL;
+	gboolean revalidate, retry;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+
+	cache = couchdb->priv->document_cache;
+	revalidate = cache != NULL;
 
-			if (params)
-				g_strfreev (params);
+	do {
+		retry = FALSE;
 
-			g_strfreev (parsed_url);
+		http_message = prepare_message (couchdb, SOUP_METHOD_GET, url, NULL, error);
+		if (http_message == NULL)
+			return NULL;
+
+		/* If we have the document cached, only get it if it changed */
+		if (revalidate) {
+			const char *etag;
+
+			etag = document_cache_get_etag (cache, dbname, docid);
+			if (etag != NULL)
+				soup_message_headers_append (http_message->request_headers, "If-None-Match", etag);
 		}
 
-		if (header != NULL) {
-			soup_message_headers_append (http_message->request_headers, "Authorization", header->str);
+		start_request_timing (couchdb, http_message, SOUP_METHOD_GET, url);
+		soup_session_send_message (couchdb->priv->http_session, http_message);
 
-			g_string_free (header, TRUE);
+		if (revalidate && http_message->status_code == SOUP_STATUS_NOT_MODIFIED) {
+			buffer = document_cache_lookup (cache, dbname, docid);
+
+			/* The cached copy was evicted while revalidating it, so
+			   get the whole document again */
+			if (buffer == NULL) {
+				revalidate = FALSE;
+				retry = TRUE;
+			}
+		} else if (process_response (couchdb, http_message, NULL, error)) {
+			/* The document is not parsed here, but only when, and if, its
+			   contents are accessed, so just check that it is an object */
+			const char *p;
+
+			buffer = soup_message_body_flatten (http_message->response_body);
+			for (p = buffer->data; p < buffer->data + buffer->length && g_ascii_isspace (*p); p++)
+				;
+			if (p == buffer->data + buffer->length || *p != '{') {
+				g_set_error (error, COUCHDB_ERROR, -1, "Invalid document");
+				soup_buffer_free (buffer);
+				buffer = NULL;
+			} else if (cache != NULL) {
+				const char *etag;
+
+				cache->misses++;
+				etag = soup_message_headers_get_one (http_message->response_headers, "ETag");
+				if (etag != NULL)
+					document_cache_insert (cache, dbname, docid, etag, buffer);
+			}
 		}
 
-		free (signed_url);
-	}
-#endif /* HAVE_OAUTH */
+		finish_request_timing (couchdb, http_message);
+		g_object_unref (G_OBJECT (http_message));
+	} while (retry);
+
+	return buffer;
+}
+
+void
+couchdb_session_invalidate_document (CouchdbSession *couchdb, const char *dbname, const char *docid)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+
+	if (couchdb->priv->document_cache != NULL && dbname != NULL && docid != NULL)
+		document_cache_remove (couchdb->priv->document_cache, dbname, docid);
+}
+
+typedef struct {
+	SoupSession *session;
+	RowSplitter *splitter;
+	GError *error;
+} StreamMessageData;
+
+static void
+stream_got_headers_cb (SoupMessage *http_message, gpointer user_data)
+{
+	StreamMessageData *data = (StreamMessageData *) user_data;
+
+	if (soup_message_headers_get_encoding (http_message->response_headers) == SOUP_ENCODING_CONTENT_LENGTH)
+		row_splitter_set_expected_length (data->splitter,
+						  soup_message_headers_get_content_length (http_message->response_headers));
 }
 
+static void
+stream_got_chunk_cb (SoupMessage *http_message, SoupBuffer *chunk, gpointer user_data)
+{
+	StreamMessageData *data = (StreamMessageData *) user_data;
+	GTimer *timer;
+
+	if (!SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code) || data->error != NULL)
+		return;
+
+	timer = g_timer_new ();
+	if (!row_splitter_feed (data->splitter, chunk->data, chunk->length, &data->error))
+		soup_session_cancel_message (data->session, http_message, SOUP_STATUS_MALFORMED);
+
+	/* This includes the time spent in the row callback */
+	add_parse_time (http_message, timer);
+	g_timer_destroy (timer);
+}
+
+/* Takes ownership of @splitter */
 static gboolean
-parse_json_response (CouchdbSession *couchdb, JsonParser *json_parser, SoupMessage *http_message, GError **error)
+send_message_stream (CouchdbSession *couchdb,
+		     const char *method,
+		     const char *url,
+		     const char *body,
+		     RowSplitter *splitter,
+		     JsonParser *envelope,
+		     GError **error)
 {
-	SoupBuffer *buffer;
-        GString *str = NULL;
-        goffset offset = 0;
-        gboolean success = TRUE;
-	
-	while ((buffer = soup_message_body_get_chunk (http_message->response_body, offset))) {
-		if (!str)
-                        str = g_string_new ("");
-                g_string_append_len (str, buffer->data, buffer->length);
-
-                offset += buffer->length;
-                soup_buffer_free (buffer);
-	}
-
-	if (str && str->len > 0) {
-		g_debug ("Response body: %s", str->str);
-		if (!json_parser_load_from_data (json_parser,
-						 (const gchar *) str->str,
-						 str->len,
-						 error)) {
-			g_object_unref (G_OBJECT (json_parser));
-			g_set_error (error, COUCHDB_ERROR, -1, "Invalid JSON response");
-			success = FALSE;
-		}
+	SoupMessage *http_message;
+	StreamMessageData data = { 0, };
+	gboolean result;
 
-		g_string_free (str, TRUE);
+	http_message = prepare_message (couchdb, method, url, body, error);
+	if (http_message == NULL) {
+		row_splitter_free (splitter);
+		return FALSE;
 	}
 
-	return success;
+	data.session = couchdb->priv->http_session;
+	data.splitter = splitter;
+
+	/* Don't keep the chunks around once they have been parsed */
+	soup_message_body_set_accumulate (http_message->response_body, FALSE);
+	g_signal_connect (G_OBJECT (http_message), "got-headers",
+			  G_CALLBACK (stream_got_headers_cb), &data);
+	g_signal_connect (G_OBJECT (http_message), "got-chunk",
+			  G_CALLBACK (stream_got_chunk_cb), &data);
+
+	start_request_timing (couchdb, http_message, method, url);
+	soup_session_send_message (couchdb->priv->http_session, http_message);
+
+	if (data.error != NULL) {
+		g_propagate_error (error, data.error);
+		result = FALSE;
+	} else if (process_response (couchdb, http_message, NULL, error))
+		result = row_splitter_finish (data.splitter, envelope, error);
+	else
+		result = FALSE;
+
+	finish_request_timing (couchdb, http_message);
+
+	/* Free memory */
+	row_splitter_free (data.splitter);
+	g_object_unref (G_OBJECT (http_message));
+
+	return result;
+}
+
+/* Like #couchdb_session_send_message_stream, but passing the rows unparsed */
+static gboolean
+send_message_stream_raw (CouchdbSession *couchdb,
+			 const char *method,
+			 const char *url,
+			 const char *body,
+			 RowSplitterRawFunc func,
+			 gpointer user_data,
+			 JsonParser *envelope,
+			 GError **error)
+{
+	return send_message_stream (couchdb, method, url, body,
+				    row_splitter_new_raw (ROW_SPLITTER_MODE_ARRAY, func, user_data),
+				    envelope, error);
 }
 
 /**
- * couchdb_session_send_message:
+ * couchdb_session_send_message_stream:
  * @couchdb: A #CouchdbSession object
  * @method: HTTP method to use
  * @url: URL to send the message to
  * @body: Body of the HTTP request
- * @output: Placeholder for output information
+ * @func: Function to call for each row in the response
+ * @user_data: Data to pass to @func
+ * @envelope: Placeholder for the rest of the response, or NULL
  * @error: Placeholder for error information
  *
- * This function is used to communicate with CouchDB over HTTP, and should not be used
- * by applications unless they really have a need (like missing API in couchdb-glib which
- * the application needs).
+ * Send a request whose response contains a list of rows, like _all_docs, views
+ * or _changes, parsing the response as it arrives instead of loading it all in
+ * memory. @func is called for each of the elements of the rows array (the first
+ * array member of the response object) as soon as it has been received. The
+ * row object passed to @func is only valid during the call.
+ *
+ * If @envelope is not NULL, the rest of the response (total_rows, last_seq, etc)
+ * is loaded into it, with the rows array left empty.
+ *
+ * As for #couchdb_session_send_message, this should not be used by applications
+ * unless they really have a need.
  *
  * Return value: TRUE if successful, FALSE otherwise.
  */
 gboolean
-couchdb_session_send_message (CouchdbSession *couchdb, const char *method, const char *url, const char *body, JsonParser *output, GError **error)
+couchdb_session_send_message_stream (CouchdbSession *couchdb,
+				     const char *method,
+				     const char *url,
+				     const char *body,
+				     CouchdbRowFunc func,
+				     gpointer user_data,
+				     JsonParser *envelope,
+				     GError **error)
 {
-	SoupMessage *http_message;
-	guint status;
-	GError **real_error;
-	
 	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
 	g_return_val_if_fail (method != NULL, FALSE);
+	g_return_val_if_fail (func != NULL, FALSE);
+
+	return send_message_stream (couchdb, method, url, body,
+				    row_splitter_new (ROW_SPLITTER_MODE_ARRAY, (RowSplitterFunc) func, user_data),
+				    envelope, error);
+}
+
+typedef struct {
+	CouchdbSession *couchdb;
+	SoupMessage *http_message;
+	JsonParser *output;
+	GCancellable *cancellable;
+	gulong cancelled_id;
+	GSimpleAsyncResult *result;
+} AsyncMessageData;
+
+static void
+async_message_cancelled_cb (GCancellable *cancellable, gpointer user_data)
+{
+	AsyncMessageData *data = (AsyncMessageData *) user_data;
+
+	cancel_async_message (data->couchdb, data->http_message);
+}
+
+static void
+async_message_finished_cb (SoupSession *session, SoupMessage *http_message, gpointer user_data)
+{
+	GError *error = NULL;
+	AsyncMessageData *data = (AsyncMessageData *) user_data;
+
+	if (data->cancellable != NULL) {
+		g_signal_handler_disconnect (data->cancellable, data->cancelled_id);
+		g_object_unref (G_OBJECT (data->cancellable));
+	}
+
+	if (http_message->status_code == SOUP_STATUS_CANCELLED) {
+		g_simple_async_result_set_error (data->result, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+						 "Operation was cancelled");
+	} else if (!process_response (data->couchdb, http_message, data->output, &error)) {
+		g_simple_async_result_set_from_error (data->result, error);
+		g_error_free (error);
+	}
 
-	if (error != NULL)
-		real_error = error;
+	finish_request_timing (data->couchdb, http_message);
+
+	/* Cancelling might have finished the message right away, from the
+	   GCancellable's "cancelled" signal, so don't call back from there */
+	if (http_message->status_code == SOUP_STATUS_CANCELLED)
+		g_simple_async_result_complete_in_idle (data->result);
 	else
-		*real_error = NULL;
+		g_simple_async_result_complete (data->result);
+
+	/* Free memory. The message itself is unref'ed by libsoup */
+	g_object_unref (G_OBJECT (data->result));
+	if (data->output != NULL)
+		g_object_unref (G_OBJECT (data->output));
+	g_object_unref (G_OBJECT (data->couchdb));
+	g_slice_free (AsyncMessageData, data);
+}
 
-	http_message = soup_message_new (method, url);
-	if (body != NULL) {
-		soup_message_set_request (http_message, "application/json", SOUP_MEMORY_COPY,
-					  body, strlen (body));
+/* The body is either copied from @body or written by @body_func */
+static void
+send_message_async (CouchdbSession *couchdb,
+		    const char *method,
+		    const char *url,
+		    const char *body,
+		    CouchdbBodyFunc body_func,
+		    gpointer body_data,
+		    JsonParser *output,
+		    GCancellable *cancellable,
+		    GAsyncReadyCallback callback,
+		    gpointer user_data)
+{
+	SoupMessage *http_message;
+	GSimpleAsyncResult *result;
+	AsyncMessageData *data;
+	GError *error = NULL;
+
+	result = g_simple_async_result_new (G_OBJECT (couchdb), callback, user_data,
+					    couchdb_session_send_message_async);
+
+	if (cancellable != NULL && g_cancellable_is_cancelled (cancellable)) {
+		g_simple_async_result_set_error (result, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+						 "Operation was cancelled");
+		g_simple_async_result_complete_in_idle (result);
+		g_object_unref (G_OBJECT (result));
+		return;
 	}
 
-	if (couchdb_session_is_authentication_enabled (couchdb)) {
-		switch (couchdb_credentials_get_auth_type (couchdb->priv->credentials)) {
-		case COUCHDB_CREDENTIALS_TYPE_OAUTH:
-			add_oauth_signature (couchdb, http_message, method, url);
-			break;
-		default:
-			g_warning ("Got unknown credentials object, not authenticating message");
-		}
+	if (body_func != NULL)
+		http_message = prepare_message_with_body (couchdb, method, url, body_func, body_data, &error);
+	else
+		http_message = prepare_message (couchdb, method, url, body, &error);
+	if (http_message == NULL) {
+		g_simple_async_result_set_from_error (result, error);
+		g_simple_async_result_complete_in_idle (result);
+		g_object_unref (G_OBJECT (result));
+		g_error_free (error);
+		return;
 	}
 
-	g_debug ("Sending %s to %s... with headers\n: ", method, url);
-#ifdef DEBUG_MESSAGES
-	soup_message_headers_foreach (http_message->request_headers,
-				      (SoupMessageHeadersForeachFunc) debug_print_headers,
-				      NULL);
-#endif
-	status = soup_session_send_message (couchdb->priv->http_session, http_message);
-	if (SOUP_STATUS_IS_SUCCESSFUL (status)) {
-		if (output != NULL)
-		       	parse_json_response (couchdb, output, http_message, real_error);
-	       	return TRUE;
-	} else {
-		if (error != NULL)
-			g_set_error (error, COUCHDB_ERROR, status, "%s", http_message->reason_phrase);
-		return FALSE;
+	data = g_slice_new0 (AsyncMessageData);
+	data->couchdb = g_object_ref (G_OBJECT (couchdb));
+	data->http_message = http_message;
+	data->output = output != NULL ? g_object_ref (G_OBJECT (output)) : NULL;
+	data->result = result;
+	if (cancellable != NULL) {
+		data->cancellable = g_object_ref (G_OBJECT (cancellable));
+		data->cancelled_id = g_signal_connect (cancellable, "cancelled",
+						       G_CALLBACK (async_message_cancelled_cb),
+						       data);
+	}
+
+	/* The session takes ownership of the message */
+	start_request_timing (couchdb, http_message, method, url);
+	queue_async_message (couchdb, http_message, async_message_finished_cb, data);
+}
+
+/**
+ * couchdb_session_send_message_async:
+ * @couchdb: A #CouchdbSession object
+ * @method: HTTP method to use
+ * @url: URL to send the message to
+ * @body: Body of the HTTP request
+ * @output: Placeholder for output information
+ * @cancellable: A #GCancellable object, or NULL
+ * @callback: Function to call when the response has been received
+ * @user_data: Data to pass to @callback
+ *
+ * Asynchronous version of #couchdb_session_send_message. This function returns
+ * immediately, and @callback is called from the main loop once the response has
+ * been received (and parsed into @output, if not NULL). The callback should then
+ * call #couchdb_session_send_message_finish to get the result of the operation.
+ *
+ * As for #couchdb_session_send_message, this should not be used by applications
+ * unless they really have a need.
+ */
+void
+couchdb_session_send_message_async (CouchdbSession *couchdb,
+				    const char *method,
+				    const char *url,
+				    const char *body,
+				    JsonParser *output,
+				    GCancellable *cancellable,
+				    GAsyncReadyCallback callback,
+				    gpointer user_data)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (method != NULL);
+
+	send_message_async (couchdb, method, url, body, NULL, NULL, output,
+			    cancellable, callback, user_data);
+}
+
+/* Asynchronous version of couchdb_session_send_message_with_body, finished
+   with couchdb_session_send_message_finish */
+void
+couchdb_session_send_message_with_body_async (CouchdbSession *couchdb,
+					      const char *method,
+					      const char *url,
+					      CouchdbBodyFunc body_func,
+					      gpointer body_data,
+					      JsonParser *output,
+					      GCancellable *cancellable,
+					      GAsyncReadyCallback callback,
+					      gpointer user_data)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (method != NULL);
+	g_return_if_fail (body_func != NULL);
+
+	send_message_async (couchdb, method, url, NULL, body_func, body_data, output,
+			    cancellable, callback, user_data);
+}
+
+/**
+ * couchdb_session_send_message_finish:
+ * @couchdb: A #CouchdbSession object
+ * @result: A #GAsyncResult, as passed to the callback
+ * @error: Placeholder for error information
+ *
+ * Finish an operation started with #couchdb_session_send_message_async.
+ *
+ * Return value: TRUE if successful, FALSE otherwise.
+ */
+gboolean
+couchdb_session_send_message_finish (CouchdbSession *couchdb, GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, G_OBJECT (couchdb),
+							      couchdb_session_send_message_async), FALSE);
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error);
+}
+
+SoupMessage *
+couchdb_session_queue_message (CouchdbSession *couchdb,
+			       const char *method,
+			       const char *url,
+			       const char *body,
+			       SoupSessionCallback callback,
+			       gpointer user_data)
+{
+	SoupMessage *http_message;
+	GError *error = NULL;
+
+	g_return_val_if_fail (COUCHDB_IS_SESSION (couchdb), NULL);
+	g_return_val_if_fail (method != NULL, NULL);
+
+	http_message = prepare_message (couchdb, method, url, body, &error);
+	if (http_message == NULL) {
+		g_warning ("Could not send message: %s", error->message);
+		g_error_free (error);
+		return NULL;
 	}
+
+	/* The session takes ownership of the message */
+	queue_async_message (couchdb, http_message, callback, user_data);
+
+	return http_message;
+}
+
+/* Signals about documents are emitted with the database name as detail, so
+   that handlers connected to "document_updated::dbname" only run for changes
+   in that database */
+void
+couchdb_session_emit_document_created (CouchdbSession *couchdb, const char *dbname, CouchdbDocument *document)
+{
+	g_signal_emit (couchdb, couchdb_session_signals[DOCUMENT_CREATED],
+		       g_quark_from_string (dbname), dbname, document);
+}
+
+void
+couchdb_session_emit_document_updated (CouchdbSession *couchdb, const char *dbname, CouchdbDocument *document)
+{
+	g_signal_emit (couchdb, couchdb_session_signals[DOCUMENT_UPDATED],
+		       g_quark_from_string (dbname), dbname, document);
+}
+
+void
+couchdb_session_emit_document_deleted (CouchdbSession *couchdb, const char *dbname, const char *docid)
+{
+	g_signal_emit (couchdb, couchdb_session_signals[DOCUMENT_DELETED],
+		       g_quark_from_string (dbname), dbname, docid);
+}
+
+/* The connections listening for changes don't emit "request-finished", as
+   they are not accounted, so their failures, before reconnecting, are
+   notified separately */
+void
+couchdb_session_emit_changes_feed_failed (CouchdbSession *couchdb, guint status_code)
+{
+	g_signal_emit (couchdb, couchdb_session_signals[CHANGES_FEED_FAILED], 0, status_code);
+}
+
+void
+couchdb_session_cancel_message (CouchdbSession *couchdb, SoupMessage *http_message)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (SOUP_IS_MESSAGE (http_message));
+
+	cancel_async_message (couchdb, http_message);
 }
 
 #ifdef DEBUG_MESSAGES
@@ -26,10 +26,13 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <json-glib/json-glib.h>
 #include "couchdb-types.h"
 #include "couchdb-credentials.h"
 #include "couchdb-database-info.h"
+#include "couchdb-bulk-result.h"
+#include "couchdb-stats.h"
 
 G_BEGIN_DECLS
 
@@ -42,6 +45,15 @@ G_BEGIN_DECLS
 
 typedef struct _CouchdbSessionPrivate CouchdbSessionPrivate;
 
+typedef enum {
+	COUCHDB_BULK_FLAGS_NONE           = 0,
+	COUCHDB_BULK_FLAGS_ALL_OR_NOTHING = 1 << 0
+} CouchdbBulkFlags;
+
+typedef void (* CouchdbRowFunc) (JsonObject *row, gpointer user_data);
+typedef void (* CouchdbDocumentForeachFunc) (CouchdbDocument *document, gpointer user_data);
+typedef void (* CouchdbChangeFunc) (const char *docid, CouchdbDocument *document, gpointer user_data);
+
 typedef struct {
 	GObject parent;
 
@@ -59,10 +71,16 @@ typedef struct {
 	void (* document_created) (CouchdbSession *couchdb, const char *dbname, CouchdbDocument *document);
 	void (* document_updated) (CouchdbSession *couchdb, const char *dbname, CouchdbDocument *document);
 	void (* document_deleted) (CouchdbSession *couchdb, const char *dbname, const char *docid);
+
+	void (* request_started) (CouchdbSession *couchdb, const char *method, const char *url);
+	void (* request_finished) (CouchdbSession *couchdb, const char *url, const CouchdbRequestInfo *info);
+
+	void (* changes_feed_failed) (CouchdbSession *couchdb, guint status_code);
 } CouchdbSessionClass;
 
 GType                couchdb_session_get_type (void);
 CouchdbSession      *couchdb_session_new (const char *uri);
+CouchdbSession      *couchdb_session_new_shared (const char *uri, CouchdbCredentials *credentials);
 
 const char          *couchdb_session_get_uri (CouchdbSession *couchdb);
 
@@ -81,16 +99,79 @@ void                 couchdb_session_enable_authentication (CouchdbSession *couc
 void                 couchdb_session_disable_authentication (CouchdbSession *couchdb);
 gboolean             couchdb_session_is_authentication_enabled (CouchdbSession *couchdb);
 
+void                 couchdb_session_set_document_cache_size (CouchdbSession *couchdb, gsize max_size);
+gsize                couchdb_session_get_document_cache_size (CouchdbSession *couchdb);
+void                 couchdb_session_get_document_cache_stats (CouchdbSession *couchdb,
+							       guint *hits,
+							       guint *misses);
+
+void                 couchdb_session_get_stats (CouchdbSession *couchdb, CouchdbSessionStats *stats);
+void                 couchdb_session_reset_stats (CouchdbSession *couchdb);
+
 gboolean             couchdb_session_send_message (CouchdbSession *couchdb,
 						   const char *method,
 						   const char *url,
 						   const char *body,
 						   JsonParser *output,
 						   GError **error);
+void                 couchdb_session_send_message_async (CouchdbSession *couchdb,
+							 const char *method,
+							 const char *url,
+							 const char *body,
+							 JsonParser *output,
+							 GCancellable *cancellable,
+							 GAsyncReadyCallback callback,
+							 gpointer user_data);
+gboolean             couchdb_session_send_message_finish (CouchdbSession *couchdb,
+							  GAsyncResult *result,
+							  GError **error);
+gboolean             couchdb_session_send_message_stream (CouchdbSession *couchdb,
+							  const char *method,
+							  const char *url,
+							  const char *body,
+							  CouchdbRowFunc func,
+							  gpointer user_data,
+							  JsonParser *envelope,
+							  GError **error);
 
 GSList              *couchdb_session_list_documents (CouchdbSession *couchdb, const char *dbname, GError **error);
+void                 couchdb_session_list_documents_async (CouchdbSession *couchdb,
+							   const char *dbname,
+							   GCancellable *cancellable,
+							   GAsyncReadyCallback callback,
+							   gpointer user_data);
+GSList              *couchdb_session_list_documents_finish (CouchdbSession *couchdb,
+							    GAsyncResult *result,
+							    GError **error);
 void                 couchdb_session_free_document_list (GSList *doclist);
 
+gboolean             couchdb_session_foreach_document (CouchdbSession *couchdb,
+						       const char *dbname,
+						       CouchdbDocumentForeachFunc func,
+						       gpointer user_data,
+						       GError **error);
+GSList              *couchdb_session_get_all_documents (CouchdbSession *couchdb, const char *dbname, GError **error);
+GSList              *couchdb_session_get_documents_by_id (CouchdbSession *couchdb,
+							  const char *dbname,
+							  GSList *docids,
+							  GError **error);
+void                 couchdb_session_free_documents (GSList *documents);
+
+gboolean             couchdb_session_foreach_change (CouchdbSession *couchdb,
+						     const char *dbname,
+						     gint since,
+						     CouchdbChangeFunc func,
+						     gpointer user_data,
+						     gint *last_sequence,
+						     GError **error);
+
+GSList              *couchdb_session_put_documents (CouchdbSession *couchdb,
+						    const char *dbname,
+						    GPtrArray *documents,
+						    CouchdbBulkFlags flags,
+						    GError **error);
+void                 couchdb_session_free_bulk_results (GSList *results);
+
 gboolean             couchdb_session_replicate (CouchdbSession *couchdb,
 						const gchar *source,
 						const gchar *target,
@@ -0,0 +1,160 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <libsoup/soup-status.h>
+#include "couchdb-stats.h"
+#include "utils.h"
+
+static const gdouble bucket_limits[COUCHDB_HISTOGRAM_N_BUCKETS - 1] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000
+};
+
+/**
+ * couchdb_histogram_get_bucket_limit:
+ * @bucket: Index of the bucket
+ *
+ * Get the upper bound of the given bucket of a #CouchdbHistogram.
+ *
+ * Return value: The upper bound, in milliseconds, of the values counted in
+ * @bucket, or G_MAXDOUBLE for the last bucket.
+ */
+gdouble
+couchdb_histogram_get_bucket_limit (guint bucket)
+{
+	g_return_val_if_fail (bucket < COUCHDB_HISTOGRAM_N_BUCKETS, 0);
+
+	if (bucket == COUCHDB_HISTOGRAM_N_BUCKETS - 1)
+		return G_MAXDOUBLE;
+
+	return bucket_limits[bucket];
+}
+
+/**
+ * couchdb_histogram_get_mean:
+ * @histogram: A #CouchdbHistogram
+ *
+ * Get the mean of the values recorded in the given histogram.
+ *
+ * Return value: The mean, in milliseconds, or 0 if no value was recorded.
+ */
+gdouble
+couchdb_histogram_get_mean (const CouchdbHistogram *histogram)
+{
+	g_return_val_if_fail (histogram != NULL, 0);
+
+	if (histogram->count == 0)
+		return 0;
+
+	return histogram->total / histogram->count;
+}
+
+static void
+histogram_add (CouchdbHistogram *histogram, gdouble value)
+{
+	guint i;
+
+	for (i = 0; i < COUCHDB_HISTOGRAM_N_BUCKETS - 1; i++) {
+		if (value <= bucket_limits[i])
+			break;
+	}
+
+	histogram->buckets[i]++;
+	histogram->count++;
+	histogram->total += value;
+	if (value > histogram->max)
+		histogram->max = value;
+}
+
+static void
+request_stats_add (CouchdbRequestStats *stats, const CouchdbRequestInfo *info)
+{
+	stats->requests++;
+	if (!SOUP_STATUS_IS_SUCCESSFUL (info->status_code) &&
+	    info->status_code != SOUP_STATUS_NOT_MODIFIED)
+		stats->failures++;
+
+	stats->bytes_sent += info->bytes_sent;
+	stats->bytes_received += info->bytes_received;
+
+	histogram_add (&stats->time_to_first_byte, info->time_to_first_byte);
+	histogram_add (&stats->total_time, info->total_time);
+	histogram_add (&stats->parse_time, info->parse_time);
+}
+
+void
+couchdb_session_stats_add (CouchdbSessionStats *stats, const CouchdbRequestInfo *info)
+{
+	request_stats_add (&stats->total, info);
+	request_stats_add (&stats->by_method[info->method], info);
+	request_stats_add (&stats->by_endpoint[info->endpoint], info);
+}
+
+CouchdbRequestMethod
+couchdb_request_method_from_string (const char *method)
+{
+	if (!g_strcmp0 (method, "GET"))
+		return COUCHDB_REQUEST_METHOD_GET;
+	else if (!g_strcmp0 (method, "PUT"))
+		return COUCHDB_REQUEST_METHOD_PUT;
+	else if (!g_strcmp0 (method, "POST"))
+		return COUCHDB_REQUEST_METHOD_POST;
+	else if (!g_strcmp0 (method, "DELETE"))
+		return COUCHDB_REQUEST_METHOD_DELETE;
+
+	return COUCHDB_REQUEST_METHOD_OTHER;
+}
+
+/* @path is the path of the request, relative to the CouchDB instance */
+CouchdbEndpointClass
+couchdb_endpoint_class_from_path (const char *path)
+{
+	char **segments;
+	guint n_segments;
+	CouchdbEndpointClass endpoint;
+
+	while (*path == '/')
+		path++;
+
+	segments = g_strsplit (path, "/", 4);
+	n_segments = g_strv_length (segments);
+
+	if (n_segments == 0 || segments[0][0] == '\0' || segments[0][0] == '_')
+		endpoint = COUCHDB_ENDPOINT_SERVER;
+	else if (n_segments == 1 || segments[1][0] == '\0')
+		endpoint = COUCHDB_ENDPOINT_DATABASE;
+	else if (!strcmp (segments[1], "_all_docs") || !strcmp (segments[1], "_bulk_docs"))
+		endpoint = COUCHDB_ENDPOINT_BULK;
+	else if (!strcmp (segments[1], "_changes"))
+		endpoint = COUCHDB_ENDPOINT_CHANGES;
+	else if (!strcmp (segments[1], "_design") && n_segments > 3 &&
+		 (g_str_has_prefix (segments[3], "_view/") || !strcmp (segments[3], "_view")))
+		endpoint = COUCHDB_ENDPOINT_VIEW;
+	else if (!strcmp (segments[1], "_design") || !strcmp (segments[1], "_local") ||
+		 segments[1][0] != '_')
+		endpoint = COUCHDB_ENDPOINT_DOCUMENT;
+	else
+		endpoint = COUCHDB_ENDPOINT_DATABASE;
+
+	g_strfreev (segments);
+
+	return endpoint;
+}
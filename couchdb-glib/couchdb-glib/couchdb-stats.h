@@ -0,0 +1,94 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __COUCHDB_STATS_H__
+#define __COUCHDB_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+	COUCHDB_REQUEST_METHOD_GET,
+	COUCHDB_REQUEST_METHOD_PUT,
+	COUCHDB_REQUEST_METHOD_POST,
+	COUCHDB_REQUEST_METHOD_DELETE,
+	COUCHDB_REQUEST_METHOD_OTHER,
+	COUCHDB_REQUEST_METHOD_LAST
+} CouchdbRequestMethod;
+
+typedef enum {
+	COUCHDB_ENDPOINT_SERVER,	/* /, _all_dbs, _replicate... */
+	COUCHDB_ENDPOINT_DATABASE,	/* /db/, /db/_compact... */
+	COUCHDB_ENDPOINT_DOCUMENT,	/* /db/docid */
+	COUCHDB_ENDPOINT_BULK,		/* /db/_all_docs, /db/_bulk_docs */
+	COUCHDB_ENDPOINT_VIEW,		/* /db/_design/ddoc/_view/view */
+	COUCHDB_ENDPOINT_CHANGES,	/* /db/_changes */
+	COUCHDB_ENDPOINT_LAST
+} CouchdbEndpointClass;
+
+/* Upper bounds, in milliseconds, of the histogram buckets are 1, 2, 5, 10, 20,
+   50, 100, 200, 500, 1000, 2000 and 5000. The last bucket counts the rest */
+#define COUCHDB_HISTOGRAM_N_BUCKETS 13
+
+typedef struct {
+	guint count;
+	gdouble total;
+	gdouble max;
+	guint buckets[COUCHDB_HISTOGRAM_N_BUCKETS];
+} CouchdbHistogram;
+
+typedef struct {
+	guint requests;
+	guint failures;
+	guint64 bytes_sent;
+	guint64 bytes_received;
+
+	CouchdbHistogram time_to_first_byte;
+	CouchdbHistogram total_time;
+	CouchdbHistogram parse_time;
+} CouchdbRequestStats;
+
+typedef struct {
+	CouchdbRequestStats total;
+	CouchdbRequestStats by_method[COUCHDB_REQUEST_METHOD_LAST];
+	CouchdbRequestStats by_endpoint[COUCHDB_ENDPOINT_LAST];
+} CouchdbSessionStats;
+
+typedef struct {
+	CouchdbRequestMethod method;
+	CouchdbEndpointClass endpoint;
+	guint status_code;
+
+	gsize bytes_sent;
+	gsize bytes_received;
+
+	gdouble time_to_first_byte;
+	gdouble total_time;
+	gdouble parse_time;
+} CouchdbRequestInfo;
+
+gdouble couchdb_histogram_get_bucket_limit (guint bucket);
+gdouble couchdb_histogram_get_mean (const CouchdbHistogram *histogram);
+
+G_END_DECLS
+
+#endif /* __COUCHDB_STATS_H__ */
@@ -29,9 +29,11 @@
 G_BEGIN_DECLS
 
 typedef struct _CouchdbArrayField CouchdbArrayField;
+typedef struct _CouchdbBulkResult CouchdbBulkResult;
 typedef struct _CouchdbDocument CouchdbDocument;
 typedef struct _CouchdbDatabaseInfo CouchdbDatabaseInfo;
 typedef struct _CouchdbDocumentInfo CouchdbDocumentInfo;
+typedef struct _CouchdbFieldKey CouchdbFieldKey;
 typedef struct _CouchdbStructField CouchdbStructField;
 
 G_END_DECLS
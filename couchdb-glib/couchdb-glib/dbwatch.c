@@ -20,127 +20,476 @@
  */
 
 #include <libsoup/soup-method.h>
+#include <libsoup/soup-session.h>
 #include "couchdb-document.h"
 #include "dbwatch.h"
+#include "row-splitter.h"
 #include "utils.h"
 
-#define LOCAL_TIMEOUT_SECONDS  60
-#define REMOTE_TIMEOUT_SECONDS 300
+/* CouchDB sends a newline every HEARTBEAT_MILLISECONDS on idle feeds, so
+   that dead connections are noticed */
+#define HEARTBEAT_MILLISECONDS 30000
+
+/* Seconds to wait before reconnecting after the feed connection is lost,
+   doubled on each consecutive failure */
+#define MIN_BACKOFF_SECONDS 1
+#define MAX_BACKOFF_SECONDS 300
+
+/* A request reading changes: the server-wide _db_updates feed (watch is
+   NULL), a continuous _changes feed for one database, or a one-shot
+   _changes request bringing one database up to date */
+struct _ChangesFeed {
+	ChangesDispatcher *dispatcher;
+	DBWatch *watch;
+	gboolean continuous;
+	SoupMessage *http_message;
+	RowSplitter *splitter;
+};
+
+static void start_feed (DBWatch *watch);
+static void start_updates_feed (ChangesDispatcher *dispatcher);
+
+/* Revisions are "N-hash", N being the number of times the document was saved */
+static gboolean
+revision_is_first (const gchar *revision)
+{
+	return revision != NULL && g_ascii_strtoull (revision, NULL, 10) == 1;
+}
 
 static void
-process_change (DBWatch *watch, JsonNode *node)
+process_change (DBWatch *watch, JsonObject *this_change)
 {
-	JsonObject *this_change;
 	const gchar *id;
+	JsonObject *doc;
 	CouchdbDocument *document;
-	GError *error = NULL;
-
-	if (json_node_get_node_type (node) != JSON_NODE_OBJECT)
-		return;
+	CouchdbSession *couchdb = watch->dispatcher->couchdb;
 
-	this_change = json_node_get_object (node);
 	if (!json_object_has_member (this_change, "id"))
 		return;
 
 	id = json_object_get_string_member (this_change, "id");
 
-	/* We need to try retrieving the document, to check if it's removed or not */
-	document = couchdb_document_get (watch->couchdb, watch->dbname, id, &error);
-	if (document) {
-		const gchar *revision;
-
-		revision = couchdb_document_get_revision (document);
-		if (revision != NULL) {
-			if (revision[0] == '1')
-				g_signal_emit_by_name (watch->couchdb, "document_created",
-						       watch->dbname, document);
-			else
-				g_signal_emit_by_name (watch->couchdb, "document_updated",
-						       watch->dbname, document);
-		}
+	/* Whatever the change is, the cached copy, if any, is outdated */
+	couchdb_session_invalidate_document (couchdb, watch->dbname, id);
+
+	if (json_object_has_member (this_change, "deleted")
+	    && json_object_get_boolean_member (this_change, "deleted")) {
+		couchdb_session_emit_document_deleted (couchdb, watch->dbname, id);
+		return;
+	}
+
+	/* The feed is requested with include_docs=true, so we get the document
+	   contents with the change, no need to retrieve it */
+	if (!json_object_has_member (this_change, "doc")
+	    || json_object_get_null_member (this_change, "doc")) {
+		g_warning ("Change for document '%s' does not contain the document", id);
+		return;
+	}
+
+	doc = json_object_get_object_member (this_change, "doc");
+	document = couchdb_document_new_from_json_object (couchdb, watch->dbname, doc);
+
+	if (revision_is_first (couchdb_document_get_revision (document)))
+		couchdb_session_emit_document_created (couchdb, watch->dbname, document);
+	else
+		couchdb_session_emit_document_updated (couchdb, watch->dbname, document);
+
+	g_object_unref (G_OBJECT (document));
+}
+
+/* Bring a database up to date, or remember to do it again once the
+   request already running is done, since it might have missed the change */
+static void
+fetch_changes (DBWatch *watch)
+{
+	if (watch->feed != NULL)
+		watch->fetch_pending = TRUE;
+	else if (watch->reconnect_id == 0)
+		start_feed (watch);
+}
+
+static void
+feed_row_cb (JsonObject *row, gpointer user_data)
+{
+	ChangesFeed *feed = (ChangesFeed *) user_data;
+	DBWatch *watch = feed->watch;
+
+	if (watch == NULL)
+		return;
+
+	if (json_object_has_member (row, "seq")) {
+		process_change (watch, row);
+		watch->last_update_seq = json_object_get_int_member (row, "seq");
+	} else if (json_object_has_member (row, "last_seq")) {
+		/* Sent by CouchDB when it closes the feed */
+		watch->last_update_seq = json_object_get_int_member (row, "last_seq");
+	}
+}
+
+static void
+updates_row_cb (JsonObject *row, gpointer user_data)
+{
+	ChangesFeed *feed = (ChangesFeed *) user_data;
+	DBWatch *watch;
+
+	if (feed->dispatcher == NULL || !json_object_has_member (row, "db_name"))
+		return;
+
+	/* Most updates are for databases nobody is watching, so this is the
+	   only thing done for them */
+	watch = g_hash_table_lookup (feed->dispatcher->watches,
+				     json_object_get_string_member (row, "db_name"));
+	if (watch == NULL)
+		return;
+
+	if (json_object_has_member (row, "type")
+	    && g_strcmp0 (json_object_get_string_member (row, "type"), "deleted") == 0)
+		return;
+
+	fetch_changes (watch);
+}
+
+static gboolean
+feed_is_alive (ChangesFeed *feed)
+{
+	return feed->dispatcher != NULL
+		&& (feed->watch != NULL || feed->dispatcher->updates_feed == feed);
+}
+
+static void
+feed_got_chunk_cb (SoupMessage *http_message, SoupBuffer *chunk, gpointer user_data)
+{
+	GError *error = NULL;
+	ChangesFeed *feed = (ChangesFeed *) user_data;
+
+	if (!feed_is_alive (feed) || !SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code))
+		return;
+
+	if (!row_splitter_feed (feed->splitter, chunk->data, chunk->length, &error)) {
+		g_warning ("Error parsing changes feed for '%s': %s",
+			   feed->watch != NULL ? feed->watch->dbname : "_db_updates",
+			   error->message);
+		g_error_free (error);
+
+		couchdb_session_cancel_message (feed->dispatcher->couchdb, http_message);
+	}
+}
+
+static void
+feed_got_headers_cb (SoupMessage *http_message, gpointer user_data)
+{
+	ChangesFeed *feed = (ChangesFeed *) user_data;
+
+	if (!feed_is_alive (feed) || !SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code))
+		return;
 
-		g_object_unref (G_OBJECT (document));
+	/* The connection is working, so start over with the backoff */
+	if (feed->watch != NULL) {
+		feed->watch->backoff = MIN_BACKOFF_SECONDS;
 	} else {
-		if (error != NULL) {
-			g_warning ("Error retrieving document '%s': %s", id, error->message);
-			g_error_free (error);
+		ChangesDispatcher *dispatcher = feed->dispatcher;
+		GHashTableIter iter;
+		gpointer value;
+
+		dispatcher->backoff = MIN_BACKOFF_SECONDS;
+		dispatcher->mode = DISPATCH_MODE_DB_UPDATES;
+
+		/* Changes done before the feed was connected are not notified
+		   on it, so catch up with all databases */
+		g_hash_table_iter_init (&iter, dispatcher->watches);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+			fetch_changes ((DBWatch *) value);
+	}
+}
+
+static gboolean
+reconnect_cb (gpointer user_data)
+{
+	DBWatch *watch = (DBWatch *) user_data;
+
+	watch->reconnect_id = 0;
+	start_feed (watch);
+
+	return FALSE;
+}
+
+static void
+feed_finished_cb (SoupSession *session, SoupMessage *http_message, gpointer user_data)
+{
+	ChangesFeed *feed = (ChangesFeed *) user_data;
+	DBWatch *watch = feed->watch;
+
+	if (watch != NULL) {
+		watch->feed = NULL;
+
+		if (!feed->continuous && SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code)) {
+			/* Up to date, unless something changed in the meantime,
+			   or _db_updates turned out to be unavailable, so that
+			   this database needs a feed of its own */
+			watch->backoff = MIN_BACKOFF_SECONDS;
+			if (watch->fetch_pending || watch->dispatcher->mode == DISPATCH_MODE_PER_DATABASE) {
+				watch->fetch_pending = FALSE;
+				start_feed (watch);
+			}
 		} else {
-			/* The document is no longer in the DB, notify */
-			g_signal_emit_by_name (watch->couchdb, "document_deleted", watch->dbname, id);
+			/* The connection was closed by the server or lost, so
+			   retry from the last sequence number we got */
+			g_debug ("Changes feed for '%s' closed (%d), reconnecting in %d seconds",
+				 watch->dbname, http_message->status_code, watch->backoff);
+
+			if (!SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code))
+				couchdb_session_emit_changes_feed_failed (watch->dispatcher->couchdb,
+									  http_message->status_code);
+
+			watch->fetch_pending = FALSE;
+			watch->reconnect_id = g_timeout_add_seconds (watch->backoff, reconnect_cb, watch);
+			watch->backoff = MIN (watch->backoff * 2, MAX_BACKOFF_SECONDS);
 		}
 	}
+
+	row_splitter_free (feed->splitter);
+	g_slice_free (ChangesFeed, feed);
 }
 
 static gboolean
-watch_timeout_cb (gpointer user_data)
+reconnect_updates_cb (gpointer user_data)
 {
-	char *url;
-	JsonParser *parser;
-	GError *error = NULL;
-	DBWatch *watch = (DBWatch *) user_data;
+	ChangesDispatcher *dispatcher = (ChangesDispatcher *) user_data;
+
+	dispatcher->reconnect_id = 0;
+	start_updates_feed (dispatcher);
+
+	return FALSE;
+}
+
+static void
+updates_feed_finished_cb (SoupSession *session, SoupMessage *http_message, gpointer user_data)
+{
+	ChangesFeed *feed = (ChangesFeed *) user_data;
+	ChangesDispatcher *dispatcher = feed->dispatcher;
 
-	url = g_strdup_printf ("%s/%s/_changes?since=%d",
-			       couchdb_session_get_uri (watch->couchdb),
-			       watch->dbname,
-			       watch->last_update_seq);
-	parser = json_parser_new ();
-	if (couchdb_session_send_message (watch->couchdb, SOUP_METHOD_GET, url, NULL, parser, &error)) {
-		JsonNode *root_node;
-
-		root_node = json_parser_get_root (parser);
-		if (json_node_get_node_type (root_node) == JSON_NODE_OBJECT) {
-			JsonObject *root_object;
-			JsonArray *results;
-
-			root_object = json_node_get_object (root_node);
-			results = json_object_get_array_member (root_object, "results");
-			if (results) {
-				GList *json_elements, *sl;
-
-				json_elements = json_array_get_elements (results);
-				for (sl = json_elements; sl != NULL; sl = sl->next)
-					process_change (watch, (JsonNode *) sl->data);
+	if (dispatcher != NULL && dispatcher->updates_feed == feed) {
+		dispatcher->updates_feed = NULL;
+
+		if (SOUP_STATUS_IS_CLIENT_ERROR (http_message->status_code)) {
+			GHashTableIter iter;
+			gpointer value;
+
+			/* Servers without _db_updates, or where we are not an
+			   admin, reject it, so use one feed per database */
+			g_debug ("_db_updates not available (%d), using one feed per database",
+				 http_message->status_code);
+
+			dispatcher->mode = DISPATCH_MODE_PER_DATABASE;
+			g_hash_table_iter_init (&iter, dispatcher->watches);
+			while (g_hash_table_iter_next (&iter, NULL, &value)) {
+				DBWatch *watch = (DBWatch *) value;
+
+				if (watch->feed == NULL && watch->reconnect_id == 0)
+					start_feed (watch);
 			}
+		} else if (g_hash_table_size (dispatcher->watches) > 0) {
+			g_debug ("_db_updates feed closed (%d), reconnecting in %d seconds",
+				 http_message->status_code, dispatcher->backoff);
+
+			if (!SOUP_STATUS_IS_SUCCESSFUL (http_message->status_code))
+				couchdb_session_emit_changes_feed_failed (dispatcher->couchdb,
+									  http_message->status_code);
+
+			dispatcher->reconnect_id = g_timeout_add_seconds (dispatcher->backoff,
+									  reconnect_updates_cb,
+									  dispatcher);
+			dispatcher->backoff = MIN (dispatcher->backoff * 2, MAX_BACKOFF_SECONDS);
+		}
+	}
+
+	row_splitter_free (feed->splitter);
+	g_slice_free (ChangesFeed, feed);
+}
 
-			if (json_object_has_member (root_object, "last_seq"))
-				watch->last_update_seq = json_object_get_int_member (root_object, "last_seq");
-		}		
+static ChangesFeed *
+queue_feed (ChangesDispatcher *dispatcher,
+	    DBWatch *watch,
+	    const char *url,
+	    gboolean continuous,
+	    RowSplitterFunc row_func,
+	    SoupSessionCallback finished_func)
+{
+	ChangesFeed *feed;
+
+	feed = g_slice_new0 (ChangesFeed);
+	feed->dispatcher = dispatcher;
+	feed->watch = watch;
+	feed->continuous = continuous;
+	feed->splitter = row_splitter_new (continuous ? ROW_SPLITTER_MODE_OBJECTS : ROW_SPLITTER_MODE_ARRAY,
+					   row_func, feed);
+	feed->http_message = couchdb_session_queue_message (dispatcher->couchdb, SOUP_METHOD_GET, url, NULL,
+							    finished_func, feed);
+	if (feed->http_message == NULL) {
+		row_splitter_free (feed->splitter);
+		g_slice_free (ChangesFeed, feed);
+
+		return NULL;
 	}
 
-	/* Free memory */
-	g_object_unref (G_OBJECT (parser));
+	/* Rows are processed as they arrive, so don't keep them around */
+	soup_message_body_set_accumulate (feed->http_message->response_body, FALSE);
+	g_signal_connect (G_OBJECT (feed->http_message), "got-headers",
+			  G_CALLBACK (feed_got_headers_cb), feed);
+	g_signal_connect (G_OBJECT (feed->http_message), "got-chunk",
+			  G_CALLBACK (feed_got_chunk_cb), feed);
+
+	return feed;
+}
+
+static void
+start_feed (DBWatch *watch)
+{
+	char *url;
+	gboolean continuous;
+
+	/* With _db_updates telling us when the database changes, a normal
+	   request is enough, and the connection goes back to the pool */
+	continuous = watch->dispatcher->mode == DISPATCH_MODE_PER_DATABASE;
+	if (continuous) {
+		url = g_strdup_printf ("%s/%s/_changes?feed=continuous&include_docs=true&heartbeat=%d&since=%d",
+				       couchdb_session_get_uri (watch->dispatcher->couchdb),
+				       watch->dbname,
+				       HEARTBEAT_MILLISECONDS,
+				       watch->last_update_seq);
+	} else {
+		url = g_strdup_printf ("%s/%s/_changes?include_docs=true&since=%d",
+				       couchdb_session_get_uri (watch->dispatcher->couchdb),
+				       watch->dbname,
+				       watch->last_update_seq);
+	}
+
+	watch->feed = queue_feed (watch->dispatcher, watch, url, continuous,
+				  feed_row_cb, feed_finished_cb);
+
 	g_free (url);
+}
 
-	return TRUE;
+static void
+start_updates_feed (ChangesDispatcher *dispatcher)
+{
+	char *url;
+
+	url = g_strdup_printf ("%s/_db_updates?feed=continuous&heartbeat=%d",
+			       couchdb_session_get_uri (dispatcher->couchdb),
+			       HEARTBEAT_MILLISECONDS);
+	dispatcher->updates_feed = queue_feed (dispatcher, NULL, url, TRUE,
+					       updates_row_cb, updates_feed_finished_cb);
+
+	g_free (url);
 }
 
-DBWatch *
-dbwatch_new (CouchdbSession *couchdb, const gchar *dbname, gint update_seq)
+static void
+dbwatch_free (DBWatch *watch)
+{
+	if (watch->feed != NULL) {
+		ChangesFeed *feed = watch->feed;
+
+		/* The feed is freed when libsoup is done with the message */
+		feed->watch = NULL;
+		feed->dispatcher = NULL;
+		couchdb_session_cancel_message (watch->dispatcher->couchdb, feed->http_message);
+	}
+
+	if (watch->reconnect_id != 0)
+		g_source_remove (watch->reconnect_id);
+
+	g_free (watch->dbname);
+	g_free (watch);
+}
+
+static void
+stop_updates_feed (ChangesDispatcher *dispatcher)
+{
+	if (dispatcher->updates_feed != NULL) {
+		ChangesFeed *feed = dispatcher->updates_feed;
+
+		dispatcher->updates_feed = NULL;
+		feed->dispatcher = NULL;
+		couchdb_session_cancel_message (dispatcher->couchdb, feed->http_message);
+	}
+
+	if (dispatcher->reconnect_id != 0) {
+		g_source_remove (dispatcher->reconnect_id);
+		dispatcher->reconnect_id = 0;
+	}
+}
+
+ChangesDispatcher *
+changes_dispatcher_new (CouchdbSession *couchdb)
+{
+	ChangesDispatcher *dispatcher;
+
+	dispatcher = g_new0 (ChangesDispatcher, 1);
+	dispatcher->couchdb = couchdb;
+	dispatcher->watches = g_hash_table_new_full (g_str_hash, g_str_equal,
+						     NULL, (GDestroyNotify) dbwatch_free);
+	dispatcher->mode = DISPATCH_MODE_UNKNOWN;
+	dispatcher->backoff = MIN_BACKOFF_SECONDS;
+
+	return dispatcher;
+}
+
+void
+changes_dispatcher_free (ChangesDispatcher *dispatcher)
+{
+	g_hash_table_destroy (dispatcher->watches);
+	stop_updates_feed (dispatcher);
+
+	g_free (dispatcher);
+}
+
+gboolean
+changes_dispatcher_add_database (ChangesDispatcher *dispatcher, const gchar *dbname, gint update_seq)
 {
 	DBWatch *watch;
-	guint timeout;
+
+	if (g_hash_table_lookup (dispatcher->watches, dbname) != NULL)
+		return FALSE;
 
 	watch = g_new0 (DBWatch, 1);
-	watch->couchdb = couchdb;
+	watch->dispatcher = dispatcher;
 	watch->dbname = g_strdup (dbname);
 	watch->last_update_seq = update_seq;
+	watch->backoff = MIN_BACKOFF_SECONDS;
+	g_hash_table_insert (dispatcher->watches, watch->dbname, watch);
 
-	/* Set timeout to check for changes every 5 minutes*/
-	if (g_str_has_prefix (couchdb_session_get_uri (watch->couchdb), "http://127.0.0.1"))
-		timeout = LOCAL_TIMEOUT_SECONDS;
-	else
-		timeout = REMOTE_TIMEOUT_SECONDS;
+	switch (dispatcher->mode) {
+	case DISPATCH_MODE_PER_DATABASE:
+		start_feed (watch);
+		break;
+	case DISPATCH_MODE_DB_UPDATES:
+		if (dispatcher->updates_feed != NULL) {
+			start_feed (watch);
+			break;
+		}
+		/* Fall through, the feed will catch up when connected */
+	case DISPATCH_MODE_UNKNOWN:
+		if (dispatcher->updates_feed == NULL && dispatcher->reconnect_id == 0)
+			start_updates_feed (dispatcher);
+		break;
+	}
+
+	return TRUE;
+}
 
-	watch->timeout_id = g_timeout_add (timeout * 1000, (GSourceFunc) watch_timeout_cb, watch);
-	
-	return watch;
+gboolean
+changes_dispatcher_has_database (ChangesDispatcher *dispatcher, const gchar *dbname)
+{
+	return g_hash_table_lookup (dispatcher->watches, dbname) != NULL;
 }
 
 void
-dbwatch_free (DBWatch *watch)
+changes_dispatcher_remove_database (ChangesDispatcher *dispatcher, const gchar *dbname)
 {
-	g_free (watch->dbname);
-	g_source_remove (watch->timeout_id);
+	g_hash_table_remove (dispatcher->watches, dbname);
 
-	g_free (watch);
+	/* No need to keep the server-wide feed if nothing is watched */
+	if (g_hash_table_size (dispatcher->watches) == 0)
+		stop_updates_feed (dispatcher);
 }
@@ -26,14 +26,45 @@
 #include "couchdb-session.h"
 #include "utils.h"
 
+typedef struct _ChangesFeed ChangesFeed;
+
+typedef enum {
+	/* Still waiting to know if the server supports _db_updates */
+	DISPATCH_MODE_UNKNOWN,
+	/* One server-wide _db_updates feed tells which databases changed */
+	DISPATCH_MODE_DB_UPDATES,
+	/* One continuous _changes feed per database */
+	DISPATCH_MODE_PER_DATABASE
+} DispatchMode;
+
 typedef struct {
 	CouchdbSession *couchdb;
+	GHashTable *watches;
+	DispatchMode mode;
+
+	ChangesFeed *updates_feed;
+	guint reconnect_id;
+	guint backoff;
+} ChangesDispatcher;
+
+typedef struct {
+	ChangesDispatcher *dispatcher;
 	gchar *dbname;
 	gint last_update_seq;
-	guint timeout_id;
+
+	ChangesFeed *feed;
+	gboolean fetch_pending;
+	guint reconnect_id;
+	guint backoff;
 } DBWatch;
 
-DBWatch *dbwatch_new (CouchdbSession *couchdb, const gchar *dbname, gint update_seq);
-void     dbwatch_free (DBWatch *watch);
+ChangesDispatcher *changes_dispatcher_new (CouchdbSession *couchdb);
+void               changes_dispatcher_free (ChangesDispatcher *dispatcher);
+
+gboolean           changes_dispatcher_add_database (ChangesDispatcher *dispatcher,
+						    const gchar *dbname,
+						    gint update_seq);
+gboolean           changes_dispatcher_has_database (ChangesDispatcher *dispatcher, const gchar *dbname);
+void               changes_dispatcher_remove_database (ChangesDispatcher *dispatcher, const gchar *dbname);
 
 #endif /* __DBWATCH_H__ */
@@ -0,0 +1,205 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include "document-cache.h"
+
+/*
+ * LRU cache of documents, keyed by database name and document ID, and
+ * bounded by the size of the responses the documents came in. Documents are
+ * kept as the JSON text returned by CouchDB, which is shared, not copied,
+ * with the documents created from the cache.
+ * Along with each document we keep its ETag, so that the session can ask
+ * CouchDB whether the cached copy is still current with If-None-Match.
+ */
+
+typedef struct {
+	char *key;
+	char *etag;
+	SoupBuffer *buffer;
+	gsize size;
+	GList *link;
+} CacheEntry;
+
+static char *
+make_key (const char *dbname, const char *docid)
+{
+	/* Database names can't contain newlines */
+	return g_strdup_printf ("%s\n%s", dbname, docid);
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_free (entry->key);
+	g_free (entry->etag);
+	soup_buffer_free (entry->buffer);
+
+	g_slice_free (CacheEntry, entry);
+}
+
+static void
+remove_entry (DocumentCache *cache, CacheEntry *entry)
+{
+	cache->size -= entry->size;
+	g_queue_delete_link (cache->lru, entry->link);
+
+	/* This frees the entry */
+	g_hash_table_remove (cache->entries, entry->key);
+}
+
+static void
+evict (DocumentCache *cache)
+{
+	while (cache->size > cache->max_size && !g_queue_is_empty (cache->lru))
+		remove_entry (cache, (CacheEntry *) g_queue_peek_tail (cache->lru));
+}
+
+DocumentCache *
+document_cache_new (gsize max_size)
+{
+	DocumentCache *cache;
+
+	cache = g_new0 (DocumentCache, 1);
+	cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+						(GDestroyNotify) cache_entry_free);
+	cache->lru = g_queue_new ();
+	cache->max_size = max_size;
+
+	return cache;
+}
+
+void
+document_cache_free (DocumentCache *cache)
+{
+	g_queue_free (cache->lru);
+	g_hash_table_destroy (cache->entries);
+
+	g_free (cache);
+}
+
+void
+document_cache_set_max_size (DocumentCache *cache, gsize max_size)
+{
+	cache->max_size = max_size;
+	evict (cache);
+}
+
+const char *
+document_cache_get_etag (DocumentCache *cache, const char *dbname, const char *docid)
+{
+	char *key;
+	CacheEntry *entry;
+
+	key = make_key (dbname, docid);
+	entry = g_hash_table_lookup (cache->entries, key);
+	g_free (key);
+
+	return entry != NULL ? entry->etag : NULL;
+}
+
+/* Returns a reference to the cached JSON text, to be freed by the caller */
+SoupBuffer *
+document_cache_lookup (DocumentCache *cache, const char *dbname, const char *docid)
+{
+	char *key;
+	CacheEntry *entry;
+
+	key = make_key (dbname, docid);
+	entry = g_hash_table_lookup (cache->entries, key);
+	g_free (key);
+
+	if (entry == NULL)
+		return NULL;
+
+	/* Move it to the front of the LRU list */
+	g_queue_unlink (cache->lru, entry->link);
+	g_queue_push_head_link (cache->lru, entry->link);
+	cache->hits++;
+
+	return soup_buffer_copy (entry->buffer);
+}
+
+void
+document_cache_insert (DocumentCache *cache,
+		       const char *dbname,
+		       const char *docid,
+		       const char *etag,
+		       SoupBuffer *buffer)
+{
+	CacheEntry *entry;
+
+	document_cache_remove (cache, dbname, docid);
+
+	entry = g_slice_new0 (CacheEntry);
+	entry->key = make_key (dbname, docid);
+	entry->etag = g_strdup (etag);
+	entry->size = buffer->length + strlen (entry->key) + strlen (etag);
+	if (entry->size > cache->max_size) {
+		g_free (entry->key);
+		g_free (entry->etag);
+		g_slice_free (CacheEntry, entry);
+		return;
+	}
+
+	entry->buffer = soup_buffer_copy (buffer);
+
+	g_queue_push_head (cache->lru, entry);
+	entry->link = g_queue_peek_head_link (cache->lru);
+	g_hash_table_insert (cache->entries, entry->key, entry);
+	cache->size += entry->size;
+
+	evict (cache);
+}
+
+void
+document_cache_remove (DocumentCache *cache, const char *dbname, const char *docid)
+{
+	char *key;
+	CacheEntry *entry;
+
+	key = make_key (dbname, docid);
+	entry = g_hash_table_lookup (cache->entries, key);
+	if (entry != NULL)
+		remove_entry (cache, entry);
+
+	g_free (key);
+}
+
+void
+document_cache_remove_database (DocumentCache *cache, const char *dbname)
+{
+	GList *l;
+	char *prefix;
+
+	prefix = g_strdup_printf ("%s\n", dbname);
+
+	l = g_queue_peek_head_link (cache->lru);
+	while (l != NULL) {
+		CacheEntry *entry = (CacheEntry *) l->data;
+
+		l = l->next;
+		if (g_str_has_prefix (entry->key, prefix))
+			remove_entry (cache, entry);
+	}
+
+	g_free (prefix);
+}
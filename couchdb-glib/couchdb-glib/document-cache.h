@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __DOCUMENT_CACHE_H__
+#define __DOCUMENT_CACHE_H__
+
+#include <glib.h>
+#include <libsoup/soup-message-body.h>
+
+typedef struct {
+	GHashTable *entries;
+	GQueue *lru;
+	gsize size;
+	gsize max_size;
+
+	guint hits;
+	guint misses;
+} DocumentCache;
+
+DocumentCache *document_cache_new (gsize max_size);
+void           document_cache_free (DocumentCache *cache);
+void           document_cache_set_max_size (DocumentCache *cache, gsize max_size);
+
+const char    *document_cache_get_etag (DocumentCache *cache, const char *dbname, const char *docid);
+SoupBuffer    *document_cache_lookup (DocumentCache *cache, const char *dbname, const char *docid);
+void           document_cache_insert (DocumentCache *cache,
+				      const char *dbname,
+				      const char *docid,
+				      const char *etag,
+				      SoupBuffer *buffer);
+void           document_cache_remove (DocumentCache *cache, const char *dbname, const char *docid);
+void           document_cache_remove_database (DocumentCache *cache, const char *dbname);
+
+#endif /* __DOCUMENT_CACHE_H__ */
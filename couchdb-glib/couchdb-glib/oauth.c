@@ -40,6 +40,7 @@
 #include <math.h>
 #include <ctype.h> // isxdigit
 #include <openssl/hmac.h>
+#include <openssl/sha.h>
 
 #include "utils.h"
 #include "xmalloc.h"
@@ -882,6 +883,322 @@ char *oauth_sign_array2 (int *argcp, char***argvp,
   return result;
 }
 
+/**
+ * precomputed state for signing requests with a given set of
+ * credentials, see \ref oauth_signer_new
+ */
+struct _OAuthSigner {
+  char *c_key; ///< url-escaped consumer key
+  char *t_key; ///< url-escaped token key, or NULL
+  SHA_CTX inner; ///< HMAC-SHA1 state after hashing the inner padded key
+  SHA_CTX outer; ///< HMAC-SHA1 state after hashing the outer padded key
+};
+
+typedef struct {
+  const char *name; ///< url-escaped
+  const char *value; ///< url-escaped
+  char *owned; ///< to be freed, if the parameter was parsed from the URL
+} OAuthParam;
+
+static int oauth_is_unreserved(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+    || c == '_' || c == '~' || c == '.' || c == '-';
+}
+
+/**
+ * append an already url-escaped string to the base string, escaping
+ * it once more: only the '%' of the escape sequences needs it.
+ */
+static void oauth_append_escaped_twice(GString *buf, const char *escaped) {
+  const char *p;
+  while ((p = strchr(escaped, '%'))) {
+    g_string_append_len(buf, escaped, p - escaped);
+    g_string_append_len(buf, "%25", 3);
+    escaped = p + 1;
+  }
+  g_string_append(buf, escaped);
+}
+
+static void oauth_append_escaped(GString *buf, const char *string, size_t len) {
+  static const char hex[] = "0123456789ABCDEF";
+  size_t start = 0, i;
+  char esc[3];
+  esc[0] = '%';
+  for (i = 0; i < len; i++) {
+    unsigned char c = string[i];
+    if (!oauth_is_unreserved(c)) {
+      g_string_append_len(buf, string + start, i - start);
+      esc[1] = hex[c >> 4];
+      esc[2] = hex[c & 0xf];
+      g_string_append_len(buf, esc, 3);
+      start = i + 1;
+    }
+  }
+  g_string_append_len(buf, string + start, len - start);
+}
+
+static int oauth_cmpparams(const void *p1, const void *p2) {
+  const OAuthParam *a = (const OAuthParam *) p1;
+  const OAuthParam *b = (const OAuthParam *) p2;
+  int rv = strcmp(a->name, b->name);
+  return rv != 0 ? rv : strcmp(a->value, b->value);
+}
+
+/**
+ * parse a query string parameter into its url-escaped name and value,
+ * normalized the same way \ref oauth_split_url_parameters does.
+ */
+static void oauth_param_from_query(OAuthParam *param, const char *token, size_t len) {
+  char *raw, *unescaped, *eq, *p;
+  GString *buf = g_string_sized_new(len + 8);
+
+  raw = (char*) xmalloc(len + 1);
+  memcpy(raw, token, len);
+  raw[len] = '\0';
+  for (p = raw; *p; p++)
+    if (*p == '+') *p = ' ';
+  unescaped = oauth_url_unescape(raw, NULL);
+  free(raw);
+
+  eq = strchr(unescaped, '=');
+  if (eq) {
+    oauth_append_escaped(buf, unescaped, eq - unescaped);
+    g_string_append_c(buf, '\0');
+    oauth_append_escaped(buf, eq + 1, strlen(eq + 1));
+  } else {
+    oauth_append_escaped(buf, unescaped, strlen(unescaped));
+    g_string_append_c(buf, '\0');
+  }
+  free(unescaped);
+
+  param->owned = g_string_free(buf, FALSE);
+  param->name = param->owned;
+  param->value = param->owned + strlen(param->owned) + 1;
+}
+
+/**
+ * create a signer for HMAC-SHA1 signed requests.
+ * the url-escaped keys and the HMAC state for the key derived from the
+ * secrets are computed once here, instead of for every request.
+ *
+ * @param c_key consumer key
+ * @param c_secret consumer secret
+ * @param t_key token key (may be NULL)
+ * @param t_secret token secret (may be NULL)
+ * @return signer to be freed with \ref oauth_signer_free
+ */
+OAuthSigner *oauth_signer_new (const char *c_key, const char *c_secret,
+                               const char *t_key, const char *t_secret) {
+  OAuthSigner *signer = (OAuthSigner*) xcalloc(1, sizeof(OAuthSigner));
+  unsigned char ipad[SHA_CBLOCK], opad[SHA_CBLOCK];
+  char *key;
+  size_t key_len, i;
+
+  signer->c_key = oauth_url_escape(c_key);
+  if (t_key)
+    signer->t_key = oauth_url_escape(t_key);
+
+  // RFC 2104: keys longer than the block size are hashed first
+  memset(ipad, 0, sizeof(ipad));
+  key = oauth_catenc(2, c_secret, t_secret);
+  key_len = strlen(key);
+  if (key_len > SHA_CBLOCK)
+    SHA1((unsigned char*) key, key_len, ipad);
+  else
+    memcpy(ipad, key, key_len);
+  memcpy(opad, ipad, sizeof(opad));
+  for (i = 0; i < SHA_CBLOCK; i++) {
+    ipad[i] ^= 0x36;
+    opad[i] ^= 0x5c;
+  }
+
+  SHA1_Init(&signer->inner);
+  SHA1_Update(&signer->inner, ipad, sizeof(ipad));
+  SHA1_Init(&signer->outer);
+  SHA1_Update(&signer->outer, opad, sizeof(opad));
+
+#ifdef WIPE_MEMORY
+  memset(key, 0, key_len);
+  memset(ipad, 0, sizeof(ipad));
+  memset(opad, 0, sizeof(opad));
+#endif
+  free(key);
+
+  return signer;
+}
+
+/**
+ * free a signer created with \ref oauth_signer_new
+ */
+void oauth_signer_free (OAuthSigner *signer) {
+  if (!signer) return;
+  free(signer->c_key);
+  if (signer->t_key) free(signer->t_key);
+#ifdef WIPE_MEMORY
+  memset(signer, 0, sizeof(OAuthSigner));
+#endif
+  free(signer);
+}
+
+/**
+ * sign a request with the given nonce and timestamp, and return the value
+ * of the Authorization header for it.
+ *
+ * this computes the same HMAC-SHA1 signature as \ref oauth_sign_url2
+ * (including the oauth_verifier and oauth_callback parameters), but builds
+ * the signature base string in a single buffer and the header directly from
+ * the protocol parameters, instead of serializing a signed URL first.
+ *
+ * @param signer signer for the credentials to use
+ * @param http_method HTTP request method
+ * @param url URL of the request, including the query string
+ * @param nonce url-escaped oauth_nonce
+ * @param timestamp oauth_timestamp
+ * @return header value, to be freed with g_free(), or NULL on error
+ */
+char *oauth_signer_sign_header_full (OAuthSigner *signer, const char *http_method, const char *url,
+                                     const char *nonce, const char *timestamp) {
+  OAuthParam *params;
+  int nparams = 0, maxparams = 8, i;
+  const char *query, *p;
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA_CTX ctx;
+  char *signature, *base_url;
+  size_t base_len;
+  GString *buf;
+
+  if (!signer || !http_method || !url || !nonce || !timestamp) return NULL;
+
+  query = strchr(url, '?');
+  if (query) {
+    for (p = query; *p; p++)
+      if (*p == '&') maxparams++;
+    maxparams++;
+  }
+  params = (OAuthParam*) xcalloc(maxparams, sizeof(OAuthParam));
+
+  // protocol parameters, as added by oauth_add_protocol
+#define OAUTH_ADD_PARAM(n, v) G_STMT_START { \
+    params[nparams].name = (n); params[nparams].value = (v); nparams++; \
+  } G_STMT_END
+  OAUTH_ADD_PARAM("oauth_nonce", nonce);
+  OAUTH_ADD_PARAM("oauth_timestamp", timestamp);
+  if (signer->t_key)
+    OAUTH_ADD_PARAM("oauth_token", signer->t_key);
+  OAUTH_ADD_PARAM("oauth_consumer_key", signer->c_key);
+  OAUTH_ADD_PARAM("oauth_signature_method", "HMAC-SHA1");
+  OAUTH_ADD_PARAM("oauth_version", "1.0");
+  OAUTH_ADD_PARAM("oauth_verifier", "None");
+  OAUTH_ADD_PARAM("oauth_callback", "None");
+#undef OAUTH_ADD_PARAM
+
+  // parameters from the query string
+  if (query) {
+    p = query + 1;
+    while (*p) {
+      size_t len = strcspn(p, "&");
+      if (len > 0 && strncasecmp(p, "oauth_signature=", 16) != 0)
+        oauth_param_from_query(&params[nparams++], p, len);
+      p += len;
+      if (*p) p++;
+    }
+  }
+
+  qsort(params, nparams, sizeof(OAuthParam), oauth_cmpparams);
+
+  // build the signature base string: METHOD&url&params
+  buf = g_string_sized_new(256 + 3 * strlen(url));
+  for (p = http_method; *p; p++)
+    g_string_append_c(buf, toupper((unsigned char) *p));
+  g_string_append_c(buf, '&');
+
+  base_len = query ? (size_t) (query - url) : strlen(url);
+  base_url = (char*) xmalloc(base_len + 2);
+  memcpy(base_url, url, base_len);
+  base_url[base_len] = '\0';
+  p = strstr(base_url, "://");
+  if (p && !strchr(p + 3, '/'))
+    strcat(base_url, "/");
+  {
+    char *unescaped = oauth_url_unescape(base_url, NULL);
+    char *port = strstr(unescaped, ":80/");
+    if (port) memmove(port, port + 3, strlen(port + 2));
+    oauth_append_escaped(buf, unescaped, strlen(unescaped));
+    free(unescaped);
+  }
+  free(base_url);
+
+  for (i = 0; i < nparams; i++) {
+    g_string_append_len(buf, i > 0 ? "%26" : "&", i > 0 ? 3 : 1);
+    oauth_append_escaped_twice(buf, params[i].name);
+    g_string_append_len(buf, "%3D", 3);
+    oauth_append_escaped_twice(buf, params[i].value);
+  }
+
+#ifdef DEBUG_MESSAGES
+  g_debug ("\nliboauth: data to sign='%s'\n\n", buf->str);
+#endif
+  // HMAC-SHA1, starting from the precomputed padded key states
+  ctx = signer->inner;
+  SHA1_Update(&ctx, buf->str, buf->len);
+  SHA1_Final(digest, &ctx);
+  ctx = signer->outer;
+  SHA1_Update(&ctx, digest, sizeof(digest));
+  SHA1_Final(digest, &ctx);
+  signature = oauth_encode_base64(sizeof(digest), digest);
+
+  // reuse the buffer for the header
+  g_string_truncate(buf, 0);
+  g_string_append(buf, "OAuth ");
+  for (i = 0; i < nparams; i++) {
+    if (strncmp(params[i].name, "oauth_", 6) != 0)
+      continue;
+    g_string_append(buf, params[i].name);
+    g_string_append_len(buf, "=\"", 2);
+    g_string_append(buf, params[i].value);
+    g_string_append_len(buf, "\", ", 3);
+  }
+  g_string_append(buf, "oauth_signature=\"");
+  oauth_append_escaped(buf, signature, strlen(signature));
+  g_string_append_c(buf, '"');
+  free(signature);
+
+  for (i = 0; i < nparams; i++)
+    g_free(params[i].owned);
+  free(params);
+
+  return g_string_free(buf, FALSE);
+}
+
+/**
+ * sign a request and return the value of the Authorization header for it,
+ * see \ref oauth_signer_sign_header_full
+ *
+ * @param signer signer for the credentials to use
+ * @param http_method HTTP request method
+ * @param url URL of the request, including the query string
+ * @return header value, to be freed with g_free(), or NULL on error
+ */
+char *oauth_signer_sign_header (OAuthSigner *signer, const char *http_method, const char *url) {
+  char nonce[33], timestamp[24];
+  static const char nonce_chars[] = "abcdefghijklmnopqrstuvwxyz"
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ" "0123456789_-";
+  guint32 rnd = 0;
+  int i;
+
+  // 64 unreserved characters, so each random int gives 5 of them
+  for (i = 0; i < (int) sizeof(nonce) - 1; i++) {
+    if (i % 5 == 0)
+      rnd = g_random_int();
+    nonce[i] = nonce_chars[rnd & 0x3f];
+    rnd >>= 6;
+  }
+  nonce[i] = '\0';
+  snprintf(timestamp, sizeof(timestamp), "%li", (long int) time(NULL));
+
+  return oauth_signer_sign_header_full(signer, http_method, url, nonce, timestamp);
+}
+
 /**
  * free array args
  *
@@ -283,6 +283,53 @@ int oauth_param_exists(char **argv, int argc, char *key);
  */
 void oauth_add_param_to_array(int *argcp, char ***argvp, const char *addparam);
 
+/**
+ * precomputed keys for signing requests with a set of credentials.
+ */
+typedef struct _OAuthSigner OAuthSigner;
+
+/**
+ * create a signer for HMAC-SHA1 signed requests, precomputing the
+ * url-escaped keys and the HMAC key.
+ *
+ * @param c_key consumer key
+ * @param c_secret consumer secret
+ * @param t_key token key (may be NULL)
+ * @param t_secret token secret (may be NULL)
+ * @return signer to be freed with \ref oauth_signer_free
+ */
+OAuthSigner *oauth_signer_new (const char *c_key, const char *c_secret,
+                               const char *t_key, const char *t_secret);
+
+/**
+ * free a signer created with \ref oauth_signer_new
+ */
+void oauth_signer_free (OAuthSigner *signer);
+
+/**
+ * sign a request and return the value of its Authorization header.
+ *
+ * @param signer signer for the credentials to use
+ * @param http_method HTTP request method
+ * @param url URL of the request, including the query string
+ * @return header value, to be freed with g_free(), or NULL on error
+ */
+char *oauth_signer_sign_header (OAuthSigner *signer, const char *http_method, const char *url);
+
+/**
+ * sign a request with a fixed nonce and timestamp, so that the result can
+ * be compared with \ref oauth_sign_url2 in tests.
+ *
+ * @param signer signer for the credentials to use
+ * @param http_method HTTP request method
+ * @param url URL of the request, including the query string
+ * @param nonce url-escaped oauth_nonce
+ * @param timestamp oauth_timestamp
+ * @return header value, to be freed with g_free(), or NULL on error
+ */
+char *oauth_signer_sign_header_full (OAuthSigner *signer, const char *http_method, const char *url,
+                                     const char *nonce, const char *timestamp);
+
 /**
  * free array args
  *
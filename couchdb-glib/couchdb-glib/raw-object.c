@@ -0,0 +1,424 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "raw-object.h"
+
+void
+raw_value_free (RawValue *value)
+{
+	if (value == NULL)
+		return;
+
+	g_free (value->string);
+	g_slice_free (RawValue, value);
+}
+
+static const char *
+skip_whitespace (const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+
+	return p;
+}
+
+/* Returns a pointer past the closing quote of the string starting at @p */
+static const char *
+skip_string (const char *p, const char *end)
+{
+	for (p++; p < end; p++) {
+		if (*p == '\\')
+			p++;
+		else if (*p == '"')
+			return p + 1;
+	}
+
+	return NULL;
+}
+
+/* Returns a pointer past the end of the object or array starting at @p */
+static const char *
+skip_container (const char *p, const char *end)
+{
+	guint depth = 0;
+
+	while (p < end) {
+		switch (*p) {
+		case '"':
+			p = skip_string (p, end);
+			if (p == NULL)
+				return NULL;
+			continue;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			if (--depth == 0)
+				return p + 1;
+			break;
+		}
+		p++;
+	}
+
+	return NULL;
+}
+
+static const char *
+skip_literal (const char *p, const char *end, const char *literal)
+{
+	gsize length = strlen (literal);
+
+	if ((gsize) (end - p) < length || strncmp (p, literal, length) != 0)
+		return NULL;
+
+	return p + length;
+}
+
+static const char *
+skip_number (const char *p, const char *end)
+{
+	const char *start = p;
+
+	while (p < end && (g_ascii_isdigit (*p) || *p == '-' || *p == '+' ||
+			   *p == '.' || *p == 'e' || *p == 'E'))
+		p++;
+
+	return p > start ? p : NULL;
+}
+
+/* Decodes the JSON string between the quotes at @data and @data + @length - 1 */
+static char *
+decode_string (const char *data, gsize length)
+{
+	const char *p, *end = data + length - 1;
+	GString *str;
+
+	/* Most strings have no escapes */
+	if (memchr (data + 1, '\\', length - 2) == NULL)
+		return g_strndup (data + 1, length - 2);
+
+	str = g_string_sized_new (length);
+	for (p = data + 1; p < end; p++) {
+		if (*p != '\\') {
+			g_string_append_c (str, *p);
+			continue;
+		}
+
+		if (++p >= end)
+			break;
+
+		switch (*p) {
+		case 'b': g_string_append_c (str, '\b'); break;
+		case 'f': g_string_append_c (str, '\f'); break;
+		case 'n': g_string_append_c (str, '\n'); break;
+		case 'r': g_string_append_c (str, '\r'); break;
+		case 't': g_string_append_c (str, '\t'); break;
+		case 'u': {
+			gunichar ch;
+			char hex[5];
+
+			if (end - p < 5)
+				break;
+			memcpy (hex, p + 1, 4);
+			hex[4] = '\0';
+			ch = strtoul (hex, NULL, 16);
+			p += 4;
+
+			/* Characters outside the BMP come as UTF-16 surrogate pairs */
+			if (ch >= 0xd800 && ch < 0xdc00 && end - p >= 7 && p[1] == '\\' && p[2] == 'u') {
+				gunichar low;
+
+				memcpy (hex, p + 3, 4);
+				low = strtoul (hex, NULL, 16);
+				if (low >= 0xdc00 && low < 0xe000) {
+					ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+					p += 6;
+				}
+			}
+
+			/* Unpaired surrogates are not characters, and a NUL would
+			   cut the string short, so both are replaced */
+			if (ch == 0 || (ch >= 0xd800 && ch < 0xe000))
+				ch = 0xfffd;
+
+			g_string_append_unichar (str, ch);
+			break;
+		}
+		default:
+			/* '"', '\\' and '/' */
+			g_string_append_c (str, *p);
+			break;
+		}
+	}
+
+	return g_string_free (str, FALSE);
+}
+
+typedef gboolean (* MemberFunc) (const char *name, gsize name_length, RawValue *value, gpointer user_data);
+
+/* Call @func for each top level member of a JSON object, with the name still
+   quoted and escaped, until it returns FALSE. Returns FALSE if @data is not a
+   valid JSON object */
+static gboolean
+scan_object (const char *data, gsize length, MemberFunc func, gpointer user_data)
+{
+	const char *p, *end = data + length;
+
+	p = skip_whitespace (data, end);
+	if (p == end || *p != '{')
+		return FALSE;
+
+	p = skip_whitespace (p + 1, end);
+	if (p < end && *p == '}')
+		return skip_whitespace (p + 1, end) == end;
+
+	while (p < end) {
+		const char *name_start, *name_end, *value_end;
+		RawValue value = { 0, };
+
+		/* Member name */
+		if (*p != '"')
+			return FALSE;
+		name_start = p;
+		name_end = skip_string (p, end);
+		if (name_end == NULL)
+			return FALSE;
+
+		p = skip_whitespace (name_end, end);
+		if (p == end || *p != ':')
+			return FALSE;
+		p = skip_whitespace (p + 1, end);
+		if (p == end)
+			return FALSE;
+
+		/* Member value */
+		switch (*p) {
+		case '{':
+			value.type = RAW_VALUE_OBJECT;
+			value_end = skip_container (p, end);
+			break;
+		case '[':
+			value.type = RAW_VALUE_ARRAY;
+			value_end = skip_container (p, end);
+			break;
+		case '"':
+			value.type = RAW_VALUE_STRING;
+			value_end = skip_string (p, end);
+			break;
+		case 't':
+			value.type = RAW_VALUE_BOOLEAN;
+			value_end = skip_literal (p, end, "true");
+			break;
+		case 'f':
+			value.type = RAW_VALUE_BOOLEAN;
+			value_end = skip_literal (p, end, "false");
+			break;
+		case 'n':
+			value.type = RAW_VALUE_NULL;
+			value_end = skip_literal (p, end, "null");
+			break;
+		default:
+			value.type = RAW_VALUE_NUMBER;
+			value_end = skip_number (p, end);
+			break;
+		}
+
+		if (value_end == NULL)
+			return FALSE;
+
+		value.data = p;
+		value.length = value_end - p;
+		if (!func (name_start, name_end - name_start, &value, user_data))
+			return TRUE;
+
+		/* Next member, or end of the object */
+		p = skip_whitespace (value_end, end);
+		if (p == end)
+			return FALSE;
+		if (*p == '}')
+			return skip_whitespace (p + 1, end) == end;
+		if (*p != ',')
+			return FALSE;
+		p = skip_whitespace (p + 1, end);
+	}
+
+	return FALSE;
+}
+
+static gboolean
+index_member (const char *name, gsize name_length, RawValue *value, gpointer user_data)
+{
+	g_hash_table_replace ((GHashTable *) user_data,
+			      decode_string (name, name_length),
+			      g_slice_dup (RawValue, value));
+
+	return TRUE;
+}
+
+/**
+ * raw_object_index:
+ * @data: Text of a JSON object
+ * @length: Length of @data
+ *
+ * Index the top level members of a JSON object. Nested objects and arrays
+ * are only checked for balanced delimiters.
+ *
+ * Return value: A #GHashTable mapping member names to #RawValue's, or NULL
+ * if @data is not a JSON object.
+ */
+GHashTable *
+raw_object_index (const char *data, gsize length)
+{
+	GHashTable *members;
+
+	members = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					 (GDestroyNotify) raw_value_free);
+	if (!scan_object (data, length, index_member, members)) {
+		g_hash_table_destroy (members);
+		return NULL;
+	}
+
+	return members;
+}
+
+typedef struct {
+	const char * const *names;
+	RawValue *values;
+	guint n_missing;
+} LookupData;
+
+static gboolean
+lookup_member (const char *name, gsize name_length, RawValue *value, gpointer user_data)
+{
+	LookupData *lookup = (LookupData *) user_data;
+	char *decoded = NULL;
+	guint i;
+
+	/* Names with escapes, which are rare, need decoding to be compared */
+	if (memchr (name, '\\', name_length) != NULL) {
+		decoded = decode_string (name, name_length);
+		name = decoded;
+		name_length = strlen (decoded);
+	} else {
+		/* Skip the quotes */
+		name++;
+		name_length -= 2;
+	}
+
+	for (i = 0; lookup->names[i] != NULL; i++) {
+		if (lookup->values[i].data == NULL
+		    && strncmp (lookup->names[i], name, name_length) == 0
+		    && lookup->names[i][name_length] == '\0') {
+			lookup->values[i] = *value;
+			lookup->n_missing--;
+			break;
+		}
+	}
+
+	g_free (decoded);
+
+	/* No need to look at the rest of the object once everything is found */
+	return lookup->n_missing > 0;
+}
+
+/**
+ * raw_object_lookup:
+ * @data: Text of a JSON object
+ * @length: Length of @data
+ * @names: NULL-terminated array of the names of the members to look up
+ * @values: Array, as long as @names, to store the members' values in
+ *
+ * Look up a few top level members of a JSON object in a single pass and
+ * without allocating memory in the usual case, for objects which are only
+ * looked at once.
+ * Member names are only decoded when they contain escapes. Unlike for
+ * #raw_object_index, the rest of the object is not checked once all the
+ * members have been found.
+ * Missing members have a NULL data pointer in @values, and the decoded
+ * strings in @values need to be freed with #raw_value_clear.
+ *
+ * Return value: TRUE if successful, FALSE if @data is not a JSON object.
+ */
+gboolean
+raw_object_lookup (const char *data, gsize length, const char * const *names, RawValue *values)
+{
+	LookupData lookup;
+
+	lookup.names = names;
+	lookup.values = values;
+	for (lookup.n_missing = 0; names[lookup.n_missing] != NULL; lookup.n_missing++)
+		memset (&values[lookup.n_missing], 0, sizeof (RawValue));
+
+	return scan_object (data, length, lookup_member, &lookup);
+}
+
+void
+raw_value_clear (RawValue *value)
+{
+	g_free (value->string);
+	value->string = NULL;
+}
+
+const char *
+raw_value_get_string (RawValue *value)
+{
+	if (value->type != RAW_VALUE_STRING)
+		return NULL;
+
+	if (value->string == NULL)
+		value->string = decode_string (value->data, value->length);
+
+	return value->string;
+}
+
+gint64
+raw_value_get_int (RawValue *value)
+{
+	if (value->type != RAW_VALUE_NUMBER)
+		return 0;
+
+	/* The number is followed by a delimiter, so it can be converted in place */
+	if (memchr (value->data, '.', value->length) || memchr (value->data, 'e', value->length)
+	    || memchr (value->data, 'E', value->length))
+		return (gint64) g_ascii_strtod (value->data, NULL);
+
+	return g_ascii_strtoll (value->data, NULL, 10);
+}
+
+gdouble
+raw_value_get_double (RawValue *value)
+{
+	if (value->type != RAW_VALUE_NUMBER)
+		return 0.0;
+
+	return g_ascii_strtod (value->data, NULL);
+}
+
+gboolean
+raw_value_get_boolean (RawValue *value)
+{
+	return value->type == RAW_VALUE_BOOLEAN && value->data[0] == 't';
+}
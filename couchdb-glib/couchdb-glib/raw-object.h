@@ -0,0 +1,66 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __RAW_OBJECT_H__
+#define __RAW_OBJECT_H__
+
+#include <glib.h>
+
+/*
+ * Index of the top level members of a JSON object, built by scanning its text
+ * without parsing the member values, which are decoded only when asked for.
+ * Values point into the indexed text, so it must outlive the index.
+ */
+
+typedef enum {
+	RAW_VALUE_OBJECT,
+	RAW_VALUE_ARRAY,
+	RAW_VALUE_STRING,
+	RAW_VALUE_NUMBER,
+	RAW_VALUE_BOOLEAN,
+	RAW_VALUE_NULL
+} RawValueType;
+
+typedef struct {
+	RawValueType type;
+	const char *data;
+	gsize length;
+
+	/* Decoded string, for RAW_VALUE_STRING values, set on first use */
+	char *string;
+} RawValue;
+
+GHashTable  *raw_object_index (const char *data, gsize length);
+gboolean     raw_object_lookup (const char *data,
+				gsize length,
+				const char * const *names,
+				RawValue *values);
+
+void         raw_value_clear (RawValue *value);
+void         raw_value_free (RawValue *value);
+
+const char  *raw_value_get_string (RawValue *value);
+gint64       raw_value_get_int (RawValue *value);
+gdouble      raw_value_get_double (RawValue *value);
+gboolean     raw_value_get_boolean (RawValue *value);
+
+#endif /* __RAW_OBJECT_H__ */
@@ -0,0 +1,326 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include "row-splitter.h"
+#include "utils.h"
+
+/*
+ * The row splitter scans the response body as it arrives, keeping track only
+ * of the nesting level and of whether we are inside a string, and cuts out
+ * each row as soon as it is complete. Only the current row is parsed with
+ * json-glib, so memory usage depends on the size of the biggest row, not on
+ * the size of the whole response. Everything outside the rows (total_rows,
+ * last_seq, etc) is kept in a separate, small, buffer, the envelope.
+ *
+ * In raw mode rows are not parsed, but copied one after the other into
+ * blocks, and passed to the callback as sub-buffers of them. Documents which
+ * keep parts of the rows then share a few blocks, which are freed, in one go,
+ * when the last of them is. Blocks start small and grow, or are sized from
+ * the length of the response when it is known, so that a document kept from
+ * a short response doesn't pin much more memory than its own size.
+ */
+
+/* Sizes of the blocks raw rows are copied to */
+#define ROW_FIRST_BLOCK_SIZE (4 * 1024)
+#define ROW_BLOCK_SIZE (64 * 1024)
+
+struct _RowSplitter {
+	RowSplitterMode mode;
+	RowSplitterFunc func;
+	RowSplitterRawFunc raw_func;
+	gpointer user_data;
+
+	JsonParser *row_parser;
+	GString *row;
+	GString *envelope;
+
+	/* Block being filled with raw rows */
+	SoupBuffer *block;
+	char *block_data;
+	gsize block_used;
+	gsize next_block_size;
+
+	guint depth;
+	guint rows_depth;
+	gboolean in_string;
+	gboolean escaped;
+	gboolean in_row;
+	gboolean rows_done;
+};
+
+RowSplitter *
+row_splitter_new (RowSplitterMode mode, RowSplitterFunc func, gpointer user_data)
+{
+	RowSplitter *splitter;
+
+	g_return_val_if_fail (func != NULL, NULL);
+
+	splitter = g_slice_new0 (RowSplitter);
+	splitter->mode = mode;
+	splitter->func = func;
+	splitter->user_data = user_data;
+	splitter->row_parser = json_parser_new ();
+	splitter->row = g_string_sized_new (1024);
+	splitter->envelope = g_string_new ("");
+
+	return splitter;
+}
+
+/* Rows are passed unparsed to @func, for callers that only look at a few
+   members of them */
+RowSplitter *
+row_splitter_new_raw (RowSplitterMode mode, RowSplitterRawFunc func, gpointer user_data)
+{
+	RowSplitter *splitter;
+
+	g_return_val_if_fail (func != NULL, NULL);
+
+	splitter = g_slice_new0 (RowSplitter);
+	splitter->mode = mode;
+	splitter->raw_func = func;
+	splitter->user_data = user_data;
+	splitter->row = g_string_sized_new (1024);
+	splitter->envelope = g_string_new ("");
+	splitter->next_block_size = ROW_FIRST_BLOCK_SIZE;
+
+	return splitter;
+}
+
+void
+row_splitter_free (RowSplitter *splitter)
+{
+	g_return_if_fail (splitter != NULL);
+
+	if (splitter->row_parser != NULL)
+		g_object_unref (G_OBJECT (splitter->row_parser));
+	g_string_free (splitter->row, TRUE);
+	g_string_free (splitter->envelope, TRUE);
+	if (splitter->block != NULL)
+		soup_buffer_free (splitter->block);
+
+	g_slice_free (RowSplitter, splitter);
+}
+
+/* Rows can't be bigger than the whole response, so a response shorter than
+   a block only needs one block as big as it. Longer ones start with full
+   size blocks */
+void
+row_splitter_set_expected_length (RowSplitter *splitter, gsize length)
+{
+	g_return_if_fail (splitter != NULL);
+
+	if (splitter->block == NULL)
+		splitter->next_block_size = MIN (MAX (length, 1), ROW_BLOCK_SIZE);
+}
+
+static gboolean
+emit_row (RowSplitter *splitter, GError **error)
+{
+	JsonNode *root_node;
+	GError *parse_error = NULL;
+
+	g_debug ("Got row: %s", splitter->row->str);
+	if (splitter->raw_func != NULL) {
+		SoupBuffer *row;
+
+		/* The row buffer is reused, so give the callback its own copy,
+		   which it can keep parts of */
+		if (splitter->block == NULL
+		    || splitter->block_used + splitter->row->len > splitter->block->length) {
+			gsize size = MAX (splitter->next_block_size, splitter->row->len);
+
+			if (splitter->block != NULL)
+				soup_buffer_free (splitter->block);
+			splitter->block_data = g_malloc (size);
+			splitter->block = soup_buffer_new (SOUP_MEMORY_TAKE, splitter->block_data, size);
+			splitter->block_used = 0;
+			splitter->next_block_size = MIN (splitter->next_block_size * 2, ROW_BLOCK_SIZE);
+		}
+
+		/* Parts of the block already handed out are never written again */
+		memcpy (splitter->block_data + splitter->block_used, splitter->row->str, splitter->row->len);
+		row = soup_buffer_new_subbuffer (splitter->block, splitter->block_used, splitter->row->len);
+		splitter->block_used += splitter->row->len;
+
+		splitter->raw_func (row, splitter->user_data);
+		soup_buffer_free (row);
+
+		g_string_truncate (splitter->row, 0);
+
+		return TRUE;
+	}
+
+	if (!json_parser_load_from_data (splitter->row_parser,
+					 splitter->row->str,
+					 splitter->row->len,
+					 &parse_error)) {
+		g_set_error (error, COUCHDB_ERROR, -1, "Invalid JSON response: %s",
+			     parse_error->message);
+		g_error_free (parse_error);
+		return FALSE;
+	}
+
+	root_node = json_parser_get_root (splitter->row_parser);
+	if (root_node != NULL && json_node_get_node_type (root_node) == JSON_NODE_OBJECT)
+		splitter->func (json_node_get_object (root_node), splitter->user_data);
+
+	g_string_truncate (splitter->row, 0);
+
+	return TRUE;
+}
+
+/**
+ * row_splitter_feed:
+ * @splitter: A #RowSplitter
+ * @data: Chunk of the response body
+ * @length: Length of @data
+ * @error: Placeholder for error information
+ *
+ * Feed a new chunk of data to the splitter, which will call its callback for
+ * each row completed by it.
+ *
+ * Return value: TRUE if successful, FALSE if the data could not be parsed.
+ */
+gboolean
+row_splitter_feed (RowSplitter *splitter, const char *data, gsize length, GError **error)
+{
+	gsize i, row_start = 0;
+
+	g_return_val_if_fail (splitter != NULL, FALSE);
+
+	for (i = 0; i < length; i++) {
+		char c = data[i];
+		gboolean row_ended = FALSE;
+
+		if (splitter->in_string) {
+			if (splitter->escaped)
+				splitter->escaped = FALSE;
+			else if (c == '\\')
+				splitter->escaped = TRUE;
+			else if (c == '"')
+				splitter->in_string = FALSE;
+		} else {
+			switch (c) {
+			case '"':
+				splitter->in_string = TRUE;
+				break;
+			case '{':
+			case '[':
+				if (!splitter->in_row) {
+					if (splitter->mode == ROW_SPLITTER_MODE_OBJECTS && splitter->depth == 0) {
+						splitter->in_row = TRUE;
+						row_start = i;
+					} else if (splitter->mode == ROW_SPLITTER_MODE_ARRAY &&
+						   splitter->rows_depth > 0 &&
+						   splitter->depth == splitter->rows_depth) {
+						splitter->in_row = TRUE;
+						row_start = i;
+					} else if (splitter->mode == ROW_SPLITTER_MODE_ARRAY &&
+						   c == '[' && splitter->depth == 1 &&
+						   !splitter->rows_done && splitter->rows_depth == 0) {
+						splitter->rows_depth = 2;
+					}
+				}
+				splitter->depth++;
+				break;
+			case '}':
+			case ']':
+				if (splitter->depth == 0) {
+					g_set_error (error, COUCHDB_ERROR, -1,
+						     "Invalid JSON response: unbalanced '%c'", c);
+					return FALSE;
+				}
+
+				splitter->depth--;
+				if (splitter->in_row) {
+					if ((splitter->mode == ROW_SPLITTER_MODE_OBJECTS && splitter->depth == 0) ||
+					    (splitter->mode == ROW_SPLITTER_MODE_ARRAY &&
+					     splitter->depth == splitter->rows_depth))
+						row_ended = TRUE;
+				} else if (splitter->rows_depth > 0 && splitter->depth == splitter->rows_depth - 1) {
+					splitter->rows_depth = 0;
+					splitter->rows_done = TRUE;
+				}
+				break;
+			}
+		}
+
+		if (row_ended) {
+			g_string_append_len (splitter->row, data + row_start, i - row_start + 1);
+			splitter->in_row = FALSE;
+			if (!emit_row (splitter, error))
+				return FALSE;
+		} else if (!splitter->in_row && splitter->mode == ROW_SPLITTER_MODE_ARRAY) {
+			/* Outside of the rows, only keep the array delimiters, so that
+			   the envelope is still valid JSON */
+			if (splitter->rows_depth == 0 || splitter->depth < splitter->rows_depth ||
+			    c == '[')
+				g_string_append_c (splitter->envelope, c);
+		}
+	}
+
+	/* Keep the incomplete row for the next chunk */
+	if (splitter->in_row)
+		g_string_append_len (splitter->row, data + row_start, length - row_start);
+
+	return TRUE;
+}
+
+/**
+ * row_splitter_finish:
+ * @splitter: A #RowSplitter
+ * @envelope: A #JsonParser to load the envelope into, or NULL
+ * @error: Placeholder for error information
+ *
+ * Tell the splitter all the data has been fed to it. For the
+ * %ROW_SPLITTER_MODE_ARRAY mode, everything but the rows is loaded
+ * into @envelope, with the rows array left empty.
+ *
+ * Return value: TRUE if successful, FALSE if the data was incomplete.
+ */
+gboolean
+row_splitter_finish (RowSplitter *splitter, JsonParser *envelope, GError **error)
+{
+	g_return_val_if_fail (splitter != NULL, FALSE);
+
+	if (splitter->in_row || splitter->depth > 0) {
+		g_set_error (error, COUCHDB_ERROR, -1, "Invalid JSON response: truncated data");
+		return FALSE;
+	}
+
+	if (envelope != NULL && splitter->mode == ROW_SPLITTER_MODE_ARRAY && splitter->envelope->len > 0) {
+		GError *parse_error = NULL;
+
+		g_debug ("Response envelope: %s", splitter->envelope->str);
+		if (!json_parser_load_from_data (envelope,
+						 splitter->envelope->str,
+						 splitter->envelope->len,
+						 &parse_error)) {
+			g_set_error (error, COUCHDB_ERROR, -1, "Invalid JSON response: %s",
+				     parse_error->message);
+			g_error_free (parse_error);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __ROW_SPLITTER_H__
+#define __ROW_SPLITTER_H__
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+#include <libsoup/soup-message-body.h>
+
+typedef enum {
+	/* Rows are the elements of the first array found in the top level
+	   object, like in _all_docs, views and _changes responses */
+	ROW_SPLITTER_MODE_ARRAY,
+	/* Rows are a sequence of top level objects, like in a continuous
+	   _changes feed */
+	ROW_SPLITTER_MODE_OBJECTS
+} RowSplitterMode;
+
+typedef void (* RowSplitterFunc) (JsonObject *row, gpointer user_data);
+typedef void (* RowSplitterRawFunc) (SoupBuffer *row, gpointer user_data);
+
+typedef struct _RowSplitter RowSplitter;
+
+RowSplitter *row_splitter_new (RowSplitterMode mode, RowSplitterFunc func, gpointer user_data);
+RowSplitter *row_splitter_new_raw (RowSplitterMode mode, RowSplitterRawFunc func, gpointer user_data);
+void         row_splitter_free (RowSplitter *splitter);
+void         row_splitter_set_expected_length (RowSplitter *splitter, gsize length);
+
+gboolean     row_splitter_feed (RowSplitter *splitter, const char *data, gsize length, GError **error);
+gboolean     row_splitter_finish (RowSplitter *splitter, JsonParser *envelope, GError **error);
+
+#endif /* __ROW_SPLITTER_H__ */
@@ -24,8 +24,10 @@
 
 #include <glib.h>
 #include <json-glib/json-glib.h>
+#include <libsoup/soup-session.h>
 #include "config.h"
 #include "couchdb-session.h"
+#include "body-writer.h"
 
 #ifndef DEBUG_MESSAGES
 #undef g_debug
@@ -37,8 +39,71 @@ GQuark      couchdb_error_quark (void);
 
 char* generate_uuid (void);
 
+struct _CouchdbFieldKey {
+	const char *path;
+	const char **names;
+	guint n_names;
+};
+
 /* Private API */
+typedef void (* CouchdbBodyFunc) (BodyWriter *writer, gpointer user_data);
+
+gboolean	  couchdb_session_send_message_with_body	(CouchdbSession *couchdb,
+								 const char *method,
+								 const char *url,
+								 CouchdbBodyFunc body_func,
+								 gpointer body_data,
+								 JsonParser *output,
+								 GError **error);
+void		  couchdb_session_send_message_with_body_async	(CouchdbSession *couchdb,
+								 const char *method,
+								 const char *url,
+								 CouchdbBodyFunc body_func,
+								 gpointer body_data,
+								 JsonParser *output,
+								 GCancellable *cancellable,
+								 GAsyncReadyCallback callback,
+								 gpointer user_data);
+SoupMessage*	  couchdb_session_queue_message		(CouchdbSession *couchdb,
+							 const char *method,
+							 const char *url,
+							 const char *body,
+							 SoupSessionCallback callback,
+							 gpointer user_data);
+void		  couchdb_session_cancel_message	(CouchdbSession *couchdb, SoupMessage *http_message);
+SoupBuffer*	  couchdb_session_fetch_document	(CouchdbSession *couchdb,
+							 const char *dbname,
+							 const char *docid,
+							 const char *url,
+							 GError **error);
+void		  couchdb_session_invalidate_document	(CouchdbSession *couchdb,
+							 const char *dbname,
+							 const char *docid);
+void		  couchdb_session_emit_document_created	(CouchdbSession *couchdb,
+							 const char *dbname,
+							 CouchdbDocument *document);
+void		  couchdb_session_emit_document_updated	(CouchdbSession *couchdb,
+							 const char *dbname,
+							 CouchdbDocument *document);
+void		  couchdb_session_emit_document_deleted	(CouchdbSession *couchdb,
+							 const char *dbname,
+							 const char *docid);
+void		  couchdb_session_emit_changes_feed_failed (CouchdbSession *couchdb,
+							 guint status_code);
+CouchdbDocument*  couchdb_document_new_from_json_object	(CouchdbSession *couchdb,
+							 const char *dbname,
+							 JsonObject *json_object);
+CouchdbDocument*  couchdb_document_new_from_buffer	(CouchdbSession *couchdb,
+							 const char *dbname,
+							 SoupBuffer *buffer);
 JsonObject*	  couchdb_document_get_json_object	(CouchdbDocument *document);
+gboolean	  couchdb_document_check_valid		(CouchdbDocument *document, GError **error);
+void		  couchdb_document_write		(CouchdbDocument *document, BodyWriter *writer);
+void		  couchdb_document_set_dbname		(CouchdbDocument *document, const char *dbname);
+
+void                 couchdb_session_stats_add (CouchdbSessionStats *stats, const CouchdbRequestInfo *info);
+CouchdbRequestMethod couchdb_request_method_from_string (const char *method);
+CouchdbEndpointClass couchdb_endpoint_class_from_path (const char *path);
 
 CouchdbArrayField  *couchdb_array_field_new_from_json_array (JsonArray *json_array);
 JsonArray          *couchdb_array_field_get_json_array (CouchdbArrayField *array);
@@ -48,290 +48,350 @@ desktopcouch_document_is_contact (CouchdbDocument *document)
 const char *
 desktopcouch_document_contact_get_title (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "title");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "title"));
 }
 
 void
 desktopcouch_document_contact_set_title (CouchdbDocument *document, const char *title)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (title != NULL);
 
-	couchdb_document_set_string_field (document, "title", title);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "title"), title);
 }
 
 const char *
 desktopcouch_document_contact_get_first_name (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "first_name");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "first_name"));
 }
 
 void
 desktopcouch_document_contact_set_first_name (CouchdbDocument *document, const char *first_name)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (first_name != NULL);
 
-	couchdb_document_set_string_field (document, "first_name", first_name);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "first_name"), first_name);
 }
 
 const char *
 desktopcouch_document_contact_get_middle_name (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "middle_name");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "middle_name"));
 }
 
 void
 desktopcouch_document_contact_set_middle_name (CouchdbDocument *document, const char *middle_name)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (middle_name != NULL);
 
-	couchdb_document_set_string_field (document, "middle_name", middle_name);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "middle_name"), middle_name);
 }
 
 const char *
 desktopcouch_document_contact_get_last_name (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "last_name");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "last_name"));
 }
 
 void
 desktopcouch_document_contact_set_last_name (CouchdbDocument *document, const char *last_name)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (last_name != NULL);
 
-	couchdb_document_set_string_field (document, "last_name", last_name);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "last_name"), last_name);
 }
 
 const char *
 desktopcouch_document_contact_get_suffix (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "suffix");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "suffix"));
 }
 
 void
 desktopcouch_document_contact_set_suffix (CouchdbDocument *document, const char *suffix)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (suffix != NULL);
 
-	couchdb_document_set_string_field (document, "suffix", suffix);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "suffix"), suffix);
 }
 
 const char *
 desktopcouch_document_contact_get_nick_name (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "nick_name");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "nick_name"));
 }
 
 void
 desktopcouch_document_contact_set_nick_name (CouchdbDocument *document, const char *nick_name)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (nick_name != NULL);
 
-	couchdb_document_set_string_field (document, "nick_name", nick_name);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "nick_name"), nick_name);
 }
 
 const char *
 desktopcouch_document_contact_get_spouse_name (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "spouse_name");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "spouse_name"));
 }
 
 void
 desktopcouch_document_contact_set_spouse_name (CouchdbDocument *document, const char *spouse_name)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (spouse_name != NULL);
 
-	couchdb_document_set_string_field (document, "spouse_name", spouse_name);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "spouse_name"), spouse_name);
 }
 
 const char *
 desktopcouch_document_contact_get_birth_date (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	JsonObject *object;
 
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "birth_date");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "birth_date"));
 }
 
 void
 desktopcouch_document_contact_set_birth_date (CouchdbDocument *document, const char *birth_date)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (birth_date != NULL);
 
-	couchdb_document_set_string_field (document, "birth_date", birth_date);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "birth_date"), birth_date);
 }
 
 const char *
 desktopcouch_document_contact_get_wedding_date (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	JsonObject *object;
 
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "wedding_date");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "wedding_date"));
 }
 
 void
 desktopcouch_document_contact_set_wedding_date (CouchdbDocument *document, const char *wedding_date)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (wedding_date != NULL);
 
-	couchdb_document_set_string_field (document, "wedding_date", wedding_date);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "wedding_date"), wedding_date);
 }
 
 const char *
 desktopcouch_document_contact_get_company (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "company");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "company"));
 }
 
 void
 desktopcouch_document_contact_set_company (CouchdbDocument *document, const char *company)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (company != NULL);
 
-	couchdb_document_set_string_field (document, "company", company);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "company"), company);
 }
 
 const char *
 desktopcouch_document_contact_get_department (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "department");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "department"));
 }
 
 void
 desktopcouch_document_contact_set_department (CouchdbDocument *document, const char *department)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (department != NULL);
 
-	couchdb_document_set_string_field (document, "department", department);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "department"), department);
 }
 
 const char *
 desktopcouch_document_contact_get_job_title (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "job_title");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "job_title"));
 }
 
 void
 desktopcouch_document_contact_set_job_title (CouchdbDocument *document, const char *job_title)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (job_title != NULL);
 
-	couchdb_document_set_string_field (document, "job_title", job_title);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "job_title"), job_title);
 }
 
 const char *
 desktopcouch_document_contact_get_manager_name (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "manager_name");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "manager_name"));
 }
 
 void
 desktopcouch_document_contact_set_manager_name (CouchdbDocument *document, const char *manager_name)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (manager_name != NULL);
 
-	couchdb_document_set_string_field (document, "manager_name", manager_name);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "manager_name"), manager_name);
 }
 
 const char *
 desktopcouch_document_contact_get_assistant_name (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "assistant_name");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "assistant_name"));
 }
 
 void
 desktopcouch_document_contact_set_assistant_name (CouchdbDocument *document, const char *assistant_name)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (assistant_name != NULL);
 
-	couchdb_document_set_string_field (document, "assistant_name", assistant_name);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "assistant_name"), assistant_name);
 }
 
 const char *
 desktopcouch_document_contact_get_office (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "office");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "office"));
 }
 
 void
 desktopcouch_document_contact_set_office (CouchdbDocument *document, const char *office)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (office != NULL);
 
-	couchdb_document_set_string_field (document, "office", office);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "office"), office);
 }
 
 static void
@@ -352,6 +412,29 @@ foreach_object_cb (JsonObject *object,
 	}
 }
 
+/* Members keyed by UUID need the whole document to be parsed. Documents
+   which could not be parsed have none, and can't be changed */
+static JsonObject *
+get_object_member (CouchdbDocument *document, const char *member)
+{
+	JsonObject *object = couchdb_document_get_json_object (document);
+
+	return object != NULL ? json_object_get_object_member (object, member) : NULL;
+}
+
+static void
+set_object_member (CouchdbDocument *document, const char *member, JsonObject *value)
+{
+	JsonObject *object = couchdb_document_get_json_object (document);
+
+	if (object == NULL) {
+		json_object_unref (value);
+		return;
+	}
+
+	json_object_set_object_member (object, member, value);
+}
+
 /**
  * desktopcouch_document_contact_get_email_addresses:
  * @document: A #CouchdbDocument object representing a contact
@@ -374,8 +457,7 @@ desktopcouch_document_contact_get_email_addresses (CouchdbDocument *document)
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	addresses_json = json_object_get_object_member (
-		couchdb_document_get_json_object (document), "email_addresses");;
+	addresses_json = get_object_member (document, "email_addresses");
 	if (addresses_json) {
 		json_object_foreach_member (addresses_json,
 					    (JsonObjectForeach) foreach_object_cb,
@@ -413,7 +495,7 @@ desktopcouch_document_contact_set_email_addresses (CouchdbDocument *document, GS
 		}
 	}
 
-	json_object_set_object_member (couchdb_document_get_json_object (document), "email_addresses", addresses_json);
+	set_object_member (document, "email_addresses", addresses_json);
 }
 
 GSList *
@@ -425,8 +507,7 @@ desktopcouch_document_contact_get_phone_numbers (CouchdbDocument *document)
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	phone_numbers = json_object_get_object_member (
-		couchdb_document_get_json_object (document), "phone_numbers");
+	phone_numbers = get_object_member (document, "phone_numbers");
 	if (phone_numbers) {
 		json_object_foreach_member (phone_numbers,
 					    (JsonObjectForeach) foreach_object_cb,
@@ -466,7 +547,7 @@ desktopcouch_document_contact_set_phone_numbers (CouchdbDocument *document, GSLi
 		}
 	}
 
-	json_object_set_object_member (couchdb_document_get_json_object (document), "phone_numbers", phone_numbers);
+	set_object_member (document, "phone_numbers", phone_numbers);
 }
 
 GSList *
@@ -478,8 +559,7 @@ desktopcouch_document_contact_get_addresses (CouchdbDocument *document)
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	addresses = json_object_get_object_member (
-		couchdb_document_get_json_object (document), "addresses");
+	addresses = get_object_member (document, "addresses");
 	if (addresses) {
 		json_object_foreach_member (addresses,
 					    (JsonObjectForeach) foreach_object_cb,
@@ -527,7 +607,7 @@ desktopcouch_document_contact_set_addresses (CouchdbDocument *document, GSList *
 		}
 	}
 
-	json_object_set_object_member (couchdb_document_get_json_object (document), "addresses", addresses);
+	set_object_member (document, "addresses", addresses);
 }
 
 GSList *
@@ -539,8 +619,7 @@ desktopcouch_document_contact_get_im_addresses (CouchdbDocument *document)
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	im_addresses = json_object_get_object_member (
-		couchdb_document_get_json_object (document), "im_addresses");
+	im_addresses = get_object_member (document, "im_addresses");
 	if (im_addresses != NULL) {
 		json_object_foreach_member (im_addresses,
 					    (JsonObjectForeach) foreach_object_cb,
@@ -580,7 +659,7 @@ desktopcouch_document_contact_set_im_addresses (CouchdbDocument *document, GSLis
 		}
 	}
 
-	json_object_set_object_member (couchdb_document_get_json_object (document), "im_addresses", im_addresses_json);
+	set_object_member (document, "im_addresses", im_addresses_json);
 }
 
 GSList *
@@ -592,8 +671,7 @@ desktopcouch_document_contact_get_urls (CouchdbDocument *document)
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	urls = json_object_get_object_member (
-		couchdb_document_get_json_object (document), "urls");
+	urls = get_object_member (document, "urls");
 	if (urls) {
 		json_object_foreach_member (urls,
 					    (JsonObjectForeach) foreach_object_cb,
@@ -631,7 +709,7 @@ desktopcouch_document_contact_set_urls (CouchdbDocument *document, GSList *list)
 		}
 	}
 
-	json_object_set_object_member (couchdb_document_get_json_object (document), "urls", urls_json);
+	set_object_member (document, "urls", urls_json);
 }
 
 /**
@@ -645,39 +723,47 @@ desktopcouch_document_contact_set_urls (CouchdbDocument *document, GSList *list)
 const char *
 desktopcouch_document_contact_get_categories (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "categories");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "categories"));
 }
 
 void
 desktopcouch_document_contact_set_categories (CouchdbDocument *document, const char *categories)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (categories != NULL);
 
-	couchdb_document_set_string_field (document, "categories", categories);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "categories"), categories);
 }
 
 const char *
 desktopcouch_document_contact_get_notes (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_contact (document), NULL);
 
-	return couchdb_document_get_string_field (document, "notes");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "notes"));
 }
 
 void
 desktopcouch_document_contact_set_notes (CouchdbDocument *document, const char *notes)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_contact (document));
 	g_return_if_fail (notes != NULL);
 
-	couchdb_document_set_string_field (document, "notes", notes);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "notes"), notes);
 }
 
 CouchdbStructField *
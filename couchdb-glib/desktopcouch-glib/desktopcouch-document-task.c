@@ -48,37 +48,45 @@ desktopcouch_document_is_task (CouchdbDocument *document)
 const char *
 desktopcouch_document_task_get_summary (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_task (document), NULL);
 
-	return couchdb_document_get_string_field (document, "summary");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "summary"));
 }
 
 void
 desktopcouch_document_task_set_summary (CouchdbDocument *document, const char *summary)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_task (document));
 	g_return_if_fail (summary != NULL);
 
-	couchdb_document_set_string_field (document, "summary", summary);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "summary"), summary);
 }
 
 const char *
 desktopcouch_document_task_get_description (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 	g_return_val_if_fail (desktopcouch_document_is_task (document), NULL);
 
-	return couchdb_document_get_string_field (document, "description");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "description"));
 }
 
 void
 desktopcouch_document_task_set_description (CouchdbDocument *document, const char *description)
 {
-      	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (desktopcouch_document_is_task (document));
 	g_return_if_fail (description != NULL);
 
-	couchdb_document_set_string_field (document, "description", description);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "description"), description);
 }
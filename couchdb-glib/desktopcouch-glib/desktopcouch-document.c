@@ -35,9 +35,11 @@
 const char *
 desktopcouch_document_get_record_type (CouchdbDocument *document)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), NULL);
 
-	return couchdb_document_get_string_field (document, "record_type");
+	return couchdb_document_get_string_by_key (document, couchdb_field_key_intern_static (&key, "record_type"));
 }
 
 /**
@@ -50,10 +52,12 @@ desktopcouch_document_get_record_type (CouchdbDocument *document)
 void
 desktopcouch_document_set_record_type (CouchdbDocument *document, const char *record_type)
 {
+	static CouchdbFieldKey *key = NULL;
+
 	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
 	g_return_if_fail (record_type != NULL);
 
-	couchdb_document_set_string_field (document, "record_type", record_type);
+	couchdb_document_set_string_by_key (document, couchdb_field_key_intern_static (&key, "record_type"), record_type);
 }
 
 /**
@@ -92,3 +96,45 @@ desktopcouch_document_set_application_annotations (CouchdbDocument *document, Co
 
 	couchdb_document_set_struct_field (document, "application_annotations", annotations);
 }
+
+/* Path of the flag desktopcouch uses to mark records as deleted, instead of
+   really deleting them, so that the deletion is replicated */
+#define DELETED_KEY_PATH "application_annotations/Ubuntu One/private_application_annotations/deleted"
+
+/**
+ * desktopcouch_document_is_deleted:
+ * @document: A #CouchdbDocument object
+ *
+ * Check whether the given document has been marked as deleted, in its
+ * application annotations.
+ *
+ * Return value: TRUE if the document is marked as deleted, FALSE otherwise.
+ */
+gboolean
+desktopcouch_document_is_deleted (CouchdbDocument *document)
+{
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_val_if_fail (COUCHDB_IS_DOCUMENT (document), FALSE);
+
+	return couchdb_document_get_boolean_by_key (document, couchdb_field_key_intern_static (&key, DELETED_KEY_PATH));
+}
+
+/**
+ * desktopcouch_document_set_deleted:
+ * @document: A #CouchdbDocument object
+ * @deleted: Whether the document is deleted
+ *
+ * Mark the given document as deleted, or not, in its application annotations.
+ * In desktopcouch, records are not deleted, just marked as deleted, and then
+ * stored with #couchdb_document_put.
+ */
+void
+desktopcouch_document_set_deleted (CouchdbDocument *document, gboolean deleted)
+{
+	static CouchdbFieldKey *key = NULL;
+
+	g_return_if_fail (COUCHDB_IS_DOCUMENT (document));
+
+	couchdb_document_set_boolean_by_key (document, couchdb_field_key_intern_static (&key, DELETED_KEY_PATH), deleted);
+}
@@ -34,6 +34,9 @@ CouchdbStructField *desktopcouch_document_get_application_annotations (CouchdbDo
 void                desktopcouch_document_set_application_annotations (CouchdbDocument *document,
 								       CouchdbStructField *annotations);
 
+gboolean            desktopcouch_document_is_deleted (CouchdbDocument *document);
+void                desktopcouch_document_set_deleted (CouchdbDocument *document, gboolean deleted);
+
 G_END_DECLS
 
 #endif
@@ -20,11 +20,42 @@
  */
 
 #include <dbus/dbus-glib.h>
+#include <gio/gio.h>
 #include <gnome-keyring.h>
+#include <libsoup/soup-status.h>
 #include "desktopcouch-session.h"
 
 G_DEFINE_TYPE(DesktopcouchSession, desktopcouch_session, COUCHDB_TYPE_SESSION)
 
+/* The desktopcouch port and OAuth tokens are looked up once per process, and
+   forgotten, together with the shared session using them, as soon as a
+   request shows they no longer work */
+G_LOCK_DEFINE_STATIC (desktopcouch);
+static gint cached_port = 0;
+static CouchdbCredentials *cached_credentials = NULL;
+static DesktopcouchSession *shared_session = NULL;
+
+static void
+desktopcouch_session_dispose (GObject *object)
+{
+	G_LOCK (desktopcouch);
+
+	if (shared_session == DESKTOPCOUCH_SESSION (object)) {
+		/* Looked up by desktopcouch_session_new_shared while the last
+		   reference was being dropped, so it stays alive */
+		if (g_atomic_int_get ((gint *) &object->ref_count) > 1) {
+			G_UNLOCK (desktopcouch);
+			return;
+		}
+
+		shared_session = NULL;
+	}
+
+	G_UNLOCK (desktopcouch);
+
+	G_OBJECT_CLASS (desktopcouch_session_parent_class)->dispose (object);
+}
+
 static void
 desktopcouch_session_finalize (GObject *object)
 {
@@ -36,6 +67,7 @@ desktopcouch_session_class_init (DesktopcouchSessionClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+	object_class->dispose = desktopcouch_session_dispose;
 	object_class->finalize = desktopcouch_session_finalize;
 }
 
@@ -44,6 +76,167 @@ desktopcouch_session_init (DesktopcouchSession *dc)
 {
 }
 
+static void
+invalidate_cached_settings (DesktopcouchSession *dc)
+{
+	G_LOCK (desktopcouch);
+
+	cached_port = 0;
+	if (cached_credentials != NULL) {
+		g_object_unref (G_OBJECT (cached_credentials));
+		cached_credentials = NULL;
+	}
+
+	/* Don't give the broken session to new users */
+	if (shared_session == dc)
+		shared_session = NULL;
+
+	G_UNLOCK (desktopcouch);
+}
+
+static void
+authentication_failed_cb (CouchdbSession *couchdb, gpointer user_data)
+{
+	invalidate_cached_settings (DESKTOPCOUCH_SESSION (couchdb));
+}
+
+/* desktopcouch is started on a different port, and with new tokens, each
+   time, so if we can't connect or are not allowed in, it has probably been
+   restarted */
+static gboolean
+is_restart_status (guint status_code)
+{
+	return status_code == SOUP_STATUS_UNAUTHORIZED
+		|| status_code == SOUP_STATUS_CANT_CONNECT
+		|| status_code == SOUP_STATUS_CANT_CONNECT_PROXY;
+}
+
+static void
+request_finished_cb (CouchdbSession *couchdb, const char *url, const CouchdbRequestInfo *info, gpointer user_data)
+{
+	if (is_restart_status (info->status_code))
+		invalidate_cached_settings (DESKTOPCOUCH_SESSION (couchdb));
+}
+
+static void
+changes_feed_failed_cb (CouchdbSession *couchdb, guint status_code, gpointer user_data)
+{
+	/* A session only listening for changes might send nothing else */
+	if (is_restart_status (status_code))
+		invalidate_cached_settings (DESKTOPCOUCH_SESSION (couchdb));
+}
+
+static gboolean
+get_cached_settings (gint *port, CouchdbCredentials **credentials)
+{
+	gboolean found = FALSE;
+
+	G_LOCK (desktopcouch);
+
+	if (cached_port > 0 && cached_credentials != NULL) {
+		*port = cached_port;
+		*credentials = g_object_ref (G_OBJECT (cached_credentials));
+		found = TRUE;
+	}
+
+	G_UNLOCK (desktopcouch);
+
+	return found;
+}
+
+static void
+set_cached_settings (gint port, CouchdbCredentials *credentials)
+{
+	G_LOCK (desktopcouch);
+
+	cached_port = port;
+	if (cached_credentials != NULL)
+		g_object_unref (G_OBJECT (cached_credentials));
+	cached_credentials = g_object_ref (G_OBJECT (credentials));
+
+	G_UNLOCK (desktopcouch);
+}
+
+static DesktopcouchSession *
+session_new_with_settings (gint port, CouchdbCredentials *credentials)
+{
+	DesktopcouchSession *dc;
+	char *uri;
+
+	uri = g_strdup_printf ("http://127.0.0.1:%d", port);
+	dc = DESKTOPCOUCH_SESSION (g_object_new (DESKTOPCOUCH_TYPE_SESSION, "uri", uri, NULL));
+	g_free (uri);
+
+	/* Enable OAuth on this connection */
+	couchdb_session_enable_authentication (COUCHDB_SESSION (dc), credentials);
+
+	g_signal_connect (G_OBJECT (dc), "authentication-failed",
+			  G_CALLBACK (authentication_failed_cb), NULL);
+	g_signal_connect (G_OBJECT (dc), "request-finished",
+			  G_CALLBACK (request_finished_cb), NULL);
+	g_signal_connect (G_OBJECT (dc), "changes-feed-failed",
+			  G_CALLBACK (changes_feed_failed_cb), NULL);
+
+	return dc;
+}
+
+static GnomeKeyringAttributeList *
+oauth_attributes_new (void)
+{
+	GnomeKeyringAttributeList *attrs;
+
+	attrs = gnome_keyring_attribute_list_new ();
+	gnome_keyring_attribute_list_append_string (attrs, "desktopcouch", "oauth");
+
+	return attrs;
+}
+
+static CouchdbCredentials *
+credentials_from_keyring (GnomeKeyringResult result, GList *items_found, GError **error)
+{
+	gchar **items;
+	CouchdbCredentials *credentials;
+
+	if (result != GNOME_KEYRING_RESULT_OK || items_found == NULL) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     "Could not get OAuth tokens from keyring: %s",
+			     gnome_keyring_result_to_message (result));
+		return NULL;
+	}
+
+	items = g_strsplit (((GnomeKeyringFound *) items_found->data)->secret, ":", 4);
+	if (g_strv_length (items) < 4) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+			     "Invalid OAuth tokens found in keyring");
+		g_strfreev (items);
+		return NULL;
+	}
+
+	credentials = couchdb_credentials_new_with_oauth (items[0], items[1], items[2], items[3]);
+	g_strfreev (items);
+
+	return credentials;
+}
+
+static DBusGProxy *
+port_proxy_new (GError **error)
+{
+	DBusGConnection *bus;
+	DBusGProxy *proxy;
+
+	bus = dbus_g_bus_get (DBUS_BUS_SESSION, error);
+	if (bus == NULL)
+		return NULL;
+
+	proxy = dbus_g_proxy_new_for_name (bus,
+					   "org.desktopcouch.CouchDB",
+					   "/",
+					   "org.desktopcouch.CouchDB");
+	dbus_g_connection_unref (bus);
+
+	return proxy;
+}
+
 /**
  * desktopcouch_session_new:
  *
@@ -51,101 +244,283 @@ desktopcouch_session_init (DesktopcouchSession *dc)
  * created, applications can use the #CouchdbSession API to communicate with
  * the underlying CouchDB instance.
  *
+ * The desktopcouch port and OAuth tokens are looked up, concurrently, the first
+ * time, and reused afterwards until a request fails to connect or authenticate.
+ * #desktopcouch_session_new_async does the same without blocking.
+ *
  * Return value: A #CouchdbSession instance.
  */
 DesktopcouchSession *
 desktopcouch_session_new (void)
 {
-	char *uri = NULL;
-	DBusGConnection *bus;
 	DBusGProxy *proxy;
+	DBusGProxyCall *call;
+	GnomeKeyringAttributeList *attrs;
+	GnomeKeyringResult result;
+	GList *items_found = NULL;
+	CouchdbCredentials *credentials;
+	DesktopcouchSession *dc;
 	gint port;
-	GError *error;
+	GError *error = NULL;
 	gboolean success;
 
+	if (get_cached_settings (&port, &credentials)) {
+		dc = session_new_with_settings (port, credentials);
+		g_object_unref (G_OBJECT (credentials));
+
+		return dc;
+	}
+
 	/* Get the desktopcouch port via the org.desktopcouch.CouchDB interface */
-	error = NULL;
-	bus = dbus_g_bus_get (DBUS_BUS_SESSION, &error);
-	if (error) {
+	proxy = port_proxy_new (&error);
+	if (proxy == NULL) {
 		g_warning ("Couldn't get session bus: %s", error->message);
 		g_error_free (error);
 
 		return NULL;
 	}
 
-	proxy = dbus_g_proxy_new_for_name (bus,
-					   "org.desktopcouch.CouchDB",
-					   "/",
-					   "org.desktopcouch.CouchDB");
+	call = dbus_g_proxy_begin_call (proxy, "getPort", NULL, NULL, NULL, G_TYPE_INVALID);
 
-	error = NULL;
-	success = dbus_g_proxy_call (proxy, "getPort", &error, G_TYPE_INVALID,
-				     G_TYPE_INT, &port, G_TYPE_INVALID);
+	/* Get OAuth tokens from GnomeKeyring while desktopcouch answers */
+	attrs = oauth_attributes_new ();
+	result = gnome_keyring_find_items_sync (GNOME_KEYRING_ITEM_GENERIC_SECRET,
+						attrs, &items_found);
+	credentials = credentials_from_keyring (result, items_found, &error);
+	if (items_found != NULL)
+		gnome_keyring_found_list_free (items_found);
+	gnome_keyring_attribute_list_free (attrs);
 
-	/* Free memory */
+	if (credentials == NULL) {
+		g_warning ("%s", error->message);
+		g_error_free (error);
+		error = NULL;
+	}
+
+	success = dbus_g_proxy_end_call (proxy, call, &error, G_TYPE_INT, &port, G_TYPE_INVALID);
 	g_object_unref (G_OBJECT (proxy));
-	dbus_g_connection_unref (bus);
 
-	if (success) {
-		GnomeKeyringAttributeList *attrs;
-		GnomeKeyringResult result;
-		GList *items_found;
-
-		uri = g_strdup_printf ("http://127.0.0.1:%d", port);
-
-		/* Get OAuth tokens from GnomeKeyring */
-		attrs = gnome_keyring_attribute_list_new ();
-		gnome_keyring_attribute_list_append_string (attrs, "desktopcouch", "oauth");
-
-		result = gnome_keyring_find_items_sync (GNOME_KEYRING_ITEM_GENERIC_SECRET,
-							attrs, &items_found);
-		if (result == GNOME_KEYRING_RESULT_OK && items_found != NULL) {
-			gchar **items;
-			char *oauth_c_key = NULL, *oauth_c_secret = NULL, *oauth_t_key = NULL, *oauth_t_secret = NULL;
-			DesktopcouchSession *dc;
-			CouchdbCredentials *credentials;
-			GnomeKeyringFound *first_item = (GnomeKeyringFound *) items_found->data;
-
-			items = g_strsplit (first_item->secret, ":", 4);
-			if (items) {
-				oauth_c_key = g_strdup (items[0]);
-				oauth_c_secret = g_strdup (items[1]);
-				oauth_t_key = g_strdup (items[2]);
-				oauth_t_secret = g_strdup (items[3]);
-				g_strfreev (items);
-			}
-
-			gnome_keyring_found_list_free (items_found);
-
-			/* Enable OAuth on this connection */
-			dc = DESKTOPCOUCH_SESSION (g_object_new (DESKTOPCOUCH_TYPE_SESSION, "uri", uri, NULL));
-
-			credentials = couchdb_credentials_new_with_oauth (oauth_c_key,
-									  oauth_c_secret,
-									  oauth_t_key,
-									  oauth_t_secret);
-			couchdb_session_enable_authentication (COUCHDB_SESSION (dc), credentials);
-
-			/* Free memory */
-			g_free (oauth_c_key);
-			g_free (oauth_c_secret);
-			g_free (oauth_t_key);
-			g_free (oauth_t_secret);
-			g_free (uri);
+	if (!success) {
+		g_warning ("Couldn't get port for desktopcouch: %s", error->message);
+		g_error_free (error);
+		if (credentials != NULL)
 			g_object_unref (G_OBJECT (credentials));
 
-			return dc;
-		} else {
-			g_warning ("Could not get OAuth tokens from keyring: %s",
-				   gnome_keyring_result_to_message (result));
-		}
+		return NULL;
+	}
+
+	if (credentials == NULL)
+		return NULL;
+
+	set_cached_settings (port, credentials);
+	dc = session_new_with_settings (port, credentials);
+	g_object_unref (G_OBJECT (credentials));
+
+	return dc;
+}
+
+typedef struct {
+	GSimpleAsyncResult *result;
+	GCancellable *cancellable;
+	DBusGProxy *proxy;
+	guint pending;
+
+	gint port;
+	CouchdbCredentials *credentials;
+	GError *error;
+} NewSessionData;
 
-		/* Free memory */
-		gnome_keyring_attribute_list_free (attrs);
+static void
+new_session_data_done (NewSessionData *data)
+{
+	if (--data->pending > 0)
+		return;
+
+	if (data->error == NULL && data->cancellable != NULL)
+		g_cancellable_set_error_if_cancelled (data->cancellable, &data->error);
+
+	if (data->error == NULL) {
+		set_cached_settings (data->port, data->credentials);
+		g_simple_async_result_set_op_res_gpointer (data->result,
+							   session_new_with_settings (data->port, data->credentials),
+							   g_object_unref);
 	} else {
-		g_warning ("Couldn't get port for desktopcouch: %s", error->message);
-		g_error_free (error);
+		g_simple_async_result_set_from_error (data->result, data->error);
+		g_error_free (data->error);
 	}
 
-	return NULL;
+	g_simple_async_result_complete (data->result);
+
+	/* Free memory */
+	g_object_unref (G_OBJECT (data->result));
+	if (data->cancellable != NULL)
+		g_object_unref (G_OBJECT (data->cancellable));
+	if (data->proxy != NULL)
+		g_object_unref (G_OBJECT (data->proxy));
+	if (data->credentials != NULL)
+		g_object_unref (G_OBJECT (data->credentials));
+	g_slice_free (NewSessionData, data);
+}
+
+static void
+get_port_cb (DBusGProxy *proxy, DBusGProxyCall *call, gpointer user_data)
+{
+	NewSessionData *data = (NewSessionData *) user_data;
+	GError *error = NULL;
+
+	if (!dbus_g_proxy_end_call (proxy, call, &error, G_TYPE_INT, &data->port, G_TYPE_INVALID)) {
+		if (data->error == NULL)
+			data->error = error;
+		else
+			g_error_free (error);
+	}
+
+	new_session_data_done (data);
+}
+
+static void
+find_items_cb (GnomeKeyringResult result, GList *items_found, gpointer user_data)
+{
+	NewSessionData *data = (NewSessionData *) user_data;
+	GError *error = NULL;
+
+	data->credentials = credentials_from_keyring (result, items_found, &error);
+	if (error != NULL) {
+		if (data->error == NULL)
+			data->error = error;
+		else
+			g_error_free (error);
+	}
+
+	new_session_data_done (data);
+}
+
+static gboolean
+complete_in_idle_cb (gpointer user_data)
+{
+	new_session_data_done ((NewSessionData *) user_data);
+
+	return FALSE;
+}
+
+/**
+ * desktopcouch_session_new_async:
+ * @cancellable: A #GCancellable object, or NULL
+ * @callback: Function to call when the session has been created
+ * @user_data: Data to pass to @callback
+ *
+ * Asynchronous version of #desktopcouch_session_new. The desktopcouch port and
+ * the OAuth tokens are requested at the same time, unless they are already
+ * known. When done, @callback will be called, and it should then call
+ * #desktopcouch_session_new_finish to get the new session.
+ */
+void
+desktopcouch_session_new_async (GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	NewSessionData *data;
+	GnomeKeyringAttributeList *attrs;
+
+	data = g_slice_new0 (NewSessionData);
+	data->result = g_simple_async_result_new (NULL, callback, user_data,
+						  desktopcouch_session_new_async);
+	if (cancellable != NULL)
+		data->cancellable = g_object_ref (G_OBJECT (cancellable));
+
+	/* Always complete from the main loop, even if nothing needs to be
+	   looked up */
+	data->pending = 1;
+	if (get_cached_settings (&data->port, &data->credentials)) {
+		g_idle_add (complete_in_idle_cb, data);
+		return;
+	}
+
+	data->proxy = port_proxy_new (&data->error);
+	if (data->proxy != NULL) {
+		data->pending++;
+		dbus_g_proxy_begin_call (data->proxy, "getPort", get_port_cb, data, NULL, G_TYPE_INVALID);
+	}
+
+	attrs = oauth_attributes_new ();
+	data->pending++;
+	gnome_keyring_find_items (GNOME_KEYRING_ITEM_GENERIC_SECRET, attrs,
+				  find_items_cb, data, NULL);
+	gnome_keyring_attribute_list_free (attrs);
+
+	g_idle_add (complete_in_idle_cb, data);
+}
+
+/**
+ * desktopcouch_session_new_finish:
+ * @result: A #GAsyncResult, as passed to the callback
+ * @error: Placeholder for error information
+ *
+ * Finish an operation started with #desktopcouch_session_new_async.
+ *
+ * Return value: A #DesktopcouchSession instance, or NULL if desktopcouch could
+ * not be contacted, in which case the error argument will contain information
+ * about the error.
+ */
+DesktopcouchSession *
+desktopcouch_session_new_finish (GAsyncResult *result, GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+							      desktopcouch_session_new_async), NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (result);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	return g_object_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
+/**
+ * desktopcouch_session_new_shared:
+ *
+ * Get a #DesktopcouchSession shared with all other callers in the process.
+ * Looking up the desktopcouch port and OAuth tokens is only done when there is
+ * no live shared session, and all users share its connections, document cache
+ * and change feeds.
+ *
+ * Return value: A #DesktopcouchSession instance, which should be unreferenced
+ * by calling g_object_unref once no longer needed, or NULL if desktopcouch
+ * could not be contacted.
+ */
+DesktopcouchSession *
+desktopcouch_session_new_shared (void)
+{
+	DesktopcouchSession *dc, *other = NULL;
+
+	/* The shared session is only cleared once its last reference is
+	   dropped, with the lock held, so the one found here is still alive */
+	G_LOCK (desktopcouch);
+	dc = shared_session != NULL ? g_object_ref (G_OBJECT (shared_session)) : NULL;
+	G_UNLOCK (desktopcouch);
+
+	if (dc != NULL)
+		return dc;
+
+	/* Looking up the settings might take a while, so don't hold the lock */
+	dc = desktopcouch_session_new ();
+	if (dc == NULL)
+		return NULL;
+
+	G_LOCK (desktopcouch);
+	if (shared_session == NULL) {
+		shared_session = dc;
+	} else {
+		/* Someone else was faster */
+		other = dc;
+		dc = g_object_ref (G_OBJECT (shared_session));
+	}
+	G_UNLOCK (desktopcouch);
+
+	/* Disposing takes the lock */
+	if (other != NULL)
+		g_object_unref (G_OBJECT (other));
+
+	return dc;
 }
@@ -43,6 +43,11 @@ typedef struct {
 
 GType                desktopcouch_session_get_type (void);
 DesktopcouchSession *desktopcouch_session_new (void);
+DesktopcouchSession *desktopcouch_session_new_shared (void);
+void                 desktopcouch_session_new_async (GCancellable *cancellable,
+						     GAsyncReadyCallback callback,
+						     gpointer user_data);
+DesktopcouchSession *desktopcouch_session_new_finish (GAsyncResult *result, GError **error);
 
 G_END_DECLS
 
@@ -0,0 +1,1592 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+#include "fake-couchdb.h"
+
+#define DEFAULT_HEARTBEAT_MILLISECONDS 60000
+
+struct _FakeCouchdb {
+	SoupServer *server;
+	GMainContext *context;
+	GThread *thread;
+	char *uri;
+
+	/* Only accessed from the server thread */
+	GHashTable *databases;
+	GList *updates_listeners;
+	GList *held_changes;
+
+	volatile gint request_count;
+	volatile gint latency;
+	volatile gint failure_permille;
+	volatile gint failure_status;
+	volatile gint fail_next;
+	volatile gint fail_next_status;
+	volatile gint session_generation;
+	volatile gint require_sessions;
+	volatile gint db_updates;
+	volatile gint hold_changes;
+};
+
+typedef struct {
+	char *name;
+	GHashTable *documents;
+	guint update_seq;
+	GList *listeners;
+} FakeDatabase;
+
+typedef struct {
+	char *id;
+	char *rev;
+	guint generation;
+	guint seq;
+	gboolean deleted;
+	JsonObject *body;
+} FakeDocument;
+
+typedef struct {
+	FakeCouchdb *fake;
+	FakeDatabase *db;
+	SoupMessage *msg;
+	gboolean include_docs;
+	gboolean continuous;
+	GSource *heartbeat;
+} FakeListener;
+
+static void
+fake_document_free (FakeDocument *doc)
+{
+	g_free (doc->id);
+	g_free (doc->rev);
+	if (doc->body != NULL)
+		json_object_unref (doc->body);
+
+	g_slice_free (FakeDocument, doc);
+}
+
+static FakeDatabase *
+fake_database_new (const char *name)
+{
+	FakeDatabase *db;
+
+	db = g_slice_new0 (FakeDatabase);
+	db->name = g_strdup (name);
+	db->documents = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					       (GDestroyNotify) fake_document_free);
+
+	return db;
+}
+
+static void
+fake_listener_free (FakeListener *listener)
+{
+	if (listener->heartbeat != NULL) {
+		g_source_destroy (listener->heartbeat);
+		g_source_unref (listener->heartbeat);
+	}
+
+	g_object_unref (G_OBJECT (listener->msg));
+	g_slice_free (FakeListener, listener);
+}
+
+static void
+fake_database_free (FakeDatabase *db)
+{
+	GList *l;
+
+	/* Listeners still connected are only left at shutdown, when no
+	   more I/O will happen on their messages */
+	for (l = db->listeners; l != NULL; l = l->next) {
+		FakeListener *listener = (FakeListener *) l->data;
+
+		g_signal_handlers_disconnect_matched (G_OBJECT (listener->msg), G_SIGNAL_MATCH_DATA,
+						      0, 0, NULL, NULL, listener);
+		fake_listener_free (listener);
+	}
+	g_list_free (db->listeners);
+
+	g_hash_table_destroy (db->documents);
+	g_free (db->name);
+
+	g_slice_free (FakeDatabase, db);
+}
+
+/*
+ * JSON helpers
+ */
+
+static JsonNode *
+object_node (JsonObject *object)
+{
+	JsonNode *node;
+
+	node = json_node_new (JSON_NODE_OBJECT);
+	json_node_take_object (node, object);
+
+	return node;
+}
+
+static char *
+node_to_string (JsonNode *node, gsize *length)
+{
+	JsonGenerator *generator;
+	char *str;
+
+	generator = json_generator_new ();
+	json_generator_set_root (generator, node);
+	str = json_generator_to_data (generator, length);
+	g_object_unref (G_OBJECT (generator));
+
+	return str;
+}
+
+/* Takes ownership of @node */
+static void
+set_response (SoupMessage *msg, guint status, JsonNode *node)
+{
+	char *data;
+	gsize length;
+
+	data = node_to_string (node, &length);
+	soup_message_set_status (msg, status);
+	soup_message_set_response (msg, "application/json", SOUP_MEMORY_TAKE, data, length);
+
+	json_node_free (node);
+}
+
+static void
+set_error (SoupMessage *msg, guint status, const char *error, const char *reason)
+{
+	JsonObject *object;
+
+	object = json_object_new ();
+	json_object_set_string_member (object, "error", error);
+	json_object_set_string_member (object, "reason", reason);
+	set_response (msg, status, object_node (object));
+}
+
+static void
+set_ok (SoupMessage *msg, guint status)
+{
+	JsonObject *object;
+
+	object = json_object_new ();
+	json_object_set_boolean_member (object, "ok", TRUE);
+	set_response (msg, status, object_node (object));
+}
+
+static void
+set_stored (SoupMessage *msg, guint status, FakeDocument *doc)
+{
+	JsonObject *object;
+	char *etag;
+
+	object = json_object_new ();
+	json_object_set_boolean_member (object, "ok", TRUE);
+	json_object_set_string_member (object, "id", doc->id);
+	json_object_set_string_member (object, "rev", doc->rev);
+	set_response (msg, status, object_node (object));
+
+	etag = g_strdup_printf ("\"%s\"", doc->rev);
+	soup_message_headers_replace (msg->response_headers, "ETag", etag);
+	g_free (etag);
+}
+
+static JsonNode *
+parse_request_body (SoupMessage *msg)
+{
+	SoupBuffer *buffer;
+	JsonParser *parser;
+	JsonNode *node = NULL;
+
+	buffer = soup_message_body_flatten (msg->request_body);
+	parser = json_parser_new ();
+	if (buffer->length > 0 &&
+	    json_parser_load_from_data (parser, buffer->data, buffer->length, NULL) &&
+	    json_parser_get_root (parser) != NULL)
+		node = json_node_copy (json_parser_get_root (parser));
+
+	g_object_unref (G_OBJECT (parser));
+	soup_buffer_free (buffer);
+
+	return node;
+}
+
+static gboolean
+query_get_boolean (GHashTable *query, const char *name)
+{
+	const char *value;
+
+	value = query != NULL ? g_hash_table_lookup (query, name) : NULL;
+
+	return value != NULL && !strcmp (value, "true");
+}
+
+static gint
+query_get_int (GHashTable *query, const char *name, gint default_value)
+{
+	const char *value;
+
+	value = query != NULL ? g_hash_table_lookup (query, name) : NULL;
+
+	return value != NULL ? atoi (value) : default_value;
+}
+
+/*
+ * Documents
+ */
+
+static char *
+generate_docid (void)
+{
+	return g_strdup_printf ("%08x%08x%08x%08x",
+				g_random_int (), g_random_int (),
+				g_random_int (), g_random_int ());
+}
+
+static JsonObject *
+document_to_json (FakeDocument *doc)
+{
+	JsonObject *object;
+
+	object = json_object_new ();
+	json_object_set_string_member (object, "_id", doc->id);
+	json_object_set_string_member (object, "_rev", doc->rev);
+
+	if (doc->deleted) {
+		json_object_set_boolean_member (object, "_deleted", TRUE);
+	} else {
+		GList *members, *l;
+
+		members = json_object_get_members (doc->body);
+		for (l = members; l != NULL; l = l->next) {
+			json_object_set_member (object, (const char *) l->data,
+						json_node_copy (json_object_get_member (doc->body, (const char *) l->data)));
+		}
+		g_list_free (members);
+	}
+
+	return object;
+}
+
+static JsonObject *
+change_to_json (FakeDocument *doc, gboolean include_docs)
+{
+	JsonObject *row, *change;
+	JsonArray *changes;
+
+	change = json_object_new ();
+	json_object_set_string_member (change, "rev", doc->rev);
+	changes = json_array_new ();
+	json_array_add_object_element (changes, change);
+
+	row = json_object_new ();
+	json_object_set_int_member (row, "seq", doc->seq);
+	json_object_set_string_member (row, "id", doc->id);
+	json_object_set_array_member (row, "changes", changes);
+	if (doc->deleted)
+		json_object_set_boolean_member (row, "deleted", TRUE);
+	if (include_docs)
+		json_object_set_object_member (row, "doc", document_to_json (doc));
+
+	return row;
+}
+
+static void
+append_change_line (SoupMessage *msg, FakeDocument *doc, gboolean include_docs)
+{
+	JsonNode *node;
+	char *data;
+	gsize length;
+
+	node = object_node (change_to_json (doc, include_docs));
+	data = node_to_string (node, &length);
+	soup_message_body_append (msg->response_body, SOUP_MEMORY_TAKE, data, length);
+	soup_message_body_append (msg->response_body, SOUP_MEMORY_STATIC, "\n", 1);
+	json_node_free (node);
+}
+
+static void
+notify_updates_listeners (FakeCouchdb *fake, FakeDatabase *db)
+{
+	GList *l;
+
+	for (l = fake->updates_listeners; l != NULL; l = l->next) {
+		FakeListener *listener = (FakeListener *) l->data;
+		JsonObject *row;
+		JsonNode *node;
+		char *data;
+		gsize length;
+
+		row = json_object_new ();
+		json_object_set_string_member (row, "db_name", db->name);
+		json_object_set_string_member (row, "type", "updated");
+		node = object_node (row);
+		data = node_to_string (node, &length);
+		soup_message_body_append (listener->msg->response_body, SOUP_MEMORY_TAKE, data, length);
+		soup_message_body_append (listener->msg->response_body, SOUP_MEMORY_STATIC, "\n", 1);
+		json_node_free (node);
+
+		soup_server_unpause_message (fake->server, listener->msg);
+	}
+}
+
+static void
+notify_listeners (FakeCouchdb *fake, FakeDatabase *db, FakeDocument *doc)
+{
+	GList *listeners, *l;
+
+	notify_updates_listeners (fake, db);
+
+	listeners = g_list_copy (db->listeners);
+	for (l = listeners; l != NULL; l = l->next) {
+		FakeListener *listener = (FakeListener *) l->data;
+
+		if (listener->continuous) {
+			append_change_line (listener->msg, doc, listener->include_docs);
+		} else {
+			JsonObject *object;
+			JsonArray *results;
+
+			results = json_array_new ();
+			json_array_add_object_element (results, change_to_json (doc, listener->include_docs));
+			object = json_object_new ();
+			json_object_set_array_member (object, "results", results);
+			json_object_set_int_member (object, "last_seq", doc->seq);
+			set_response (listener->msg, SOUP_STATUS_OK, object_node (object));
+		}
+
+		soup_server_unpause_message (fake->server, listener->msg);
+	}
+
+	g_list_free (listeners);
+}
+
+/* Updates the document's revision, as CouchDB would do */
+static void
+update_revision (FakeDocument *doc)
+{
+	JsonNode *node;
+	char *str, *hash;
+
+	doc->generation++;
+
+	node = object_node (json_object_ref (doc->body));
+	str = node_to_string (node, NULL);
+	hash = g_compute_checksum_for_string (G_CHECKSUM_MD5, str, -1);
+
+	g_free (doc->rev);
+	doc->rev = g_strdup_printf ("%u-%s", doc->generation, hash);
+
+	g_free (hash);
+	g_free (str);
+	json_node_free (node);
+}
+
+static FakeDocument *
+store_document (FakeCouchdb *fake,
+		FakeDatabase *db,
+		const char *id,
+		JsonObject *object,
+		gboolean check_revision,
+		const char **error)
+{
+	FakeDocument *doc;
+	const char *rev = NULL;
+	GList *members, *l;
+
+	doc = g_hash_table_lookup (db->documents, id);
+
+	if (json_object_has_member (object, "_rev"))
+		rev = json_object_get_string_member (object, "_rev");
+
+	if (check_revision) {
+		gboolean alive = doc != NULL && !doc->deleted;
+
+		if ((alive && g_strcmp0 (rev, doc->rev) != 0) ||
+		    (!alive && rev != NULL && (doc == NULL || strcmp (rev, doc->rev) != 0))) {
+			*error = "conflict";
+			return NULL;
+		}
+	}
+
+	if (doc == NULL) {
+		doc = g_slice_new0 (FakeDocument);
+		doc->id = g_strdup (id);
+		g_hash_table_insert (db->documents, doc->id, doc);
+	}
+
+	/* Keep everything but the special fields */
+	if (doc->body != NULL)
+		json_object_unref (doc->body);
+	doc->body = json_object_new ();
+	members = json_object_get_members (object);
+	for (l = members; l != NULL; l = l->next) {
+		const char *name = (const char *) l->data;
+
+		if (name[0] != '_')
+			json_object_set_member (doc->body, name,
+						json_node_copy (json_object_get_member (object, name)));
+	}
+	g_list_free (members);
+
+	doc->deleted = json_object_has_member (object, "_deleted") &&
+		json_object_get_boolean_member (object, "_deleted");
+	update_revision (doc);
+	doc->seq = ++db->update_seq;
+
+	notify_listeners (fake, db, doc);
+
+	return doc;
+}
+
+static gint
+compare_documents_by_id (gconstpointer a, gconstpointer b)
+{
+	return strcmp (((FakeDocument *) a)->id, ((FakeDocument *) b)->id);
+}
+
+static gint
+compare_documents_by_seq (gconstpointer a, gconstpointer b)
+{
+	return (gint) ((FakeDocument *) a)->seq - (gint) ((FakeDocument *) b)->seq;
+}
+
+static GList *
+get_live_documents (FakeDatabase *db)
+{
+	GList *documents = NULL;
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init (&iter, db->documents);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		if (!((FakeDocument *) value)->deleted)
+			documents = g_list_prepend (documents, value);
+	}
+
+	return g_list_sort (documents, compare_documents_by_id);
+}
+
+/*
+ * Request handlers
+ */
+
+static void
+handle_root (FakeCouchdb *fake, SoupMessage *msg)
+{
+	JsonObject *object;
+
+	object = json_object_new ();
+	json_object_set_string_member (object, "couchdb", "Welcome");
+	json_object_set_string_member (object, "version", "0.10.0");
+	set_response (msg, SOUP_STATUS_OK, object_node (object));
+}
+
+static void
+handle_all_dbs (FakeCouchdb *fake, SoupMessage *msg)
+{
+	JsonArray *array;
+	JsonNode *node;
+	GList *names, *l;
+
+	names = g_list_sort (g_hash_table_get_keys (fake->databases), (GCompareFunc) strcmp);
+	array = json_array_new ();
+	for (l = names; l != NULL; l = l->next)
+		json_array_add_string_element (array, (const char *) l->data);
+	g_list_free (names);
+
+	node = json_node_new (JSON_NODE_ARRAY);
+	json_node_take_array (node, array);
+	set_response (msg, SOUP_STATUS_OK, node);
+}
+
+static FakeDatabase *
+database_from_url (FakeCouchdb *fake, const char *url)
+{
+	const char *name;
+
+	/* Only databases on this server can be replicated */
+	name = strstr (url, "://") ? strrchr (url, '/') + 1 : url;
+
+	return g_hash_table_lookup (fake->databases, name);
+}
+
+static void
+handle_replicate (FakeCouchdb *fake, SoupMessage *msg)
+{
+	JsonNode *body;
+	JsonObject *request, *object;
+	FakeDatabase *source, *target;
+	GList *documents, *l;
+
+	body = parse_request_body (msg);
+	if (body == NULL || json_node_get_node_type (body) != JSON_NODE_OBJECT) {
+		set_error (msg, SOUP_STATUS_BAD_REQUEST, "bad_request", "Invalid JSON");
+		if (body != NULL)
+			json_node_free (body);
+		return;
+	}
+
+	request = json_node_get_object (body);
+	source = json_object_has_member (request, "source") ?
+		database_from_url (fake, json_object_get_string_member (request, "source")) : NULL;
+	target = json_object_has_member (request, "target") ?
+		database_from_url (fake, json_object_get_string_member (request, "target")) : NULL;
+	if (source == NULL || target == NULL) {
+		set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", "no_db_file");
+		json_node_free (body);
+		return;
+	}
+
+	/* Copy every document whose revision differs, keeping the revision */
+	documents = g_hash_table_get_values (source->documents);
+	documents = g_list_sort (documents, compare_documents_by_seq);
+	for (l = documents; l != NULL; l = l->next) {
+		FakeDocument *doc = (FakeDocument *) l->data;
+		FakeDocument *copy;
+
+		copy = g_hash_table_lookup (target->documents, doc->id);
+		if (copy != NULL && !strcmp (copy->rev, doc->rev))
+			continue;
+
+		if (copy == NULL) {
+			copy = g_slice_new0 (FakeDocument);
+			copy->id = g_strdup (doc->id);
+			g_hash_table_insert (target->documents, copy->id, copy);
+		}
+
+		g_free (copy->rev);
+		copy->rev = g_strdup (doc->rev);
+		copy->generation = doc->generation;
+		copy->deleted = doc->deleted;
+		if (copy->body != NULL)
+			json_object_unref (copy->body);
+		copy->body = json_object_ref (doc->body);
+		copy->seq = ++target->update_seq;
+
+		notify_listeners (fake, target, copy);
+	}
+	g_list_free (documents);
+
+	object = json_object_new ();
+	json_object_set_boolean_member (object, "ok", TRUE);
+	json_object_set_string_member (object, "session_id", "fake");
+	json_object_set_int_member (object, "source_last_seq", source->update_seq);
+	json_object_set_array_member (object, "history", json_array_new ());
+	set_response (msg, SOUP_STATUS_OK, object_node (object));
+
+	json_node_free (body);
+}
+
+static void
+handle_new_document (FakeCouchdb *fake, SoupMessage *msg, FakeDatabase *db)
+{
+	JsonNode *body;
+	FakeDocument *doc;
+	char *id;
+	const char *error = NULL;
+
+	body = parse_request_body (msg);
+	if (body == NULL || json_node_get_node_type (body) != JSON_NODE_OBJECT) {
+		set_error (msg, SOUP_STATUS_BAD_REQUEST, "bad_request", "Document must be a JSON object");
+		if (body != NULL)
+			json_node_free (body);
+		return;
+	}
+
+	if (json_object_has_member (json_node_get_object (body), "_id"))
+		id = g_strdup (json_object_get_string_member (json_node_get_object (body), "_id"));
+	else
+		id = generate_docid ();
+
+	doc = store_document (fake, db, id, json_node_get_object (body), TRUE, &error);
+	if (doc != NULL)
+		set_stored (msg, SOUP_STATUS_CREATED, doc);
+	else
+		set_error (msg, SOUP_STATUS_CONFLICT, error, "Document update conflict.");
+
+	g_free (id);
+	json_node_free (body);
+}
+
+static void
+handle_database (FakeCouchdb *fake, SoupMessage *msg, const char *dbname)
+{
+	FakeDatabase *db;
+
+	db = g_hash_table_lookup (fake->databases, dbname);
+
+	if (msg->method == SOUP_METHOD_PUT) {
+		if (db != NULL) {
+			set_error (msg, SOUP_STATUS_PRECONDITION_FAILED, "file_exists",
+				   "The database could not be created, the file already exists.");
+		} else {
+			db = fake_database_new (dbname);
+			g_hash_table_insert (fake->databases, db->name, db);
+			set_ok (msg, SOUP_STATUS_CREATED);
+		}
+		return;
+	}
+
+	if (db == NULL) {
+		set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", "no_db_file");
+		return;
+	}
+
+	if (msg->method == SOUP_METHOD_DELETE) {
+		GList *l;
+
+		/* Close all feeds on the database */
+		for (l = db->listeners; l != NULL; l = l->next) {
+			FakeListener *listener = (FakeListener *) l->data;
+
+			listener->db = NULL;
+			if (listener->continuous)
+				soup_message_body_complete (listener->msg->response_body);
+			else
+				set_error (listener->msg, SOUP_STATUS_NOT_FOUND, "not_found", "no_db_file");
+			soup_server_unpause_message (fake->server, listener->msg);
+		}
+		g_list_free (db->listeners);
+		db->listeners = NULL;
+
+		g_hash_table_remove (fake->databases, dbname);
+		set_ok (msg, SOUP_STATUS_OK);
+	} else if (msg->method == SOUP_METHOD_GET) {
+		JsonObject *object;
+		GHashTableIter iter;
+		gpointer value;
+		guint doc_count = 0, doc_del_count = 0;
+
+		g_hash_table_iter_init (&iter, db->documents);
+		while (g_hash_table_iter_next (&iter, NULL, &value)) {
+			if (((FakeDocument *) value)->deleted)
+				doc_del_count++;
+			else
+				doc_count++;
+		}
+
+		object = json_object_new ();
+		json_object_set_string_member (object, "db_name", db->name);
+		json_object_set_int_member (object, "doc_count", doc_count);
+		json_object_set_int_member (object, "doc_del_count", doc_del_count);
+		json_object_set_int_member (object, "update_seq", db->update_seq);
+		json_object_set_int_member (object, "purge_seq", 0);
+		json_object_set_boolean_member (object, "compact_running", FALSE);
+		json_object_set_int_member (object, "disk_size", 0);
+		json_object_set_string_member (object, "instance_start_time", "0");
+		json_object_set_int_member (object, "disk_format_version", 4);
+		set_response (msg, SOUP_STATUS_OK, object_node (object));
+	} else if (msg->method == SOUP_METHOD_POST) {
+		handle_new_document (fake, msg, db);
+	} else
+		set_error (msg, SOUP_STATUS_METHOD_NOT_ALLOWED, "method_not_allowed", msg->method);
+}
+
+static JsonObject *
+all_docs_row (FakeDocument *doc, gboolean include_docs)
+{
+	JsonObject *row, *value;
+
+	value = json_object_new ();
+	json_object_set_string_member (value, "rev", doc->rev);
+	if (doc->deleted)
+		json_object_set_boolean_member (value, "deleted", TRUE);
+
+	row = json_object_new ();
+	json_object_set_string_member (row, "id", doc->id);
+	json_object_set_string_member (row, "key", doc->id);
+	json_object_set_object_member (row, "value", value);
+	if (include_docs) {
+		if (doc->deleted)
+			json_object_set_null_member (row, "doc");
+		else
+			json_object_set_object_member (row, "doc", document_to_json (doc));
+	}
+
+	return row;
+}
+
+static void
+handle_all_docs (FakeCouchdb *fake, SoupMessage *msg, FakeDatabase *db, GHashTable *query)
+{
+	JsonObject *object;
+	JsonArray *rows;
+	GList *documents, *l;
+	gboolean include_docs;
+	gint limit, offset = 0;
+	JsonNode *body = NULL;
+
+	include_docs = query_get_boolean (query, "include_docs");
+	limit = query_get_int (query, "limit", -1);
+	documents = get_live_documents (db);
+	rows = json_array_new ();
+
+	if (msg->method == SOUP_METHOD_POST) {
+		JsonArray *keys = NULL;
+		guint i;
+
+		body = parse_request_body (msg);
+		if (body != NULL && json_node_get_node_type (body) == JSON_NODE_OBJECT &&
+		    json_object_has_member (json_node_get_object (body), "keys"))
+			keys = json_object_get_array_member (json_node_get_object (body), "keys");
+		if (keys == NULL) {
+			set_error (msg, SOUP_STATUS_BAD_REQUEST, "bad_request", "`keys` member must exist.");
+			json_array_unref (rows);
+			g_list_free (documents);
+			if (body != NULL)
+				json_node_free (body);
+			return;
+		}
+
+		for (i = 0; i < json_array_get_length (keys); i++) {
+			const char *key;
+			FakeDocument *doc;
+
+			key = json_node_get_string (json_array_get_element (keys, i));
+			doc = key != NULL ? g_hash_table_lookup (db->documents, key) : NULL;
+			if (doc != NULL) {
+				json_array_add_object_element (rows, all_docs_row (doc, include_docs));
+			} else {
+				JsonObject *row;
+
+				row = json_object_new ();
+				json_object_set_string_member (row, "key", key);
+				json_object_set_string_member (row, "error", "not_found");
+				json_array_add_object_element (rows, row);
+			}
+		}
+	} else {
+		const char *startkey;
+
+		startkey = query != NULL ? g_hash_table_lookup (query, "startkey_docid") : NULL;
+		for (l = documents; l != NULL; l = l->next) {
+			FakeDocument *doc = (FakeDocument *) l->data;
+
+			if (startkey != NULL && strcmp (doc->id, startkey) < 0) {
+				offset++;
+				continue;
+			}
+
+			if (limit >= 0 && (gint) json_array_get_length (rows) >= limit)
+				break;
+
+			json_array_add_object_element (rows, all_docs_row (doc, include_docs));
+		}
+	}
+
+	object = json_object_new ();
+	json_object_set_int_member (object, "total_rows", g_list_length (documents));
+	json_object_set_int_member (object, "offset", offset);
+	json_object_set_array_member (object, "rows", rows);
+	set_response (msg, SOUP_STATUS_OK, object_node (object));
+
+	g_list_free (documents);
+	if (body != NULL)
+		json_node_free (body);
+}
+
+static void
+handle_bulk_docs (FakeCouchdb *fake, SoupMessage *msg, FakeDatabase *db)
+{
+	JsonNode *body, *node;
+	JsonObject *request;
+	JsonArray *docs, *results;
+	gboolean all_or_nothing;
+	guint i;
+
+	body = parse_request_body (msg);
+	if (body == NULL || json_node_get_node_type (body) != JSON_NODE_OBJECT ||
+	    !json_object_has_member (json_node_get_object (body), "docs")) {
+		set_error (msg, SOUP_STATUS_BAD_REQUEST, "bad_request", "Missing JSON list of 'docs'");
+		if (body != NULL)
+			json_node_free (body);
+		return;
+	}
+
+	request = json_node_get_object (body);
+	docs = json_object_get_array_member (request, "docs");
+	all_or_nothing = json_object_has_member (request, "all_or_nothing") &&
+		json_object_get_boolean_member (request, "all_or_nothing");
+
+	results = json_array_new ();
+	for (i = 0; i < json_array_get_length (docs); i++) {
+		JsonObject *object, *result;
+		FakeDocument *doc;
+		char *id;
+		const char *error = NULL;
+
+		object = json_array_get_object_element (docs, i);
+		if (json_object_has_member (object, "_id"))
+			id = g_strdup (json_object_get_string_member (object, "_id"));
+		else
+			id = generate_docid ();
+
+		/* With all_or_nothing, CouchDB stores conflicting revisions too */
+		doc = store_document (fake, db, id, object, !all_or_nothing, &error);
+
+		result = json_object_new ();
+		json_object_set_string_member (result, "id", id);
+		if (doc != NULL) {
+			json_object_set_string_member (result, "rev", doc->rev);
+		} else {
+			json_object_set_string_member (result, "error", error);
+			json_object_set_string_member (result, "reason", "Document update conflict.");
+		}
+		json_array_add_object_element (results, result);
+
+		g_free (id);
+	}
+
+	node = json_node_new (JSON_NODE_ARRAY);
+	json_node_take_array (node, results);
+	set_response (msg, SOUP_STATUS_CREATED, node);
+
+	json_node_free (body);
+}
+
+static void
+listener_finished_cb (SoupMessage *msg, gpointer user_data)
+{
+	FakeListener *listener = (FakeListener *) user_data;
+
+	if (listener->db != NULL)
+		listener->db->listeners = g_list_remove (listener->db->listeners, listener);
+	else
+		listener->fake->updates_listeners = g_list_remove (listener->fake->updates_listeners, listener);
+
+	g_signal_handlers_disconnect_matched (G_OBJECT (msg), G_SIGNAL_MATCH_DATA,
+					      0, 0, NULL, NULL, listener);
+	fake_listener_free (listener);
+}
+
+static gboolean
+heartbeat_cb (gpointer user_data)
+{
+	FakeListener *listener = (FakeListener *) user_data;
+
+	soup_message_body_append (listener->msg->response_body, SOUP_MEMORY_STATIC, "\n", 1);
+	soup_server_unpause_message (listener->fake->server, listener->msg);
+
+	return TRUE;
+}
+
+static void
+add_listener (FakeCouchdb *fake, SoupMessage *msg, FakeDatabase *db,
+	      gboolean include_docs, gboolean continuous, gint heartbeat)
+{
+	FakeListener *listener;
+
+	listener = g_slice_new0 (FakeListener);
+	listener->fake = fake;
+	listener->db = db;
+	listener->msg = g_object_ref (G_OBJECT (msg));
+	listener->include_docs = include_docs;
+	listener->continuous = continuous;
+
+	if (continuous && heartbeat > 0) {
+		listener->heartbeat = g_timeout_source_new (heartbeat);
+		g_source_set_callback (listener->heartbeat, heartbeat_cb, listener, NULL);
+		g_source_attach (listener->heartbeat, fake->context);
+	}
+
+	g_signal_connect (G_OBJECT (msg), "finished", G_CALLBACK (listener_finished_cb), listener);
+	if (db != NULL)
+		db->listeners = g_list_prepend (db->listeners, listener);
+	else
+		fake->updates_listeners = g_list_prepend (fake->updates_listeners, listener);
+
+	soup_server_pause_message (fake->server, msg);
+}
+
+static void
+handle_changes (FakeCouchdb *fake, SoupMessage *msg, FakeDatabase *db, GHashTable *query)
+{
+	GList *documents, *changes = NULL, *l;
+	const char *feed;
+	gint since;
+	gboolean include_docs;
+
+	since = query_get_int (query, "since", 0);
+	include_docs = query_get_boolean (query, "include_docs");
+	feed = query != NULL ? g_hash_table_lookup (query, "feed") : NULL;
+
+	documents = g_hash_table_get_values (db->documents);
+	for (l = documents; l != NULL; l = l->next) {
+		if (((FakeDocument *) l->data)->seq > (guint) since)
+			changes = g_list_prepend (changes, l->data);
+	}
+	g_list_free (documents);
+	changes = g_list_sort (changes, compare_documents_by_seq);
+
+	if (!g_strcmp0 (feed, "continuous")) {
+		soup_message_set_status (msg, SOUP_STATUS_OK);
+		soup_message_headers_set_encoding (msg->response_headers, SOUP_ENCODING_CHUNKED);
+		soup_message_headers_set_content_type (msg->response_headers, "text/plain", NULL);
+
+		for (l = changes; l != NULL; l = l->next)
+			append_change_line (msg, (FakeDocument *) l->data, include_docs);
+
+		add_listener (fake, msg, db, include_docs, TRUE,
+			      query_get_int (query, "heartbeat", DEFAULT_HEARTBEAT_MILLISECONDS));
+	} else if (!g_strcmp0 (feed, "longpoll") && changes == NULL) {
+		/* Wait for the next change */
+		add_listener (fake, msg, db, include_docs, FALSE, 0);
+	} else {
+		JsonObject *object;
+		JsonArray *results;
+
+		results = json_array_new ();
+		for (l = changes; l != NULL; l = l->next)
+			json_array_add_object_element (results, change_to_json ((FakeDocument *) l->data, include_docs));
+
+		object = json_object_new ();
+		json_object_set_array_member (object, "results", results);
+		json_object_set_int_member (object, "last_seq", db->update_seq);
+		set_response (msg, SOUP_STATUS_OK, object_node (object));
+
+		if (g_atomic_int_get (&fake->hold_changes)) {
+			soup_server_pause_message (fake->server, msg);
+			fake->held_changes = g_list_append (fake->held_changes, g_object_ref (G_OBJECT (msg)));
+		}
+	}
+
+	g_list_free (changes);
+}
+
+/* Only available when enabled with fake_couchdb_set_db_updates(), so that
+   clients are tested against servers without it by default */
+static void
+handle_db_updates (FakeCouchdb *fake, SoupMessage *msg, GHashTable *query)
+{
+	if (!g_atomic_int_get (&fake->db_updates)) {
+		set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", "missing");
+		return;
+	}
+
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+	soup_message_headers_set_encoding (msg->response_headers, SOUP_ENCODING_CHUNKED);
+	soup_message_headers_set_content_type (msg->response_headers, "text/plain", NULL);
+
+	add_listener (fake, msg, NULL, FALSE, TRUE,
+		      query_get_int (query, "heartbeat", DEFAULT_HEARTBEAT_MILLISECONDS));
+
+	/* Send the headers right away, as CouchDB does. The message pauses
+	   itself again when it runs out of chunks */
+	soup_server_unpause_message (fake->server, msg);
+}
+
+static void
+handle_document (FakeCouchdb *fake, SoupMessage *msg, FakeDatabase *db,
+		 const char *docid, GHashTable *query)
+{
+	FakeDocument *doc;
+	const char *error = NULL;
+
+	doc = g_hash_table_lookup (db->documents, docid);
+
+	if (msg->method == SOUP_METHOD_GET) {
+		const char *if_none_match;
+		char *etag;
+
+		if (doc == NULL || doc->deleted) {
+			set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", doc ? "deleted" : "missing");
+			return;
+		}
+
+		etag = g_strdup_printf ("\"%s\"", doc->rev);
+		if_none_match = soup_message_headers_get_one (msg->request_headers, "If-None-Match");
+		if (if_none_match != NULL && !strcmp (if_none_match, etag))
+			soup_message_set_status (msg, SOUP_STATUS_NOT_MODIFIED);
+		else
+			set_response (msg, SOUP_STATUS_OK, object_node (document_to_json (doc)));
+
+		soup_message_headers_replace (msg->response_headers, "ETag", etag);
+		g_free (etag);
+	} else if (msg->method == SOUP_METHOD_PUT) {
+		JsonNode *body;
+
+		body = parse_request_body (msg);
+		if (body == NULL || json_node_get_node_type (body) != JSON_NODE_OBJECT) {
+			set_error (msg, SOUP_STATUS_BAD_REQUEST, "bad_request", "Document must be a JSON object");
+			if (body != NULL)
+				json_node_free (body);
+			return;
+		}
+
+		doc = store_document (fake, db, docid, json_node_get_object (body), TRUE, &error);
+		if (doc != NULL)
+			set_stored (msg, SOUP_STATUS_CREATED, doc);
+		else
+			set_error (msg, SOUP_STATUS_CONFLICT, error, "Document update conflict.");
+
+		json_node_free (body);
+	} else if (msg->method == SOUP_METHOD_DELETE) {
+		JsonObject *object;
+		const char *rev;
+
+		if (doc == NULL || doc->deleted) {
+			set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", doc ? "deleted" : "missing");
+			return;
+		}
+
+		rev = query != NULL ? g_hash_table_lookup (query, "rev") : NULL;
+		object = json_object_new ();
+		if (rev != NULL)
+			json_object_set_string_member (object, "_rev", rev);
+		json_object_set_boolean_member (object, "_deleted", TRUE);
+
+		doc = store_document (fake, db, docid, object, TRUE, &error);
+		if (doc != NULL)
+			set_stored (msg, SOUP_STATUS_OK, doc);
+		else
+			set_error (msg, SOUP_STATUS_CONFLICT, error, "Document update conflict.");
+
+		json_object_unref (object);
+	} else
+		set_error (msg, SOUP_STATUS_METHOD_NOT_ALLOWED, "method_not_allowed", msg->method);
+}
+
+/* Splits the path in its decoded segments, keeping design and local
+   document IDs, like "_design/foo", in one segment */
+static char **
+split_path (const char *path)
+{
+	char **segments;
+	GPtrArray *array;
+	guint i;
+
+	segments = g_strsplit (path[0] == '/' ? path + 1 : path, "/", -1);
+	array = g_ptr_array_new ();
+	for (i = 0; segments[i] != NULL; i++) {
+		if (segments[i][0] == '\0')
+			continue;
+
+		if (array->len == 1 &&
+		    (!strcmp (segments[i], "_design") || !strcmp (segments[i], "_local")) &&
+		    segments[i + 1] != NULL) {
+			char *decoded = soup_uri_decode (segments[i + 1]);
+
+			g_ptr_array_add (array, g_strdup_printf ("%s/%s", segments[i], decoded));
+			g_free (decoded);
+			i++;
+		} else
+			g_ptr_array_add (array, soup_uri_decode (segments[i]));
+	}
+	g_ptr_array_add (array, NULL);
+	g_strfreev (segments);
+
+	return (char **) g_ptr_array_free (array, FALSE);
+}
+
+static gboolean
+inject_failure (FakeCouchdb *fake, SoupMessage *msg)
+{
+	gint fail_next, permille;
+	guint status = 0;
+
+	do {
+		fail_next = g_atomic_int_get (&fake->fail_next);
+		if (fail_next <= 0)
+			break;
+	} while (!g_atomic_int_compare_and_exchange (&fake->fail_next, fail_next, fail_next - 1));
+
+	if (fail_next > 0) {
+		status = g_atomic_int_get (&fake->fail_next_status);
+	} else {
+		permille = g_atomic_int_get (&fake->failure_permille);
+		if (permille > 0 && g_random_int_range (0, 1000) < permille)
+			status = g_atomic_int_get (&fake->failure_status);
+	}
+
+	if (status == 0)
+		return FALSE;
+
+	set_error (msg, status, "fake_failure", "Failure injected by the test server");
+
+	return TRUE;
+}
+
+static void
+handle_session (FakeCouchdb *fake, SoupMessage *msg)
+{
+	SoupBuffer *buffer;
+	GHashTable *form;
+	const char *password;
+	char *cookie;
+
+	if (msg->method != SOUP_METHOD_POST) {
+		set_error (msg, SOUP_STATUS_METHOD_NOT_ALLOWED, "method_not_allowed", "Only POST allowed");
+		return;
+	}
+
+	/* Any name is accepted, with any password but an empty one, so that
+	   tests can check refused logins */
+	buffer = soup_message_body_flatten (msg->request_body);
+	form = soup_form_decode (buffer->data);
+	soup_buffer_free (buffer);
+
+	password = g_hash_table_lookup (form, "password");
+	if (password == NULL || *password == '\0') {
+		g_hash_table_destroy (form);
+		set_error (msg, SOUP_STATUS_UNAUTHORIZED, "unauthorized", "Name or password is incorrect.");
+		return;
+	}
+	g_hash_table_destroy (form);
+
+	cookie = g_strdup_printf ("AuthSession=%d-%08x; Version=1; Path=/; HttpOnly",
+				  g_atomic_int_get (&fake->session_generation),
+				  g_random_int ());
+	soup_message_headers_append (msg->response_headers, "Set-Cookie", cookie);
+	g_free (cookie);
+
+	set_ok (msg, SOUP_STATUS_OK);
+}
+
+/* Requests carrying a session cookie from before the last call to
+   fake_couchdb_expire_sessions() are rejected, as CouchDB does with
+   expired cookies */
+static gboolean
+has_expired_session (FakeCouchdb *fake, SoupMessage *msg)
+{
+	const char *cookie;
+
+	cookie = soup_message_headers_get_one (msg->request_headers, "Cookie");
+	if (cookie == NULL || !g_str_has_prefix (cookie, "AuthSession="))
+		return FALSE;
+
+	return atoi (cookie + strlen ("AuthSession=")) != g_atomic_int_get (&fake->session_generation);
+}
+
+/* When sessions are required, requests other than logging in must carry
+   either a session cookie or an Authorization header */
+static gboolean
+lacks_credentials (FakeCouchdb *fake, SoupMessage *msg, char **segments)
+{
+	if (!g_atomic_int_get (&fake->require_sessions))
+		return FALSE;
+
+	if (segments[0] != NULL && !strcmp (segments[0], "_session"))
+		return FALSE;
+
+	return soup_message_headers_get_one (msg->request_headers, "Cookie") == NULL
+		&& soup_message_headers_get_one (msg->request_headers, "Authorization") == NULL;
+}
+
+typedef struct {
+	SoupServer *server;
+	SoupMessage *msg;
+} DelayedMessage;
+
+static gboolean
+unpause_delayed_cb (gpointer user_data)
+{
+	DelayedMessage *delayed = (DelayedMessage *) user_data;
+
+	soup_server_unpause_message (delayed->server, delayed->msg);
+
+	g_object_unref (G_OBJECT (delayed->msg));
+	g_slice_free (DelayedMessage, delayed);
+
+	return FALSE;
+}
+
+static void
+server_callback (SoupServer *server,
+		 SoupMessage *msg,
+		 const char *path,
+		 GHashTable *query,
+		 SoupClientContext *client,
+		 gpointer user_data)
+{
+	FakeCouchdb *fake = (FakeCouchdb *) user_data;
+	char **segments;
+	guint n_segments;
+	gint latency;
+
+	g_atomic_int_inc (&fake->request_count);
+
+	segments = split_path (path);
+	n_segments = g_strv_length (segments);
+
+	if (inject_failure (fake, msg)) {
+		/* Nothing else to do */
+	} else if (has_expired_session (fake, msg)) {
+		set_error (msg, SOUP_STATUS_UNAUTHORIZED, "unauthorized", "Session expired");
+	} else if (lacks_credentials (fake, msg, segments)) {
+		set_error (msg, SOUP_STATUS_UNAUTHORIZED, "unauthorized", "You are not authorized to access this db.");
+	} else if (n_segments == 0) {
+		handle_root (fake, msg);
+	} else if (segments[0][0] == '_') {
+		if (!strcmp (segments[0], "_all_dbs"))
+			handle_all_dbs (fake, msg);
+		else if (!strcmp (segments[0], "_replicate") && msg->method == SOUP_METHOD_POST)
+			handle_replicate (fake, msg);
+		else if (!strcmp (segments[0], "_session"))
+			handle_session (fake, msg);
+		else if (!strcmp (segments[0], "_db_updates") && msg->method == SOUP_METHOD_GET)
+			handle_db_updates (fake, msg, query);
+		else
+			set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", "missing");
+	} else if (n_segments == 1) {
+		handle_database (fake, msg, segments[0]);
+	} else {
+		FakeDatabase *db;
+
+		db = g_hash_table_lookup (fake->databases, segments[0]);
+		if (db == NULL)
+			set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", "no_db_file");
+		else if (n_segments > 2)
+			set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", "missing");
+		else if (!strcmp (segments[1], "_all_docs"))
+			handle_all_docs (fake, msg, db, query);
+		else if (!strcmp (segments[1], "_bulk_docs") && msg->method == SOUP_METHOD_POST)
+			handle_bulk_docs (fake, msg, db);
+		else if (!strcmp (segments[1], "_changes"))
+			handle_changes (fake, msg, db, query);
+		else if (!strcmp (segments[1], "_compact") && msg->method == SOUP_METHOD_POST)
+			set_ok (msg, SOUP_STATUS_ACCEPTED);
+		else if (segments[1][0] == '_' &&
+			 !g_str_has_prefix (segments[1], "_design/") &&
+			 !g_str_has_prefix (segments[1], "_local/"))
+			set_error (msg, SOUP_STATUS_NOT_FOUND, "not_found", "missing");
+		else
+			handle_document (fake, msg, db, segments[1], query);
+	}
+
+	g_strfreev (segments);
+
+	/* Delay the response, if requested */
+	latency = g_atomic_int_get (&fake->latency);
+	if (latency > 0) {
+		DelayedMessage *delayed;
+		GSource *source;
+
+		delayed = g_slice_new (DelayedMessage);
+		delayed->server = server;
+		delayed->msg = g_object_ref (G_OBJECT (msg));
+
+		soup_server_pause_message (server, msg);
+		source = g_timeout_source_new (latency);
+		g_source_set_callback (source, unpause_delayed_cb, delayed, NULL);
+		g_source_attach (source, fake->context);
+		g_source_unref (source);
+	}
+}
+
+static gpointer
+server_thread (gpointer user_data)
+{
+	FakeCouchdb *fake = (FakeCouchdb *) user_data;
+
+	soup_server_run (fake->server);
+
+	return NULL;
+}
+
+static gboolean
+quit_server_cb (gpointer user_data)
+{
+	FakeCouchdb *fake = (FakeCouchdb *) user_data;
+
+	soup_server_quit (fake->server);
+
+	return FALSE;
+}
+
+/**
+ * fake_couchdb_new:
+ *
+ * Start a new fake CouchDB server, with no databases, listening on a random
+ * port on the loopback interface.
+ *
+ * Return value: A #FakeCouchdb, or NULL if the server could not be started.
+ */
+FakeCouchdb *
+fake_couchdb_new (void)
+{
+	FakeCouchdb *fake;
+	SoupAddress *address;
+
+	fake = g_new0 (FakeCouchdb, 1);
+	fake->context = g_main_context_new ();
+	fake->databases = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+						 (GDestroyNotify) fake_database_free);
+
+	address = soup_address_new ("127.0.0.1", SOUP_ADDRESS_ANY_PORT);
+	soup_address_resolve_sync (address, NULL);
+	fake->server = soup_server_new (SOUP_SERVER_INTERFACE, address,
+					SOUP_SERVER_ASYNC_CONTEXT, fake->context,
+					NULL);
+	g_object_unref (G_OBJECT (address));
+
+	if (fake->server == NULL) {
+		g_hash_table_destroy (fake->databases);
+		g_main_context_unref (fake->context);
+		g_free (fake);
+
+		return NULL;
+	}
+
+	soup_server_add_handler (fake->server, NULL, server_callback, fake, NULL);
+	fake->uri = g_strdup_printf ("http://127.0.0.1:%u", soup_server_get_port (fake->server));
+
+	fake->thread = g_thread_create (server_thread, fake, TRUE, NULL);
+
+	return fake;
+}
+
+/**
+ * fake_couchdb_free:
+ * @fake: A #FakeCouchdb
+ *
+ * Stop the server and free all the data stored in it.
+ */
+void
+fake_couchdb_free (FakeCouchdb *fake)
+{
+	GSource *source;
+
+	g_return_if_fail (fake != NULL);
+
+	/* Quit from the server thread */
+	source = g_idle_source_new ();
+	g_source_set_callback (source, quit_server_cb, fake, NULL);
+	g_source_attach (source, fake->context);
+	g_source_unref (source);
+
+	g_thread_join (fake->thread);
+
+	/* Same as for the databases' listeners */
+	while (fake->updates_listeners != NULL) {
+		FakeListener *listener = (FakeListener *) fake->updates_listeners->data;
+
+		g_signal_handlers_disconnect_matched (G_OBJECT (listener->msg), G_SIGNAL_MATCH_DATA,
+						      0, 0, NULL, NULL, listener);
+		fake_listener_free (listener);
+		fake->updates_listeners = g_list_delete_link (fake->updates_listeners,
+							      fake->updates_listeners);
+	}
+	g_list_foreach (fake->held_changes, (GFunc) g_object_unref, NULL);
+	g_list_free (fake->held_changes);
+
+	g_hash_table_destroy (fake->databases);
+	g_object_unref (G_OBJECT (fake->server));
+	g_main_context_unref (fake->context);
+	g_free (fake->uri);
+
+	g_free (fake);
+}
+
+const char *
+fake_couchdb_get_uri (FakeCouchdb *fake)
+{
+	g_return_val_if_fail (fake != NULL, NULL);
+
+	return fake->uri;
+}
+
+/**
+ * fake_couchdb_get_request_count:
+ * @fake: A #FakeCouchdb
+ *
+ * Get the number of requests received by the server since it was started.
+ */
+guint
+fake_couchdb_get_request_count (FakeCouchdb *fake)
+{
+	g_return_val_if_fail (fake != NULL, 0);
+
+	return g_atomic_int_get (&fake->request_count);
+}
+
+/**
+ * fake_couchdb_set_latency:
+ * @fake: A #FakeCouchdb
+ * @milliseconds: Time to wait before sending each response
+ *
+ * Make the server delay all its responses by the given time.
+ */
+void
+fake_couchdb_set_latency (FakeCouchdb *fake, guint milliseconds)
+{
+	g_return_if_fail (fake != NULL);
+
+	g_atomic_int_set (&fake->latency, milliseconds);
+}
+
+/**
+ * fake_couchdb_set_failure_rate:
+ * @fake: A #FakeCouchdb
+ * @rate: Fraction, between 0 and 1, of the requests to fail
+ * @status_code: HTTP status to respond failed requests with
+ *
+ * Make the server fail randomly the given fraction of the requests.
+ */
+void
+fake_couchdb_set_failure_rate (FakeCouchdb *fake, gdouble rate, guint status_code)
+{
+	g_return_if_fail (fake != NULL);
+	g_return_if_fail (rate >= 0 && rate <= 1);
+
+	g_atomic_int_set (&fake->failure_status, status_code);
+	g_atomic_int_set (&fake->failure_permille, (gint) (rate * 1000));
+}
+
+/**
+ * fake_couchdb_fail_next_requests:
+ * @fake: A #FakeCouchdb
+ * @n_requests: Number of requests to fail
+ * @status_code: HTTP status to respond failed requests with
+ *
+ * Make the server fail the next @n_requests requests it receives.
+ */
+void
+fake_couchdb_fail_next_requests (FakeCouchdb *fake, guint n_requests, guint status_code)
+{
+	g_return_if_fail (fake != NULL);
+
+	g_atomic_int_set (&fake->fail_next_status, status_code);
+	g_atomic_int_set (&fake->fail_next, n_requests);
+}
+
+/**
+ * fake_couchdb_expire_sessions:
+ * @fake: A #FakeCouchdb
+ *
+ * Invalidate all session cookies handed out by the server so far, so that
+ * requests using them fail with 401 until the client logs in again.
+ */
+void
+fake_couchdb_expire_sessions (FakeCouchdb *fake)
+{
+	g_return_if_fail (fake != NULL);
+
+	g_atomic_int_inc (&fake->session_generation);
+}
+
+/**
+ * fake_couchdb_require_sessions:
+ * @fake: A #FakeCouchdb
+ * @require: Whether to require credentials
+ *
+ * Make the server reject with 401 every request, other than logging in,
+ * that carries neither a session cookie nor an Authorization header.
+ */
+void
+fake_couchdb_require_sessions (FakeCouchdb *fake, gboolean require)
+{
+	g_return_if_fail (fake != NULL);
+
+	g_atomic_int_set (&fake->require_sessions, require ? 1 : 0);
+}
+
+static gboolean
+close_updates_listeners_cb (gpointer user_data)
+{
+	FakeCouchdb *fake = (FakeCouchdb *) user_data;
+	GList *listeners, *l;
+
+	/* Finishing the messages removes them from the list */
+	listeners = g_list_copy (fake->updates_listeners);
+	for (l = listeners; l != NULL; l = l->next) {
+		FakeListener *listener = (FakeListener *) l->data;
+
+		soup_message_body_complete (listener->msg->response_body);
+		soup_server_unpause_message (fake->server, listener->msg);
+	}
+	g_list_free (listeners);
+
+	return FALSE;
+}
+
+/**
+ * fake_couchdb_set_db_updates:
+ * @fake: A #FakeCouchdb
+ * @enabled: Whether to serve the _db_updates feed
+ *
+ * Enable or disable the server-wide _db_updates feed, which is not
+ * available by default. Disabling it closes the feeds already connected,
+ * and clients reconnecting get a 404 error.
+ */
+void
+fake_couchdb_set_db_updates (FakeCouchdb *fake, gboolean enabled)
+{
+	GSource *source;
+
+	g_return_if_fail (fake != NULL);
+
+	g_atomic_int_set (&fake->db_updates, enabled ? 1 : 0);
+	if (enabled)
+		return;
+
+	source = g_idle_source_new ();
+	g_source_set_callback (source, close_updates_listeners_cb, fake, NULL);
+	g_source_attach (source, fake->context);
+	g_source_unref (source);
+}
+
+static gboolean
+release_held_changes_cb (gpointer user_data)
+{
+	FakeCouchdb *fake = (FakeCouchdb *) user_data;
+	GList *held_changes, *l;
+
+	held_changes = fake->held_changes;
+	fake->held_changes = NULL;
+	for (l = held_changes; l != NULL; l = l->next) {
+		soup_server_unpause_message (fake->server, SOUP_MESSAGE (l->data));
+		g_object_unref (G_OBJECT (l->data));
+	}
+	g_list_free (held_changes);
+
+	return FALSE;
+}
+
+/**
+ * fake_couchdb_hold_changes:
+ * @fake: A #FakeCouchdb
+ * @hold: Whether to hold the responses
+ *
+ * Hold the responses to one-shot _changes requests until called again
+ * with @hold set to FALSE, so that tests can act while they are pending.
+ */
+void
+fake_couchdb_hold_changes (FakeCouchdb *fake, gboolean hold)
+{
+	GSource *source;
+
+	g_return_if_fail (fake != NULL);
+
+	g_atomic_int_set (&fake->hold_changes, hold ? 1 : 0);
+	if (hold)
+		return;
+
+	source = g_idle_source_new ();
+	g_source_set_callback (source, release_held_changes_cb, fake, NULL);
+	g_source_attach (source, fake->context);
+	g_source_unref (source);
+}
@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/*
+ * Copyright (C) 2010 Canonical Services Ltd (www.canonical.com)
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU Lesser General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __FAKE_COUCHDB_H__
+#define __FAKE_COUCHDB_H__
+
+#include <glib.h>
+
+/*
+ * In-process stand-in for a CouchDB server, implementing the subset of the
+ * HTTP API used by couchdb-glib, so that tests and benchmarks can run without
+ * any external service. The server runs in its own thread, so it can be used
+ * with the synchronous API of CouchdbSession.
+ */
+
+typedef struct _FakeCouchdb FakeCouchdb;
+
+FakeCouchdb *fake_couchdb_new (void);
+void         fake_couchdb_free (FakeCouchdb *fake);
+
+const char  *fake_couchdb_get_uri (FakeCouchdb *fake);
+guint        fake_couchdb_get_request_count (FakeCouchdb *fake);
+
+void         fake_couchdb_set_latency (FakeCouchdb *fake, guint milliseconds);
+void         fake_couchdb_set_failure_rate (FakeCouchdb *fake, gdouble rate, guint status_code);
+void         fake_couchdb_fail_next_requests (FakeCouchdb *fake, guint n_requests, guint status_code);
+void         fake_couchdb_expire_sessions (FakeCouchdb *fake);
+void         fake_couchdb_require_sessions (FakeCouchdb *fake, gboolean require);
+void         fake_couchdb_set_db_updates (FakeCouchdb *fake, gboolean enabled);
+void         fake_couchdb_hold_changes (FakeCouchdb *fake, gboolean hold);
+
+#endif /* __FAKE_COUCHDB_H__ */
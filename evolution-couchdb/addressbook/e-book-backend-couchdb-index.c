@@ -0,0 +1,434 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-book-backend-couchdb-index.c - In-memory index for contact searches
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#include <string.h>
+#include "e-couchdb-query.h"
+#include "e-book-backend-couchdb-index.h"
+
+/* All the contacts in the cache are kept in memory, with their vCard strings,
+   and the terms autocompletion searches for (names, file as and email
+   addresses) are indexed, so that queries don't need to parse every vCard in
+   the cache. Prefix searches use a sorted sequence of terms, substring ones
+   use a trigram index. Candidates are then checked against the query */
+
+typedef struct {
+	gchar *uid;
+	EContact *contact;
+	gchar *vcard;
+	GPtrArray *terms;
+} IndexedContact;
+
+typedef struct {
+	gchar *term;
+	IndexedContact *indexed;
+	GSequenceIter *iter;
+} SearchTerm;
+
+struct _EBookBackendCouchDBIndex {
+	GHashTable *contacts;
+	GSequence *search_terms;
+	GHashTable *trigrams;
+};
+
+#define TRIGRAM_KEY(s) GUINT_TO_POINTER (((guchar) (s)[0] << 16) | ((guchar) (s)[1] << 8) | (guchar) (s)[2])
+
+static gint
+compare_search_terms (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const SearchTerm *term_a = a, *term_b = b;
+	gint result;
+
+	result = strcmp (term_a->term, term_b->term);
+	if (result != 0)
+		return result;
+
+	/* Probes, with no contact, go before the terms they are equal to */
+	if (term_a->indexed == term_b->indexed)
+		return 0;
+	if (term_a->indexed == NULL)
+		return -1;
+	if (term_b->indexed == NULL)
+		return 1;
+
+	return term_a->indexed < term_b->indexed ? -1 : 1;
+}
+
+static void
+add_search_term (EBookBackendCouchDBIndex *index, IndexedContact *indexed, const gchar *str)
+{
+	SearchTerm *term;
+	gsize i, length;
+
+	term = g_slice_new (SearchTerm);
+	term->term = e_couchdb_normalize_search_string (str);
+	term->indexed = indexed;
+	term->iter = g_sequence_insert_sorted (index->search_terms, term, compare_search_terms, NULL);
+	g_ptr_array_add (indexed->terms, term);
+
+	length = strlen (term->term);
+	for (i = 0; i + 3 <= length; i++) {
+		GHashTable *posting;
+
+		posting = g_hash_table_lookup (index->trigrams, TRIGRAM_KEY (term->term + i));
+		if (posting == NULL) {
+			posting = g_hash_table_new (g_direct_hash, g_direct_equal);
+			g_hash_table_insert (index->trigrams, TRIGRAM_KEY (term->term + i), posting);
+		}
+		g_hash_table_insert (posting, indexed, indexed);
+	}
+}
+
+/* Adds the full string, and each of its words, so that names can be
+   found by any of their parts */
+static void
+add_search_terms (EBookBackendCouchDBIndex *index, IndexedContact *indexed, const gchar *str)
+{
+	gchar **words;
+	gint i;
+
+	if (str == NULL || *str == '\0')
+		return;
+
+	add_search_term (index, indexed, str);
+
+	words = g_strsplit_set (str, " \t,.-", -1);
+	if (words[0] != NULL && words[1] != NULL) {
+		for (i = 0; words[i] != NULL; i++) {
+			if (*words[i] != '\0')
+				add_search_term (index, indexed, words[i]);
+		}
+	}
+	g_strfreev (words);
+}
+
+static void
+remove_search_terms (EBookBackendCouchDBIndex *index, IndexedContact *indexed)
+{
+	guint i;
+
+	for (i = 0; i < indexed->terms->len; i++) {
+		SearchTerm *term = g_ptr_array_index (indexed->terms, i);
+		gsize j, length;
+
+		length = strlen (term->term);
+		for (j = 0; j + 3 <= length; j++) {
+			GHashTable *posting;
+
+			posting = g_hash_table_lookup (index->trigrams, TRIGRAM_KEY (term->term + j));
+			if (posting != NULL) {
+				g_hash_table_remove (posting, indexed);
+				if (g_hash_table_size (posting) == 0)
+					g_hash_table_remove (index->trigrams, TRIGRAM_KEY (term->term + j));
+			}
+		}
+
+		g_sequence_remove (term->iter);
+		g_free (term->term);
+		g_slice_free (SearchTerm, term);
+	}
+
+	g_ptr_array_set_size (indexed->terms, 0);
+}
+
+static void
+indexed_contact_free (IndexedContact *indexed)
+{
+	g_free (indexed->uid);
+	g_object_unref (G_OBJECT (indexed->contact));
+	g_free (indexed->vcard);
+	g_ptr_array_free (indexed->terms, TRUE);
+
+	g_slice_free (IndexedContact, indexed);
+}
+
+EBookBackendCouchDBIndex *
+e_book_backend_couchdb_index_new (void)
+{
+	EBookBackendCouchDBIndex *index;
+
+	index = g_slice_new (EBookBackendCouchDBIndex);
+	index->contacts = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 NULL, (GDestroyNotify) indexed_contact_free);
+	index->search_terms = g_sequence_new (NULL);
+	index->trigrams = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						 NULL, (GDestroyNotify) g_hash_table_destroy);
+
+	return index;
+}
+
+void
+e_book_backend_couchdb_index_free (EBookBackendCouchDBIndex *index)
+{
+	g_return_if_fail (index != NULL);
+
+	e_book_backend_couchdb_index_clear (index);
+	g_hash_table_destroy (index->contacts);
+	g_hash_table_destroy (index->trigrams);
+	g_sequence_free (index->search_terms);
+
+	g_slice_free (EBookBackendCouchDBIndex, index);
+}
+
+/**
+ * e_book_backend_couchdb_index_add:
+ * @index: An #EBookBackendCouchDBIndex
+ * @contact: Contact to add
+ *
+ * Add a contact to the index, replacing the one with the same UID, if any.
+ */
+void
+e_book_backend_couchdb_index_add (EBookBackendCouchDBIndex *index, EContact *contact)
+{
+	IndexedContact *indexed;
+	const gchar *uid;
+	GList *emails, *l;
+
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (E_IS_CONTACT (contact));
+
+	uid = e_contact_get_const (contact, E_CONTACT_UID);
+	if (uid == NULL)
+		return;
+
+	indexed = g_hash_table_lookup (index->contacts, uid);
+	if (indexed != NULL) {
+		remove_search_terms (index, indexed);
+		g_object_unref (G_OBJECT (indexed->contact));
+		g_free (indexed->vcard);
+	} else {
+		indexed = g_slice_new (IndexedContact);
+		indexed->uid = g_strdup (uid);
+		indexed->terms = g_ptr_array_new ();
+		g_hash_table_insert (index->contacts, indexed->uid, indexed);
+	}
+
+	indexed->contact = g_object_ref (G_OBJECT (contact));
+	indexed->vcard = e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30);
+
+	add_search_terms (index, indexed, e_contact_get_const (contact, E_CONTACT_FULL_NAME));
+	add_search_terms (index, indexed, e_contact_get_const (contact, E_CONTACT_NICKNAME));
+	add_search_terms (index, indexed, e_contact_get_const (contact, E_CONTACT_GIVEN_NAME));
+	add_search_terms (index, indexed, e_contact_get_const (contact, E_CONTACT_FAMILY_NAME));
+	add_search_terms (index, indexed, e_contact_get_const (contact, E_CONTACT_FILE_AS));
+
+	emails = e_contact_get (contact, E_CONTACT_EMAIL);
+	for (l = emails; l != NULL; l = l->next)
+		add_search_term (index, indexed, (const gchar *) l->data);
+	g_list_foreach (emails, (GFunc) g_free, NULL);
+	g_list_free (emails);
+}
+
+void
+e_book_backend_couchdb_index_remove (EBookBackendCouchDBIndex *index, const gchar *uid)
+{
+	IndexedContact *indexed;
+
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (uid != NULL);
+
+	indexed = g_hash_table_lookup (index->contacts, uid);
+	if (indexed != NULL) {
+		remove_search_terms (index, indexed);
+		g_hash_table_remove (index->contacts, uid);
+	}
+}
+
+void
+e_book_backend_couchdb_index_clear (EBookBackendCouchDBIndex *index)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_return_if_fail (index != NULL);
+
+	g_hash_table_iter_init (&iter, index->contacts);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		remove_search_terms (index, (IndexedContact *) value);
+
+	g_hash_table_remove_all (index->contacts);
+}
+
+/**
+ * e_book_backend_couchdb_index_get_vcard:
+ * @index: An #EBookBackendCouchDBIndex
+ * @uid: UID of the contact
+ *
+ * Get the vCard string of a contact in the index.
+ *
+ * Return value: The vCard string, owned by the index, or NULL if the
+ * contact is not in the index.
+ */
+const gchar *
+e_book_backend_couchdb_index_get_vcard (EBookBackendCouchDBIndex *index, const gchar *uid)
+{
+	IndexedContact *indexed;
+
+	g_return_val_if_fail (index != NULL, NULL);
+	g_return_val_if_fail (uid != NULL, NULL);
+
+	indexed = g_hash_table_lookup (index->contacts, uid);
+
+	return indexed != NULL ? indexed->vcard : NULL;
+}
+
+/*
+ * Query planning
+ */
+
+static void
+find_prefix (EBookBackendCouchDBIndex *index, const gchar *prefix, ECouchDBCandidates *candidates)
+{
+	SearchTerm probe;
+	GSequenceIter *iter;
+
+	probe.term = e_couchdb_normalize_search_string (prefix);
+	probe.indexed = NULL;
+
+	e_couchdb_candidates_init_empty (candidates, FALSE);
+	iter = g_sequence_search (index->search_terms, &probe, compare_search_terms, NULL);
+	while (!g_sequence_iter_is_end (iter)) {
+		SearchTerm *term = g_sequence_get (iter);
+
+		if (!g_str_has_prefix (term->term, probe.term))
+			break;
+
+		e_couchdb_candidates_add (candidates, term->indexed);
+		iter = g_sequence_iter_next (iter);
+	}
+
+	g_free (probe.term);
+}
+
+static void
+find_substring (EBookBackendCouchDBIndex *index, const gchar *substring, ECouchDBCandidates *candidates)
+{
+	gchar *normalized;
+	gsize i, length;
+
+	normalized = e_couchdb_normalize_search_string (substring);
+	length = strlen (normalized);
+
+	e_couchdb_candidates_init_empty (candidates, FALSE);
+	if (length < 3) {
+		GSequenceIter *iter;
+
+		/* Too short for trigrams, but still cheap compared to the query */
+		iter = g_sequence_get_begin_iter (index->search_terms);
+		while (!g_sequence_iter_is_end (iter)) {
+			SearchTerm *term = g_sequence_get (iter);
+
+			if (strstr (term->term, normalized) != NULL)
+				e_couchdb_candidates_add (candidates, term->indexed);
+			iter = g_sequence_iter_next (iter);
+		}
+	} else {
+		GHashTable *posting;
+		GHashTableIter iter;
+		gpointer key;
+
+		/* Contacts having all the trigrams of the string */
+		posting = g_hash_table_lookup (index->trigrams, TRIGRAM_KEY (normalized));
+		if (posting != NULL) {
+			g_hash_table_iter_init (&iter, posting);
+			while (g_hash_table_iter_next (&iter, &key, NULL))
+				e_couchdb_candidates_add (candidates, key);
+		}
+
+		for (i = 1; i + 3 <= length && g_hash_table_size (candidates->items) > 0; i++) {
+			posting = g_hash_table_lookup (index->trigrams, TRIGRAM_KEY (normalized + i));
+
+			g_hash_table_iter_init (&iter, candidates->items);
+			while (g_hash_table_iter_next (&iter, &key, NULL)) {
+				if (posting == NULL || !g_hash_table_lookup (posting, key))
+					g_hash_table_iter_remove (&iter);
+			}
+		}
+	}
+
+	g_free (normalized);
+}
+
+static gboolean
+is_indexed_field (const gchar *field)
+{
+	return !strcmp (field, "full_name") || !strcmp (field, "nickname")
+		|| !strcmp (field, "file_as") || !strcmp (field, "email");
+}
+
+static void
+plan_function (ECouchDBSExpNode *node, const gchar *function, ECouchDBCandidates *candidates, gpointer user_data)
+{
+	EBookBackendCouchDBIndex *index = user_data;
+	const gchar *field, *value;
+
+	field = e_couchdb_sexp_node_get_string_arg (node, 1);
+	value = e_couchdb_sexp_node_get_string_arg (node, 2);
+	if (node->children->len != 3 || field == NULL || value == NULL
+	    || !is_indexed_field (field) || *value == '\0') {
+		e_couchdb_candidates_init_all (candidates, FALSE);
+		return;
+	}
+
+	if (!strcmp (function, "beginswith") || !strcmp (function, "is"))
+		find_prefix (index, value, candidates);
+	else if (!strcmp (function, "contains"))
+		find_substring (index, value, candidates);
+	else
+		e_couchdb_candidates_init_all (candidates, FALSE);
+}
+
+/**
+ * e_book_backend_couchdb_index_find:
+ * @index: An #EBookBackendCouchDBIndex
+ * @query: Query to find the contacts for
+ * @sexp: The #EBookBackendSExp for @query
+ *
+ * Find the contacts matching a query, checking the query only against the
+ * candidates found in the index.
+ *
+ * Return value: A list of the UIDs, owned by the index, of the matching
+ * contacts, to be freed with g_list_free.
+ */
+GList *
+e_book_backend_couchdb_index_find (EBookBackendCouchDBIndex *index, const gchar *query, EBookBackendSExp *sexp)
+{
+	ECouchDBCandidates candidates;
+	GHashTableIter iter;
+	gpointer value;
+	GList *matches = NULL;
+
+	g_return_val_if_fail (index != NULL, NULL);
+	g_return_val_if_fail (E_IS_BOOK_BACKEND_SEXP (sexp), NULL);
+
+	e_couchdb_plan_query (query, plan_function, index, &candidates);
+
+	g_hash_table_iter_init (&iter, candidates.all ? index->contacts : candidates.items);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		IndexedContact *indexed = (IndexedContact *) value;
+
+		if (indexed->vcard != NULL && e_book_backend_sexp_match_contact (sexp, indexed->contact))
+			matches = g_list_prepend (matches, indexed->uid);
+	}
+
+	e_couchdb_candidates_clear (&candidates);
+
+	return matches;
+}
@@ -0,0 +1,42 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-book-backend-couchdb-index.h - In-memory index for contact searches
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#ifndef __E_BOOK_BACKEND_COUCHDB_INDEX_H__
+#define __E_BOOK_BACKEND_COUCHDB_INDEX_H__
+
+#include <libebook/e-contact.h>
+#include <libedata-book/e-book-backend-sexp.h>
+
+typedef struct _EBookBackendCouchDBIndex EBookBackendCouchDBIndex;
+
+EBookBackendCouchDBIndex *e_book_backend_couchdb_index_new (void);
+void                      e_book_backend_couchdb_index_free (EBookBackendCouchDBIndex *index);
+
+void                      e_book_backend_couchdb_index_add (EBookBackendCouchDBIndex *index, EContact *contact);
+void                      e_book_backend_couchdb_index_remove (EBookBackendCouchDBIndex *index, const gchar *uid);
+void                      e_book_backend_couchdb_index_clear (EBookBackendCouchDBIndex *index);
+
+const gchar              *e_book_backend_couchdb_index_get_vcard (EBookBackendCouchDBIndex *index, const gchar *uid);
+GList                    *e_book_backend_couchdb_index_find (EBookBackendCouchDBIndex *index,
+							     const gchar *query,
+							     EBookBackendSExp *sexp);
+
+#endif
@@ -21,6 +21,7 @@
  */
 
 #include <string.h>
+#include "e-couchdb-sync.h"
 #include "e-book-backend-couchdb.h"
 #include <libedata-book/e-book-backend-sexp.h>
 #include <libedata-book/e-data-book.h>
@@ -60,24 +61,10 @@ contact_from_couch_document (CouchdbDocument *document)
 		return NULL;
 
 	/* Check if the contact is marked for deletion */
-	if ((app_annotations = desktopcouch_document_get_application_annotations (document))) {
-		CouchdbStructField *u1_annotations;
-
-		u1_annotations = couchdb_struct_field_get_struct_field (
-			app_annotations, "Ubuntu One");
-		if (u1_annotations != NULL) {
-			CouchdbStructField *private_annotations;
-
-			private_annotations = couchdb_struct_field_get_struct_field (
-				u1_annotations, "private_application_annotations");
-			if (private_annotations != NULL) {
-				if (couchdb_struct_field_has_field (private_annotations, "deleted")
-				    && couchdb_struct_field_get_boolean_field (private_annotations, "deleted"))
-					couchdb_struct_field_unref (app_annotations);
-					return NULL;
-			}
-		}
-	}
+	if (desktopcouch_document_is_deleted (document))
+		return NULL;
+
+	app_annotations = desktopcouch_document_get_application_annotations (document);
 
 	/* Fill in the EContact with the data from the CouchDBDocument */
 	contact = e_contact_new ();
@@ -937,15 +924,58 @@ couch_document_from_contact (EBookBackendCouchDB *couchdb_backend, EContact *con
 	return document;
 }
 
+static void
+cache_add_contact (EBookBackendCouchDB *couchdb_backend, EContact *contact)
+{
+	e_book_backend_cache_add_contact (couchdb_backend->cache, contact);
+	e_book_backend_couchdb_index_add (couchdb_backend->index, contact);
+}
+
+static void
+cache_remove_contact (EBookBackendCouchDB *couchdb_backend, const gchar *uid)
+{
+	e_book_backend_cache_remove_contact (couchdb_backend->cache, uid);
+	e_book_backend_couchdb_index_remove (couchdb_backend->index, uid);
+}
+
+static void
+clear_cached_contacts (EBookBackendCouchDB *couchdb_backend)
+{
+	e_book_backend_couchdb_index_clear (couchdb_backend->index);
+}
+
+/* Loads into memory the contacts in the cache that weren't already */
+static void
+load_cached_contacts (EBookBackendCouchDB *couchdb_backend)
+{
+	GSList *objects, *sl;
+
+	objects = e_file_cache_get_objects (E_FILE_CACHE (couchdb_backend->cache));
+	for (sl = objects; sl != NULL; sl = sl->next) {
+		const gchar *vcard = (const gchar *) sl->data;
+		EContact *contact;
+		const gchar *uid;
+
+		if (vcard == NULL || strncmp (vcard, "BEGIN:VCARD", 11) != 0)
+			continue;
+
+		contact = e_contact_new_from_vcard (vcard);
+		uid = e_contact_get_const (contact, E_CONTACT_UID);
+		if (uid != NULL && e_book_backend_couchdb_index_get_vcard (couchdb_backend->index, uid) == NULL)
+			e_book_backend_couchdb_index_add (couchdb_backend->index, contact);
+
+		g_object_unref (G_OBJECT (contact));
+	}
+
+	g_slist_free (objects);
+}
+
 static void
 document_updated_cb (CouchdbSession *couchdb, const char *dbname, CouchdbDocument *document, gpointer user_data)
 {
 	EContact *contact;
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (user_data);
 
-	if (g_strcmp0 (dbname, couchdb_backend->dbname) != 0)
-		return;
-
 	contact = contact_from_couch_document (document);
 	if (!contact)
 		return;
@@ -953,7 +983,7 @@ document_updated_cb (CouchdbSession *couchdb, const char *dbname, CouchdbDocumen
 	e_book_backend_notify_update (E_BOOK_BACKEND (couchdb_backend), contact);
 
 	/* Add the contact to the cache */
-	e_book_backend_cache_add_contact (couchdb_backend->cache, contact);
+	cache_add_contact (couchdb_backend, contact);
 
 	g_object_unref (G_OBJECT (contact));
 }
@@ -963,15 +993,33 @@ document_deleted_cb (CouchdbSession *couchdb, const char *dbname, const char *do
 {
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (user_data);
 
-	if (g_strcmp0 (dbname, couchdb_backend->dbname) != 0)
-		return;
-
 	e_book_backend_notify_remove (E_BOOK_BACKEND (couchdb_backend), docid);
 
 	/* Remove the contact from the cache */
-	e_book_backend_cache_remove_contact (couchdb_backend->cache, docid);
+	cache_remove_contact (couchdb_backend, docid);
 }
 
+static void
+apply_change_to_cache (const gchar *docid, CouchdbDocument *document, EBookBackendCouchDB *couchdb_backend)
+{
+	EContact *contact = NULL;
+
+	if (document != NULL)
+		contact = contact_from_couch_document (document);
+
+	if (contact != NULL) {
+		cache_add_contact (couchdb_backend, contact);
+		g_object_unref (G_OBJECT (contact));
+	} else
+		cache_remove_contact (couchdb_backend, docid);
+}
+
+static const ECouchDBSyncFuncs sync_funcs = {
+	(CouchdbChangeFunc) apply_change_to_cache,
+	(ECouchDBCacheFunc) clear_cached_contacts,
+	(ECouchDBCacheFunc) load_cached_contacts
+};
+
 static GNOME_Evolution_Addressbook_CallStatus
 e_book_backend_couchdb_load_source (EBookBackend *backend,
 				    ESource *source,
@@ -980,18 +1028,21 @@ e_book_backend_couchdb_load_source (EBookBackend *backend,
 	gchar *uri;
 	const gchar *property;
 	CouchdbDatabaseInfo *db_info;
+	gint update_seq = 0;
 	GError *error = NULL;
-	GSList *doc_list, *sl;
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (backend);
 
 	g_return_val_if_fail (E_IS_BOOK_BACKEND_COUCHDB (couchdb_backend), GNOME_Evolution_Addressbook_OtherError);
 
-	if (couchdb_backend->couchdb != NULL)
+	if (couchdb_backend->couchdb != NULL) {
+		e_couchdb_disconnect_document_signals (couchdb_backend->couchdb, couchdb_backend);
 		g_object_unref (G_OBJECT (couchdb_backend->couchdb));
+	}
 	if (couchdb_backend->dbname != NULL)
 		g_free (couchdb_backend->dbname);
 	if (couchdb_backend->cache != NULL)
 		g_object_unref (G_OBJECT (couchdb_backend->cache));
+	clear_cached_contacts (couchdb_backend);
 
 	/* create CouchDB main object */
 	couchdb_backend->dbname = g_strdup ("contacts");
@@ -999,7 +1050,7 @@ e_book_backend_couchdb_load_source (EBookBackend *backend,
 
 	property = e_source_get_property (source, "couchdb_instance");
 	if (g_strcmp0 (property, "user") == 0) {
-		if (! (couchdb_backend->couchdb = COUCHDB_SESSION (desktopcouch_session_new ()))) {
+		if (! (couchdb_backend->couchdb = COUCHDB_SESSION (desktopcouch_session_new_shared ()))) {
 			g_warning ("Could not create DesktopcouchSession object");
 			return GNOME_Evolution_Addressbook_NoSuchBook;
 		}
@@ -1011,7 +1062,7 @@ e_book_backend_couchdb_load_source (EBookBackend *backend,
 		else
 			uri = g_strdup ("http://127.0.0.1:5984");
 
-		if (! (couchdb_backend->couchdb = couchdb_session_new (uri))) {
+		if (! (couchdb_backend->couchdb = couchdb_session_new_shared (uri, NULL))) {
 			g_free (uri);
 			return GNOME_Evolution_Addressbook_NoSuchBook;
 		}
@@ -1043,8 +1094,10 @@ e_book_backend_couchdb_load_source (EBookBackend *backend,
 
 			return GNOME_Evolution_Addressbook_PermissionDenied;
 		}
-	} else
+	} else {
+		update_seq = couchdb_database_info_get_update_sequence (db_info);
 		couchdb_database_info_unref (db_info);
+	}
 
 	/* Create cache */
 	uri = e_source_get_uri (source);
@@ -1052,43 +1105,15 @@ e_book_backend_couchdb_load_source (EBookBackend *backend,
 	g_free (uri);
 
 	/* Populate the cache */
-	e_file_cache_clean (E_FILE_CACHE (couchdb_backend->cache));
-	error = NULL;
-	doc_list = couchdb_session_list_documents (couchdb_backend->couchdb,
-						   couchdb_backend->dbname,
-						   &error);
-	for (sl = doc_list; sl != NULL; sl = sl->next) {
-		EContact *contact;
-		CouchdbDocument *document;
-		CouchdbDocumentInfo *doc_info = (CouchdbDocumentInfo *) sl->data;
-
-		/* Retrieve this document */
-		error = NULL;
-		document = couchdb_document_get (couchdb_backend->couchdb,
-						 couchdb_backend->dbname,
-						 couchdb_document_info_get_docid (doc_info),
-						 &error);
-		if (!document)
-			continue;
-
-		contact = contact_from_couch_document (document);
-		if (contact != NULL) {
-			e_book_backend_cache_add_contact (couchdb_backend->cache, contact);
-			g_object_unref (G_OBJECT (contact));
-		}
-
-		g_object_unref (G_OBJECT (document));
-	}
-
-	couchdb_session_free_document_list (doc_list);
+	e_couchdb_sync_cache (couchdb_backend->couchdb, couchdb_backend->dbname,
+			      E_FILE_CACHE (couchdb_backend->cache), update_seq,
+			      &sync_funcs, couchdb_backend);
 
 	/* Listen for changes on database */
-	g_signal_connect (G_OBJECT (couchdb_backend->couchdb), "document_created",
-			  G_CALLBACK (document_updated_cb), couchdb_backend);
-	g_signal_connect (G_OBJECT (couchdb_backend->couchdb), "document_updated",
-			  G_CALLBACK (document_updated_cb), couchdb_backend);
-	g_signal_connect (G_OBJECT (couchdb_backend->couchdb), "document_deleted",
-			  G_CALLBACK (document_deleted_cb), couchdb_backend);
+	e_couchdb_connect_document_signals (couchdb_backend->couchdb, couchdb_backend->dbname,
+					    G_CALLBACK (document_updated_cb),
+					    G_CALLBACK (document_deleted_cb),
+					    couchdb_backend);
 	couchdb_session_listen_for_changes (couchdb_backend->couchdb, couchdb_backend->dbname);
 
 	e_book_backend_set_is_loaded (backend, TRUE);
@@ -1103,6 +1128,7 @@ e_book_backend_couchdb_remove (EBookBackend *backend, EDataBook *book, guint32 o
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (backend);
 
 	/* Remove the cache */
+	clear_cached_contacts (couchdb_backend);
 	if (couchdb_backend->cache != NULL) {
 		g_object_unref (G_OBJECT (couchdb_backend->cache));
 		couchdb_backend->cache = NULL;
@@ -1131,7 +1157,7 @@ put_document (EBookBackendCouchDB *couchdb_backend, CouchdbDocument *document)
 		new_contact = contact_from_couch_document (document);
 
 		/* Add the new contact to the cache */
-		e_book_backend_cache_add_contact (couchdb_backend->cache, new_contact);
+		cache_add_contact (couchdb_backend, new_contact);
 
 		return new_contact;
 	} else {
@@ -1186,74 +1212,92 @@ e_book_backend_couchdb_remove_contacts (EBookBackend *backend,
 					GList *id_list)
 {
 	GList *l, *deleted_ids = NULL;
+	GSList *docids = NULL, *documents, *results, *sl;
+	GHashTable *uids;
+	GPtrArray *changes;
+	GError *error = NULL;
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (backend);
 
+	/* Map the document IDs back to the strings we got, since those are
+	   the ones we need to respond with */
+	uids = g_hash_table_new (g_str_hash, g_str_equal);
 	for (l = id_list; l != NULL; l = l->next) {
-		CouchdbDocument *document;
-		GError *error = NULL;
-		const gchar *uid = (const gchar *) l->data;
+		g_hash_table_insert (uids, l->data, l->data);
+		docids = g_slist_prepend (docids, l->data);
+	}
+	docids = g_slist_reverse (docids);
+
+	/* Retrieve all the documents in one request */
+	documents = couchdb_session_get_documents_by_id (couchdb_backend->couchdb,
+							 couchdb_backend->dbname,
+							 docids, &error);
+	g_slist_free (docids);
+	if (error != NULL) {
+		g_debug ("Error getting documents: %s", error->message);
+		g_error_free (error);
+		error = NULL;
+	}
 
-		document = couchdb_document_get (couchdb_backend->couchdb, couchdb_backend->dbname, uid, &error);
-		if (document) {
-			if (couchdb_backend->using_desktopcouch) {
-				CouchdbStructField *app_annotations, *u1_annotations, *private_annotations;
-
-				/* For desktopcouch, we don't remove contacts, we just
-				 * mark them as deleted */
-				app_annotations = desktopcouch_document_get_application_annotations (document);
-				if (app_annotations == NULL)
-					app_annotations = couchdb_struct_field_new ();
-
-				u1_annotations = couchdb_struct_field_get_struct_field (app_annotations, "Ubuntu One");
-				if (u1_annotations == NULL)
-					u1_annotations = couchdb_struct_field_new ();
-
-				private_annotations = couchdb_struct_field_get_struct_field (u1_annotations, "private_application_annotations");
-				if (private_annotations == NULL)
-					private_annotations = couchdb_struct_field_new ();
-
-				couchdb_struct_field_set_boolean_field (private_annotations, "deleted", TRUE);
-				couchdb_struct_field_set_struct_field (u1_annotations, "private_application_annotations", private_annotations);
-				couchdb_struct_field_set_struct_field (app_annotations, "Ubuntu One", u1_annotations);
-				desktopcouch_document_set_application_annotations (document, app_annotations);
-
-				/* Now put the new revision of the document */
-				if (couchdb_document_put (document, couchdb_backend->dbname, &error)) {
-					deleted_ids = g_list_append (deleted_ids, (gpointer) uid);
-					e_book_backend_cache_remove_contact (couchdb_backend->cache, uid);
-				} else {
-					if (error != NULL) {
-						g_debug ("Error deleting document: %s", error->message);
-						g_error_free (error);
-					} else
-						g_debug ("Error deleting document");
-				}
+	changes = g_ptr_array_sized_new (g_slist_length (documents));
+	for (sl = documents; sl != NULL; sl = sl->next) {
+		CouchdbDocument *document = COUCHDB_DOCUMENT (sl->data);
 
-				/* Free memory */
-				couchdb_struct_field_unref (app_annotations);
-				couchdb_struct_field_unref (u1_annotations);
-				couchdb_struct_field_unref (private_annotations);
-			} else {
-				if (couchdb_document_delete (document, &error)) {
-					deleted_ids = g_list_append (deleted_ids, (gpointer) uid);
-					e_book_backend_cache_remove_contact (couchdb_backend->cache, uid);
-				} else {
-					if (error != NULL) {
-						g_debug ("Error deleting document: %s", error->message);
-						g_error_free (error);
-					} else
-						g_debug ("Error deleting document");
-				}
-			}
+		if (couchdb_backend->using_desktopcouch) {
+			/* For desktopcouch, we don't remove contacts, we just
+			 * mark them as deleted */
+			desktopcouch_document_set_deleted (document, TRUE);
+
+			g_ptr_array_add (changes, g_object_ref (G_OBJECT (document)));
 		} else {
-			if (error != NULL) {
-				g_debug ("Error getting document: %s", error->message);
-				g_error_free (error);
-			} else
-				g_debug ("Error getting document");
+			CouchdbDocument *tombstone;
+
+			/* A deletion only needs the ID and current revision */
+			tombstone = couchdb_document_new (couchdb_backend->couchdb);
+			couchdb_document_set_id (tombstone, couchdb_document_get_id (document));
+			couchdb_document_set_revision (tombstone, couchdb_document_get_revision (document));
+			couchdb_document_set_boolean_field (tombstone, "_deleted", TRUE);
+
+			g_ptr_array_add (changes, tombstone);
 		}
 	}
 
+	if (documents != NULL)
+		couchdb_session_free_documents (documents);
+
+	/* And store all the changes in one request */
+	results = couchdb_session_put_documents (couchdb_backend->couchdb,
+						 couchdb_backend->dbname,
+						 changes,
+						 COUCHDB_BULK_FLAGS_NONE,
+						 &error);
+	if (error != NULL) {
+		g_debug ("Error deleting documents: %s", error->message);
+		g_error_free (error);
+	}
+
+	for (sl = results; sl != NULL; sl = sl->next) {
+		CouchdbBulkResult *result = (CouchdbBulkResult *) sl->data;
+		const gchar *uid;
+
+		uid = g_hash_table_lookup (uids, couchdb_bulk_result_get_docid (result));
+		if (uid == NULL)
+			continue;
+
+		if (couchdb_bulk_result_is_ok (result)) {
+			deleted_ids = g_list_prepend (deleted_ids, (gpointer) uid);
+			cache_remove_contact (couchdb_backend, uid);
+		} else
+			g_debug ("Error deleting document %s: %s", uid, couchdb_bulk_result_get_error (result));
+	}
+	deleted_ids = g_list_reverse (deleted_ids);
+
+	/* Free memory */
+	if (results != NULL)
+		couchdb_session_free_bulk_results (results);
+	g_ptr_array_foreach (changes, (GFunc) g_object_unref, NULL);
+	g_ptr_array_free (changes, TRUE);
+	g_hash_table_destroy (uids);
+
 	if (deleted_ids) {
 		e_data_book_respond_remove_contacts (book, opid,
 						     GNOME_Evolution_Addressbook_Success, deleted_ids);
@@ -1304,23 +1348,16 @@ e_book_backend_couchdb_get_contact (EBookBackend *backend,
 				    guint32 opid,
 				    const char *id)
 {
-	GError *error = NULL;
-	EContact *contact;
+	const gchar *vcard;
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (backend);
 
-	contact = e_book_backend_cache_get_contact (couchdb_backend->cache, id);
-	if (contact != NULL) {
-		char *vcard = e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30);
-
-		g_object_unref (G_OBJECT (contact));
-		if (vcard != NULL) {
-			e_data_book_respond_get_contact (book,
-							 opid,
-							 GNOME_Evolution_Addressbook_Success,
-							 vcard);
-			g_free (vcard);
-			return;
-		}
+	vcard = e_book_backend_couchdb_index_get_vcard (couchdb_backend->index, id);
+	if (vcard != NULL) {
+		e_data_book_respond_get_contact (book,
+						 opid,
+						 GNOME_Evolution_Addressbook_Success,
+						 vcard);
+		return;
 	}
 
 	e_data_book_respond_get_contact (book, opid, GNOME_Evolution_Addressbook_ContactNotFound, "");
@@ -1331,23 +1368,25 @@ e_book_backend_couchdb_get_contact_list (EBookBackend *backend,
 					 EDataBook *book,
 					 guint32 opid, const char *query)
 {
-	GList *doc_list, *contacts = NULL;
-	GError *error = NULL;
+	GList *matches, *l, *contacts = NULL;
+	EBookBackendSExp *sexp;
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (backend);
 
-	/* Get the list of documents from cache */
-	doc_list = e_book_backend_cache_get_contacts (couchdb_backend->cache, query);
-	while (doc_list != NULL) {
-		char *vcard;
-		EContact *contact = E_CONTACT (doc_list->data);
+	sexp = e_book_backend_sexp_new (query);
+	if (!sexp) {
+		e_data_book_respond_get_contact_list (book, opid, GNOME_Evolution_Addressbook_InvalidQuery, NULL);
+		return;
+	}
 
-		vcard = e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30);
-		if (vcard != NULL)
-			contacts = g_list_prepend (contacts, vcard);
+	/* Get the list of contacts from the in-memory cache */
+	matches = e_book_backend_couchdb_index_find (couchdb_backend->index, query, sexp);
+	for (l = matches; l != NULL; l = l->next) {
+		const gchar *uid = (const gchar *) l->data;
 
-		doc_list = g_list_remove (doc_list, contact);
-		g_object_unref (G_OBJECT (contact));
+		contacts = g_list_prepend (contacts, g_strdup (e_book_backend_couchdb_index_get_vcard (couchdb_backend->index, uid)));
 	}
+	g_list_free (matches);
+	g_object_unref (G_OBJECT (sexp));
 
 	e_data_book_respond_get_contact_list (book, opid, GNOME_Evolution_Addressbook_Success, contacts);
 }
@@ -1356,27 +1395,24 @@ static void
 e_book_backend_couchdb_start_book_view (EBookBackend *backend,
 					EDataBookView *book_view)
 {
-	GList *doc_list;
+	GList *matches, *l;
 	EBookBackendCouchDB *couchdb_backend = E_BOOK_BACKEND_COUCHDB (backend);
 
 	e_book_backend_add_book_view (backend, book_view);
 
-	/* Get the list of documents from cache */
-	doc_list = e_book_backend_cache_get_contacts (couchdb_backend->cache,
-						      e_data_book_view_get_card_query (book_view));
-	while (doc_list != NULL) {
-		char *vcard;
-		EContact *contact = E_CONTACT (doc_list->data);
-
-		vcard = e_vcard_to_string (E_VCARD (contact), EVC_FORMAT_VCARD_30);
-		if (!vcard)
-			continue;
-
-		e_data_book_view_notify_update_vcard (book_view, vcard);
+	/* Get the list of contacts from the in-memory cache. They are already
+	   checked against the view's query, so the view doesn't need to parse
+	   them again */
+	matches = e_book_backend_couchdb_index_find (couchdb_backend->index,
+						     e_data_book_view_get_card_query (book_view),
+						     e_data_book_view_get_card_sexp (book_view));
+	for (l = matches; l != NULL; l = l->next) {
+		const gchar *uid = (const gchar *) l->data;
 
-		doc_list = g_list_remove (doc_list, contact);
-		g_object_unref (G_OBJECT (contact));
+		e_data_book_view_notify_update_prefiltered_vcard (book_view, uid,
+								  g_strdup (e_book_backend_couchdb_index_get_vcard (couchdb_backend->index, uid)));
 	}
+	g_list_free (matches);
 
 	e_data_book_view_notify_complete (book_view, GNOME_Evolution_Addressbook_Success);
 }
@@ -1546,6 +1582,7 @@ e_book_backend_couchdb_dispose (GObject *object)
 
 	/* Free all memory and resources */
 	if (couchdb_backend->couchdb) {
+		e_couchdb_disconnect_document_signals (couchdb_backend->couchdb, couchdb_backend);
 		g_object_unref (G_OBJECT (couchdb_backend->couchdb));
 		couchdb_backend->couchdb = NULL;
 	}
@@ -1559,6 +1596,11 @@ e_book_backend_couchdb_dispose (GObject *object)
 		g_free (couchdb_backend->dbname);
 		couchdb_backend->dbname = NULL;
 	}
+
+	if (couchdb_backend->index != NULL) {
+		e_book_backend_couchdb_index_free (couchdb_backend->index);
+		couchdb_backend->index = NULL;
+	}
 }
 
 static void
@@ -1597,4 +1639,5 @@ e_book_backend_couchdb_init (EBookBackendCouchDB *backend)
 	backend->couchdb = NULL;
 	backend->dbname = NULL;
 	backend->cache = NULL;
+	backend->index = e_book_backend_couchdb_index_new ();
 }
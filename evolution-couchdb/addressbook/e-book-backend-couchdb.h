@@ -27,6 +27,7 @@
 #include <desktopcouch-glib.h>
 #include <libedata-book/e-book-backend.h>
 #include <libedata-book/e-book-backend-cache.h>
+#include "e-book-backend-couchdb-index.h"
 
 #define E_TYPE_BOOK_BACKEND_COUCHDB        (e_book_backend_couchdb_get_type ())
 #define E_BOOK_BACKEND_COUCHDB(o)          (G_TYPE_CHECK_INSTANCE_CAST ((o), E_TYPE_BOOK_BACKEND_COUCHDB, EBookBackendCouchDB))
@@ -40,6 +41,7 @@ typedef struct {
 
 	CouchdbSession *couchdb;
 	EBookBackendCache *cache;
+	EBookBackendCouchDBIndex *index;
 	char *dbname;
 	gboolean using_desktopcouch;
 } EBookBackendCouchDB;
@@ -0,0 +1,326 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-cal-backend-couchdb-index.c - Indexes for calendar queries
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Miguel Angel Rodelas Delgado <miguel.rodelas@gmail.com>
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#include <string.h>
+#include <libecal/e-cal-time-util.h>
+#include "e-couchdb-query.h"
+#include "e-cal-backend-couchdb-index.h"
+
+/* Secondary indexes over the tasks in the backend's cache, used to answer
+   the most common query shapes without evaluating the query's s-expression
+   against every task */
+
+/* Maximum difference between a due date in UTC and in any time zone, to
+   make sure ranges computed in UTC include every possible match */
+#define MAX_ZONE_OFFSET (24 * 60 * 60)
+
+typedef struct {
+	gchar *uid;
+	gchar *summary;
+	time_t due;
+	gboolean completed;
+
+	/* Set for the entries used to search the sequences */
+	gboolean probe;
+
+	GSequenceIter *due_iter;
+} IndexEntry;
+
+struct _ECalBackendCouchDBIndex {
+	GHashTable *entries;
+	GSequence *by_due;
+	GHashTable *completed;
+};
+
+static gint
+compare_by_due (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const IndexEntry *entry_a = a, *entry_b = b;
+
+	if (entry_a->due != entry_b->due)
+		return entry_a->due < entry_b->due ? -1 : 1;
+
+	/* Probes go before the entries they are equal to */
+	if (entry_a->probe != entry_b->probe)
+		return entry_a->probe ? -1 : 1;
+
+	return entry_a->probe ? 0 : strcmp (entry_a->uid, entry_b->uid);
+}
+
+static void
+index_entry_free (IndexEntry *entry)
+{
+	if (entry->due_iter != NULL)
+		g_sequence_remove (entry->due_iter);
+
+	g_free (entry->uid);
+	g_free (entry->summary);
+
+	g_slice_free (IndexEntry, entry);
+}
+
+ECalBackendCouchDBIndex *
+e_cal_backend_couchdb_index_new (void)
+{
+	ECalBackendCouchDBIndex *index;
+
+	index = g_slice_new (ECalBackendCouchDBIndex);
+	index->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+						NULL, (GDestroyNotify) index_entry_free);
+	index->by_due = g_sequence_new (NULL);
+	index->completed = g_hash_table_new (g_str_hash, g_str_equal);
+
+	return index;
+}
+
+void
+e_cal_backend_couchdb_index_free (ECalBackendCouchDBIndex *index)
+{
+	g_return_if_fail (index != NULL);
+
+	g_hash_table_destroy (index->completed);
+	g_hash_table_destroy (index->entries);
+	g_sequence_free (index->by_due);
+
+	g_slice_free (ECalBackendCouchDBIndex, index);
+}
+
+void
+e_cal_backend_couchdb_index_add (ECalBackendCouchDBIndex *index, const gchar *uid, ECalComponent *task)
+{
+	IndexEntry *entry;
+	ECalComponentText summary;
+	ECalComponentDateTime due;
+	struct icaltimetype *completed = NULL;
+
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (uid != NULL);
+
+	e_cal_backend_couchdb_index_remove (index, uid);
+
+	entry = g_slice_new0 (IndexEntry);
+	entry->uid = g_strdup (uid);
+
+	e_cal_component_get_summary (task, &summary);
+	entry->summary = e_couchdb_normalize_search_string (summary.value ? summary.value : "");
+
+	e_cal_component_get_due (task, &due);
+	if (due.value != NULL) {
+		entry->due = icaltime_as_timet_with_zone (*due.value, icaltimezone_get_utc_timezone ());
+		entry->due_iter = g_sequence_insert_sorted (index->by_due, entry, compare_by_due, NULL);
+	}
+	e_cal_component_free_datetime (&due);
+
+	e_cal_component_get_completed (task, &completed);
+	if (completed != NULL) {
+		entry->completed = TRUE;
+		g_hash_table_insert (index->completed, entry->uid, entry);
+		e_cal_component_free_icaltimetype (completed);
+	}
+
+	g_hash_table_insert (index->entries, entry->uid, entry);
+}
+
+void
+e_cal_backend_couchdb_index_remove (ECalBackendCouchDBIndex *index, const gchar *uid)
+{
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (uid != NULL);
+
+	g_hash_table_remove (index->completed, uid);
+	g_hash_table_remove (index->entries, uid);
+}
+
+void
+e_cal_backend_couchdb_index_clear (ECalBackendCouchDBIndex *index)
+{
+	g_return_if_fail (index != NULL);
+
+	g_hash_table_remove_all (index->completed);
+	g_hash_table_remove_all (index->entries);
+}
+
+/* Gets the time for a (make-time "ISODATE") argument */
+static time_t
+sexp_get_time_arg (ECouchDBSExpNode *node, guint n)
+{
+	ECouchDBSExpNode *arg;
+	const gchar *isodate;
+
+	if (node->children->len <= n)
+		return -1;
+
+	arg = g_ptr_array_index (node->children, n);
+	if (g_strcmp0 (e_couchdb_sexp_node_get_function (arg), "make-time") != 0
+	    || (isodate = e_couchdb_sexp_node_get_string_arg (arg, 1)) == NULL)
+		return -1;
+
+	return time_from_isodate (isodate);
+}
+
+/*
+ * Query planning
+ */
+
+static void
+plan_summary_contains (ECalBackendCouchDBIndex *index, const gchar *text, ECouchDBCandidates *candidates)
+{
+	gchar *normalized;
+	GHashTableIter iter;
+	gpointer value;
+
+	normalized = e_couchdb_normalize_search_string (text);
+
+	/* Cheaper than evaluating the query, but candidates are still
+	   checked, since case folding rules differ slightly */
+	e_couchdb_candidates_init_empty (candidates, FALSE);
+	g_hash_table_iter_init (&iter, index->entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		IndexEntry *entry = (IndexEntry *) value;
+
+		if (strstr (entry->summary, normalized) != NULL)
+			e_couchdb_candidates_add (candidates, entry);
+	}
+
+	g_free (normalized);
+}
+
+static void
+plan_due_range (ECalBackendCouchDBIndex *index, time_t start, time_t end, ECouchDBCandidates *candidates)
+{
+	IndexEntry probe = { 0, };
+	GSequenceIter *iter;
+
+	probe.probe = TRUE;
+	probe.due = start - MAX_ZONE_OFFSET;
+
+	e_couchdb_candidates_init_empty (candidates, FALSE);
+	iter = g_sequence_search (index->by_due, &probe, compare_by_due, NULL);
+	while (!g_sequence_iter_is_end (iter)) {
+		IndexEntry *entry = g_sequence_get (iter);
+
+		if (entry->due > end + MAX_ZONE_OFFSET)
+			break;
+
+		e_couchdb_candidates_add (candidates, entry);
+		iter = g_sequence_iter_next (iter);
+	}
+}
+
+static void
+plan_completed (ECalBackendCouchDBIndex *index, gboolean completed, ECouchDBCandidates *candidates)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	e_couchdb_candidates_init_empty (candidates, TRUE);
+	g_hash_table_iter_init (&iter, completed ? index->completed : index->entries);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		IndexEntry *entry = (IndexEntry *) value;
+
+		if (entry->completed == completed)
+			e_couchdb_candidates_add (candidates, entry);
+	}
+}
+
+static void
+plan_function (ECouchDBSExpNode *node, const gchar *function, ECouchDBCandidates *candidates, gpointer user_data)
+{
+	ECalBackendCouchDBIndex *index = user_data;
+	const gchar *arg;
+
+	if (!strcmp (function, "uid?") && (arg = e_couchdb_sexp_node_get_string_arg (node, 1)) != NULL) {
+		IndexEntry *entry;
+
+		e_couchdb_candidates_init_empty (candidates, TRUE);
+		if ((entry = g_hash_table_lookup (index->entries, arg)) != NULL)
+			e_couchdb_candidates_add (candidates, entry);
+	} else if (!strcmp (function, "contains?")
+		   && g_strcmp0 (e_couchdb_sexp_node_get_string_arg (node, 1), "summary") == 0
+		   && (arg = e_couchdb_sexp_node_get_string_arg (node, 2)) != NULL) {
+		plan_summary_contains (index, arg, candidates);
+	} else if (!strcmp (function, "due-in-time-range?")) {
+		time_t start, end;
+
+		start = sexp_get_time_arg (node, 1);
+		end = sexp_get_time_arg (node, 2);
+		if (start != -1 && end != -1)
+			plan_due_range (index, start, end, candidates);
+		else
+			e_couchdb_candidates_init_all (candidates, FALSE);
+	} else if (!strcmp (function, "is-completed?") && node->children->len == 1) {
+		plan_completed (index, TRUE, candidates);
+	} else if (!strcmp (function, "not") && node->children->len == 2
+		   && g_strcmp0 (e_couchdb_sexp_node_get_function (g_ptr_array_index (node->children, 1)), "is-completed?") == 0
+		   && ((ECouchDBSExpNode *) g_ptr_array_index (node->children, 1))->children->len == 1) {
+		plan_completed (index, FALSE, candidates);
+	} else
+		e_couchdb_candidates_init_all (candidates, FALSE);
+}
+
+/**
+ * e_cal_backend_couchdb_index_query:
+ * @index: An #ECalBackendCouchDBIndex
+ * @sexp: Query to find the candidate tasks for
+ * @uids: Placeholder for the list of candidate task UIDs
+ * @exact: Placeholder for whether the candidates exactly match the query
+ *
+ * Find, from the indexes, the tasks that might match a query. If @exact
+ * is set to TRUE, all the candidates match the query. Otherwise they must
+ * still be checked against the query, but tasks not in the list are known
+ * not to match.
+ *
+ * Return value: TRUE if the candidates could be narrowed down, in which case
+ * @uids is set to a list of UIDs, owned by the index, that should be freed
+ * with g_list_free. FALSE if every task is a candidate.
+ */
+gboolean
+e_cal_backend_couchdb_index_query (ECalBackendCouchDBIndex *index,
+				   const gchar *sexp,
+				   GList **uids,
+				   gboolean *exact)
+{
+	ECouchDBCandidates candidates;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_return_val_if_fail (index != NULL, FALSE);
+	g_return_val_if_fail (uids != NULL, FALSE);
+	g_return_val_if_fail (exact != NULL, FALSE);
+
+	*uids = NULL;
+	*exact = FALSE;
+
+	if (!e_couchdb_plan_query (sexp, plan_function, index, &candidates))
+		return FALSE;
+
+	*exact = candidates.exact;
+	if (candidates.all)
+		return FALSE;
+
+	g_hash_table_iter_init (&iter, candidates.items);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		*uids = g_list_prepend (*uids, ((IndexEntry *) key)->uid);
+	e_couchdb_candidates_clear (&candidates);
+
+	return TRUE;
+}
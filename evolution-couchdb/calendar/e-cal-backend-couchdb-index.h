@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-cal-backend-couchdb-index.h - Indexes for calendar queries
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Miguel Angel Rodelas Delgado <miguel.rodelas@gmail.com>
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#ifndef __E_CAL_BACKEND_COUCHDB_INDEX_H__
+#define __E_CAL_BACKEND_COUCHDB_INDEX_H__
+
+#include <libecal/e-cal-component.h>
+
+typedef struct _ECalBackendCouchDBIndex ECalBackendCouchDBIndex;
+
+ECalBackendCouchDBIndex *e_cal_backend_couchdb_index_new (void);
+void                     e_cal_backend_couchdb_index_free (ECalBackendCouchDBIndex *index);
+
+void                     e_cal_backend_couchdb_index_add (ECalBackendCouchDBIndex *index,
+							  const gchar *uid,
+							  ECalComponent *task);
+void                     e_cal_backend_couchdb_index_remove (ECalBackendCouchDBIndex *index, const gchar *uid);
+void                     e_cal_backend_couchdb_index_clear (ECalBackendCouchDBIndex *index);
+
+gboolean                 e_cal_backend_couchdb_index_query (ECalBackendCouchDBIndex *index,
+							    const gchar *sexp,
+							    GList **uids,
+							    gboolean *exact);
+
+#endif
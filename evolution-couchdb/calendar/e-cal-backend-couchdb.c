@@ -20,6 +20,7 @@
  */
 
 #include <string.h>
+#include "e-couchdb-sync.h"
 #include "e-cal-backend-couchdb.h"
 #include <libedata-cal/e-cal-backend-sexp.h>
 #include <libedata-cal/e-data-cal.h>
@@ -41,7 +42,6 @@ static ECalComponent *
 task_from_couch_document (CouchdbDocument *document)
 {
 	ECalComponent *task;
-	CouchdbStructField *app_annotations;
 	
 	const char *uid;
 	ECalComponentText summary;
@@ -55,24 +55,8 @@ task_from_couch_document (CouchdbDocument *document)
 		return NULL;
 
 	/* Check if the task is marked for deletion */
-	if ((app_annotations = desktopcouch_document_get_application_annotations (document))) {
-		CouchdbStructField *u1_annotations;
-
-		u1_annotations = couchdb_struct_field_get_struct_field (
-			app_annotations, "Ubuntu One");
-		if (u1_annotations != NULL) {
-			CouchdbStructField *private_annotations;
-
-			private_annotations = couchdb_struct_field_get_struct_field (
-				u1_annotations, "private_application_annotations");
-			if (private_annotations != NULL) {
-				if (couchdb_struct_field_has_field (private_annotations, "deleted")
-				    && couchdb_struct_field_get_boolean_field (private_annotations, "deleted"))
-					couchdb_struct_field_unref (app_annotations);
-					return NULL;
-			}
-		}
-	}
+	if (desktopcouch_document_is_deleted (document))
+		return NULL;
 
 	/* Fill in the ECalComponent with the data from the CouchDBDocument*/
 	task = e_cal_component_new ();
@@ -134,33 +118,152 @@ couch_document_from_task (ECalBackendCouchDB *couchdb_backend, ECalComponent *ta
 	return document;
 }
 
+/* In-memory copy of the tasks in the cache, with their iCalendar strings
+   already generated, so that listing and querying don't need to parse
+   and serialize every task on each call */
+typedef struct {
+	gchar *revision;
+	ECalComponent *task;
+	gchar *task_string;
+} CachedTask;
+
+static void
+cached_task_free (CachedTask *cached)
+{
+	g_free (cached->revision);
+	g_object_unref (G_OBJECT (cached->task));
+	g_free (cached->task_string);
+
+	g_slice_free (CachedTask, cached);
+}
+
+/* Adds @task to the cache, unless it is already there with the same
+   revision, and returns the previous string for the task, if any */
+static gchar *
+cache_put_task (ECalBackendCouchDB *couchdb_backend, const gchar *revision, ECalComponent *task)
+{
+	CachedTask *cached;
+	const gchar *uid;
+	gchar *old_string = NULL;
+
+	e_cal_component_get_uid (task, &uid);
+
+	cached = g_hash_table_lookup (couchdb_backend->tasks, uid);
+	if (cached != NULL) {
+		if (revision != NULL && g_strcmp0 (revision, cached->revision) == 0)
+			return g_strdup (cached->task_string);
+
+		old_string = cached->task_string;
+		cached->task_string = NULL;
+		g_hash_table_remove (couchdb_backend->tasks, uid);
+	}
+
+	cached = g_slice_new (CachedTask);
+	cached->revision = g_strdup (revision);
+	cached->task = g_object_ref (G_OBJECT (task));
+	e_cal_component_commit_sequence (task);
+	cached->task_string = e_cal_component_get_as_string (task);
+	g_hash_table_insert (couchdb_backend->tasks, g_strdup (uid), cached);
+	e_cal_backend_couchdb_index_add (couchdb_backend->index, uid, task);
+
+	e_cal_backend_cache_put_component (couchdb_backend->cache, task);
+
+	return old_string;
+}
+
+static void
+cache_remove_task (ECalBackendCouchDB *couchdb_backend, const gchar *uid, const gchar *rid)
+{
+	g_hash_table_remove (couchdb_backend->tasks, uid);
+	e_cal_backend_couchdb_index_remove (couchdb_backend->index, uid);
+	e_cal_backend_cache_remove_component (couchdb_backend->cache, uid, rid);
+}
+
+static void
+clear_cached_tasks (ECalBackendCouchDB *couchdb_backend)
+{
+	g_hash_table_remove_all (couchdb_backend->tasks);
+	e_cal_backend_couchdb_index_clear (couchdb_backend->index);
+}
+
+/* Loads into memory the tasks in the cache that weren't already */
+static void
+load_cached_tasks (ECalBackendCouchDB *couchdb_backend)
+{
+	GList *doc_list;
+
+	doc_list = e_cal_backend_cache_get_components (couchdb_backend->cache);
+	while (doc_list != NULL) {
+		ECalComponent *task = E_CAL_COMPONENT (doc_list->data);
+		const gchar *uid;
+
+		e_cal_component_get_uid (task, &uid);
+		if (uid != NULL && g_hash_table_lookup (couchdb_backend->tasks, uid) == NULL) {
+			CachedTask *cached;
+
+			cached = g_slice_new (CachedTask);
+			cached->revision = NULL;
+			cached->task = task;
+			e_cal_component_commit_sequence (task);
+			cached->task_string = e_cal_component_get_as_string (task);
+			g_hash_table_insert (couchdb_backend->tasks, g_strdup (uid), cached);
+			e_cal_backend_couchdb_index_add (couchdb_backend->index, uid, task);
+		} else
+			g_object_unref (G_OBJECT (task));
+
+		doc_list = g_list_delete_link (doc_list, doc_list);
+	}
+}
+
 static void
 document_updated_cb (CouchdbSession *couchdb, const char *dbname, CouchdbDocument *document, gpointer user_data)
 {
 	ECalComponent *task;
 	ECalBackendCouchDB *couchdb_backend = E_CAL_BACKEND_COUCHDB (user_data);
-	const gchar *uid, *task_string;
-
-	if (g_strcmp0 (dbname, couchdb_backend->dbname) != 0)
-		return;
+	CachedTask *cached;
+	const gchar *uid;
+	gchar *old_string;
 
 	task = task_from_couch_document (document);
-	if (!task)
+	if (!task) {
+		const gchar *docid = couchdb_document_get_id (document);
+
+		/* Not a task any more, for instance because another client
+		   marked it as deleted, so drop it, as syncing the cache would */
+		if (docid != NULL && g_hash_table_lookup (couchdb_backend->tasks, docid) != NULL) {
+			ECalComponentId id;
+
+			id.uid = (gchar *) docid;
+			id.rid = NULL;
+			e_cal_backend_notify_object_removed (E_CAL_BACKEND (couchdb_backend), &id, NULL, NULL);
+
+			cache_remove_task (couchdb_backend, docid, NULL);
+		}
+
 		return;
+	}
 
 	e_cal_component_get_uid (task, &uid);
-	e_cal_component_commit_sequence (task);
-	task_string = e_cal_component_get_as_string(task);
-	
-	if (e_cal_backend_cache_get_component(couchdb_backend->cache, uid, NULL) != NULL) {
-		e_cal_backend_notify_object_modified (E_CAL_BACKEND (couchdb_backend), task_string, task_string);
-	} else {
-		e_cal_backend_notify_object_created (E_CAL_BACKEND (couchdb_backend), task_string);
 
-		/* Add the task to the cache */
-		e_cal_backend_cache_put_component (couchdb_backend->cache, task);
+	/* Changes we already know about, like our own changes coming back
+	   from the changes feed, are not notified again */
+	cached = g_hash_table_lookup (couchdb_backend->tasks, uid);
+	if (cached != NULL && cached->revision != NULL
+	    && g_strcmp0 (cached->revision, couchdb_document_get_revision (document)) == 0) {
+		g_object_unref (G_OBJECT (task));
+		return;
 	}
 
+	/* Add the task to the cache */
+	old_string = cache_put_task (couchdb_backend, couchdb_document_get_revision (document), task);
+	cached = g_hash_table_lookup (couchdb_backend->tasks, uid);
+
+	if (old_string != NULL) {
+		e_cal_backend_notify_object_modified (E_CAL_BACKEND (couchdb_backend), old_string, cached->task_string);
+		g_free (old_string);
+	} else
+		e_cal_backend_notify_object_created (E_CAL_BACKEND (couchdb_backend), cached->task_string);
+
 	g_object_unref (G_OBJECT (task));
 }
 
@@ -173,13 +276,10 @@ document_deleted_cb (CouchdbSession *couchdb, const char *dbname, const char *do
 
 	id.uid = (gchar *)docid;
 
-	if (g_strcmp0 (dbname, couchdb_backend->dbname) != 0)
-		return;
-
 	e_cal_backend_notify_object_removed (E_CAL_BACKEND (couchdb_backend), &id, NULL, NULL);
 
 	/* Remove the task from the cache */
-	e_cal_backend_cache_remove_component (couchdb_backend->cache, docid, NULL);
+	cache_remove_task (couchdb_backend, docid, NULL);
 }
 
 static ECalComponent *
@@ -194,7 +294,8 @@ put_document (ECalBackendCouchDB *couchdb_backend, CouchdbDocument *document)
 		new_task = task_from_couch_document (document);
 
 		/* Add the new task to the cache */
-		e_cal_backend_cache_put_component (couchdb_backend->cache, new_task);
+		if (new_task != NULL)
+			g_free (cache_put_task (couchdb_backend, couchdb_document_get_revision (document), new_task));
 
 		return new_task;
 
@@ -258,14 +359,35 @@ e_cal_backend_couchdb_get_static_capabilities (ECalBackend *backend, EDataCal *c
 	e_data_cal_notify_static_capabilities(cal, GNOME_Evolution_Calendar_Success, capabilities);
 }
 
+static void
+apply_change_to_cache (const gchar *docid, CouchdbDocument *document, ECalBackendCouchDB *couchdb_backend)
+{
+	ECalComponent *task = NULL;
+
+	if (document != NULL)
+		task = task_from_couch_document (document);
+
+	if (task != NULL) {
+		g_free (cache_put_task (couchdb_backend, couchdb_document_get_revision (document), task));
+		g_object_unref (G_OBJECT (task));
+	} else
+		cache_remove_task (couchdb_backend, docid, NULL);
+}
+
+static const ECouchDBSyncFuncs sync_funcs = {
+	(CouchdbChangeFunc) apply_change_to_cache,
+	(ECouchDBCacheFunc) clear_cached_tasks,
+	(ECouchDBCacheFunc) load_cached_tasks
+};
+
 void 
 e_cal_backend_couchdb_open (ECalBackend *backend, EDataCal *cal, gboolean only_if_exists, const gchar *username, const gchar *password)
 {
 	gchar *uri;
 	const gchar *property;
 	CouchdbDatabaseInfo *db_info;
+	gint update_seq = 0;
 	GError *error = NULL;
-	GSList *doc_list, *sl;
 
 	ECalBackendCouchDB *couchdb_backend = E_CAL_BACKEND_COUCHDB (backend);
 	ESource *source;
@@ -276,12 +398,15 @@ e_cal_backend_couchdb_open (ECalBackend *backend, EDataCal *cal, gboolean only_i
 		e_data_cal_notify_open (cal, GNOME_Evolution_Calendar_OtherError);
 	}
 
-	if (couchdb_backend->couchdb != NULL)
+	if (couchdb_backend->couchdb != NULL) {
+		e_couchdb_disconnect_document_signals (couchdb_backend->couchdb, couchdb_backend);
 		g_object_unref (G_OBJECT (couchdb_backend->couchdb));
+	}
 	if (couchdb_backend->dbname != NULL)
 		g_free (couchdb_backend->dbname);
 	if (couchdb_backend->cache != NULL)
 		g_object_unref (G_OBJECT (couchdb_backend->cache));
+	clear_cached_tasks (couchdb_backend);
 
 	/* create CouchDB main object */
 	couchdb_backend->dbname = g_strdup ("tasks");
@@ -289,7 +414,7 @@ e_cal_backend_couchdb_open (ECalBackend *backend, EDataCal *cal, gboolean only_i
 
 	property = e_source_get_property (source, "couchdb_instance");
 	if (g_strcmp0 (property, "user") == 0) {
-		if (! (couchdb_backend->couchdb = COUCHDB_SESSION (desktopcouch_session_new ()))) {
+		if (! (couchdb_backend->couchdb = COUCHDB_SESSION (desktopcouch_session_new_shared ()))) {
 			g_warning ("Could not create DesktopcouchSession object");
 			e_data_cal_notify_open (cal, GNOME_Evolution_Calendar_NoSuchCal);
 		}
@@ -301,7 +426,7 @@ e_cal_backend_couchdb_open (ECalBackend *backend, EDataCal *cal, gboolean only_i
 		else
 			uri = g_strdup ("http://127.0.0.1:5984");
 
-		if (! (couchdb_backend->couchdb = couchdb_session_new (uri))) {
+		if (! (couchdb_backend->couchdb = couchdb_session_new_shared (uri, NULL))) {
 			g_free (uri);
 			e_data_cal_notify_open (cal, GNOME_Evolution_Calendar_NoSuchCal);
 		}
@@ -333,51 +458,24 @@ e_cal_backend_couchdb_open (ECalBackend *backend, EDataCal *cal, gboolean only_i
 
 			e_data_cal_notify_open (cal, GNOME_Evolution_Calendar_PermissionDenied);
 		}
-	} else
+	} else {
+		update_seq = couchdb_database_info_get_update_sequence (db_info);
 		couchdb_database_info_unref (db_info);
+	}
 
 	/* Create cache */
 	couchdb_backend->cache = e_cal_backend_cache_new (e_cal_backend_get_uri (E_CAL_BACKEND (couchdb_backend)), E_CAL_SOURCE_TYPE_TODO);
 
 	/* Populate the cache */
-	e_file_cache_clean (E_FILE_CACHE (couchdb_backend->cache));
-	error = NULL;
-	doc_list = couchdb_session_list_documents (couchdb_backend->couchdb,
-						   couchdb_backend->dbname,
-						   &error);
-
-	for (sl = doc_list; sl != NULL; sl = sl->next) {
-		ECalComponent *task;
-		CouchdbDocument *document;
-		CouchdbDocumentInfo *doc_info = (CouchdbDocumentInfo *) sl->data;
-
-		/* Retrieve this document */
-		error = NULL;
-		document = couchdb_document_get (couchdb_backend->couchdb,
-						 couchdb_backend->dbname,
-						 couchdb_document_info_get_docid (doc_info),
-						 &error);
-		if (!document)
-			continue;
-
-		task = task_from_couch_document (document);
-		if (task != NULL) {
-			e_cal_backend_cache_put_component (couchdb_backend->cache, task);
-			g_object_unref (G_OBJECT (task));
-		}
-
-		g_object_unref (G_OBJECT (document));
-	}
-
-	couchdb_session_free_document_list (doc_list);
+	e_couchdb_sync_cache (couchdb_backend->couchdb, couchdb_backend->dbname,
+			      E_FILE_CACHE (couchdb_backend->cache), update_seq,
+			      &sync_funcs, couchdb_backend);
 
 	/* Listen for changes on database */
-	g_signal_connect (G_OBJECT (couchdb_backend->couchdb), "document_created",
-			  G_CALLBACK (document_updated_cb), couchdb_backend);
-	g_signal_connect (G_OBJECT (couchdb_backend->couchdb), "document_updated",
-			  G_CALLBACK (document_updated_cb), couchdb_backend);
-	g_signal_connect (G_OBJECT (couchdb_backend->couchdb), "document_deleted",
-			  G_CALLBACK (document_deleted_cb), couchdb_backend);
+	e_couchdb_connect_document_signals (couchdb_backend->couchdb, couchdb_backend->dbname,
+					    G_CALLBACK (document_updated_cb),
+					    G_CALLBACK (document_deleted_cb),
+					    couchdb_backend);
 	couchdb_session_listen_for_changes (couchdb_backend->couchdb, couchdb_backend->dbname);
 	
 	e_data_cal_notify_open (cal, GNOME_Evolution_Calendar_Success);
@@ -390,6 +488,7 @@ e_cal_backend_couchdb_remove (ECalBackend *backend, EDataCal *cal)
 	ECalBackendCouchDB *couchdb_backend = E_CAL_BACKEND_COUCHDB (backend);
 
 	/* Remove the cache */
+	clear_cached_tasks (couchdb_backend);
 	if (couchdb_backend->cache != NULL) {
 
 		e_file_cache_remove (E_FILE_CACHE (couchdb_backend->cache));
@@ -491,31 +590,14 @@ e_cal_backend_couchdb_remove_object (ECalBackend *backend, EDataCal *cal, const
 	document = couchdb_document_get (couchdb_backend->couchdb, couchdb_backend->dbname, uid, &error);
 	if (document) {
 		if (couchdb_backend->using_desktopcouch) {
-			CouchdbStructField *app_annotations, *u1_annotations, *private_annotations;
-
 			/* For desktopcouch, we don't remove tasks, we just
 			* mark them as deleted */
-			app_annotations = desktopcouch_document_get_application_annotations (document);
-			if (app_annotations == NULL)
-				app_annotations = couchdb_struct_field_new ();
-
-			u1_annotations = couchdb_struct_field_get_struct_field (app_annotations, "Ubuntu One");
-			if (u1_annotations == NULL)
-				u1_annotations = couchdb_struct_field_new ();
-
-			private_annotations = couchdb_struct_field_get_struct_field (u1_annotations, "private_application_annotations");
-			if (private_annotations == NULL)
-				private_annotations = couchdb_struct_field_new ();
-
-			couchdb_struct_field_set_boolean_field (private_annotations, "deleted", TRUE);
-			couchdb_struct_field_set_struct_field (u1_annotations, "private_application_annotations", private_annotations);
-			couchdb_struct_field_set_struct_field (app_annotations, "Ubuntu One", u1_annotations);
-			desktopcouch_document_set_application_annotations (document, app_annotations);
+			desktopcouch_document_set_deleted (document, TRUE);
 
 			/* Now put the new revision of the document */
 			if (couchdb_document_put (document, couchdb_backend->dbname, &error)) {
 				deleted = TRUE;
-				e_cal_backend_cache_remove_component (couchdb_backend->cache, uid, rid);
+				cache_remove_task (couchdb_backend, uid, rid);
 			} else {
 				if (error != NULL) {
 					g_warning ("Error deleting document: %s", error->message);
@@ -523,17 +605,12 @@ e_cal_backend_couchdb_remove_object (ECalBackend *backend, EDataCal *cal, const
 				} else
 					g_warning ("Error deleting document");
 			}
-
-			/* Free memory */
-			couchdb_struct_field_unref (app_annotations);
-			couchdb_struct_field_unref (u1_annotations);
-			couchdb_struct_field_unref (private_annotations);
 		
 		} else {
 			
 			if (couchdb_document_delete (document, &error)) {
 				deleted = TRUE;
-				e_cal_backend_cache_remove_component (couchdb_backend->cache, uid, rid);
+				cache_remove_task (couchdb_backend, uid, rid);
 			} else {
 				if (error != NULL) {
 					g_warning ("Error deleting document: %s", error->message);
@@ -586,50 +663,81 @@ e_cal_backend_couchdb_get_default_object (ECalBackend *backend, EDataCal *cal)
 void 
 e_cal_backend_couchdb_get_object (ECalBackend *backend, EDataCal *cal, const gchar *uid, const gchar *rid)
 {
-	GError *error = NULL;
-	ECalComponent *task;
+	CachedTask *cached;
 	ECalBackendCouchDB *couchdb_backend = E_CAL_BACKEND_COUCHDB (backend);
 
-	task = e_cal_backend_cache_get_component (couchdb_backend->cache, uid, rid);
-	if (task != NULL) {
-		e_cal_component_commit_sequence (task);
-		gchar *task_string = e_cal_component_get_as_string (task);
+	cached = g_hash_table_lookup (couchdb_backend->tasks, uid);
+	if (cached != NULL && cached->task_string != NULL) {
+		e_data_cal_notify_object (cal, GNOME_Evolution_Calendar_Success, cached->task_string);
+		return;
+	}
 
-		g_object_unref (G_OBJECT (task));
-		if (task_string != NULL) {
-			e_data_cal_notify_object (cal, GNOME_Evolution_Calendar_Success, task_string);
-			g_free (task_string);
-			return;
+	e_data_cal_notify_object (cal, GNOME_Evolution_Calendar_ObjectNotFound, "");
+}
+
+/* Returns the cached tasks matching a query. The indexes are used to find
+   the candidate tasks, so that the query is only evaluated, if needed at
+   all, on those */
+static GList *
+find_matching_tasks (ECalBackendCouchDB *couchdb_backend, const gchar *query, ECalBackendSExp *sexp)
+{
+	GList *uids, *l, *matches = NULL;
+	gboolean exact;
+
+	if (e_cal_backend_couchdb_index_query (couchdb_backend->index, query, &uids, &exact)) {
+		for (l = uids; l != NULL; l = l->next) {
+			CachedTask *cached = g_hash_table_lookup (couchdb_backend->tasks, l->data);
+
+			if (cached == NULL || cached->task_string == NULL)
+				continue;
+
+			if (exact || e_cal_backend_sexp_match_comp (sexp, cached->task, E_CAL_BACKEND (couchdb_backend)))
+				matches = g_list_prepend (matches, cached);
+		}
+
+		g_list_free (uids);
+	} else {
+		GHashTableIter iter;
+		gpointer value;
+
+		g_hash_table_iter_init (&iter, couchdb_backend->tasks);
+		while (g_hash_table_iter_next (&iter, NULL, &value)) {
+			CachedTask *cached = (CachedTask *) value;
+
+			if (cached->task_string == NULL)
+				continue;
+
+			if (exact || e_cal_backend_sexp_match_comp (sexp, cached->task, E_CAL_BACKEND (couchdb_backend)))
+				matches = g_list_prepend (matches, cached);
 		}
 	}
 
-	e_data_cal_notify_object (cal, GNOME_Evolution_Calendar_ObjectNotFound, "");
+	return matches;
 }
 
 void 
 e_cal_backend_couchdb_get_object_list (ECalBackend *backend, EDataCal *cal, const gchar *sexp)
 {
-	GList *doc_list, *tasks = NULL;
-	GError *error = NULL;
+	GList *matches, *l, *tasks = NULL;
+	ECalBackendSExp *cbsexp;
 	ECalBackendCouchDB *couchdb_backend = E_CAL_BACKEND_COUCHDB (backend);
 
-	/* Get the list of documents from cache */
-	doc_list = e_cal_backend_cache_get_components (couchdb_backend->cache);
-
-	while (doc_list != NULL) {
-		gchar *task_string;
-		ECalComponent *task = E_CAL_COMPONENT (doc_list->data);
-
-		 e_cal_component_commit_sequence (task);
-		task_string = e_cal_component_get_as_string (task);
-		if (!task_string)
-			tasks = g_list_prepend (tasks, task_string);
-
-		doc_list = g_list_remove (doc_list, task);
-		g_object_unref (G_OBJECT (task));
+	cbsexp = e_cal_backend_sexp_new (sexp);
+	if (!cbsexp) {
+		e_data_cal_notify_object_list (cal, GNOME_Evolution_Calendar_InvalidQuery, NULL);
+		return;
 	}
 
+	/* Get the list of tasks from the in-memory cache */
+	matches = find_matching_tasks (couchdb_backend, sexp, cbsexp);
+	for (l = matches; l != NULL; l = l->next)
+		tasks = g_list_prepend (tasks, ((CachedTask *) l->data)->task_string);
+
 	e_data_cal_notify_object_list (cal, GNOME_Evolution_Calendar_Success, tasks);
+
+	g_list_free (tasks);
+	g_list_free (matches);
+	g_object_unref (G_OBJECT (cbsexp));
 }
 
 void 
@@ -695,37 +803,19 @@ e_cal_backend_couchdb_internal_get_default_timezone (ECalBackend *backend)
 void 
 e_cal_backend_couchdb_start_query (ECalBackend *backend, EDataCalView *query)
 {
-	GList *doc_list;
+	GList *matches, *l;
 	ECalBackendCouchDB *couchdb_backend = E_CAL_BACKEND_COUCHDB (backend);
 	ECalBackendSExp *sexp;
-	ECalComponentText summary;
 
 	e_cal_backend_add_query (backend, query);
 	sexp = e_data_cal_view_get_object_sexp (query);
 
-	/* Get the list of documents from cache */
-	doc_list = e_cal_backend_cache_get_components (couchdb_backend->cache);
-
-	while (doc_list != NULL) {
-		gchar *task_string;
-		ECalComponent *task = E_CAL_COMPONENT (doc_list->data);
-
-		e_cal_component_commit_sequence (task);
-		task_string = e_cal_component_get_as_string (task);
-		if (!task_string)
-			continue;
-
-		e_cal_component_get_summary (task, &summary);
-		if (summary.value == NULL)
-			continue;
-
-		if (e_cal_backend_sexp_match_comp (sexp, task, backend))
-			e_data_cal_view_notify_objects_added_1 (query, task_string);
-
-		doc_list = g_list_remove (doc_list, task);
-		g_object_unref (G_OBJECT (task));
-	}
+	/* Get the list of tasks from the in-memory cache */
+	matches = find_matching_tasks (couchdb_backend, e_data_cal_view_get_text (query), sexp);
+	for (l = matches; l != NULL; l = l->next)
+		e_data_cal_view_notify_objects_added_1 (query, ((CachedTask *) l->data)->task_string);
 
+	g_list_free (matches);
 
 	e_data_cal_view_notify_done (query, GNOME_Evolution_Calendar_Success);
 }
@@ -765,6 +855,7 @@ e_cal_backend_couchdb_dispose (GObject *object)
 
 	/* Free all memory and resources */
 	if (couchdb_backend->couchdb) {
+		e_couchdb_disconnect_document_signals (couchdb_backend->couchdb, couchdb_backend);
 		g_object_unref (G_OBJECT (couchdb_backend->couchdb));
 		couchdb_backend->couchdb = NULL;
 	}
@@ -779,6 +870,15 @@ e_cal_backend_couchdb_dispose (GObject *object)
 		couchdb_backend->dbname = NULL;
 	}
 
+	if (couchdb_backend->tasks != NULL) {
+		g_hash_table_destroy (couchdb_backend->tasks);
+		couchdb_backend->tasks = NULL;
+	}
+
+	if (couchdb_backend->index != NULL) {
+		e_cal_backend_couchdb_index_free (couchdb_backend->index);
+		couchdb_backend->index = NULL;
+	}
 }
 
 
@@ -844,4 +944,7 @@ e_cal_backend_couchdb_init (ECalBackendCouchDB *backend)
 	backend->couchdb = NULL;
 	backend->dbname = NULL;
 	backend->cache = NULL;
+	backend->tasks = g_hash_table_new_full (g_str_hash, g_str_equal,
+						g_free, (GDestroyNotify) cached_task_free);
+	backend->index = e_cal_backend_couchdb_index_new ();
 }
@@ -27,6 +27,7 @@
 #include <desktopcouch-glib.h>
 #include <libedata-cal/e-cal-backend.h>
 #include <libedata-cal/e-cal-backend-cache.h>
+#include "e-cal-backend-couchdb-index.h"
 
 #define E_TYPE_CAL_BACKEND_COUCHDB        (e_cal_backend_couchdb_get_type ())
 #define E_CAL_BACKEND_COUCHDB(o)          (G_TYPE_CHECK_INSTANCE_CAST ((o), E_TYPE_CAL_BACKEND_COUCHDB, ECalBackendCouchDB))
@@ -41,6 +42,8 @@ typedef struct {
 
 	CouchdbSession *couchdb;
 	ECalBackendCache *cache;
+	GHashTable *tasks;
+	ECalBackendCouchDBIndex *index;
 	char *dbname;
 	gboolean using_desktopcouch;
 
@@ -0,0 +1,376 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-couchdb-query.c - Query planning shared by the CouchDB backends
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#include <string.h>
+#include "e-couchdb-query.h"
+
+/* The backends' in-memory indexes parse queries with this code, and derive
+   from them the set of entries that might match. Only the leaf expressions
+   are index specific; booleans, and, and or are planned here */
+
+/**
+ * e_couchdb_normalize_search_string:
+ * @str: String to normalize
+ *
+ * Removes accents and case from @str, as the backends' s-expressions
+ * do when comparing strings, so that normalized strings can be compared
+ * with strcmp and strstr.
+ *
+ * Return value: The normalized string, to be freed with g_free.
+ */
+gchar *
+e_couchdb_normalize_search_string (const gchar *str)
+{
+	gchar *decomposed, *folded;
+	GString *stripped;
+	const gchar *p;
+
+	decomposed = g_utf8_normalize (str, -1, G_NORMALIZE_NFD);
+	if (decomposed == NULL)
+		return g_utf8_casefold (str, -1);
+
+	stripped = g_string_new (NULL);
+	for (p = decomposed; *p != '\0'; p = g_utf8_next_char (p)) {
+		gunichar c = g_utf8_get_char (p);
+
+		if (g_unichar_type (c) != G_UNICODE_NON_SPACING_MARK)
+			g_string_append_unichar (stripped, c);
+	}
+
+	folded = g_utf8_casefold (stripped->str, stripped->len);
+
+	g_string_free (stripped, TRUE);
+	g_free (decomposed);
+
+	return folded;
+}
+
+/*
+ * S-expression parsing
+ */
+
+static void
+sexp_node_free (ECouchDBSExpNode *node)
+{
+	if (node->children != NULL) {
+		g_ptr_array_foreach (node->children, (GFunc) sexp_node_free, NULL);
+		g_ptr_array_free (node->children, TRUE);
+	}
+
+	g_free (node->value);
+	g_slice_free (ECouchDBSExpNode, node);
+}
+
+static ECouchDBSExpNode *
+sexp_parse_node (const gchar **p)
+{
+	ECouchDBSExpNode *node;
+	const gchar *start;
+
+	while (g_ascii_isspace (**p))
+		(*p)++;
+
+	switch (**p) {
+	case '\0':
+	case ')':
+		return NULL;
+	case '(':
+		(*p)++;
+		node = g_slice_new0 (ECouchDBSExpNode);
+		node->type = E_COUCHDB_SEXP_LIST;
+		node->children = g_ptr_array_new ();
+		while (TRUE) {
+			ECouchDBSExpNode *child = sexp_parse_node (p);
+
+			if (child == NULL)
+				break;
+			g_ptr_array_add (node->children, child);
+		}
+
+		if (**p != ')') {
+			sexp_node_free (node);
+			return NULL;
+		}
+		(*p)++;
+
+		return node;
+	case '"': {
+		GString *str = g_string_new (NULL);
+
+		for ((*p)++; **p != '"'; (*p)++) {
+			if (**p == '\\' && *(*p + 1) != '\0')
+				(*p)++;
+			if (**p == '\0') {
+				g_string_free (str, TRUE);
+				return NULL;
+			}
+			g_string_append_c (str, **p);
+		}
+		(*p)++;
+
+		node = g_slice_new0 (ECouchDBSExpNode);
+		node->type = E_COUCHDB_SEXP_STRING;
+		node->value = g_string_free (str, FALSE);
+
+		return node;
+	}
+	default:
+		start = *p;
+		while (**p != '\0' && **p != '(' && **p != ')' && !g_ascii_isspace (**p))
+			(*p)++;
+
+		node = g_slice_new0 (ECouchDBSExpNode);
+		if (*p - start == 2 && start[0] == '#' && (start[1] == 't' || start[1] == 'f')) {
+			node->type = E_COUCHDB_SEXP_BOOLEAN;
+			node->boolean = start[1] == 't';
+		} else {
+			node->type = E_COUCHDB_SEXP_SYMBOL;
+			node->value = g_strndup (start, *p - start);
+		}
+
+		return node;
+	}
+}
+
+static ECouchDBSExpNode *
+sexp_parse (const gchar *sexp)
+{
+	ECouchDBSExpNode *node;
+	const gchar *p = sexp;
+
+	node = sexp_parse_node (&p);
+	if (node == NULL)
+		return NULL;
+
+	/* Only one expression is allowed */
+	while (g_ascii_isspace (*p))
+		p++;
+	if (*p != '\0') {
+		sexp_node_free (node);
+		return NULL;
+	}
+
+	return node;
+}
+
+/**
+ * e_couchdb_sexp_node_get_function:
+ * @node: An #ECouchDBSExpNode
+ *
+ * Get the name of the function a list node calls.
+ *
+ * Return value: The function name, or NULL if @node is not a function call.
+ */
+const gchar *
+e_couchdb_sexp_node_get_function (ECouchDBSExpNode *node)
+{
+	ECouchDBSExpNode *head;
+
+	if (node->type != E_COUCHDB_SEXP_LIST || node->children->len == 0)
+		return NULL;
+
+	head = g_ptr_array_index (node->children, 0);
+
+	return head->type == E_COUCHDB_SEXP_SYMBOL ? head->value : NULL;
+}
+
+/**
+ * e_couchdb_sexp_node_get_string_arg:
+ * @node: A list #ECouchDBSExpNode
+ * @n: Position of the argument, 1 being the first one
+ *
+ * Get a string argument of a function call.
+ *
+ * Return value: The string, or NULL if there is no such argument or it
+ * is not a string.
+ */
+const gchar *
+e_couchdb_sexp_node_get_string_arg (ECouchDBSExpNode *node, guint n)
+{
+	ECouchDBSExpNode *arg;
+
+	if (node->type != E_COUCHDB_SEXP_LIST || node->children->len <= n)
+		return NULL;
+
+	arg = g_ptr_array_index (node->children, n);
+
+	return arg->type == E_COUCHDB_SEXP_STRING ? arg->value : NULL;
+}
+
+/*
+ * Candidates
+ */
+
+void
+e_couchdb_candidates_init_empty (ECouchDBCandidates *candidates, gboolean exact)
+{
+	candidates->all = FALSE;
+	candidates->items = g_hash_table_new (g_direct_hash, g_direct_equal);
+	candidates->exact = exact;
+}
+
+void
+e_couchdb_candidates_init_all (ECouchDBCandidates *candidates, gboolean exact)
+{
+	candidates->all = TRUE;
+	candidates->items = NULL;
+	candidates->exact = exact;
+}
+
+void
+e_couchdb_candidates_add (ECouchDBCandidates *candidates, gpointer item)
+{
+	g_hash_table_insert (candidates->items, item, item);
+}
+
+void
+e_couchdb_candidates_clear (ECouchDBCandidates *candidates)
+{
+	if (candidates->items != NULL) {
+		g_hash_table_destroy (candidates->items);
+		candidates->items = NULL;
+	}
+}
+
+static void
+candidates_intersect (ECouchDBCandidates *result, ECouchDBCandidates *other)
+{
+	result->exact = result->exact && other->exact;
+
+	if (other->all)
+		return;
+
+	if (result->all) {
+		result->all = FALSE;
+		result->items = other->items;
+		other->items = NULL;
+	} else {
+		GHashTableIter iter;
+		gpointer key;
+
+		g_hash_table_iter_init (&iter, result->items);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			if (!g_hash_table_lookup (other->items, key))
+				g_hash_table_iter_remove (&iter);
+		}
+	}
+}
+
+static void
+candidates_union (ECouchDBCandidates *result, ECouchDBCandidates *other)
+{
+	result->exact = result->exact && other->exact;
+
+	if (result->all)
+		return;
+
+	if (other->all) {
+		e_couchdb_candidates_clear (result);
+		result->all = TRUE;
+	} else {
+		GHashTableIter iter;
+		gpointer key;
+
+		g_hash_table_iter_init (&iter, other->items);
+		while (g_hash_table_iter_next (&iter, &key, NULL))
+			g_hash_table_insert (result->items, key, key);
+	}
+}
+
+/*
+ * Query planning
+ */
+
+static void
+plan_node (ECouchDBSExpNode *node, ECouchDBPlanFunc plan_func, gpointer user_data, ECouchDBCandidates *candidates)
+{
+	const gchar *function;
+	guint i;
+
+	if (node->type == E_COUCHDB_SEXP_BOOLEAN) {
+		if (node->boolean)
+			e_couchdb_candidates_init_all (candidates, TRUE);
+		else
+			e_couchdb_candidates_init_empty (candidates, TRUE);
+		return;
+	}
+
+	function = e_couchdb_sexp_node_get_function (node);
+	if (function == NULL) {
+		e_couchdb_candidates_init_all (candidates, FALSE);
+	} else if (!strcmp (function, "and")) {
+		e_couchdb_candidates_init_all (candidates, TRUE);
+		for (i = 1; i < node->children->len; i++) {
+			ECouchDBCandidates child;
+
+			plan_node (g_ptr_array_index (node->children, i), plan_func, user_data, &child);
+			candidates_intersect (candidates, &child);
+			e_couchdb_candidates_clear (&child);
+		}
+	} else if (!strcmp (function, "or")) {
+		e_couchdb_candidates_init_empty (candidates, TRUE);
+		for (i = 1; i < node->children->len; i++) {
+			ECouchDBCandidates child;
+
+			plan_node (g_ptr_array_index (node->children, i), plan_func, user_data, &child);
+			candidates_union (candidates, &child);
+			e_couchdb_candidates_clear (&child);
+		}
+	} else
+		plan_func (node, function, candidates, user_data);
+}
+
+/**
+ * e_couchdb_plan_query:
+ * @query: S-expression to plan
+ * @plan_func: Function that plans the leaf function calls in @query
+ * @user_data: Data to pass to @plan_func
+ * @candidates: Placeholder for the entries that might match @query
+ *
+ * Find the entries of an index that might match a query. Booleans, and,
+ * and or are planned here, and every other function call is passed to
+ * @plan_func, which must initialize the #ECouchDBCandidates it gets,
+ * with init_all if it can't restrict them.
+ *
+ * Return value: TRUE if the query could be parsed. If it couldn't,
+ * @candidates is set to every entry, not exactly matching.
+ */
+gboolean
+e_couchdb_plan_query (const gchar *query,
+		      ECouchDBPlanFunc plan_func,
+		      gpointer user_data,
+		      ECouchDBCandidates *candidates)
+{
+	ECouchDBSExpNode *node;
+
+	g_return_val_if_fail (plan_func != NULL, FALSE);
+	g_return_val_if_fail (candidates != NULL, FALSE);
+
+	if (query == NULL || (node = sexp_parse (query)) == NULL) {
+		e_couchdb_candidates_init_all (candidates, FALSE);
+		return FALSE;
+	}
+
+	plan_node (node, plan_func, user_data, candidates);
+	sexp_node_free (node);
+
+	return TRUE;
+}
@@ -0,0 +1,70 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-couchdb-query.h - Query planning shared by the CouchDB backends
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#ifndef __E_COUCHDB_QUERY_H__
+#define __E_COUCHDB_QUERY_H__
+
+#include <glib.h>
+
+gchar       *e_couchdb_normalize_search_string (const gchar *str);
+
+typedef enum {
+	E_COUCHDB_SEXP_LIST,
+	E_COUCHDB_SEXP_SYMBOL,
+	E_COUCHDB_SEXP_STRING,
+	E_COUCHDB_SEXP_BOOLEAN
+} ECouchDBSExpType;
+
+typedef struct {
+	ECouchDBSExpType type;
+	gchar *value;
+	gboolean boolean;
+	GPtrArray *children;
+} ECouchDBSExpNode;
+
+const gchar *e_couchdb_sexp_node_get_function (ECouchDBSExpNode *node);
+const gchar *e_couchdb_sexp_node_get_string_arg (ECouchDBSExpNode *node, guint n);
+
+/* Set of index entries that might match a query. If @all is set, no
+   restriction could be derived, and @items is NULL. If @exact is set, the
+   set contains exactly the matching entries */
+typedef struct {
+	gboolean all;
+	GHashTable *items;
+	gboolean exact;
+} ECouchDBCandidates;
+
+void         e_couchdb_candidates_init_empty (ECouchDBCandidates *candidates, gboolean exact);
+void         e_couchdb_candidates_init_all (ECouchDBCandidates *candidates, gboolean exact);
+void         e_couchdb_candidates_add (ECouchDBCandidates *candidates, gpointer item);
+void         e_couchdb_candidates_clear (ECouchDBCandidates *candidates);
+
+typedef void (* ECouchDBPlanFunc) (ECouchDBSExpNode *node,
+				   const gchar *function,
+				   ECouchDBCandidates *candidates,
+				   gpointer user_data);
+
+gboolean     e_couchdb_plan_query (const gchar *query,
+				   ECouchDBPlanFunc plan_func,
+				   gpointer user_data,
+				   ECouchDBCandidates *candidates);
+
+#endif
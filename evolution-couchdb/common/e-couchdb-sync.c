@@ -0,0 +1,182 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-couchdb-sync.c - Cache synchronization shared by the CouchDB backends
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#include "e-couchdb-sync.h"
+
+/* Key, in the cache, of the last database update sequence the cache contains */
+#define CACHE_CHECKPOINT_KEY "couchdb::update_seq"
+
+typedef struct {
+	const ECouchDBSyncFuncs *funcs;
+	gpointer user_data;
+} SyncClosure;
+
+static gint
+get_cache_checkpoint (EFileCache *cache)
+{
+	const gchar *value;
+	gchar *end;
+	gint64 seq;
+
+	value = e_file_cache_get_object (cache, CACHE_CHECKPOINT_KEY);
+	if (value == NULL)
+		return -1;
+
+	seq = g_ascii_strtoll (value, &end, 10);
+	if (*end != '\0' || end == value || seq < 0 || seq > G_MAXINT)
+		return -1;
+
+	return (gint) seq;
+}
+
+static void
+set_cache_checkpoint (EFileCache *cache, gint seq)
+{
+	gchar *value;
+
+	value = g_strdup_printf ("%d", seq);
+	if (!e_file_cache_replace_object (cache, CACHE_CHECKPOINT_KEY, value))
+		e_file_cache_add_object (cache, CACHE_CHECKPOINT_KEY, value);
+	g_free (value);
+}
+
+static void
+add_document_to_cache (CouchdbDocument *document, gpointer user_data)
+{
+	SyncClosure *closure = (SyncClosure *) user_data;
+
+	closure->funcs->apply_change (couchdb_document_get_id (document), document, closure->user_data);
+}
+
+/**
+ * e_couchdb_sync_cache:
+ * @couchdb: A #CouchdbSession
+ * @dbname: Name of the database the cache mirrors
+ * @cache: The backend's cache
+ * @update_seq: Current update sequence of the database
+ * @funcs: The backend's functions to update its cache
+ * @user_data: Data to pass to @funcs
+ *
+ * Brings the cache up to date with the database, applying only the changes
+ * done since the last time it was synced, if possible.
+ */
+void
+e_couchdb_sync_cache (CouchdbSession *couchdb,
+		      const gchar *dbname,
+		      EFileCache *cache,
+		      gint update_seq,
+		      const ECouchDBSyncFuncs *funcs,
+		      gpointer user_data)
+{
+	SyncClosure closure;
+	gint checkpoint, last_seq;
+	GError *error = NULL;
+
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (dbname != NULL);
+	g_return_if_fail (E_IS_FILE_CACHE (cache));
+	g_return_if_fail (funcs != NULL);
+
+	/* A checkpoint newer than the database means it was recreated */
+	checkpoint = get_cache_checkpoint (cache);
+	if (checkpoint >= 0 && checkpoint <= update_seq) {
+		if (couchdb_session_foreach_change (couchdb, dbname, checkpoint,
+						    funcs->apply_change, user_data,
+						    &last_seq, &error)) {
+			set_cache_checkpoint (cache, last_seq);
+			funcs->load (user_data);
+			return;
+		}
+
+		g_warning ("Could not retrieve changes from CouchDB: %s", error->message);
+		g_error_free (error);
+		error = NULL;
+	}
+
+	/* Populate the cache from scratch. Changes done while doing it will
+	   be applied again on next sync, which is harmless */
+	e_file_cache_clean (cache);
+	funcs->clear (user_data);
+
+	closure.funcs = funcs;
+	closure.user_data = user_data;
+	if (!couchdb_session_foreach_document (couchdb, dbname, add_document_to_cache, &closure, &error)) {
+		g_warning ("Could not retrieve documents from CouchDB: %s", error->message);
+		g_error_free (error);
+		return;
+	}
+
+	set_cache_checkpoint (cache, update_seq);
+}
+
+static void
+connect_detailed (CouchdbSession *couchdb, const gchar *signal, const gchar *dbname, GCallback callback, gpointer user_data)
+{
+	gchar *signal_name;
+
+	signal_name = g_strdup_printf ("%s::%s", signal, dbname);
+	g_signal_connect (G_OBJECT (couchdb), signal_name, callback, user_data);
+	g_free (signal_name);
+}
+
+/**
+ * e_couchdb_connect_document_signals:
+ * @couchdb: A #CouchdbSession
+ * @dbname: Name of the database to listen for changes to
+ * @updated_cb: Handler for created and updated documents
+ * @deleted_cb: Handler for deleted documents
+ * @user_data: Data to pass to the handlers
+ *
+ * Connects to the document signals of @couchdb. The session emits them
+ * with the database name as detail, so the handlers only hear about
+ * changes in @dbname.
+ */
+void
+e_couchdb_connect_document_signals (CouchdbSession *couchdb,
+				    const gchar *dbname,
+				    GCallback updated_cb,
+				    GCallback deleted_cb,
+				    gpointer user_data)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+	g_return_if_fail (dbname != NULL);
+
+	connect_detailed (couchdb, "document_created", dbname, updated_cb, user_data);
+	connect_detailed (couchdb, "document_updated", dbname, updated_cb, user_data);
+	connect_detailed (couchdb, "document_deleted", dbname, deleted_cb, user_data);
+}
+
+/**
+ * e_couchdb_disconnect_document_signals:
+ * @couchdb: A #CouchdbSession
+ * @user_data: Data the handlers were connected with
+ *
+ * Disconnects the handlers connected with e_couchdb_connect_document_signals.
+ */
+void
+e_couchdb_disconnect_document_signals (CouchdbSession *couchdb, gpointer user_data)
+{
+	g_return_if_fail (COUCHDB_IS_SESSION (couchdb));
+
+	g_signal_handlers_disconnect_matched (G_OBJECT (couchdb),
+					      G_SIGNAL_MATCH_DATA,
+					      0, 0, NULL, NULL, user_data);
+}
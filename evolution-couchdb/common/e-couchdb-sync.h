@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* e-couchdb-sync.h - Cache synchronization shared by the CouchDB backends
+ *
+ * Copyright (C) 2010 Canonical, Ltd. (www.canonical.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Rodrigo Moya <rodrigo.moya@canonical.com>
+ */
+
+#ifndef __E_COUCHDB_SYNC_H__
+#define __E_COUCHDB_SYNC_H__
+
+#include <couchdb-glib.h>
+#include <libedataserver/e-file-cache.h>
+
+/* How a backend keeps its cache and in-memory copies up to date. @apply_change
+   gets a NULL document for deleted documents. @clear is called before the
+   cache is populated from scratch, and @load after changes were applied to
+   it, so that cached objects not in memory yet are loaded */
+typedef void (* ECouchDBCacheFunc) (gpointer user_data);
+
+typedef struct {
+	CouchdbChangeFunc apply_change;
+	ECouchDBCacheFunc clear;
+	ECouchDBCacheFunc load;
+} ECouchDBSyncFuncs;
+
+void e_couchdb_sync_cache (CouchdbSession *couchdb,
+			   const gchar *dbname,
+			   EFileCache *cache,
+			   gint update_seq,
+			   const ECouchDBSyncFuncs *funcs,
+			   gpointer user_data);
+
+void e_couchdb_connect_document_signals (CouchdbSession *couchdb,
+					 const gchar *dbname,
+					 GCallback updated_cb,
+					 GCallback deleted_cb,
+					 gpointer user_data);
+void e_couchdb_disconnect_document_signals (CouchdbSession *couchdb, gpointer user_data);
+
+#endif